@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include "id_map.h"
+
+/* implementation of id map. See id_map.h for the specification of an id map
+ * and its functions.
+ *
+ * The map is an open addressing hash table with linear probing. A slot is
+ * empty if its value is NULL. The number of slots is a power of 2 and the 
+ * table is grown to keep it at most 3/4 full. Deletion shifts later entries
+ * of the probe run back so that no tombstones are needed.
+ */
+
+#define IDMAP_INIT_NSLOTS 16
+
+/* definition of a key/value slot in a map */
+typedef struct idmap_slot {
+    uintptr_t id;
+    void* val;
+} idmap_slot;
+
+/* definition of a map */
+struct idmap {
+    size_t nslots;
+    size_t nentries;
+    idmap_slot* slots;
+};
+
+/* home slot of an id: ids are often aligned addresses so the bits are mixed
+ * (splitmix64 finaliser) before masking */
+static size_t _id_slot(idmap* m, uintptr_t id) {
+    uint64_t h = (uint64_t) id;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return (size_t) h & (m->nslots - 1);
+}
+
+/* index of the slot holding id or of the empty slot that ends its probe run */
+static size_t _find_slot(idmap* m, uintptr_t id) {
+    size_t i = _id_slot(m, id);
+
+    while (m->slots[i].val && m->slots[i].id != id)
+        i = (i + 1) & (m->nslots - 1);
+
+    return i;
+}
+
+static bool _resize(idmap* m, size_t nslots) {
+    idmap_slot* old = m->slots;
+    size_t old_nslots = m->nslots;
+    idmap_slot* slots = (idmap_slot*) calloc(nslots, sizeof(idmap_slot));
+
+    if (!slots) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    m->slots = slots;
+    m->nslots = nslots;
+
+    for (size_t i = 0; i < old_nslots; i++) {
+        if (old[i].val) {
+            size_t j = _find_slot(m, old[i].id);
+            m->slots[j] = old[i];
+        }
+    }
+
+    free(old);
+
+    return true;
+}
+
+/* see id_map.h */
+idmap* create_idmap() {
+    idmap* m = (idmap*) malloc(sizeof(idmap));
+
+    if (m) {
+        m->nslots = IDMAP_INIT_NSLOTS;
+        m->nentries = 0;
+        m->slots = (idmap_slot*) calloc(m->nslots, sizeof(idmap_slot));
+
+        if (!m->slots) {
+            free(m);
+            m = NULL;
+        }
+    }
+
+    if (!m)
+        errno = ENOMEM;
+
+    return m;
+}
+
+/* see id_map.h */
+void delete_idmap(idmap** m) {
+    if (m && *m) {
+        free((*m)->slots);
+        free(*m);
+        *m = NULL;
+    }
+}
+
+/* see id_map.h */
+void* get_identry(idmap* m, uintptr_t id) {
+    if (!m) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* val = m->slots[_find_slot(m, id)].val;
+
+    if (!val)
+        errno = EINVAL;
+
+    return val;
+}
+
+/* see id_map.h */
+bool set_identry(idmap* m, uintptr_t id, void* val) {
+    if (!m || !val) {
+        errno = EINVAL;
+        return false;
+    }
+
+    size_t i = _find_slot(m, id);
+
+    if (!m->slots[i].val) {
+        if (4 * (m->nentries + 1) > 3 * m->nslots) {
+            if (!_resize(m, m->nslots * 2))
+                return false;
+
+            i = _find_slot(m, id);
+        }
+
+        m->slots[i].id = id;
+        m->nentries++;
+    }
+
+    m->slots[i].val = val;
+
+    return true;
+}
+
+/* see id_map.h */
+void* delete_identry(idmap* m, uintptr_t id) {
+    if (!m) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t mask = m->nslots - 1;
+    size_t i = _find_slot(m, id);
+    void* val = m->slots[i].val;
+
+    if (!val) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for (size_t j = (i + 1) & mask; m->slots[j].val; j = (j + 1) & mask) {
+        size_t home = _id_slot(m, m->slots[j].id);
+
+        /* move entry j to i unless its home slot lies cyclically in (i, j] */
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+
+    m->slots[i].val = NULL;
+    m->nentries--;
+
+    return val;
+}
+
+/* see id_map.h */
+int get_numidentries(idmap* m) {
+    if (!m) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return (int) m->nentries;
+}
+
+/* see id_map.h */
+void foreach_identry(idmap* m, void (*fn)(uintptr_t id, void* val, void* arg),
+    void* arg) {
+    if (!m || !fn)
+        return;
+
+    for (size_t i = 0; i < m->nslots; i++)
+        if (m->slots[i].val)
+            fn(m->slots[i].id, m->slots[i].val, arg);
+}
@@ -0,0 +1,116 @@
+#ifndef _ID_MAP_H
+#define _ID_MAP_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Specification of an id map: a map from numeric identifiers (object ids as
+ * used by the object store, or content hashes) to generic void* values.
+ *
+ * An id map serves the same purpose as an object map (see obj_map.h) for the
+ * internal tables of the object store, which can hold millions of entries.
+ * It differs from an object map in that:
+ *      - keys are uintptr_t values rather than pointers, and 0 is a valid key
+ *      - the table grows as entries are added, so lookups stay O(1) 
+ *        regardless of the number of entries
+ *      - the entries of a map can be visited with foreach_identry
+ *
+ * As with an object map, values must be non-NULL.
+ */
+typedef struct idmap idmap;
+
+/*
+ * Function:
+ * create_idmap()
+ *
+ * Description:
+ * Creates an empty id map.
+ *
+ * Usage:
+ *      idmap* map = create_idmap();
+ *      ...
+ *      delete_idmap(&map);
+ *
+ * Return:
+ * On success: a new non-null pointer to a dynamically allocated id map
+ * On failure: NULL, and errno is set to ENOMEM
+ */
+idmap* create_idmap();
+
+/*
+ * Function:
+ * delete_idmap(idmap** m)
+ *
+ * Description:
+ * Deletes an id map created by create_idmap and sets *m to NULL. Values
+ * stored in the map are not freed. Has no effect if m or *m is NULL.
+ */
+void delete_idmap(idmap** m);
+
+/*
+ * Function:
+ * get_identry(idmap* m, uintptr_t id)
+ *
+ * Description:
+ * Gets the value stored in the map for the given id.
+ *
+ * Return:
+ * On success: the value stored for id
+ * On failure: NULL if m is NULL or there is no entry for id, in which case
+ *      errno is set to EINVAL
+ */
+void* get_identry(idmap* m, uintptr_t id);
+
+/*
+ * Function:
+ * set_identry(idmap* m, uintptr_t id, void* val)
+ *
+ * Description:
+ * Sets the value stored for the given id, replacing any existing value. 
+ * The map is grown if necessary.
+ *
+ * Return:
+ * true on success, false otherwise, in which case errno is set to:
+ *      EINVAL - invalid argument: if m or val is NULL
+ *      ENOMEM - not enough space: if the map could not be grown
+ */
+bool set_identry(idmap* m, uintptr_t id, void* val);
+
+/*
+ * Function:
+ * delete_identry(idmap* m, uintptr_t id)
+ *
+ * Description:
+ * Deletes the entry for the given id.
+ *
+ * Return:
+ * On success: the value that was stored for id
+ * On failure: NULL if m is NULL or there is no entry for id, in which case
+ *      errno is set to EINVAL
+ */
+void* delete_identry(idmap* m, uintptr_t id);
+
+/*
+ * Function:
+ * get_numidentries(idmap* m)
+ *
+ * Description:
+ * Gets the number of entries in the map, or -1 with errno set to EINVAL if
+ * m is NULL.
+ */
+int get_numidentries(idmap* m);
+
+/*
+ * Function:
+ * foreach_identry(idmap* m, void (*fn)(uintptr_t id, void* val, void* arg),
+ *      void* arg)
+ *
+ * Description:
+ * Calls fn once for each entry in the map, passing the entry's id and value
+ * and the given arg, in no particular order. fn must not add entries to or 
+ * delete entries from the map.
+ */
+void foreach_identry(idmap* m, void (*fn)(uintptr_t id, void* val, void* arg),
+    void* arg);
+
+#endif
@@ -0,0 +1,18 @@
+#!/bin/sh
+# This script runs each test of the id map in turn in a separate process.
+# This means that the failure of one test will not prevent others from running.
+# It is assumed that the test_id_map binary that the script runs is
+# in the "bin" subdirectory of the current directory.
+# Usage:
+#       ./id_map_tests.sh
+
+cd ./bin
+
+if [ $? != 0 ]; then exit $?; fi
+
+for i in 0 1 2
+do
+    ./test_id_map $i $1
+done
+
+cd ..
\ No newline at end of file
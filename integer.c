@@ -91,25 +91,14 @@ static void _delete_int(Integer* ai, bool check_store) {
  * returns true for success of the function). If the object store is enabled
  * the function will attempt to store a string representation of the given
  * integer to the object store. The string representation is the int value
- * followed by a new line (see STR_REP_FMT).
- * Do NOT change this function.
+ * followed by a new line (see STR_REP_FMT), which store_int_obj formats
+ * only if the store needs it.
  */
 static bool _store_obj_rep(Integer oi, int val) {
     if (!ostore_is_on())
         return true;
     
-    bool r = false;
-    char* valstr = NULL;
-    (void) asprintf(&valstr, STR_REP_FMT, val);
-    
-    if (valstr) {
-        object_rep obj_rep = { TYPE_STR, (uintptr_t) oi, valstr };
-        r = store_obj(&obj_rep);
-        
-        free(valstr);
-    }
-    
-    return r;
+    return store_int_obj(TYPE_STR, (uintptr_t) oi, val);
 }
 
 /*
@@ -230,6 +219,69 @@ void deleteInteger(Integer* ai) {
     _delete_int(ai, true);
 }
 
+/* 
+ * loadInteger: as newInteger for the value of the string representation
+ * valstr (see STR_REP_FMT), without storing the new Integer
+ */
+Integer loadInteger(const char* valstr) {
+    char* end;
+
+    if (!valstr) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    errno = 0;
+    long value = strtol(valstr, &end, 10);
+
+    if (errno || end == valstr || strcmp(end, "\n") 
+        || value < INT_MIN || value > INT_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    Integer self = (Integer) malloc(sizeof(struct integer));
+
+    if (self) {
+        if (_new_intobj(self, (int) value)) {
+            self->add = _add;
+            self->subtract = _subtract;
+            self->multiply = _multiply;
+            self->divide = _divide;
+            self->modulo = _modulo;
+            self->get_value = _get_value;
+        } else {
+            free(self);
+            self = NULL;
+        }
+    }
+
+    return self;
+}
+
+/* the emit function and its ctx of walkIntegers */
+typedef struct int_walk {
+    ostore_emit_fn emit;
+    void* ctx;
+} int_walk;
+
+/* emit the Integer key with value val (see foreach_mentry) */
+static void _walk_int(void* key, void* val, void* arg) {
+    int_walk* w = (int_walk*) arg;
+    char valstr[16];
+
+    snprintf(valstr, sizeof(valstr), STR_REP_FMT, *(int*) val);
+    w->emit((uintptr_t) key, valstr, w->ctx);
+}
+
+/* walkIntegers: emits the string representation of each live Integer */
+void walkIntegers(ostore_emit_fn emit, void* ctx) {
+    int_walk w = { emit, ctx };
+
+    if (_object_map && emit)
+        foreach_mentry(_object_map, _walk_int, &w);
+}
+
 /* printInteger: implemented, do NOT change */
 int printInteger(const char* format, Integer i) {
     return fprintInteger(stdout, format, i);
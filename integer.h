@@ -1,6 +1,7 @@
 #ifndef _INTEGER_H
 #define _INTEGER_H
 #include <stdbool.h>
+#include "obj_store.h"
 
 /*
  * Type definition:
@@ -80,6 +81,70 @@ Integer newInteger(int value);
  */
 void deleteInteger(Integer* ai);
 
+/*
+ * Function:
+ * loadInteger(const char* valstr)
+ * 
+ * Description:
+ * Dynamically allocate a new struct integer with the value of the given 
+ * string representation, as written to the object store by newInteger 
+ * (the int value followed by a new line), and return a pointer (Integer) to
+ * the allocated struct. Unlike newInteger, the new integer is not saved to
+ * the object store. Intended for the parse function of an ostore_loader 
+ * (see load_ostore in obj_store.h).
+ * It is the user's responsibility to use deleteInteger to subsequently free
+ * the allocated memory.
+ *
+ * Usage: 
+ *      Integer i = loadInteger("10\n");
+ *      ...
+ *      ...
+ *      deleteInteger(&i);
+ *
+ * Parameters:
+ * valstr - the string representation of an integer
+ *
+ * Return:
+ * On success: a new non-null pointer to a dynamically allocated struct 
+ *      integer (or Integer) with the value of valstr
+ * On failure: NULL, and errno will be set
+ *
+ * Errors:
+ * If the call fails, the NULL pointer will be returned and errno will be 
+ * set as follows.
+ *      EINVAL - invalid argument: if valstr is NULL or is not the string
+ *          representation of an int
+ *      ENOMEM - not enough space: if dynamic allocation fails
+ */
+Integer loadInteger(const char* valstr);
+
+/*
+ * Function:
+ * walkIntegers(ostore_emit_fn emit, void* ctx)
+ * 
+ * Description:
+ * Calls emit once for each live struct integer, with its id (the address 
+ * of the struct) and the string representation newInteger stores for it, 
+ * in no particular order. Intended for the walk function of an 
+ * ostore_ckpt_source (see checkpoint_ostore in obj_store.h). emit must not 
+ * create or delete integers.
+ *
+ * Usage: 
+ *      ostore_ckpt_source src = { "int", walkIntegers };
+ *      bool r = checkpoint_ostore("ints.ckpt", &src, 1, false);
+ *
+ * Parameters:
+ * emit - the function to call for each integer
+ * ctx - passed to emit
+ *
+ * Return:
+ * No return value
+ *
+ * Errors:
+ * Not applicable
+ */
+void walkIntegers(ostore_emit_fn emit, void* ctx);
+
 /*
  * Function:
  * printInteger(const char* format, Integer i)
@@ -159,6 +159,40 @@ void delete_map(omap** m);
  */
 void* delete_mentry(omap* map, void* key);
 
+/*
+ * Function:
+ * foreach_mentry(omap* map, void (*fn)(void* key, void* val, void* arg), 
+ *      void* arg)
+ * 
+ * Description:
+ * Calls fn once for each entry in the given map, passing the key and value
+ * of the entry and the given arg, in no particular order. fn must not add 
+ * entries to or delete entries from the map.
+ *
+ * Usage:
+ *      void count(void* key, void* val, void* arg) {
+ *          (*(int*) arg)++;
+ *      }
+ *      ...
+ *      int n = 0;
+ *      foreach_mentry(map, count, &n);
+ *      // n == get_numentries(map)
+ *          
+ * Parameters:
+ * map - the map whose entries to visit
+ * fn - the function to call for each entry
+ * arg - passed to each call of fn
+ *
+ * Return:
+ * Nothing. If map or fn is NULL, fn is not called and errno is set.
+ *
+ * Errors:
+ * errno will be set as follows:
+ *      EINVAL - invalid argument: if either map or fn is NULL
+ */
+void foreach_mentry(omap* map, void (*fn)(void* key, void* val, void* arg),
+    void* arg);
+
 /*
  * Function:
  * get_mentry(omap* map, void* key)
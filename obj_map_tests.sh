@@ -10,7 +10,7 @@ cd ./bin
 
 if [ $? != 0 ]; then exit $?; fi
 
-for i in 0 1 2 3 4 5 6
+for i in 0 1 2 3 4 5 6 7
 do
     ./test_obj_map $i $1
 done
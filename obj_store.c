@@ -11,120 +11,1341 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include "obj_store.h"
+#include "ostore_impl.h"
 
 #define OSTR_REP_MAX 4096   /* max size of a string representation to write 
                              * to file
                              */
+#define REC_STACK_MAX 256   /* records up to this size are encoded on the 
+                             * stack
+                             */
+
+static bool ostore_on = false;  /* ostore enabled flag */
+static ostore_backend backend = OSTORE_FILES;   /* backend in use */
+static bool async = false;      /* stores are queued to the writer thread */
+static bool uring = false;      /* files backend submits through io_uring */
+static ostore_format format = OSTORE_FMT_TEXT;  /* layout of stored values */
+static bool defer = false;      /* stores are held for the deferral window */
+static bool reap = false;       /* unlinks are applied by the reaper thread */
+static unsigned shard_levels = 0;   /* levels of shard directories */
+static bool dedup = false;      /* object files are links to value blobs */
+
+/*
+ * the files written or unlinked since the last _files_sync, by path 
+ * relative to the ostore directory; a path ending in '/' names only its 
+ * directory. Kept unless the durability is OSTORE_SYNC_NONE.
+ */
+#define FILES_DIRTY_MAX 4096    /* synced early beyond this many */
+#define DIRTY_PATH_MAX (OSTORE_TYPE_MAX + 1 + OSTORE_NAME_MAX + 8)
+
+typedef struct dirty_path {
+    char path[DIRTY_PATH_MAX];
+} dirty_path;
+
+static pthread_mutex_t _dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool _dirty_on = false;
+static dirty_path* _dirty = NULL;
+static size_t _ndirty = 0;
+static bool _dirty_lost = false;    /* a path could not be noted */
+static int _dirty_err = 0;          /* errno of a failed early sync */
+
+static char* OFILE_FMT = "%#zx.txt"; 
+                                        /* format for object file name */
+static char* OSTORE_DIR = OSTORE_DIRNAME;
+                                        /* name of object store directory */
+static char* TYPEPATH_FMT = "%s/%s";    /* format for typedir path */
+
+/* 
+ * Open directories of the files backend: the ostore directory and a cache 
+ * of type directories. Object files are opened and unlinked relative to the
+ * type directory (openat/unlinkat), so the per-object path is a single file
+ * name formatted on the stack and the kernel does not walk ostore/<type>
+ * again. Entries are only added while the store is enabled, readers scan 
+ * the first _ntypedirs entries without the lock.
+ *
+ * With shard_levels, the object file of id is in the shard directories 
+ * named by the top bytes of a multiplicative hash of id (ids are addresses,
+ * whose low bits vary little). Shard directories are created on the first
+ * store into them and never removed while the store is enabled; a bitmap 
+ * per cached type directory records those known to exist, so a store makes
+ * no mkdir calls once its shard is known.
+ */
+typedef struct typedir {
+    char name[OSTORE_TYPE_MAX + 1];
+    int fd;
+    unsigned char* shards;      /* bitmap of existing leaf shards, or NULL */
+} typedir;
+
+static int _ostore_fd = -1;
+static typedir _typedirs[OSTORE_MAX_TYPES];
+static int _ntypedirs = 0;
+static pthread_mutex_t _typedir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 
+ * Declaration of private _create_ostore_dir helper function.
+ * 
+ * This function creates an object store directory if it does not already 
+ * exist. 
+ * If the typedir parameter is NULL then the top-level ostore directory 
+ * will be created. 
+ * If the typedir parameter is not NULL then a type director ostore/<typedir>
+ * will be created (where typedir is int or str etc.).
+ * If directory creation succeeds or the relevant directory already exists
+ * the function returns true,  otherwise it returns false and errno will be 
+ * set.
+ */
+bool _create_ostore_dir(const char* typedir);
+
+/* 
+ * Declarations of the functions of the files backend (see 
+ * ostore_backend_ops): one file per object in the type directories.
+ */
+static bool _files_open(const ostore_opts* opts);
+static void _files_close();
+static bool _files_store(const char* type, uintptr_t id, const char* data, 
+    size_t len);
+static bool _files_storev(const char* type, uintptr_t id, 
+    const struct iovec* iov, int n, size_t len);
+static bool _files_unlink(const char* type, uintptr_t id);
+static char* _files_load(const char* type, uintptr_t id, size_t* len);
+static bool _files_flush();
+static bool _files_sync();
+
+/* format at name the path of the object file of id relative to its type dir */
+static void _objname(uintptr_t id, char* name);
+
+/* the backends, indexed by ostore_backend */
+static const ostore_backend_ops BACKENDS[OSTORE_NBACKENDS] = {
+    { _files_open, _files_close, _files_store, _files_storev, _files_unlink,
+        _files_load, _files_flush, _files_sync },
+    { _log_open, _log_close, _log_store, NULL, _log_unlink, _log_load, 
+        _log_flush, _log_sync },
+    { _mem_open, _mem_close, _mem_store, _mem_storev, _mem_unlink, _mem_load,
+        _mem_flush, _mem_flush }
+};
+
+/* 
+ * the value string of the stored object type/id (malloced, NUL-terminated,
+ * len set to its length), or NULL with errno set
+ */
+static char* _ostore_load(const char* type, uintptr_t id, size_t* len);
+
+/* 
+ * the value string of the stored data[0..dlen), which is freed unless
+ * returned, in either format; its length in *len. NULL with errno set on
+ * failure.
+ */
+static char* _decode(char* data, size_t dlen, size_t* len);
+
+/* store the already validated and encoded data, or queue it in async mode */
+static bool _store(const char* type, uintptr_t id, const char* data, 
+    size_t len);
+
+/* encode the value string valstr[0..len) in the format in use and _store it */
+static bool _store_value(const char* type, uintptr_t id, const char* valstr,
+    size_t len);
+
+/* 
+ * the n buffers of iov, len bytes in all, gathered into one NUL-terminated
+ * buffer: stack if it fits in size bytes, otherwise malloced. NULL with 
+ * errno set on failure.
+ */
+static char* _gather(const struct iovec* iov, int n, size_t len, char* stack,
+    size_t size);
+
+/* close the directories opened by the files backend */
+static void _close_dirs();
+
+/* 
+ * convert the object files of the type directory dfd (and its shard 
+ * directories) to format, returns false with errno set to the first error
+ */
+static bool _convert_dir(int dfd, const char* type, ostore_format format);
+
+/* enable_ostore: equivalent to enable_ostore_opts with the defaults */
+bool enable_ostore() {
+    return enable_ostore_opts(NULL);
+}
+
+bool enable_ostore_opts(const ostore_opts* opts) {
+    if (opts && ((unsigned) opts->backend >= OSTORE_NBACKENDS
+        || (opts->async_backpressure != OSTORE_BP_BLOCK 
+            && opts->async_backpressure != OSTORE_BP_SYNC)
+        || opts->async_queue_size > OSTORE_QUEUE_MAX
+        || opts->durability < OSTORE_SYNC_NONE 
+        || opts->durability > OSTORE_SYNC_ALWAYS
+        || opts->shard_levels > OSTORE_SHARD_MAX
+        || (opts->compress_min && opts->format != OSTORE_FMT_BINARY)
+        || (opts->dedup && (opts->backend != OSTORE_FILES 
+            || opts->format != OSTORE_FMT_TEXT))
+        || (opts->format != OSTORE_FMT_TEXT 
+            && opts->format != OSTORE_FMT_BINARY)
+        || (opts->slot_type && !_valid_type(opts->slot_type)))) {
+        errno = EINVAL;
+        return false;
+    }
+
+    disable_ostore();
+
+    if (!_create_ostore_dir(NULL)) //creates directory 
+        return false;
+
+    backend = opts ? opts->backend : OSTORE_FILES;
+    shard_levels = opts ? opts->shard_levels : 0;
+    dedup = opts && opts->dedup;
+    _rec_open(opts);
+    _cache_open(opts);
+    _stats_open(opts);      /* before the writer threads start */
+    _rate_open(opts);
+
+    bool opened = BACKENDS[backend].open(opts);
+    bool ok = opened
+        && (!(opts && opts->slot_type) || _slots_open(opts->slot_type));
+
+    ok = ok && _sync_open(opts);
+
+    if (ok && opts && opts->async && !_async_open(opts)) {
+        int err = errno;
+        (void) _sync_close();
+        errno = err;
+        ok = false;
+    }
+
+    if (ok && opts && (opts->defer_ms || opts->defer_count) 
+        && !_defer_open(opts)) {
+        int err = errno;
+        if (opts->async)
+            _async_close();
+        (void) _sync_close();
+        errno = err;
+        ok = false;
+    }
+
+    if (ok && opts && opts->unlink_async && !opts->async 
+        && !_reap_open(opts)) {
+        int err = errno;
+        if (opts->defer_ms || opts->defer_count)
+            (void) _defer_close();
+        (void) _sync_close();
+        errno = err;
+        ok = false;
+    }
+
+    if (!ok) {          /* unwinds in reverse order, back to the defaults */
+        int err = errno;
+        if (opened) {
+            _slots_close();
+            BACKENDS[backend].close();
+        }
+        _rate_close();
+        _stats_close();
+        _cache_close();
+        backend = OSTORE_FILES;
+        shard_levels = 0;
+        dedup = false;
+        errno = err;
+        return false;
+    }
+
+    async = opts && opts->async;
+    defer = opts && (opts->defer_ms || opts->defer_count);
+    reap = opts && opts->unlink_async && !opts->async;
+    format = opts ? opts->format : OSTORE_FMT_TEXT;
+    ostore_on = true;
+    
+    return ostore_on;
+}
+
+void disable_ostore() {
+    if (!ostore_on)
+        return;
+
+    if (reap)
+        (void) _reap_close();   /* applies the pending unlinks */
+
+    if (defer)
+        (void) _defer_close();  /* persists the pending stores */
+
+    if (async)
+        _async_close();     /* drains the queue to the backend */
+
+    (void) _sync_close();   /* final sync unless OSTORE_SYNC_NONE */
+    _slots_close();
+    BACKENDS[backend].close();
+
+    _cache_close();
+    _stats_close();
+    _rate_close();
+    ostore_on = false;
+    async = false;
+    defer = false;
+    reap = false;
+    format = OSTORE_FMT_TEXT;
+    backend = OSTORE_FILES;
+}
+
+bool flush_ostore() {
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    bool ok = defer ? _defer_flush() : true;
+    int err = errno;
+
+    if (async && !_async_flush()) {
+        err = ok ? errno : err;
+        ok = false;
+    }
+
+    if (reap && !_reap_flush()) {
+        err = ok ? errno : err;
+        ok = false;
+    }
+
+    if (!_sync_all())
+        return false;
+
+    errno = err;
+
+    return ok;
+}
+
+bool load_ostore(const ostore_loader* loaders, size_t nloaders, 
+    unsigned nthreads, idmap** objs) {
+    if (objs)
+        *objs = NULL;
+
+    if (!loaders || !objs) {
+        errno = EINVAL;
+        return false;
+    }
+
+    for (size_t i = 0; i < nloaders; i++) {
+        if (!_valid_type(loaders[i].type) || !loaders[i].parse) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    /* the memory backend keeps no records from before the store was on */
+    if (backend == OSTORE_MEMORY) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    bool ok = !defer || _defer_flush();
+
+    ok = (!async || _async_flush()) && ok;
+    ok = (!reap || _reap_flush()) && ok;
+
+    int err = errno;
+
+    /* the records are rewritten directly, not through the queue */
+    bool run = _load_run(loaders, nloaders, nthreads, backend, 
+        format == OSTORE_FMT_BINARY, objs);
+
+    _cache_clear();     /* the old ids were removed */
+
+    if (!run)
+        return false;
+
+    errno = err;
+
+    return ok;
+}
+
+bool checkpoint_ostore(const char* path, const ostore_ckpt_source* srcs, 
+    size_t nsrcs, bool background) {
+    if (!path || !srcs) {
+        errno = EINVAL;
+        return false;
+    }
+
+    for (size_t i = 0; i < nsrcs; i++) {
+        if (!_valid_type(srcs[i].type) || !srcs[i].walk) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    return _ckpt_write(path, srcs, nsrcs, background);
+}
+
+bool wait_checkpoint_ostore() {
+    return _ckpt_wait();
+}
+
+bool load_checkpoint_ostore(const char* path, const ostore_loader* loaders,
+    size_t nloaders, idmap** objs) {
+    if (objs)
+        *objs = NULL;
+
+    if (!path || !loaders || !objs) {
+        errno = EINVAL;
+        return false;
+    }
+
+    for (size_t i = 0; i < nloaders; i++) {
+        if (!_valid_type(loaders[i].type) || !loaders[i].parse) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    return _ckpt_read(path, loaders, nloaders, objs);
+}
+
+bool defer_stats_ostore(ostore_defer_stats* stats) {
+    if (!stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (defer)
+        _defer_stats(stats);
+
+    return true;
+}
+
+bool promote_all_ostore() {
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    bool ok = !defer || _defer_flush();
+    int err = errno;
+
+    if (async && !_async_flush()) {
+        err = ok ? errno : err;
+        ok = false;
+    }
+
+    errno = err;
+
+    return ok;
+}
+
+bool cache_stats_ostore(ostore_cache_stats* stats) {
+    if (!stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    _cache_stats(&stats->hits, &stats->misses);
+
+    return true;
+}
+
+bool rate_stats_ostore(ostore_rate_stats* stats) {
+    if (!stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    _rate_stats(&stats->throttled, &stats->throttled_ns);
+
+    return true;
+}
+
+bool drain_unlinks_ostore() {
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    return !reap || _reap_flush();
+}
+
+bool unlink_stats_ostore(ostore_unlink_stats* stats) {
+    if (!stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (reap)
+        _reap_stats(stats);
+
+    return true;
+}
+
+bool stats_ostore(ostore_stats* stats) {
+    if (!stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    return _stats_get(stats);
+}
+
+bool dump_stats_ostore(FILE* stream) {
+    if (!stream) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    return _stats_dump(stream);
+}
+
+uint64_t percentile_ostore(const ostore_hist* hist, double pct) {
+    return hist ? _stats_percentile(hist, pct) : 0;
+}
+
+bool compact_ostore() {
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    return backend == OSTORE_LOG ? _log_compact() : true;
+}
+
+bool convert_ostore(ostore_format format) {
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    if (format != OSTORE_FMT_TEXT && format != OSTORE_FMT_BINARY) {
+        errno = EINVAL;
+        return false;
+    }
+
+    /* binary records of linked object files would change every link */
+    if (backend != OSTORE_FILES || dedup) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    bool ok = !defer || _defer_flush();
+
+    ok = (!async || _async_flush()) && ok;
+    ok = (!reap || _reap_flush()) && ok;
+
+    int err = ok ? 0 : errno;
+    int fd = dup(_ostore_fd);
+    DIR* dir = fd >= 0 ? fdopendir(fd) : NULL;
+    struct dirent* de;
+
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    rewinddir(dir);
+
+    while ((de = readdir(dir))) {
+        struct stat sbuf;
+        bool tmp;
+
+        /* the type directories (not the slot file) */
+        if (!_valid_type(de->d_name) 
+            || fstatat(_ostore_fd, de->d_name, &sbuf, 0) 
+            || !S_ISDIR(sbuf.st_mode))
+            continue;
+
+        int dfd = _ostore_dirfd(de->d_name, false, &tmp);
+
+        if (dfd < 0 || !_convert_dir(dfd, de->d_name, format)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+
+        if (dfd >= 0 && tmp)
+            close(dfd);
+    }
+
+    closedir(dir);
+    errno = err;
+
+    return ok;
+}
+
+/* ostore_is_on: implemented, do NOT change */
+bool ostore_is_on() {
+    return ostore_on;
+}
+
+/* 
+ * store_obj: validates obj_rep and either stores it with the backend in use
+ * or, in async mode, queues it for the writer thread
+ */
+bool store_obj(object_rep* obj_rep) {
+    if (!obj_rep || !obj_rep->valstr || !_valid_type(obj_rep->type)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    uint64_t start = _stats_start();
+    uint64_t gen = _cache_gen();
+    size_t len = strlen(obj_rep->valstr);
+    bool ok = _store_value(obj_rep->type, obj_rep->id, obj_rep->valstr, len);
+
+    /* a failed store may have removed the previous value */
+    if (ok)
+        _cache_put(obj_rep->type, obj_rep->id, obj_rep->valstr, len, gen);
+    else
+        _cache_drop(obj_rep->type, obj_rep->id);
+
+    _stats_op(OSTORE_STAT_STORE, obj_rep->type, start, ok);
+
+    return ok;
+}
+
+/* 
+ * store_obj_iov: as store_obj, passing the buffers straight to the backend
+ * when the value is stored as it is and synchronously
+ */
+bool store_obj_iov(const char* type, uintptr_t id, const struct iovec* iov,
+    int n) {
+    size_t len = 0;
+
+    if (!_valid_type(type) || !iov || n < 1 || n > OSTORE_IOV_MAX) {
+        errno = EINVAL;
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!iov[i].iov_base && iov[i].iov_len) {
+            errno = EINVAL;
+            return false;
+        }
+
+        len += iov[i].iov_len;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    uint64_t start = _stats_start();
+    uint64_t gen = _cache_gen();
+    bool ok;
+
+    if (format == OSTORE_FMT_TEXT && !_slots_type(type) && !defer && !async
+        && !uring) {
+        ostore_op op = { OSTORE_OP_STORE, id, type, NULL, len, iov, n };
+
+        if (reap)
+            _reap_on_store(type, id);
+
+        ok = _ostore_apply(&op, 1) == 0 && _sync_commit(1);
+    } else {
+        /* the value is encoded or copied anyway */
+        char stack[REC_STACK_MAX];
+        char* valstr = _gather(iov, n, len, stack, sizeof(stack));
+
+        ok = valstr && _store_value(type, id, valstr, len);
+
+        if (valstr && valstr != stack)
+            free(valstr);
+    }
+
+    if (ok)
+        _cache_putv(type, id, iov, n, len, gen);
+    else
+        _cache_drop(type, id);
+
+    _stats_op(OSTORE_STAT_STORE, type, start, ok);
+
+    return ok;
+}
+
+/* store_int_obj: as store_obj, encoding the record straight from val */
+bool store_int_obj(const char* type, uintptr_t id, int val) {
+    char buf[OSTORE_REC_OVERHEAD + 16];
+    size_t len;
+
+    if (!_valid_type(type)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return false;
+    }
+
+    uint64_t start = _stats_start();
+    uint64_t gen = _cache_gen();
+    bool text = format == OSTORE_FMT_TEXT || _slots_type(type);
+    char valstr[16];
+    size_t vlen = 0;
+
+    /* the value string only for the text format or the cache */
+    if (text || _cache_on())
+        vlen = (size_t) snprintf(valstr, sizeof(valstr), "%d\n", val);
+
+    if (text) {
+        memcpy(buf, valstr, vlen + 1);
+        len = vlen;
+    } else {
+        len = _rec_encode_int(buf, id, val);
+    }
+
+    bool ok = _store(type, id, buf, len);
+
+    if (ok && vlen)
+        _cache_put(type, id, valstr, vlen, gen);
+    else if (!ok)
+        _cache_drop(type, id);
+
+    _stats_op(OSTORE_STAT_STORE, type, start, ok);
+
+    return ok;
+}
+
+/* _store_value: see declaration at start of this file */
+static bool _store_value(const char* type, uintptr_t id, const char* valstr,
+    size_t len) {
+    if (format == OSTORE_FMT_TEXT || _slots_type(type))
+        return _store(type, id, valstr, len);
+
+    char stack[REC_STACK_MAX];
+    char* rec = len + OSTORE_REC_OVERHEAD <= sizeof(stack) ? stack 
+        : (char*) malloc(len + OSTORE_REC_OVERHEAD);
+
+    if (!rec)
+        return false;
+
+    size_t rlen = _rec_encode(rec, type, id, valstr, len);
+    bool ok = _store(type, id, rec, rlen);
+
+    if (rec != stack)
+        free(rec);
+
+    return ok;
+}
+
+/* _gather: see declaration at start of this file */
+static char* _gather(const struct iovec* iov, int n, size_t len, char* stack,
+    size_t size) {
+    char* buf = len < size ? stack : (char*) malloc(len + 1);
+    size_t at = 0;
+
+    if (!buf)
+        return NULL;
+
+    for (int i = 0; i < n; i++) {
+        if (iov[i].iov_len)
+            memcpy(buf + at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+
+    buf[len] = '\0';
+
+    return buf;
+}
+
+/* _store: see declaration at start of this file */
+static bool _store(const char* type, uintptr_t id, const char* data, 
+    size_t len) {
+    if (reap)
+        _reap_on_store(type, id);   /* the store replaces the value */
+
+    if (defer)
+        return _defer_on_store(type, id, data, len);
+
+    if (async)
+        return _async_store(type, id, data, len);
+
+    ostore_op op = { OSTORE_OP_STORE, id, type, data, len, NULL, 0 };
+
+    return _ostore_apply(&op, 1) == 0 && _sync_commit(1);
+}
+
+/* unlink_obj: removes obj_rep with the backend in use or queues its removal */
+void unlink_obj(object_rep* obj_rep) {
+    if (ostore_on && obj_rep && _valid_type(obj_rep->type)) {
+        uint64_t start = _stats_start();
+        bool ok = true;
+
+        _cache_drop(obj_rep->type, obj_rep->id);
+
+        if (defer && _defer_on_unlink(obj_rep->type, obj_rep->id))
+            ok = true;      /* cancelled a pending store, nothing to unlink */
+        else if (async)
+            ok = _async_unlink(obj_rep->type, obj_rep->id);
+        else if (reap)
+            ok = _reap_unlink(obj_rep->type, obj_rep->id);
+        else {
+            ostore_op op = { OSTORE_OP_UNLINK, obj_rep->id, obj_rep->type, 
+                NULL, 0, NULL, 0 };
+
+            ok = _ostore_apply(&op, 1) == 0 && _sync_commit(1);
+        }
+
+        /* a load that read the value meanwhile must not cache it */
+        _cache_drop(obj_rep->type, obj_rep->id);
+        _stats_op(OSTORE_STAT_UNLINK, obj_rep->type, start, ok);
+    }
+    
+    return;
+}
+
+/* 
+ * load_obj: serves the value of type/id from the cache or reads it with the
+ * backend in use and caches it
+ */
+ssize_t load_obj(const char* type, uintptr_t id, char* buf, size_t len) {
+    if (!buf || !_valid_type(type)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!ostore_on) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    uint64_t start = _stats_start();
+
+    /* before the cache, which may hold the value of a pending unlink */
+    if (reap && _reap_pending(type, id)) {
+        errno = ENOENT;
+        _stats_op(OSTORE_STAT_LOAD, type, start, false);
+        return -1;
+    }
+
+    ssize_t n = _cache_get(type, id, buf, len);
+
+    if (n < 0) {
+        uint64_t gen = _cache_gen();
+        size_t vlen;
+        char* val = _ostore_load(type, id, &vlen);
+
+        if (!val) {
+            _stats_op(OSTORE_STAT_LOAD, type, start, false);
+            return -1;
+        }
+
+        _cache_fill(type, id, val, vlen, gen);
+
+        if (vlen < len)
+            memcpy(buf, val, vlen + 1);
+
+        n = (ssize_t) vlen;
+        free(val);
+    }
+
+    if ((size_t) n >= len) {
+        errno = ERANGE;
+        n = -1;
+    }
+
+    _stats_op(OSTORE_STAT_LOAD, type, start, n >= 0);
+
+    return n;
+}
+
+/* store the buffers of the store op, gathered if the backend has no storev */
+static bool _storev(const ostore_op* op) {
+    if (BACKENDS[backend].storev)
+        return BACKENDS[backend].storev(op->type, op->id, op->iov, 
+            op->iovcnt, op->len);
+
+    char stack[REC_STACK_MAX];
+    char* data = _gather(op->iov, op->iovcnt, op->len, stack, sizeof(stack));
+    bool ok = data && BACKENDS[backend].store(op->type, op->id, data, 
+        op->len);
+
+    if (data && data != stack)
+        free(data);
+
+    return ok;
+}
+
+/* apply ops[0..n), none of which is of the slot type, with the backend */
+static size_t _apply_backend(const ostore_op* ops, size_t n) {
+    size_t failed = 0;
+    int err = 0;
+
+    _rate_admit(ops, n);    /* slot operations are not disk writes */
+
+    if (uring && _uring_ready())
+        return _uring_apply(ops, n);
+
+    for (size_t i = 0; i < n; i++) {
+        const ostore_op* op = &ops[i];
+        bool ok = op->op == OSTORE_OP_UNLINK
+            ? BACKENDS[backend].unlink(op->type, op->id)
+            : !op->iov
+            ? BACKENDS[backend].store(op->type, op->id, op->data, op->len)
+            : _storev(op);
+
+        if (!ok) {
+            failed++;
+            err = err ? err : errno;
+        } else if (backend == OSTORE_FILES) {
+            _ostore_dirty(op);  /* for the next _files_sync */
+        }
+    }
+
+    errno = err;
+
+    return failed;
+}
+
+/* _ostore_apply: see specification in ostore_impl.h */
+size_t _ostore_apply(const ostore_op* ops, size_t n) {
+    size_t failed = 0;
+    int err = 0;
+
+    _stats_apply(ops, n);
+
+    /* runs of backend operations, with slot operations applied in between */
+    for (size_t i = 0, j; i < n; i = j) {
+        size_t f;
+
+        if (_slots_type(ops[i].type)) {
+            j = i + 1;
+            f = ops[i].op == OSTORE_OP_STORE
+                ? !_slots_store(ops[i].id, ops[i].data, ops[i].len)
+                : !_slots_unlink(ops[i].id);
+        } else {
+            for (j = i + 1; j < n && !_slots_type(ops[j].type); j++)
+                ;
+            f = _apply_backend(ops + i, j - i);
+        }
 
-static bool ostore_on = false;  /* ostore enabled flag */
+        if (f) {
+            failed += f;
+            err = err ? err : errno;
+        }
+    }
 
-static char* OFILE_FMT = "./%s/%s/%#zx.txt"; 
-                                        /* format for object store file path */
-static char* OSTORE_DIR = "ostore";     /* name of object store directory */
-static char* TYPEPATH_FMT = "%s/%s";    /* format for typedir path */
+    errno = err;
 
-/* 
- * Declaration of private _create_ostore_dir helper function.
- * 
- * This function creates an object store directory if it does not already 
- * exist. 
- * If the typedir parameter is NULL then the top-level ostore directory 
- * will be created. 
- * If the typedir parameter is not NULL then a type director ostore/<typedir>
- * will be created (where typedir is int or str etc.).
- * If directory creation succeeds or the relevant directory already exists
- * the function returns true,  otherwise it returns false and errno will be 
- * set.
- */
-bool _create_ostore_dir(const char* typedir);
+    return failed;
+}
 
-/* 
- * Declaration of private _get_ofile_path helper function.
- * 
- * Given an object representation, this function returns
- * a newly allocated pathname for the object file in the store. 
- * OFILE_FMT defines the path format. 
- * For example, if the object_rep id is 0x7f91c1402710, the returned path 
- * will be:
- *      ./ostore/int/0x7f91c1402710.txt
- * 
- * assuming the object_rep type is "int"
- *
- * _get_ofile_path dynamically allocates the path name. It is the user's
- * responsibility to free the allocated memory.
- *
- * _get_ofile_path is used by store_obj to create the filename to use to 
- * store an object and by unlink_obj to create the filename to unlink/delete.
- */
-char *_get_ofile_path(object_rep* obj_rep);
+/* _files_open: opens the ostore directory and the io_uring engine */
+static bool _files_open(const ostore_opts* opts) {
+    if ((_ostore_fd = open(OSTORE_DIR, O_RDONLY | O_DIRECTORY)) < 0)
+        return false;
 
-/* enable_ostore: implemented, do NOT change */
-bool enable_ostore() {
-    ostore_on = _create_ostore_dir(NULL); //creates directory 
-    
-    return ostore_on;
+    /* without kernel support the plain system calls are used */
+    uring = opts && opts->io_uring && !dedup && _uring_open();
+    _dirty_on = opts && opts->durability != OSTORE_SYNC_NONE;
+
+    return true;
 }
 
-/* ostore_is_on: implemented, do NOT change */
-bool ostore_is_on() {
-    return ostore_on;
+/* _files_close: closes the io_uring engine and the directories */
+static void _files_close() {
+    if (uring)
+        _uring_close();
+
+    uring = false;
+    _close_dirs();
+
+    pthread_mutex_lock(&_dirty_lock);
+    free(_dirty);
+    _dirty = NULL;
+    _ndirty = 0;
+    _dirty_on = _dirty_lost = false;
+    _dirty_err = 0;
+    pthread_mutex_unlock(&_dirty_lock);
 }
 
-/* 
- * TODO: IMPLEMENT store_obj
- * See comments to the store_obj function declaration in obj_store.h for the
- * specification of this function. Also see the comments below in the body of
- * the function.
- */
-bool store_obj(object_rep* obj_rep) {
+/* _files_store: see declaration at start of this file */
+static bool _files_store(const char* type, uintptr_t id, const char* data, 
+    size_t len) {
+    struct iovec iov = { (void*) data, len };
+
+    return _files_storev(type, id, &iov, 1, len);
+}
+
+/* _files_storev: writes the buffers of iov to the object file with writev */
+static bool _files_storev(const char* type, uintptr_t id, 
+    const struct iovec* iov, int n, size_t len) {
+    char name[OSTORE_NAME_MAX];
+    bool tmp;
+    int dfd = _ostore_objfile(type, id, true, name, &tmp);
+
+    if (dfd < 0)
+        return false;
+
+    if (dedup) {
+        /* the blob is named by a hash of the whole value */
+        char stack[REC_STACK_MAX];
+        char* data = n == 1 ? (char*) iov[0].iov_base
+            : _gather(iov, n, len, stack, sizeof(stack));
+        bool ok = data && _dedup_store(dfd, name, id, data, len);
+        int err = errno;
+
+        if (n > 1 && data && data != stack)
+            free(data);
+
+        if (tmp)
+            close(dfd);
+
+        errno = err;
+
+        return ok;
+    }
+
+    int fd = openat(dfd, name, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+
+    _stats_sys(ok ? 3 : 1);     /* with the write and close */
+
+    if (ok) {
+        ssize_t w = writev(fd, iov, n); //write to file descriptor
+
+        if (w != (ssize_t) len && w >= 0)
+            errno = EIO;
+
+        ok = w == (ssize_t) len;
+        
+        if (close(fd))
+            ok = false;
+
+        if (!ok) {
+            int err = errno;
+            unlinkat(dfd, name, 0); //no file should remain on failure
+            errno = err;
+        }
+    }
+
+    if (tmp)
+        close(dfd);
+
+    return ok;
+}
+
+/* _files_load: the contents of the object file of type/id */
+static char* _files_load(const char* type, uintptr_t id, size_t* len) {
+    char name[OSTORE_NAME_MAX];
+    struct stat sbuf;
+    bool tmp;
+    int dfd = _ostore_objfile(type, id, false, name, &tmp);
+
+    if (dfd < 0)
+        return NULL;    /* ENOENT if nothing of the type was stored */
+
+    int fd = openat(dfd, name, O_RDONLY);
+    int err = errno;
+
+    _stats_sys(fd < 0 ? 1 : 4);     /* with the stat, read and close */
+
+    if (tmp)
+        close(dfd);
+
+    if (fd < 0) {
+        errno = err;
+        return NULL;
+    }
+
+    char* data = fstat(fd, &sbuf) ? NULL : (char*) malloc(sbuf.st_size + 1);
+    ssize_t r = data ? pread(fd, data, sbuf.st_size, 0) : -1;
+
+    close(fd);
+
+    if (r != (ssize_t) sbuf.st_size) {
+        if (r >= 0)
+            errno = EIO;
+        free(data);
+        return NULL;
+    }
+
+    data[r] = '\0';
+    *len = (size_t) r;
+
+    return data;
+}
+
+/* _ostore_load: see declaration at start of this file */
+static char* _ostore_load(const char* type, uintptr_t id, size_t* len) {
+    char* data;
+    size_t dlen;
+
+    /* a pending operation on the object has the latest value */
+    if ((defer && _defer_lookup(type, id, &data, &dlen))
+        || (async && _async_lookup(type, id, &data, &dlen))) {
+        if (data && !_slots_type(type))
+            return _decode(data, dlen, len);
+
+        if (data)
+            *len = dlen;
+
+        return data;
+    }
+
+    if (reap && _reap_pending(type, id)) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if (_slots_type(type)) {
+        char slot[OSTORE_SLOT_DATA];
+
+        if (!(dlen = _slots_load(id, slot))) {
+            errno = ENOENT;
+            return NULL;
+        }
+
+        if ((data = strndup(slot, dlen)))
+            *len = dlen;
+
+        return data;
+    }
+
+    data = BACKENDS[backend].load(type, id, &dlen);
+
+    return data ? _decode(data, dlen, len) : NULL;
+}
+
+/* _decode: see declaration at start of this file */
+static char* _decode(char* data, size_t dlen, size_t* len) {
+    /* either format, whichever was in use when the object was stored */
+    if (!_rec_is_binary(data, dlen)) {
+        *len = dlen;
+        return data;
+    }
+
+    ostore_rec rec;
+    char* text = _rec_decode(data, dlen, &rec) ? _rec_text(&rec, len) : NULL;
+
+    free(data);
+
+    return text;
+}
+
+/* _ostore_flush: see specification in ostore_impl.h */
+bool _ostore_flush() {
+    return BACKENDS[backend].flush();
+}
+
+/* _ostore_sync: see specification in ostore_impl.h */
+bool _ostore_sync() {
+    return _slots_sync() && BACKENDS[backend].sync();
+}
+
+/* _files_flush: object files are written straight away */
+static bool _files_flush() {
+    return true;
+}
+
+/* _ostore_dirty: see specification in ostore_impl.h */
+void _ostore_dirty(const ostore_op* op) {
+    if (!_dirty_on)
+        return;
+
+    pthread_mutex_lock(&_dirty_lock);
+
     /* 
-     * You should:
-     *      - include appropriate error checking of the parameter to the 
-     *        function and its fields and of return values from library 
-     *        and helper function calls
-     *      - only use file system operations specified in the rules in
-     *        README.txt
-     *      - use helper functions to create a type subdirectory and get 
-     *        the get the path of the file to write to
-     *      - write the valstr of the object representation to the file
-     *      - free any memory you were responsible for allocating
-     *      - return true if the string representation is successfully written 
-     *        to file and false otherwise, in which case no file should remain
+     * sync what is noted so far rather than holding more; every noted file
+     * has been written, so none is synced before its write
      */
-     if (obj_rep && obj_rep->valstr) {
-	/*this would create a path for the relevant type*/
-	bool path_created = _create_ostore_dir(obj_rep->type); 
-    
-        if (path_created) { //if the path has been created 
-            char *obj_path = _get_ofile_path(obj_rep); //get object path
-            int fd = open(obj_path, O_CREAT | O_RDWR,  0777); //open for writing
-            free(obj_path);
-            write(fd, obj_rep->valstr, strlen(obj_rep->valstr)); //write to file descriptor
-            close(fd); //close 
-            return true; //return true
-        } 
-
-	}
-     
-    errno = EINVAL;
-    return false;
-}
-
-/* unlink_obj: implemented, do NOT change */
-void unlink_obj(object_rep* obj_rep) {
-    if (ostore_on) {
-        char *ofile_path = _get_ofile_path(obj_rep); 
-                                // returns NULL for bad obj_rep
-    
-        if (ofile_path) {
-            unlink(ofile_path);
-        
-            free(ofile_path);
+    while (_ndirty + 2 > FILES_DIRTY_MAX) {
+        pthread_mutex_unlock(&_dirty_lock);
+        bool ok = _files_sync();
+        int err = errno;
+        pthread_mutex_lock(&_dirty_lock);
+
+        if (!ok) {
+            if (!_dirty_err)
+                _dirty_err = err ? err : EIO;
+            break;
         }
     }
-    
-    return;
+
+    if (_ndirty + 2 > FILES_DIRTY_MAX || (!_dirty && !(_dirty = (dirty_path*)
+        malloc(FILES_DIRTY_MAX * sizeof(dirty_path))))) {
+        _dirty_lost = true;     /* the next sync is a syncfs */
+        pthread_mutex_unlock(&_dirty_lock);
+        return;
+    }
+
+    char name[OSTORE_NAME_MAX];
+
+    _objname(op->id, name);
+    snprintf(_dirty[_ndirty++].path, DIRTY_PATH_MAX, "%s/%s", op->type,
+        name);
+
+    /* a stored value may have added a blob name */
+    if (dedup && op->op == OSTORE_OP_STORE)
+        snprintf(_dirty[_ndirty++].path, DIRTY_PATH_MAX, "%s/.blobs/",
+            op->type);
+
+    pthread_mutex_unlock(&_dirty_lock);
+}
+
+/* compare dirty paths for qsort */
+static int _cmp_path(const void* a, const void* b) {
+    return strcmp(((const dirty_path*) a)->path, ((const dirty_path*) b)->path);
+}
+
+/* fsync the file or directory at path relative to the ostore directory */
+static bool _fsync_path(const char* path, bool dir) {
+    int fd = openat(_ostore_fd, path, O_RDONLY | (dir ? O_DIRECTORY : 0));
+
+    _stats_sys(fd < 0 ? 1 : 3);
+
+    if (fd < 0)
+        return errno == ENOENT;     /* unlinked since */
+
+    bool ok = (dir ? fsync(fd) : fdatasync(fd)) == 0;
+    int err = errno;
+
+    close(fd);
+    errno = err;
+
+    return ok;
+}
+
+/* 
+ * _files_sync: fdatasyncs the object files written since the last sync and
+ * fsyncs the directories they were created or unlinked in
+ */
+static bool _files_sync() {
+    pthread_mutex_lock(&_dirty_lock);
+    dirty_path* files = _dirty;
+    size_t n = _ndirty;
+    bool lost = _dirty_lost;
+    int err = _dirty_err;
+    _dirty = NULL;
+    _ndirty = 0;
+    _dirty_lost = false;
+    _dirty_err = 0;
+    pthread_mutex_unlock(&_dirty_lock);
+
+    bool ok = !err;
+    size_t ndirs = 0;
+    dirty_path* dirs = (dirty_path*) malloc((n * (OSTORE_SHARD_MAX + 3) + 1)
+        * sizeof(dirty_path));
+
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(files[i].path);
+
+        if (len && files[i].path[len - 1] != '/' 
+            && !_fsync_path(files[i].path, false)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+
+        /* every directory on its path, which may have been created too */
+        for (size_t c = 0; dirs && c < len; c++) {
+            if (files[i].path[c] == '/') {
+                memcpy(dirs[ndirs].path, files[i].path, c);
+                dirs[ndirs++].path[c] = '\0';
+            }
+        }
+    }
+
+    free(files);
+
+    if (lost || (n && !dirs)) {
+        /* out of memory: fall back to the whole file system */
+        free(dirs);
+        _stats_sys(1);
+
+        if (syncfs(_ostore_fd)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+
+        errno = err;
+
+        return ok;
+    }
+
+    if (!n) {
+        free(dirs);
+        errno = err;
+        return ok;
+    }
+
+    strcpy(dirs[ndirs++].path, ".");    /* new type directories */
+    qsort(dirs, ndirs, sizeof(dirty_path), _cmp_path);
+
+    for (size_t i = 0; i < ndirs; i++) {
+        if (i && !strcmp(dirs[i].path, dirs[i - 1].path))
+            continue;
+
+        if (!_fsync_path(dirs[i].path, true)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+    }
+
+    free(dirs);
+    errno = err;
+
+    return ok;
+}
+
+/* _files_unlink: see declaration at start of this file */
+static bool _files_unlink(const char* type, uintptr_t id) {
+    char name[OSTORE_NAME_MAX];
+    bool tmp;
+    int dfd = _ostore_objfile(type, id, false, name, &tmp);
+
+    if (dfd < 0)
+        return errno == ENOENT;     //no type directory, nothing to unlink
+
+    if (!dedup)
+        _stats_sys(1);
+
+    bool ok = dedup ? _dedup_unlink(dfd, name)
+        : unlinkat(dfd, name, 0) == 0 || errno == ENOENT;
+
+    if (tmp)
+        close(dfd);
+
+    return ok;
 }
 
 /* _create_ostore_dir: see specification at start of this file. 
@@ -162,15 +1383,284 @@ bool _create_ostore_dir(const char* typedir) {
     return r == 0;
 }
 
-/* _get_ofile_path: see specification at start of this file. 
- * Do NOT change this function.
+/* 
+ * as _ostore_dirfd, also setting *shards to the shard bitmap of the type 
+ * directory (NULL if there is none)
  */
-char *_get_ofile_path(object_rep* obj_rep) {
-    char *ofile_path = NULL;
+static int _typedir_fd(const char* type, bool create, bool* tmp, 
+    unsigned char** shards) {
+    int n = __atomic_load_n(&_ntypedirs, __ATOMIC_ACQUIRE);
 
-    if (obj_rep && obj_rep->type) 
-        (void) asprintf(&ofile_path, OFILE_FMT, OSTORE_DIR, obj_rep->type,
-            obj_rep->id);
-    
-    return ofile_path;
+    *tmp = false;
+    *shards = NULL;
+
+    for (int i = 0; i < n; i++) {
+        if (!strcmp(_typedirs[i].name, type)) {
+            *shards = _typedirs[i].shards;
+            return _typedirs[i].fd;
+        }
+    }
+
+    pthread_mutex_lock(&_typedir_lock);
+
+    /* another thread may have added it meanwhile */
+    for (int i = n; i < _ntypedirs; i++) {
+        if (!strcmp(_typedirs[i].name, type)) {
+            *shards = _typedirs[i].shards;
+            pthread_mutex_unlock(&_typedir_lock);
+            return _typedirs[i].fd;
+        }
+    }
+
+    int fd = -1;
+
+    if (!create || mkdirat(_ostore_fd, type, 0755) == 0 || errno == EEXIST)
+        fd = openat(_ostore_fd, type, O_RDONLY | O_DIRECTORY);
+
+    _stats_sys(create ? 2 : 1);
+
+    if (fd >= 0) {
+        if (_ntypedirs < OSTORE_MAX_TYPES) {
+            typedir* td = &_typedirs[_ntypedirs];
+
+            strncpy(td->name, type, OSTORE_TYPE_MAX);
+            td->name[OSTORE_TYPE_MAX] = '\0';
+            td->fd = fd;
+            /* without a bitmap every store makes its shard directories */
+            td->shards = shard_levels 
+                ? (unsigned char*) calloc(1, (1u << (8 * shard_levels)) / 8)
+                : NULL;
+            *shards = td->shards;
+            __atomic_store_n(&_ntypedirs, _ntypedirs + 1, __ATOMIC_RELEASE);
+        } else {
+            *tmp = true;
+        }
+    }
+
+    pthread_mutex_unlock(&_typedir_lock);
+
+    return fd;
+}
+
+/* _ostore_dirfd: see specification in ostore_impl.h */
+int _ostore_dirfd(const char* type, bool create, bool* tmp) {
+    unsigned char* shards;
+
+    return _typedir_fd(type, create, tmp, &shards);
+}
+
+/* _ostore_objfile: see specification in ostore_impl.h */
+int _ostore_objfile(const char* type, uintptr_t id, bool create, char* name,
+    bool* tmp) {
+    unsigned char* shards;
+    int dfd = _typedir_fd(type, create, tmp, &shards);
+
+    _objname(id, name);
+
+    if (dfd < 0 || !shard_levels)
+        return dfd;
+
+    unsigned hash = (unsigned) (((uint64_t) id * 0x9e3779b97f4a7c15u) >> 48);
+    unsigned shard = hash >> (16 - 8 * shard_levels);   /* leaf shard */
+
+    bool known = shards && (__atomic_load_n(&shards[shard / 8], 
+        __ATOMIC_RELAXED) & (1u << (shard % 8)));
+
+    for (unsigned l = 1; create && !known && l <= shard_levels; l++) {
+        name[3 * l - 1] = '\0';    /* the path of the shard of level l */
+        int r = mkdirat(dfd, name, 0755);
+        name[3 * l - 1] = '/';
+
+        _stats_sys(1);
+
+        if (r && errno != EEXIST) {
+            if (*tmp) {
+                int err = errno;
+                close(dfd);
+                errno = err;
+            }
+            return -1;
+        }
+    }
+
+    if (create && !known && shards)
+        (void) __atomic_fetch_or(&shards[shard / 8], 
+            (unsigned char) (1u << (shard % 8)), __ATOMIC_RELAXED);
+
+    return dfd;
+}
+
+/* _objname: see declaration at start of this file */
+static void _objname(uintptr_t id, char* name) {
+    size_t n = 0;
+
+    /* the top 8 bits of the hash name the first level, and so on */
+    unsigned hash = (unsigned) (((uint64_t) id * 0x9e3779b97f4a7c15u) >> 48);
+
+    for (unsigned l = 0; l < shard_levels; l++)
+        n += snprintf(name + n, OSTORE_NAME_MAX - n, "%02x/", 
+            (hash >> (8 - 8 * l)) & 0xff);
+
+    snprintf(name + n, OSTORE_NAME_MAX - n, OFILE_FMT, id); //object file name
+}
+
+/* _ostore_shard_name: see specification in ostore_impl.h */
+bool _ostore_shard_name(const char* name) {
+    for (int i = 0; i < 2; i++)
+        if (!((name[i] >= '0' && name[i] <= '9') 
+            || (name[i] >= 'a' && name[i] <= 'f')))
+            return false;
+
+    return name[2] == '\0';
+}
+
+/* 
+ * convert the object file name of the type directory dfd to format, true if
+ * it is converted or already has the format
+ */
+static bool _convert_file(int dfd, const char* name, const char* type, 
+    ostore_format format) {
+    char tmpname[NAME_MAX + sizeof(".tmp")];
+    struct stat sbuf;
+    char* out = NULL;
+    size_t olen = 0;
+    bool ok = false;
+    int fd = openat(dfd, name, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    char* buf = fstat(fd, &sbuf) ? NULL : (char*) malloc(sbuf.st_size + 1);
+    ssize_t len = buf ? read(fd, buf, sbuf.st_size) : -1;
+
+    close(fd);
+
+    if (len != (ssize_t) sbuf.st_size) {
+        if (len >= 0)
+            errno = EIO;
+        free(buf);
+        return false;
+    }
+
+    if (format == OSTORE_FMT_BINARY && !_rec_is_binary(buf, len)) {
+        uintptr_t id = (uintptr_t) strtoull(name, NULL, 16);
+
+        if ((out = (char*) malloc(len + OSTORE_REC_OVERHEAD)))
+            olen = _rec_encode(out, type, id, buf, len);
+    } else if (format == OSTORE_FMT_TEXT && _rec_is_binary(buf, len)) {
+        ostore_rec rec;
+
+        if (_rec_decode(buf, len, &rec))
+            out = _rec_text(&rec, &olen);
+    } else {
+        free(buf);
+        return true;    /* already in the format */
+    }
+
+    if (out) {
+        snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+        fd = openat(dfd, tmpname, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        ok = fd >= 0;
+
+        if (ok) {
+            ssize_t w = write(fd, out, olen);
+
+            if (w >= 0 && w != (ssize_t) olen)
+                errno = EIO;
+
+            ok = w == (ssize_t) olen;
+
+            if (close(fd))
+                ok = false;
+
+            ok = ok && renameat(dfd, tmpname, dfd, name) == 0;
+
+            if (!ok) {
+                int err = errno;
+                unlinkat(dfd, tmpname, 0);
+                errno = err;
+            }
+        }
+    }
+
+    free(out);
+    free(buf);
+
+    return ok;
+}
+
+/* _convert_dir: see declaration at start of this file */
+static bool _convert_dir(int dfd, const char* type, ostore_format format) {
+    int fd = dup(dfd);
+    DIR* dir = fd >= 0 ? fdopendir(fd) : NULL;
+    struct dirent* de;
+    bool ok = true;
+    int err = 0;
+
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    rewinddir(dir);
+
+    while ((de = readdir(dir))) {
+        size_t n = strlen(de->d_name);
+
+        if (_ostore_shard_name(de->d_name)) {
+            int sfd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
+
+            if (sfd >= 0 ? !_convert_dir(sfd, type, format) 
+                : errno != ENOTDIR) {
+                ok = false;
+                err = err ? err : errno;
+            }
+
+            if (sfd >= 0)
+                close(sfd);
+
+            continue;
+        }
+
+        /* object files only, not temporary files of a failed conversion */
+        if (n < 5 || strcmp(de->d_name + n - 4, ".txt"))
+            continue;
+
+        if (!_convert_file(dfd, de->d_name, type, format)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+    }
+
+    closedir(dir);
+    errno = err;
+
+    return ok;
+}
+
+/* close the directories opened by the files backend */
+static void _close_dirs() {
+    for (int i = 0; i < _ntypedirs; i++) {
+        close(_typedirs[i].fd);
+        free(_typedirs[i].shards);
+    }
+
+    _ntypedirs = 0;
+
+    if (_ostore_fd >= 0)
+        close(_ostore_fd);
+
+    _ostore_fd = -1;
+}
+
+/* _valid_type: see specification in ostore_impl.h */
+bool _valid_type(const char* type) {
+    if (!type)
+        return false;
+
+    size_t len = strlen(type);
+
+    return len > 0 && len <= OSTORE_TYPE_MAX && !strchr(type, '/')
+        && strcmp(type, ".") && strcmp(type, "..");
 }
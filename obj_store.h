@@ -1,7 +1,12 @@
 #ifndef _OBJ_STORE_H
 #define _OBJ_STORE_H
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "id_map.h"
 
 /* 
  * Declaration of the object_rep type to represent the key information about
@@ -15,6 +20,370 @@ typedef struct object_rep {
     const char* valstr; /* string representation of object state */
 } object_rep;
 
+/*
+ * Declaration of the ostore_backend type that selects how objects are laid
+ * out in the object store.
+ *
+ * OSTORE_FILES - one text file per object: ostore/<type>/<id>.txt (see 
+ *      store_obj), or ostore/<type>/<shard>/.../<id>.txt with shard_levels
+ *      (see ostore_opts). This is the default.
+ * OSTORE_LOG - log-structured storage: objects of each type are appended as
+ *      put records to segment files ostore/<type>/<segment>.log and deletions
+ *      are appended as tombstone records. An in-memory index maps each live
+ *      object id to its latest record. Segments whose records are mostly 
+ *      dead are compacted in the background: their live records are copied
+ *      to the active segment and the segment file is removed. A store or
+ *      unlink is a single write to an already open file, with no per-object
+ *      inode.
+ * OSTORE_MEMORY - values are kept in a hash table in memory and nothing is
+ *      written to disk (other than the ostore directory). Objects are 
+ *      stored, unlinked and loaded as with the other backends, so it 
+ *      measures the overhead of the libraries and the store without I/O 
+ *      and runs tests quickly. The contents are lost when the store is 
+ *      disabled, so load_ostore is not supported.
+ */
+typedef enum ostore_backend {
+    OSTORE_FILES = 0,
+    OSTORE_LOG,
+    OSTORE_MEMORY
+} ostore_backend;
+
+/*
+ * Declaration of the ostore_backpressure type that selects what store_obj and
+ * unlink_obj do in async mode (see ostore_opts) when the queue is full.
+ *
+ * OSTORE_BP_BLOCK - wait until the writer thread has made room in the queue.
+ *      This is the default.
+ * OSTORE_BP_SYNC - the caller applies the queued operations itself and then
+ *      stores or removes its object synchronously, so the operation order is 
+ *      kept.
+ */
+typedef enum ostore_backpressure {
+    OSTORE_BP_BLOCK = 0,
+    OSTORE_BP_SYNC
+} ostore_backpressure;
+
+/*
+ * Declaration of the ostore_durability type that selects when stored and
+ * unlinked objects are made durable (synced to disk, e.g. with fdatasync).
+ * Stores and unlinks are committed in batches: a synchronous call is a batch
+ * of one, in async mode each drain of the queue is a batch. A batch is 
+ * written with one write per segment (OSTORE_LOG) and a sync covers all
+ * batches committed before it (group commit).
+ *
+ * OSTORE_SYNC_NONE - never sync, durability is left to the operating 
+ *      system. This is the default.
+ * OSTORE_SYNC_INTERVAL - sync every sync_interval_ms milliseconds if 
+ *      anything was committed since the last sync
+ * OSTORE_SYNC_COUNT - sync when sync_every records have been committed 
+ *      since the last sync
+ * OSTORE_SYNC_ALWAYS - every batch is durable when it is committed, i.e.
+ *      when store_obj returns in synchronous mode
+ *
+ * flush_ostore and disable_ostore make everything durable unless the mode is
+ * OSTORE_SYNC_NONE.
+ */
+typedef enum ostore_durability {
+    OSTORE_SYNC_NONE = 0,
+    OSTORE_SYNC_INTERVAL,
+    OSTORE_SYNC_COUNT,
+    OSTORE_SYNC_ALWAYS
+} ostore_durability;
+
+/*
+ * Declaration of the ostore_format type that selects how the value of an
+ * object is laid out in the store.
+ *
+ * OSTORE_FMT_TEXT - the value string as given to store_obj. This is the 
+ *      default.
+ * OSTORE_FMT_BINARY - a binary record: a type tag byte, the object id and
+ *      the payload length as varints, the payload and a CRC32C checksum of
+ *      the record. The values of "int" objects are stored as a variable 
+ *      length binary integer and those of "str" objects as the bytes of the
+ *      string (without the length prefix and new line of the value string);
+ *      values of other types are stored as given. A reader reads the fixed
+ *      size and length prefixed fields without scanning for delimiters and
+ *      detects corrupt records by the checksum. The first byte of a record
+ *      is never a printable character, so both layouts can be told apart 
+ *      (see convert_ostore).
+ *
+ * The objects of the slot_type (see ostore_opts) are always kept as text in
+ * their slots.
+ */
+typedef enum ostore_format {
+    OSTORE_FMT_TEXT = 0,
+    OSTORE_FMT_BINARY
+} ostore_format;
+
+/*
+ * Declaration of the ostore_opts type of options for enable_ostore_opts.
+ * A field that is 0 selects the default for that option, so a zero 
+ * initialised ostore_opts selects the same store as enable_ostore.
+ */
+typedef struct ostore_opts {
+    ostore_backend backend;     /* storage layout, default OSTORE_FILES */
+    size_t log_segment_size;    /* OSTORE_LOG: size in bytes at which the 
+                                 * active segment is sealed and a new one 
+                                 * started, default 4 MiB */
+    bool async;                 /* if true, store_obj and unlink_obj queue
+                                 * the operation for a background writer 
+                                 * thread and return without waiting for 
+                                 * I/O (see flush_ostore), default false */
+    size_t async_queue_size;    /* async: maximum number of queued 
+                                 * operations, rounded up to a power of 2, 
+                                 * default 1024, maximum 1048576 */
+    ostore_backpressure async_backpressure;
+                                /* async: what to do when the queue is 
+                                 * full, default OSTORE_BP_BLOCK */
+    ostore_durability durability;
+                                /* when to sync, default OSTORE_SYNC_NONE */
+    unsigned sync_interval_ms;  /* OSTORE_SYNC_INTERVAL: period, default 
+                                 * 100 ms */
+    unsigned sync_every;        /* OSTORE_SYNC_COUNT: number of records, 
+                                 * default 64 */
+    bool io_uring;              /* OSTORE_FILES: open, write, close and 
+                                 * unlink object files through io_uring, 
+                                 * one submission per batch (see 
+                                 * ostore_durability). Falls back to plain
+                                 * system calls if the kernel lacks 
+                                 * support. Default false */
+    const char* slot_type;      /* name of a type (e.g. "int") whose 
+                                 * objects are kept in a memory-mapped 
+                                 * file of fixed-size slots, 
+                                 * ostore/<slot_type>.slots, instead of the
+                                 * backend. Storing or unlinking such an 
+                                 * object is a copy into the mapping. 
+                                 * Values must be 1 to 20 bytes long. The 
+                                 * mapping is synced with msync according
+                                 * to the durability. Default NULL: none */
+    ostore_format format;       /* layout of stored values, default 
+                                 * OSTORE_FMT_TEXT */
+    unsigned defer_ms;          /* if non-zero, store_obj holds each store
+                                 * in memory for this many milliseconds 
+                                 * before it is written (or queued in async
+                                 * mode). An unlink_obj of the object 
+                                 * within that window cancels the store and
+                                 * neither does any I/O (see 
+                                 * defer_stats_ostore). Default 0: off */
+    unsigned shard_levels;      /* OSTORE_FILES: number of levels (0 to 2)
+                                 * of shard directories between a type 
+                                 * directory and its object files, each 
+                                 * level named by a byte of a hash of the 
+                                 * object id, e.g. ostore/int/ab/cd/<id>.txt
+                                 * for 2. Spreads a large population over 
+                                 * up to 256 or 65536 small directories. 
+                                 * Must be the same each time a store is 
+                                 * enabled. Default 0: flat type 
+                                 * directories */
+    size_t compress_min;        /* OSTORE_FMT_BINARY: size in bytes from 
+                                 * which the payload of a record (e.g. the
+                                 * characters of a String) is compressed 
+                                 * with a built-in LZ codec, if that makes
+                                 * it smaller. Smaller payloads are stored
+                                 * as they are. Records of either kind are 
+                                 * read back whatever the setting. Default
+                                 * 0: no compression */
+    bool dedup;                 /* OSTORE_FILES with OSTORE_FMT_TEXT: each 
+                                 * distinct value of a type is written 
+                                 * once, as a blob file named by a hash of
+                                 * the value in ostore/<type>/.blobs, and 
+                                 * the object files of objects with that 
+                                 * value are hard links to it. A blob is 
+                                 * removed when the last object linked to 
+                                 * it is unlinked. Must be the same each 
+                                 * time a store is enabled. Default false */
+    size_t cache_size;          /* maximum number of value strings kept in
+                                 * an in-memory LRU cache of the values 
+                                 * most recently stored and loaded, from 
+                                 * which load_obj is served without I/O 
+                                 * (see cache_stats_ostore). Default 0: no
+                                 * cache */
+    bool stats;                 /* if true, operation latencies and I/O are
+                                 * counted (see stats_ostore). Ignored if 
+                                 * the store is built with OSTORE_NO_STATS
+                                 * defined. Default false */
+    size_t rate_bytes;          /* if non-zero, the bytes per second at 
+                                 * most that stores write to the backend. 
+                                 * A batch over the budget waits: in sync 
+                                 * mode the caller of store_obj, in async 
+                                 * mode the writer thread, while further 
+                                 * stores queue up to be written as a 
+                                 * larger batch (see rate_stats_ostore). 
+                                 * Default 0: unlimited */
+    size_t rate_ops;            /* if non-zero, the stores and unlinks per
+                                 * second at most, as rate_bytes. Default 
+                                 * 0: unlimited */
+    unsigned rate_burst_ms;     /* the budget of rate_bytes and rate_ops 
+                                 * that may be used at once after a quiet
+                                 * period, in ms at the rates. Default 100
+                                 */
+    unsigned defer_count;       /* if non-zero, a store held by defer_ms is
+                                 * also written once this many newer 
+                                 * objects have been stored after it, and 
+                                 * if defer_ms is 0 it is held until then.
+                                 * Objects that are unlinked first are 
+                                 * never written (see promote_all_ostore 
+                                 * and defer_stats_ostore). Default 0: no 
+                                 * limit */
+    bool unlink_async;          /* if true, unlink_obj adds the object to a
+                                 * set of pending unlinks and returns, and a
+                                 * background thread applies them in 
+                                 * batches. A store of a pending object 
+                                 * cancels its unlink and load_obj reports
+                                 * it as not stored (see 
+                                 * drain_unlinks_ostore and 
+                                 * unlink_stats_ostore). Ignored in async 
+                                 * mode, which queues unlinks already. 
+                                 * Default false */
+} ostore_opts;
+
+/*
+ * Declaration of the ostore_defer_stats type of the counters of deferred
+ * stores (see defer_ms and defer_count in ostore_opts and 
+ * defer_stats_ostore).
+ */
+typedef struct ostore_defer_stats {
+    uint64_t cancelled;         /* stores cancelled by an unlink within the
+                                 * window */
+    uint64_t persisted;         /* stores passed on to be written */
+    uint64_t aged;              /* of those, held for defer_ms */
+    uint64_t counted;           /* of those, followed by defer_count newer
+                                 * objects first; the rest were written by
+                                 * a flush or to bound memory */
+    uint64_t pending;           /* stores held now */
+    uint64_t death_age_ns;      /* total time the cancelled stores were 
+                                 * held, divide by cancelled for the mean 
+                                 * age of the objects that die young */
+    double survival;            /* persisted / (persisted + cancelled), 
+                                 * the share of objects that outlived the
+                                 * nursery, 0 if none was persisted */
+} ostore_defer_stats;
+
+/*
+ * Declaration of the ostore_cache_stats type of the counters of the value
+ * cache (see cache_size in ostore_opts and cache_stats_ostore).
+ */
+typedef struct ostore_cache_stats {
+    uint64_t hits;              /* loads served from the cache */
+    uint64_t misses;            /* loads read from the store */
+} ostore_cache_stats;
+
+/*
+ * Declaration of the ostore_rate_stats type of the counters of the rate 
+ * limiter (see rate_bytes in ostore_opts and rate_stats_ostore).
+ */
+typedef struct ostore_rate_stats {
+    uint64_t throttled;         /* batches of writes that waited */
+    uint64_t throttled_ns;      /* the total time they waited */
+} ostore_rate_stats;
+
+/*
+ * Declaration of the ostore_unlink_stats type of the counters of the 
+ * background unlinker (see unlink_async in ostore_opts and 
+ * unlink_stats_ostore).
+ */
+typedef struct ostore_unlink_stats {
+    uint64_t pending;           /* unlinks not yet applied */
+    uint64_t unlinked;          /* unlinks applied */
+    uint64_t cancelled;         /* unlinks cancelled by a store of the 
+                                 * object before they were applied */
+    uint64_t batches;           /* batches the unlinks were applied in */
+} ostore_unlink_stats;
+
+/* number of buckets of an ostore_hist */
+#define OSTORE_HIST_BUCKETS 320
+
+/* errno values below this are counted separately in ostore_stats */
+#define OSTORE_STATS_ERRNO_MAX 134
+
+/* 
+ * number of types with their own latency histograms in ostore_stats, the
+ * last of which, named "*", counts the operations of any further types
+ */
+#define OSTORE_STATS_TYPES 17
+
+/*
+ * Declaration of the ostore_stat_op type of the operations whose latencies
+ * are counted (see ostore_stats).
+ */
+typedef enum ostore_stat_op {
+    OSTORE_STAT_STORE,          /* store_obj and store_int_obj */
+    OSTORE_STAT_UNLINK,         /* unlink_obj */
+    OSTORE_STAT_LOAD,           /* load_obj */
+    OSTORE_STAT_OPS             /* the number of operations */
+} ostore_stat_op;
+
+/*
+ * Declaration of the ostore_hist type of a latency histogram. Bucket b 
+ * counts latencies from b to b ns for b below 8; above that each power of
+ * two of ns is split into 8 equal buckets (so a bucket is at most 12.5% 
+ * wide), up to 2^42 ns. Use percentile_ostore to read it.
+ */
+typedef struct ostore_hist {
+    uint64_t count;             /* operations counted */
+    uint64_t total_ns;          /* sum of their latencies */
+    uint64_t max_ns;            /* highest latency */
+    uint64_t buckets[OSTORE_HIST_BUCKETS];
+} ostore_hist;
+
+/* Declaration of the ostore_type_stats type of the histograms of a type. */
+typedef struct ostore_type_stats {
+    char type[32];              /* the type, "*" for the other types */
+    ostore_hist ops[OSTORE_STAT_OPS];
+                                /* indexed by ostore_stat_op */
+} ostore_type_stats;
+
+/*
+ * Declaration of the ostore_stats type of the instrumentation counters 
+ * (see stats in ostore_opts and stats_ostore). About 130 KB, so allocate 
+ * it dynamically.
+ */
+typedef struct ostore_stats {
+    uint64_t records_written;   /* stores applied to the backend */
+    uint64_t bytes_written;     /* bytes of their values or records */
+    uint64_t syscalls;          /* system calls made by the backends */
+    uint64_t failures[OSTORE_STATS_ERRNO_MAX];
+                                /* failed operations by errno, 0 for an 
+                                 * errno value out of range */
+    size_t queue_depth;         /* async: operations queued now */
+    size_t queue_max;           /* async: the most queued at once */
+    size_t ntypes;              /* entries of types in use */
+    ostore_type_stats types[OSTORE_STATS_TYPES];
+} ostore_stats;
+
+/*
+ * Declaration of the ostore_loader type that tells load_ostore how to 
+ * recreate the objects of a type from their value strings.
+ */
+typedef struct ostore_loader {
+    const char* type;           /* type of the objects, e.g. "int" */
+    void* (*parse)(const char* valstr, void* arg);
+                                /* creates an object from the value string
+                                 * it was stored with (as given to 
+                                 * store_obj), without storing it, or 
+                                 * returns NULL and sets errno. Called for
+                                 * one object at a time */
+    void* arg;                  /* passed to parse */
+} ostore_loader;
+
+/*
+ * Declaration of the ostore_emit_fn type of the function a checkpoint 
+ * source calls for each of its objects (see ostore_ckpt_source).
+ */
+typedef void (*ostore_emit_fn)(uintptr_t id, const char* valstr, void* ctx);
+
+/*
+ * Declaration of the ostore_ckpt_source type that tells checkpoint_ostore 
+ * how to walk the live objects of a type.
+ */
+typedef struct ostore_ckpt_source {
+    const char* type;           /* type of the objects, e.g. "int" */
+    void (*walk)(ostore_emit_fn emit, void* ctx);
+                                /* calls emit(id, valstr, ctx) for each 
+                                 * live object of the type, with the value
+                                 * string store_obj would be given for it */
+} ostore_ckpt_source;
+
 /*
  * Function:
  * enable_ostore()
@@ -42,6 +411,550 @@ typedef struct object_rep {
  */
 bool enable_ostore();
 
+/*
+ * Function:
+ * enable_ostore_opts(const ostore_opts* opts)
+ * 
+ * Description:
+ * Enables storage of objects to the object store using the given options,
+ * creating the ostore directory if necessary. enable_ostore() is equivalent
+ * to enable_ostore_opts(NULL).
+ * If the store is already enabled it is first disabled (see disable_ostore)
+ * and then enabled with the new options.
+ * For the OSTORE_LOG backend, existing segments are replayed to rebuild 
+ * the index of live objects.
+ *
+ * Usage: 
+ *      ostore_opts opts = { .backend = OSTORE_LOG };
+ *      bool r = enable_ostore_opts(&opts);
+ *
+ * Parameters:
+ * opts - the options, or NULL for the defaults
+ *
+ * Return:
+ * true if the object store was enabled, false otherwise, in which case 
+ * errno will be set and ostore_is_on will return false.
+ *
+ * Errors:
+ * If the call fails, the function returns false and errno will be set to:
+ *      EINVAL - invalid argument: if an option is out of range or needs 
+ *          another option (compress_min and dedup, see ostore_opts)
+ *      Other errno values set by creating the ostore directory or opening
+ *          and reading log segments.
+ */
+bool enable_ostore_opts(const ostore_opts* opts);
+
+/*
+ * Function:
+ * disable_ostore()
+ * 
+ * Description:
+ * Disables the object store. Any background work of the store is finished
+ * (in async mode all queued operations are applied first),
+ * open files are closed and in-memory state is released. Objects already 
+ * stored remain in the ostore directory. After the call, ostore_is_on will
+ * return false. Has no effect if the store is not enabled.
+ *
+ * Usage: 
+ *      disable_ostore();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * Not applicable
+ *
+ * Errors:
+ * Not applicable
+ */
+void disable_ostore();
+
+/*
+ * Function:
+ * flush_ostore()
+ * 
+ * Description:
+ * Waits until every store_obj and unlink_obj call that returned before the 
+ * call to flush_ostore has been applied to the object store and, unless the
+ * durability is OSTORE_SYNC_NONE, made durable. In async mode,
+ * errors of queued operations cannot be returned by store_obj, so the first
+ * such error since the previous flush is reported by flush_ostore, as are
+ * those of unlinks with unlink_async. Returns immediately if the store is 
+ * not in async mode, has no pending unlinks and the durability is 
+ * OSTORE_SYNC_NONE.
+ *
+ * Usage: 
+ *      bool r = flush_ostore();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * true if the store is enabled and all queued operations succeeded, false
+ * otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      The errno value of the first queued operation that failed.
+ */
+bool flush_ostore();
+
+/*
+ * Function:
+ * compact_ostore()
+ * 
+ * Description:
+ * Synchronously compacts the object store. For the OSTORE_LOG backend, 
+ * every sealed segment that contains dead (overwritten or deleted) records
+ * is rewritten: its live records are appended to the active segment and the
+ * segment file is removed. Compaction also runs automatically in the 
+ * background for segments that are at least half dead. For OSTORE_FILES 
+ * there is nothing to compact.
+ *
+ * Usage: 
+ *      bool r = compact_ostore();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * true if the store is enabled and compaction succeeded, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      Other errno values related to I/O errors reading or writing segments.
+ */
+bool compact_ostore();
+
+/*
+ * Function:
+ * defer_stats_ostore(ostore_defer_stats* stats)
+ * 
+ * Description:
+ * Gets the counters of deferred stores since the store was enabled: the
+ * number of stores cancelled by an unlink_obj within the deferral window 
+ * and the number passed on to be written, by why, with the survival rate 
+ * and the age of the cancelled objects to tune defer_ms and defer_count 
+ * by. All are 0 if defer_ms and defer_count are 0 (see ostore_opts).
+ *
+ * Usage: 
+ *      ostore_defer_stats stats;
+ *      bool r = defer_stats_ostore(&stats);
+ *
+ * Parameters:
+ * stats - set to the counters
+ *
+ * Return:
+ * true if the store is enabled and stats is set, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stats is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ */
+bool defer_stats_ostore(ostore_defer_stats* stats);
+
+/*
+ * Function:
+ * promote_all_ostore()
+ * 
+ * Description:
+ * Writes every store held by defer_ms or defer_count (see ostore_opts) 
+ * now, whatever its age, and in async mode waits until they have been 
+ * written. Stores made after the call are held as before. Unlike 
+ * flush_ostore, it does not sync. Does nothing if neither option is set.
+ * For example, to persist the surviving objects before a shutdown that 
+ * does not call disable_ostore.
+ *
+ * Usage: 
+ *      bool r = promote_all_ostore();
+ *
+ * Parameters:
+ * None
+ *
+ * Return:
+ * true if the store is enabled and every held store was written, false 
+ * otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      Other errno values related to the error of the first store that 
+ *      failed since the last flush.
+ */
+bool promote_all_ostore();
+
+/*
+ * Function:
+ * cache_stats_ostore(ostore_cache_stats* stats)
+ * 
+ * Description:
+ * Gets the counters of load_obj since the store was enabled: the number of
+ * loads served from the value cache and the number read from the store. 
+ * Every load is a miss if cache_size is 0 (see ostore_opts).
+ *
+ * Usage: 
+ *      ostore_cache_stats stats;
+ *      bool r = cache_stats_ostore(&stats);
+ *
+ * Parameters:
+ * stats - set to the counters
+ *
+ * Return:
+ * true if the store is enabled and stats is set, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stats is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ */
+bool cache_stats_ostore(ostore_cache_stats* stats);
+
+/*
+ * Function:
+ * rate_stats_ostore(ostore_rate_stats* stats)
+ * 
+ * Description:
+ * Gets the counters of the rate limiter since the store was enabled: the
+ * number of batches of writes held back by rate_bytes or rate_ops (see 
+ * ostore_opts) and the total time they waited. Both are 0 if neither rate
+ * is set.
+ *
+ * Usage: 
+ *      ostore_rate_stats stats;
+ *      bool r = rate_stats_ostore(&stats);
+ *
+ * Parameters:
+ * stats - set to the counters
+ *
+ * Return:
+ * true if the store is enabled and stats is set, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stats is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ */
+bool rate_stats_ostore(ostore_rate_stats* stats);
+
+/*
+ * Function:
+ * drain_unlinks_ostore()
+ * 
+ * Description:
+ * Applies every unlink_obj call made with unlink_async (see ostore_opts) 
+ * that has not been applied yet, on the calling thread, and waits for the
+ * batch the background thread is applying. Unlike flush_ostore, it does 
+ * not wait for stores or sync. Does nothing if unlink_async is not set.
+ *
+ * Usage: 
+ *      bool r = drain_unlinks_ostore();
+ *
+ * Parameters:
+ * None
+ *
+ * Return:
+ * true if the store is enabled and every pending unlink succeeded, false
+ * otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      Other errno values related to the error of the first unlink that 
+ *      failed since the last flush.
+ */
+bool drain_unlinks_ostore();
+
+/*
+ * Function:
+ * unlink_stats_ostore(ostore_unlink_stats* stats)
+ * 
+ * Description:
+ * Gets the counters of the background unlinker since the store was 
+ * enabled: the number of unlinks pending now, applied, and cancelled by a
+ * store of the same object, and the number of batches they were applied 
+ * in. All are 0 if unlink_async is not set (see ostore_opts).
+ *
+ * Usage: 
+ *      ostore_unlink_stats stats;
+ *      bool r = unlink_stats_ostore(&stats);
+ *
+ * Parameters:
+ * stats - set to the counters
+ *
+ * Return:
+ * true if the store is enabled and stats is set, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stats is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ */
+bool unlink_stats_ostore(ostore_unlink_stats* stats);
+
+/*
+ * Function:
+ * stats_ostore(ostore_stats* stats)
+ * 
+ * Description:
+ * Gets the instrumentation counters since the store was enabled with the 
+ * stats option (see ostore_opts): for each type, a histogram of the 
+ * latencies of each operation (see ostore_stat_op) as seen by the caller 
+ * (in async and deferred mode, the time to queue or hold the operation),
+ * and for the store, the records and bytes written to the backend, the 
+ * system calls made by the backends, the failures by errno (including 
+ * operations that fail when they are applied in the background) and the
+ * depth of the async queue. All are 0 if the stats option is off. 
+ * Counting costs two clock readings and a few atomic additions per 
+ * operation; if the store is built with OSTORE_NO_STATS defined there is
+ * no instrumentation at all.
+ *
+ * Usage: 
+ *      ostore_stats* stats = malloc(sizeof(ostore_stats));
+ *      bool r = stats_ostore(stats);
+ *      ...
+ *      uint64_t p99 = percentile_ostore(
+ *          &stats->types[0].ops[OSTORE_STAT_STORE], 99);
+ *
+ * Parameters:
+ * stats - set to the counters
+ *
+ * Return:
+ * true if the store is enabled and stats is set, false otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stats is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      ENOTSUP - not supported: if built with OSTORE_NO_STATS
+ */
+bool stats_ostore(ostore_stats* stats);
+
+/*
+ * Function:
+ * dump_stats_ostore(FILE* stream)
+ * 
+ * Description:
+ * Writes the counters of stats_ostore to stream as text: a line each of 
+ * the totals, the async queue and each errno that failures were counted 
+ * for, then a table of the count, mean, median, 99th and 99.9th 
+ * percentiles and maximum latency in ns of each operation of each type.
+ *
+ * Usage: 
+ *      bool r = dump_stats_ostore(stderr);
+ *
+ * Parameters:
+ * stream - the stream to write to
+ *
+ * Return:
+ * true if the store is enabled and the counters were written, false 
+ * otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if stream is NULL
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      ENOTSUP - not supported: if built with OSTORE_NO_STATS
+ *      Other errno values related to errors writing to stream.
+ */
+bool dump_stats_ostore(FILE* stream);
+
+/*
+ * Function:
+ * percentile_ostore(const ostore_hist* hist, double pct)
+ * 
+ * Description:
+ * Estimates the latency below which pct percent of the operations counted
+ * in hist fell: the highest latency of the bucket of that rank, but no 
+ * more than the maximum.
+ *
+ * Usage: 
+ *      uint64_t p50 = percentile_ostore(hist, 50);
+ *
+ * Parameters:
+ * hist - a histogram of ostore_stats
+ * pct - the percentile, from 0 to 100
+ *
+ * Return:
+ * the latency in ns, 0 if hist is NULL or empty.
+ *
+ * Errors:
+ * Not applicable
+ */
+uint64_t percentile_ostore(const ostore_hist* hist, double pct);
+
+/*
+ * Function:
+ * load_ostore(const ostore_loader* loaders, size_t nloaders, 
+ *      unsigned nthreads, idmap** objs)
+ * 
+ * Description:
+ * Recreates the stored objects of the types of the given loaders, e.g. 
+ * after a restart. The records of those types (object files, log segments
+ * or slots, in either format) are read, decoded and checksummed by a pool 
+ * of nthreads worker threads and the parse function of each type creates 
+ * the object for each record. The records are then rewritten under the ids
+ * of the new objects (the stores first, then the removals of the old ids,
+ * so that a crash during the load cannot lose an object) and *objs is set
+ * to a map from each old id to its new object.
+ * Left-overs of a crash are removed as the type directories are scanned:
+ * temporary files of convert_ostore and empty object files. A binary
+ * record whose checksum does not match, or for which parse fails, is left
+ * in the store and the others are still loaded. In async and deferred 
+ * mode, pending stores and unlinks are applied first. Must not be called 
+ * concurrently with store_obj or unlink_obj.
+ *
+ * Usage: 
+ *      static void* parse_int(const char* valstr, void* arg) {
+ *          return loadInteger(valstr);
+ *      }
+ *      ...
+ *      ostore_loader loader = { "int", parse_int, NULL };
+ *      idmap* objs = NULL;
+ *      bool r = load_ostore(&loader, 1, 0, &objs);
+ *      ...
+ *      delete_idmap(&objs);
+ *
+ * Parameters:
+ * loaders - the loaders of the types to load, one per type
+ * nloaders - the number of loaders
+ * nthreads - the number of worker threads, 0 for one per online CPU (at 
+ *      most 64)
+ * objs - set to a new id map (see id_map.h) from old id to new object, 
+ *      which the caller must delete, or to NULL if it cannot be created
+ *
+ * Return:
+ * true if every record was loaded, false otherwise. *objs holds the 
+ * objects that were loaded either way.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      EINVAL - invalid argument: if loaders or objs is NULL, or a loader
+ *          has an invalid type or no parse function
+ *      EBADMSG - bad message: if a binary record is corrupt
+ *      ENOTSUP - not supported: if the backend is OSTORE_MEMORY
+ *      The errno value set by parse for a record it could not load.
+ *      Other errno values related to I/O errors reading or writing records.
+ */
+bool load_ostore(const ostore_loader* loaders, size_t nloaders, 
+    unsigned nthreads, idmap** objs);
+
+/*
+ * Function:
+ * checkpoint_ostore(const char* path, const ostore_ckpt_source* srcs, 
+ *      size_t nsrcs, bool background)
+ * 
+ * Description:
+ * Writes a snapshot of all the live objects of the given sources to the 
+ * single file path: the binary record of each object (see 
+ * OSTORE_FMT_BINARY) followed by an index of the records of each type by
+ * id. The snapshot is written to a temporary file, path plus ".tmp", which 
+ * is synced and renamed to path, so path is either the previous snapshot
+ * or the complete new one, even after a crash.
+ * If background is true, a forked child process writes the snapshot from 
+ * its copy-on-write image of memory and the function returns at once: the 
+ * snapshot holds the objects as they were at the call, however they change
+ * afterwards, and wait_checkpoint_ostore waits for it to be written. 
+ * Independent of the object store, which need not be enabled.
+ *
+ * Usage: 
+ *      ostore_ckpt_source srcs[] = { 
+ *          { "int", walkIntegers }, { "str", walkStrings } 
+ *      };
+ *      bool r = checkpoint_ostore("objs.ckpt", srcs, 2, false);
+ *
+ * Parameters:
+ * path - the path of the snapshot file
+ * srcs - the sources of the objects to write, one per type
+ * nsrcs - the number of sources
+ * background - true to write the snapshot in a child process
+ *
+ * Return:
+ * true if the snapshot was written (or, in the background, the child 
+ * process started), false otherwise, in which case path is unchanged.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if path or srcs is NULL, or a source has
+ *          an invalid type or no walk function
+ *      EBUSY - device or resource busy: if a background checkpoint has not
+ *          been waited for
+ *      Other errno values related to I/O errors writing the snapshot or 
+ *      forking the child process.
+ */
+bool checkpoint_ostore(const char* path, const ostore_ckpt_source* srcs, 
+    size_t nsrcs, bool background);
+
+/*
+ * Function:
+ * wait_checkpoint_ostore()
+ * 
+ * Description:
+ * Waits for the background checkpoint started by checkpoint_ostore, if 
+ * any, to finish writing its snapshot.
+ *
+ * Usage: 
+ *      bool r = wait_checkpoint_ostore();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * true if there was no background checkpoint or it was written, false 
+ * otherwise.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to the
+ * errno value the snapshot could not be written with (EINTR if the child 
+ * process was killed).
+ */
+bool wait_checkpoint_ostore();
+
+/*
+ * Function:
+ * load_checkpoint_ostore(const char* path, const ostore_loader* loaders, 
+ *      size_t nloaders, idmap** objs)
+ * 
+ * Description:
+ * Recreates the objects of the snapshot written to path by 
+ * checkpoint_ostore, for the types of the given loaders (objects of other
+ * types are skipped). The header and index checksums are verified before 
+ * any object is created, and each record as it is read. The objects are 
+ * not stored. Independent of the object store, which need not be enabled.
+ *
+ * Usage: 
+ *      ostore_loader loader = { "int", parse_int, NULL };
+ *      idmap* objs = NULL;
+ *      bool r = load_checkpoint_ostore("objs.ckpt", &loader, 1, &objs);
+ *      ...
+ *      delete_idmap(&objs);
+ *
+ * Parameters:
+ * path - the path of the snapshot file
+ * loaders - the loaders of the types to load, one per type
+ * nloaders - the number of loaders
+ * objs - set to a new id map (see id_map.h) from the id of each object in
+ *      the snapshot to its new object, which the caller must delete, or to 
+ *      NULL if the snapshot could not be verified
+ *
+ * Return:
+ * true if every object of the types was loaded, false otherwise. *objs 
+ * holds the objects that were loaded before a failure.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if path, loaders or objs is NULL, or a 
+ *          loader has an invalid type or no parse function
+ *      EBADMSG - bad message: if the snapshot is corrupt
+ *      The errno value set by parse for an object it could not load.
+ *      Other errno values related to I/O errors reading the snapshot.
+ */
+bool load_checkpoint_ostore(const char* path, const ostore_loader* loaders,
+    size_t nloaders, idmap** objs);
+
 /*
  * Function:
  * ostore_is_on()
@@ -91,6 +1004,21 @@ bool ostore_is_on();
  * strings. The data/representation written to the files is valstr field of the 
  * relevant object_rep struct.
  *
+ * This is the layout of the default OSTORE_FILES backend. With the 
+ * OSTORE_LOG backend (see enable_ostore_opts) valstr is instead appended as 
+ * a put record to the active segment of ostore/<type>/.
+ *
+ * With the OSTORE_FMT_BINARY format (see ostore_opts) the value is written
+ * as a binary record instead of valstr (see ostore_format).
+ *
+ * If defer_ms or defer_count is set (see ostore_opts) valstr is copied and
+ * held for that long before it is written; an unlink_obj of the object in 
+ * the meantime cancels the store.
+ *
+ * In async mode (see ostore_opts) valstr is copied to a queue and written 
+ * by a background thread. The result then only reports whether the object
+ * was queued; I/O errors are reported by flush_ostore.
+ *
  * Usage: 
  *      bool r = store_obj(obj_rep);
  *                      // see newInteger in integer.c and newString in
@@ -107,23 +1035,179 @@ bool ostore_is_on();
  *
  * Errors:
  * If the call fails, false will be returned and errno will be set as follows.
- *      EINVAL - invalid argument: if obj_rep is NULL or obj_rep->valstr is
- *          NULL
+ *      EINVAL - invalid argument: if obj_rep is NULL, obj_rep->valstr is
+ *          NULL or obj_rep->type is not a valid type name, or if the type
+ *          is the slot_type (see ostore_opts) and valstr is empty or 
+ *          longer than a slot
  *      ENOENT - no such entity: if the object store is not enabled or the
  *          ostore directory does not exist
  *      Other errno values related to I/O errors writing to file.
  */
 bool store_obj(object_rep* obj_rep);
 
+/*
+ * Function:
+ * store_int_obj(const char* type, uintptr_t id, int val)
+ * 
+ * Description:
+ * Stores an object whose value is an int, as store_obj does for the value
+ * string "<val>\n" (the string representation of an Integer, see 
+ * integer.c). With the OSTORE_FMT_BINARY format the record is encoded
+ * straight from val, without formatting a value string.
+ *
+ * Usage: 
+ *      bool r = store_int_obj("int", (uintptr_t) oi, 42);
+ *
+ * Parameters:
+ * type - the type of the object
+ * id - the identifier of the object
+ * val - the value of the object
+ *
+ * Return:
+ * true if the object store is enabled and the object is stored successfully, 
+ * false otherwise. 
+ *
+ * Errors:
+ * As for store_obj.
+ */
+bool store_int_obj(const char* type, uintptr_t id, int val);
+
+/* maximum number of buffers of a store_obj_iov call (IOV_MAX on Linux) */
+#define OSTORE_IOV_MAX 1024
+
+/*
+ * Function:
+ * store_obj_iov(const char* type, uintptr_t id, const struct iovec* iov, 
+ *      int n)
+ * 
+ * Description:
+ * Stores an object whose value string is the concatenation of the n 
+ * buffers of iov, as store_obj does for that value string, without the 
+ * caller having to put the value together in one buffer first. With the
+ * OSTORE_FILES or OSTORE_MEMORY backend, the text format, and neither 
+ * async, defer nor io_uring mode, the buffers are passed to the backend as
+ * they are (the files backend writes them with a single writev) and the
+ * value is not copied. Otherwise the buffers are gathered into one value 
+ * string, on the stack unless it is large, which is then stored as 
+ * store_obj stores it.
+ *
+ * Usage: 
+ *      struct iovec iov[3] = { { hdr, hlen }, { val, len }, { "\n", 1 } };
+ *      bool r = store_obj_iov("str", (uintptr_t) so, iov, 3);
+ *                      // see _store_obj_rep in string_o.c
+ *
+ * Parameters:
+ * type - the type of the object
+ * id - the identifier of the object
+ * iov - the buffers of the value string; buffers may be empty
+ * n - the number of buffers, 1 to OSTORE_IOV_MAX
+ *
+ * Return:
+ * true if the object store is enabled and the object is stored successfully, 
+ * false otherwise. 
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set as follows.
+ *      EINVAL - invalid argument: if type is not a valid type name, iov is
+ *          NULL, n is not between 1 and OSTORE_IOV_MAX or a buffer with a 
+ *          length has a NULL base, or as for store_obj for the slot_type
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      Other errno values as for store_obj.
+ */
+bool store_obj_iov(const char* type, uintptr_t id, const struct iovec* iov,
+    int n);
+
+/*
+ * Function:
+ * load_obj(const char* type, uintptr_t id, char* buf, size_t len)
+ * 
+ * Description:
+ * Reads back the value string last stored for the object type/id, i.e. 
+ * the valstr given to store_obj, with the backend and format in use. If 
+ * the value is in the cache (see cache_size in ostore_opts) no I/O is 
+ * done; otherwise it is read (with pread, relative to the cached type 
+ * directory of the OSTORE_FILES backend) and cached. A load that is not
+ * served from the cache first applies the stores and unlinks pending in
+ * async or deferred mode.
+ *
+ * Usage: 
+ *      char buf[32];
+ *      ssize_t n = load_obj("int", (uintptr_t) oi, buf, sizeof(buf));
+ *
+ * Parameters:
+ * type - the type of the object
+ * id - the identifier of the object
+ * buf - set to the NUL-terminated value string
+ * len - the size of buf in bytes
+ *
+ * Return:
+ * the length of the value string (not counting the NUL) if the object is
+ * stored and its value fits in buf, -1 otherwise.
+ *
+ * Errors:
+ * If the call fails, -1 will be returned and errno will be set to:
+ *      EINVAL - invalid argument: if type is not a valid type name or buf 
+ *          is NULL
+ *      ENOENT - no such entity: if the object store is not enabled or the
+ *          object is not stored
+ *      ERANGE - result too large: if the value string and its NUL do not 
+ *          fit in len bytes
+ *      EBADMSG - bad message: if the stored binary record is corrupt
+ *      Other errno values related to I/O errors reading the value.
+ */
+ssize_t load_obj(const char* type, uintptr_t id, char* buf, size_t len);
+
+/*
+ * Function:
+ * convert_ostore(ostore_format format)
+ * 
+ * Description:
+ * Converts every object file of the OSTORE_FILES backend (ostore/<type>/
+ * <id>.txt) that is not already in the given format to that format, for 
+ * example to migrate a store written as text to OSTORE_FMT_BINARY or back.
+ * Each file is replaced atomically (a converted copy is written and renamed 
+ * over it). Conversion to text restores the exact value strings that were
+ * stored. In async mode queued operations are applied first. The format 
+ * that store_obj writes is not changed (see ostore_opts). Must not be 
+ * called concurrently with store_obj or unlink_obj.
+ *
+ * Usage: 
+ *      bool r = convert_ostore(OSTORE_FMT_BINARY);
+ *
+ * Parameters:
+ * format - the format to convert to
+ *
+ * Return:
+ * true if every object file was converted (or already had the format), 
+ * false otherwise. Files that cannot be converted are left as they are and
+ * the others are still converted.
+ *
+ * Errors:
+ * If the call fails, false will be returned and errno will be set to:
+ *      ENOENT - no such entity: if the object store is not enabled
+ *      EINVAL - invalid argument: if format is not an ostore_format
+ *      ENOTSUP - not supported: if the backend is not OSTORE_FILES or dedup
+ *      is on
+ *      EBADMSG - bad message: if a binary record is corrupt (its checksum
+ *          does not match)
+ *      Other errno values related to I/O errors reading or writing files.
+ */
+bool convert_ostore(ostore_format format);
+
 /*
  * Function:
  * unlink_obj(object_rep* obj_rep)
  * 
  * Description:
  * Unlinks/deletes the file for the given object representation from the 
- * object store. Note: only type and id fields of obj_rep are used. The 
+ * object store (or, with the OSTORE_LOG backend, appends a tombstone record
+ * for it). Note: only type and id fields of obj_rep are used. The 
  * valstr can be NULL and is ignored. 
  *
+ * In async mode, or with unlink_async (see ostore_opts), the unlink is 
+ * queued and applied by a background thread; the object is reported as 
+ * not stored by load_obj meanwhile.
+ *
  * Usage: 
  *      unlink_obj(obj_rep);
  *
@@ -10,7 +10,7 @@ cd ./bin
 
 if [ $? != 0 ]; then exit $?; fi
 
-for i in 0 1 2
+for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22
 do
     ./test_obj_store $i $1
 done
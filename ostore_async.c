@@ -0,0 +1,483 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "id_map.h"
+#include "ostore_impl.h"
+
+/*
+ * Asynchronous writer of the object store.
+ *
+ * store_obj and unlink_obj push operations into a bounded multi-producer
+ * queue (D. Vyukov's array based queue: each cell carries a sequence number
+ * that tells producers and the consumer whether the cell is free or full, so
+ * a push or pop is a single compare-and-swap on the queue position). A
+ * writer thread pops operations and applies them to the backend in batches
+ * with _ostore_apply.
+ *
+ * Each drain of the queue is committed as one batch (see _sync_commit), so
+ * queued objects share writes and syncs.
+ *
+ * Operations are popped and applied with _async_io_lock held. When the
+ * queue is full and the backpressure is OSTORE_BP_SYNC, the producer takes
+ * the lock, applies all queued operations itself and then its own, so
+ * operations on the same object are never reordered.
+ *
+ * The writer sleeps on _async_cond when the queue is empty and producers
+ * blocked by a full queue (OSTORE_BP_BLOCK) sleep on _async_space. The
+ * _async_sleeping and _async_waiting counters let the common paths skip the
+ * mutex when nobody sleeps.
+ *
+ * So that a load does not wait for the queue, the objects with queued
+ * operations are kept in an id map (_async_index, under _async_pend_lock)
+ * with the latest operation on each and the number queued. An entry is
+ * added before its operation is pushed and dropped once the last queued
+ * operation on the object has been applied; it refers to the value of the
+ * latest store, which is freed only after that.
+ */
+
+#define ASYNC_DEFAULT_QUEUE_SIZE 1024
+
+#define ASYNC_BATCH 64      /* operations applied with one _ostore_apply */
+
+/*
+ * a queued operation (OSTORE_OP_STORE or OSTORE_OP_UNLINK), data is a copy
+ * of the value string for a store 
+ */
+typedef struct async_op {
+    int op;
+    uintptr_t id;
+    char type[OSTORE_TYPE_MAX + 1];
+    char* data;
+    size_t len;
+} async_op;
+
+/* the queued operations on an object */
+typedef struct async_pend {
+    int op;                 /* of the latest */
+    char type[OSTORE_TYPE_MAX + 1];
+    const char* data;       /* value of the latest, owned by its async_op */
+    size_t len;
+    size_t refs;            /* operations queued and not yet applied */
+} async_pend;
+
+/* a queue cell */
+typedef struct async_cell {
+    size_t seq;
+    async_op op;
+} async_cell;
+
+static async_cell* _async_queue = NULL;
+static size_t _async_mask;
+static size_t _async_enq_pos;
+static size_t _async_deq_pos;
+static ostore_backpressure _async_bp;
+
+static pthread_t _async_writer;
+static pthread_mutex_t _async_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _async_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _async_space = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _async_done_cond = PTHREAD_COND_INITIALIZER;
+static int _async_sleeping = 0;     /* writer waits for work */
+static int _async_waiting = 0;      /* producers wait for space or a flush */
+static bool _async_stopping = false;
+
+static pthread_mutex_t _async_pend_lock = PTHREAD_MUTEX_INITIALIZER;
+static idmap* _async_index = NULL;  /* id -> async_pend* */
+
+static size_t _async_pushed = 0;    /* operations queued */
+static size_t _async_done = 0;      /* operations applied, which are the
+                                     * queue positions below it */
+static int _async_err = 0;          /* errno of first failed operation */
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define LOAD_SC(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define STORE_SC(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+/* push op, false if the queue is full */
+static bool _push(const async_op* op) {
+    size_t pos = __atomic_load_n(&_async_enq_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        async_cell* cell = &_async_queue[pos & _async_mask];
+        intptr_t dif = (intptr_t) LOAD(&cell->seq) - (intptr_t) pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&_async_enq_pos, &pos, pos + 1,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->op = *op;
+                STORE(&cell->seq, pos + 1);
+                return true;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&_async_enq_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* pop into op, false if the queue is empty */
+static bool _pop(async_op* op) {
+    size_t pos = __atomic_load_n(&_async_deq_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        async_cell* cell = &_async_queue[pos & _async_mask];
+        intptr_t dif = (intptr_t) LOAD(&cell->seq) - (intptr_t) (pos + 1);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&_async_deq_pos, &pos, pos + 1,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *op = cell->op;
+                STORE(&cell->seq, pos + _async_mask + 1);
+                return true;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&_async_deq_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* note op as the latest queued operation on its object */
+static bool _pend(const async_op* op) {
+    pthread_mutex_lock(&_async_pend_lock);
+
+    async_pend* p = (async_pend*) get_identry(_async_index, op->id);
+
+    if (!p && (!(p = (async_pend*) calloc(1, sizeof(async_pend)))
+        || !set_identry(_async_index, op->id, p))) {
+        pthread_mutex_unlock(&_async_pend_lock);
+        free(p);
+        return false;
+    }
+
+    p->op = op->op;
+    strcpy(p->type, op->type);
+    p->data = op->data;
+    p->len = op->len;
+    p->refs++;
+
+    pthread_mutex_unlock(&_async_pend_lock);
+
+    return true;
+}
+
+/* 
+ * drop the n applied operations ops from their objects, before their
+ * values are freed
+ */
+static void _unpend(const async_op* ops, size_t n) {
+    pthread_mutex_lock(&_async_pend_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        async_pend* p = (async_pend*) get_identry(_async_index, ops[i].id);
+
+        if (p && !--p->refs) {
+            (void) delete_identry(_async_index, ops[i].id);
+            free(p);
+        }
+    }
+
+    pthread_mutex_unlock(&_async_pend_lock);
+}
+
+/* record err as the error of a queued operation unless there is one */
+static void _set_err(int err) {
+    pthread_mutex_lock(&_async_lock);
+    if (!_async_err)
+        _async_err = err ? err : EIO;
+    pthread_mutex_unlock(&_async_lock);
+}
+
+/*
+ * pop and apply queued operations while there are any, at most max (0 for
+ * no limit), in batches of up to ASYNC_BATCH. The operations are committed
+ * as one batch. Returns the number applied. Called with _async_io_lock held.
+ */
+static size_t _drain(size_t max) {
+    async_op batch[ASYNC_BATCH];
+    ostore_op ops[ASYNC_BATCH];
+    size_t total = 0, n;
+
+    do {
+        for (n = 0; n < ASYNC_BATCH && (!max || total + n < max)
+            && _pop(&batch[n]); n++) {
+            ops[n].op = batch[n].op;
+            ops[n].id = batch[n].id;
+            ops[n].type = batch[n].type;
+            ops[n].data = batch[n].data;
+            ops[n].len = batch[n].len;
+            ops[n].iov = NULL;
+        }
+
+        size_t failed = n ? _ostore_apply(ops, n) : 0;
+
+        if (failed) {
+            _stats_fail(errno, failed);
+            _set_err(errno);
+        }
+
+        _unpend(batch, n);
+
+        for (size_t i = 0; i < n; i++)
+            free(batch[i].data);
+
+        total += n;
+    } while (n == ASYNC_BATCH && (!max || total < max));
+
+    if (total && !_sync_commit(total))
+        _set_err(errno);
+
+    if (total) {
+        __atomic_add_fetch(&_async_done, total, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);    /* pairs with _enqueue */
+
+        if (LOAD_SC(&_async_waiting)) {
+            pthread_mutex_lock(&_async_lock);
+            pthread_cond_broadcast(&_async_space);
+            pthread_cond_broadcast(&_async_done_cond);
+            pthread_mutex_unlock(&_async_lock);
+        }
+    }
+
+    return total;
+}
+
+/* true if the queue has no operations */
+static bool _empty() {
+    return LOAD_SC(&_async_done) == LOAD_SC(&_async_pushed);
+}
+
+/* the writer thread */
+static void* _writer(void* arg) {
+    for (;;) {
+        pthread_mutex_lock(&_async_io_lock);
+        size_t n = _drain(64);     /* let sync producers in between batches */
+        pthread_mutex_unlock(&_async_io_lock);
+
+        if (n)
+            continue;
+
+        pthread_mutex_lock(&_async_lock);
+        STORE_SC(&_async_sleeping, 1);
+
+        while (_empty() && !_async_stopping)
+            pthread_cond_wait(&_async_cond, &_async_lock);
+
+        STORE_SC(&_async_sleeping, 0);
+        bool stop = _async_stopping && _empty();
+        pthread_mutex_unlock(&_async_lock);
+
+        if (stop)
+            return NULL;
+    }
+}
+
+/* queue op, applying backpressure if the queue is full */
+static bool _enqueue(async_op* op) {
+    if (!_pend(op)) {
+        free(op->data);
+        return false;
+    }
+
+    if (!_push(op)) {
+        if (_async_bp == OSTORE_BP_SYNC) {
+            pthread_mutex_lock(&_async_io_lock);
+            (void) _drain(0);
+
+            ostore_op o = { op->op, op->id, op->type, op->data, op->len, 
+                NULL, 0 };
+            bool ok = _ostore_apply(&o, 1) == 0 && _sync_commit(1);
+            _unpend(op, 1);
+            pthread_mutex_unlock(&_async_io_lock);
+            free(op->data);
+
+            return ok;
+        }
+
+        pthread_mutex_lock(&_async_lock);
+        __atomic_add_fetch(&_async_waiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);    /* pairs with _drain */
+
+        while (!_push(op))
+            pthread_cond_wait(&_async_space, &_async_lock);
+
+        __atomic_sub_fetch(&_async_waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&_async_lock);
+    }
+
+    __atomic_add_fetch(&_async_pushed, 1, __ATOMIC_SEQ_CST);
+    _stats_queue(_async_depth());
+
+    if (LOAD_SC(&_async_sleeping)) {
+        pthread_mutex_lock(&_async_lock);
+        pthread_cond_signal(&_async_cond);
+        pthread_mutex_unlock(&_async_lock);
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _async_open(const ostore_opts* opts) {
+    size_t size = ASYNC_DEFAULT_QUEUE_SIZE;
+
+    if (opts->async_queue_size)
+        for (size = 2; size < opts->async_queue_size; size <<= 1)
+            ;
+
+    _async_queue = (async_cell*) malloc(size * sizeof(async_cell));
+
+    if (!_async_queue || !(_async_index = create_idmap())) {
+        free(_async_queue);
+        _async_queue = NULL;
+        return false;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        _async_queue[i].seq = i;
+
+    _async_mask = size - 1;
+    _async_enq_pos = _async_deq_pos = 0;
+    _async_pushed = _async_done = 0;
+    _async_bp = opts->async_backpressure;
+    _async_err = 0;
+    _async_stopping = false;
+
+    int err = pthread_create(&_async_writer, NULL, _writer, NULL);
+
+    if (err) {
+        free(_async_queue);
+        _async_queue = NULL;
+        delete_idmap(&_async_index);
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+void _async_close() {
+    if (!_async_queue)
+        return;
+
+    pthread_mutex_lock(&_async_lock);
+    _async_stopping = true;
+    pthread_cond_signal(&_async_cond);
+    pthread_mutex_unlock(&_async_lock);
+
+    pthread_join(_async_writer, NULL);
+
+    free(_async_queue);
+    _async_queue = NULL;
+    delete_idmap(&_async_index);
+}
+
+/* see ostore_impl.h */
+bool _async_store(const char* type, uintptr_t id, const char* data,
+    size_t len) {
+    async_op op;
+
+    memset(&op, 0, sizeof(op));
+    op.op = OSTORE_OP_STORE;
+    op.id = id;
+
+    if (!(op.data = (char*) malloc(len + 1)))
+        return false;
+
+    memcpy(op.data, data, len);
+    op.data[len] = '\0';
+    op.len = len;
+    strncpy(op.type, type, OSTORE_TYPE_MAX);
+
+    return _enqueue(&op);
+}
+
+/* see ostore_impl.h */
+bool _async_unlink(const char* type, uintptr_t id) {
+    async_op op;
+
+    memset(&op, 0, sizeof(op));
+    op.op = OSTORE_OP_UNLINK;
+    op.id = id;
+
+    strncpy(op.type, type, OSTORE_TYPE_MAX);
+
+    return _enqueue(&op);
+}
+
+/* see ostore_impl.h */
+bool _async_lookup(const char* type, uintptr_t id, char** data, size_t* len) {
+    if (!_async_queue)
+        return false;
+
+    pthread_mutex_lock(&_async_pend_lock);
+
+    async_pend* p = (async_pend*) get_identry(_async_index, id);
+
+    if (p && strcmp(p->type, type)) {
+        /* earlier operations on this object may still be queued */
+        pthread_mutex_unlock(&_async_pend_lock);
+        (void) _async_flush();
+        return false;
+    }
+
+    if (p && p->op == OSTORE_OP_UNLINK) {
+        *data = NULL;
+        errno = ENOENT;
+    } else if (p && (*data = (char*) malloc(p->len + 1))) {
+        memcpy(*data, p->data, p->len + 1);
+        *len = p->len;
+    }
+
+    pthread_mutex_unlock(&_async_pend_lock);
+
+    return p != NULL;
+}
+
+/* see ostore_impl.h */
+size_t _async_depth() {
+    if (!_async_queue)
+        return 0;
+
+    /* the writer may count an operation done before its push is counted */
+    size_t done = LOAD_SC(&_async_done);
+    size_t pushed = LOAD_SC(&_async_pushed);
+
+    return pushed > done ? pushed - done : 0;
+}
+
+/* see ostore_impl.h */
+bool _async_flush() {
+    /* 
+     * every operation queued before the call holds a position below this
+     * one, even if its producer has not counted it in _async_pushed yet;
+     * positions are applied in order and counted in _async_done
+     */
+    size_t target = LOAD_SC(&_async_enq_pos);
+
+    pthread_mutex_lock(&_async_lock);
+    __atomic_add_fetch(&_async_waiting, 1, __ATOMIC_SEQ_CST);
+
+    while (LOAD_SC(&_async_done) < target)
+        pthread_cond_wait(&_async_done_cond, &_async_lock);
+
+    __atomic_sub_fetch(&_async_waiting, 1, __ATOMIC_SEQ_CST);
+
+    int err = _async_err;
+    _async_err = 0;
+    pthread_mutex_unlock(&_async_lock);
+
+    if (err) {
+        errno = err;
+        return false;
+    }
+
+    return true;
+}
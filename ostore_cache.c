@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "ostore_impl.h"
+
+/*
+ * LRU cache of value strings of the object store (see load_obj in
+ * obj_store.h and ostore_opts.cache_size).
+ *
+ * Entries are kept in a chained hash table by type and id and in a list in
+ * order of use, most recent first. store_obj puts the value it stores,
+ * load_obj the value it reads from the backend, and either moves the entry
+ * to the front; when there are more than the configured number of entries
+ * the least recently used is evicted. unlink_obj drops the entry of the
+ * object.
+ *
+ * A value read from the backend may be older than a store made while it
+ * was being read. Every put and drop advances a generation, and a read
+ * value is only filled in if the generation is still the one taken before
+ * the read (_cache_fill), so the cache never goes back to an older value.
+ *
+ * All state is protected by _cache_lock.
+ */
+
+/* an entry of the cache */
+typedef struct cache_ent {
+    struct cache_ent* chain;    /* next in the hash bucket */
+    struct cache_ent* prev;     /* more recently used */
+    struct cache_ent* next;     /* less recently used */
+    uintptr_t id;
+    char type[OSTORE_TYPE_MAX + 1];
+    char* val;
+    size_t len;
+} cache_ent;
+
+static pthread_mutex_t _cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t _cache_cap = 0;           /* maximum entries, 0 if off */
+static size_t _cache_n = 0;
+static cache_ent** _cache_buckets = NULL;
+static size_t _cache_nbuckets = 0;      /* a power of 2 */
+static cache_ent* _cache_head = NULL;   /* most recently used */
+static cache_ent* _cache_tail = NULL;
+static uint64_t _cache_gen_no = 0;
+static uint64_t _cache_hits = 0;
+static uint64_t _cache_misses = 0;
+
+/* the bucket of the object type/id */
+static cache_ent** _bucket(const char* type, uintptr_t id) {
+    uint64_t h = (uint64_t) id * 0x9e3779b97f4a7c15u;
+
+    for (const char* c = type; *c; c++)
+        h = (h ^ (unsigned char) *c) * 0x100000001b3u;
+
+    return &_cache_buckets[(h >> 32) & (_cache_nbuckets - 1)];
+}
+
+/* the entry of type/id, or NULL. Called with _cache_lock held. */
+static cache_ent* _find(const char* type, uintptr_t id) {
+    if (!_cache_buckets)
+        return NULL;
+
+    for (cache_ent* e = *_bucket(type, id); e; e = e->chain)
+        if (e->id == id && !strcmp(e->type, type))
+            return e;
+
+    return NULL;
+}
+
+/* take e out of the list of use. Called with _cache_lock held. */
+static void _unlist(cache_ent* e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        _cache_head = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        _cache_tail = e->prev;
+}
+
+/* put e at the front of the list of use. Called with _cache_lock held. */
+static void _front(cache_ent* e) {
+    e->prev = NULL;
+    e->next = _cache_head;
+
+    if (_cache_head)
+        _cache_head->prev = e;
+    else
+        _cache_tail = e;
+
+    _cache_head = e;
+}
+
+/* remove and free e. Called with _cache_lock held. */
+static void _evict(cache_ent* e) {
+    cache_ent** p = _bucket(e->type, e->id);
+
+    while (*p != e)
+        p = &(*p)->chain;
+
+    *p = e->chain;
+    _unlist(e);
+    _cache_n--;
+    free(e->val);
+    free(e);
+}
+
+/*
+ * set the value of type/id to the n buffers of iov, len bytes in all,
+ * adding or moving its entry to the front. Called with _cache_lock held.
+ */
+static void _set(const char* type, uintptr_t id, const struct iovec* iov,
+    int n, size_t len) {
+    cache_ent* e = _find(type, id);
+    char* copy = (char*) malloc(len + 1);
+
+    /* the table is allocated by the first value */
+    if (!_cache_buckets && !(_cache_buckets = 
+        (cache_ent**) calloc(_cache_nbuckets, sizeof(cache_ent*)))) {
+        free(copy);
+        return;
+    }
+
+    if (!copy) {
+        if (e)
+            _evict(e);      /* better no value than an old one */
+        return;
+    }
+
+    for (size_t at = 0; n > 0; iov++, n--) {
+        if (iov->iov_len)
+            memcpy(copy + at, iov->iov_base, iov->iov_len);
+        at += iov->iov_len;
+    }
+
+    copy[len] = '\0';
+
+    if (e) {
+        free(e->val);
+        _unlist(e);
+    } else if ((e = (cache_ent*) malloc(sizeof(cache_ent)))) {
+        cache_ent** b = _bucket(type, id);
+
+        strncpy(e->type, type, OSTORE_TYPE_MAX);
+        e->type[OSTORE_TYPE_MAX] = '\0';
+        e->id = id;
+        e->chain = *b;
+        *b = e;
+        _cache_n++;
+    } else {
+        free(copy);
+        return;
+    }
+
+    e->val = copy;
+    e->len = len;
+    _front(e);
+
+    while (_cache_n > _cache_cap)
+        _evict(_cache_tail);
+}
+
+/* see ostore_impl.h */
+void _cache_open(const ostore_opts* opts) {
+    size_t cap = opts ? opts->cache_size : 0;
+    size_t nb = 16;
+
+    while (nb < cap && nb < ((size_t) 1 << 30))
+        nb *= 2;
+
+    pthread_mutex_lock(&_cache_lock);
+    _cache_hits = _cache_misses = 0;
+    _cache_nbuckets = nb;
+    _cache_cap = cap;
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+void _cache_close() {
+    _cache_clear();
+
+    pthread_mutex_lock(&_cache_lock);
+    free(_cache_buckets);
+    _cache_buckets = NULL;
+    _cache_nbuckets = 0;
+    _cache_cap = 0;
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+void _cache_clear() {
+    pthread_mutex_lock(&_cache_lock);
+
+    while (_cache_tail)
+        _evict(_cache_tail);
+
+    _cache_gen_no++;
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+ssize_t _cache_get(const char* type, uintptr_t id, char* buf, size_t size) {
+    ssize_t len = -1;
+
+    pthread_mutex_lock(&_cache_lock);
+
+    cache_ent* e = _cache_cap ? _find(type, id) : NULL;
+
+    if (e) {
+        _unlist(e);
+        _front(e);
+        len = (ssize_t) e->len;
+
+        if (e->len < size)
+            memcpy(buf, e->val, e->len + 1);
+
+        _cache_hits++;
+    } else {
+        _cache_misses++;
+    }
+
+    pthread_mutex_unlock(&_cache_lock);
+
+    return len;
+}
+
+/* see ostore_impl.h */
+void _cache_put(const char* type, uintptr_t id, const char* val,
+    size_t len, uint64_t gen) {
+    struct iovec iov = { (void*) val, len };
+
+    _cache_putv(type, id, &iov, 1, len, gen);
+}
+
+/* see ostore_impl.h */
+void _cache_putv(const char* type, uintptr_t id, const struct iovec* iov,
+    int n, size_t len, uint64_t gen) {
+    if (!_cache_cap)
+        return;     /* set before any store, no lock on the hot path */
+
+    pthread_mutex_lock(&_cache_lock);
+
+    /* a concurrent store may have applied its value after this one */
+    cache_ent* e;
+
+    if (gen == _cache_gen_no)
+        _set(type, id, iov, n, len);
+    else if ((e = _find(type, id)))
+        _evict(e);
+
+    _cache_gen_no++;
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+bool _cache_on() {
+    return _cache_cap > 0;  /* set before any store, as in _cache_putv */
+}
+
+/* see ostore_impl.h */
+void _cache_drop(const char* type, uintptr_t id) {
+    if (!_cache_cap)
+        return;
+
+    pthread_mutex_lock(&_cache_lock);
+
+    cache_ent* e = _find(type, id);
+
+    if (e)
+        _evict(e);
+
+    _cache_gen_no++;
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+uint64_t _cache_gen() {
+    if (!_cache_cap)
+        return 0;
+
+    pthread_mutex_lock(&_cache_lock);
+    uint64_t gen = _cache_gen_no;
+    pthread_mutex_unlock(&_cache_lock);
+
+    return gen;
+}
+
+/* see ostore_impl.h */
+void _cache_fill(const char* type, uintptr_t id, const char* val,
+    size_t len, uint64_t gen) {
+    struct iovec iov = { (void*) val, len };
+
+    pthread_mutex_lock(&_cache_lock);
+
+    if (_cache_cap && gen == _cache_gen_no)
+        _set(type, id, &iov, 1, len);
+
+    pthread_mutex_unlock(&_cache_lock);
+}
+
+/* see ostore_impl.h */
+void _cache_stats(uint64_t* hits, uint64_t* misses) {
+    pthread_mutex_lock(&_cache_lock);
+    *hits = _cache_hits;
+    *misses = _cache_misses;
+    pthread_mutex_unlock(&_cache_lock);
+}
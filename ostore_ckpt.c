@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "ostore_impl.h"
+
+/*
+ * Checkpoints (see checkpoint_ostore in obj_store.h).
+ *
+ * A snapshot file is:
+ *
+ *      header      CKPT_MAGIC (8 bytes), the number of objects (8), the
+ *                  offset of the index (8), the number of types (4) and
+ *                  the CRC32C of the preceding 28 bytes (4)
+ *      records     a binary record (see ostore_rec.c) of each object
+ *      index       per type: the length of its name (1), the name, the
+ *                  number of its objects (8) and for each of them, in
+ *                  order of id, the id (8) and the offset of its record (8)
+ *      crc         CRC32C of the index (4)
+ *
+ * Integers are little-endian. The snapshot is written to <path>.tmp, synced
+ * and renamed to path, so a reader sees either the previous snapshot or the
+ * complete new one. In the background a forked child process writes the
+ * snapshot from its copy-on-write image of the parent's memory, so the
+ * objects are as they were at the fork however the application changes
+ * them meanwhile.
+ */
+
+#define CKPT_MAGIC "OSCKPT01"
+#define CKPT_HDR_SIZE 32
+#define CKPT_WBUF 65536
+
+/* the index entry of an object */
+typedef struct ckpt_ent {
+    uint64_t id;
+    uint64_t off;
+} ckpt_ent;
+
+/* the state of a checkpoint being written */
+typedef struct ckpt_writer {
+    int fd;
+    const char* type;       /* of the source being walked */
+    ckpt_ent* ents;         /* of the source being walked */
+    size_t nents;
+    size_t cap;
+    uint64_t off;           /* offset of the next record */
+    char* buf;              /* write buffer */
+    size_t blen;
+    int err;                /* errno of the first failure */
+} ckpt_writer;
+
+static pid_t _ckpt_child = 0;   /* of a background checkpoint */
+
+/* write len bytes of data through the buffer of w */
+static void _put(ckpt_writer* w, const void* data, size_t len) {
+    if (w->err)
+        return;
+
+    if (w->blen + len > CKPT_WBUF) {
+        if (write(w->fd, w->buf, w->blen) != (ssize_t) w->blen) {
+            w->err = errno ? errno : EIO;
+            return;
+        }
+
+        w->blen = 0;
+    }
+
+    if (len > CKPT_WBUF) {
+        if (write(w->fd, data, len) != (ssize_t) len)
+            w->err = errno ? errno : EIO;
+        return;
+    }
+
+    memcpy(w->buf + w->blen, data, len);
+    w->blen += len;
+}
+
+/* write v as n little-endian bytes at p */
+static void _put_le(char* p, uint64_t v, int n) {
+    for (int i = 0; i < n; i++)
+        p[i] = (char) (v >> (8 * i));
+}
+
+/* the n little-endian bytes at p */
+static uint64_t _get_le(const char* p, int n) {
+    uint64_t v = 0;
+
+    for (int i = 0; i < n; i++)
+        v |= (uint64_t) (unsigned char) p[i] << (8 * i);
+
+    return v;
+}
+
+/* append the record of an object (ostore_emit_fn) */
+static void _emit(uintptr_t id, const char* valstr, void* ctx) {
+    ckpt_writer* w = (ckpt_writer*) ctx;
+    size_t len = strlen(valstr);
+    char stack[1024 + OSTORE_REC_OVERHEAD];
+
+    if (w->err)
+        return;
+
+    if (w->nents == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 1024;
+        ckpt_ent* ents = (ckpt_ent*) realloc(w->ents,
+            cap * sizeof(ckpt_ent));
+
+        if (!ents) {
+            w->err = ENOMEM;
+            return;
+        }
+
+        w->ents = ents;
+        w->cap = cap;
+    }
+
+    char* rec = len + OSTORE_REC_OVERHEAD <= sizeof(stack) ? stack
+        : (char*) malloc(len + OSTORE_REC_OVERHEAD);
+
+    if (!rec) {
+        w->err = ENOMEM;
+        return;
+    }
+
+    size_t rlen = _rec_encode(rec, w->type, id, valstr, len);
+
+    w->ents[w->nents].id = id;
+    w->ents[w->nents++].off = w->off;
+    w->off += rlen;
+    _put(w, rec, rlen);
+
+    if (rec != stack)
+        free(rec);
+}
+
+static int _cmp_ent(const void* a, const void* b) {
+    uint64_t x = ((const ckpt_ent*) a)->id, y = ((const ckpt_ent*) b)->id;
+
+    return x < y ? -1 : x > y;
+}
+
+/* fsync the directory of path, so that a rename into it is durable */
+static bool _sync_dir(const char* path) {
+    char* copy = strdup(path);
+
+    if (!copy)
+        return false;
+
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    bool ok = fd >= 0 && fsync(fd) == 0;
+
+    if (fd >= 0)
+        close(fd);
+
+    free(copy);
+
+    return ok;
+}
+
+/* write the snapshot of the objects of srcs[0..n) to path */
+static bool _write(const char* path, const ostore_ckpt_source* srcs,
+    size_t n) {
+    ckpt_writer w;
+    char hdr[CKPT_HDR_SIZE];
+    char* tmp = NULL;
+    char** index = (char**) calloc(n ? n : 1, sizeof(char*));
+    size_t* ilens = (size_t*) calloc(n ? n : 1, sizeof(size_t));
+    uint64_t nobjs = 0;
+
+    memset(&w, 0, sizeof(w));
+    w.fd = -1;
+
+    if (!index || !ilens || asprintf(&tmp, "%s.tmp", path) < 0
+        || !(w.buf = (char*) malloc(CKPT_WBUF))) {
+        free(index);
+        free(ilens);
+        free(tmp);
+        return false;
+    }
+
+    if ((w.fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0)
+        w.err = errno;
+
+    memset(hdr, 0, sizeof(hdr));
+    _put(&w, hdr, sizeof(hdr));     /* written again at the end */
+    w.off = CKPT_HDR_SIZE;
+
+    /* the records, collecting the index of each type */
+    for (size_t i = 0; !w.err && i < n; i++) {
+        size_t tlen = strlen(srcs[i].type);
+
+        w.type = srcs[i].type;
+        w.nents = 0;
+        srcs[i].walk(_emit, &w);
+
+        if (w.err || !(index[i] = (char*) malloc(1 + tlen + 8
+            + w.nents * 16))) {
+            w.err = w.err ? w.err : ENOMEM;
+            break;
+        }
+
+        char* p = index[i];
+
+        qsort(w.ents, w.nents, sizeof(ckpt_ent), _cmp_ent);
+        *p++ = (char) tlen;
+        memcpy(p, srcs[i].type, tlen);
+        p += tlen;
+        _put_le(p, w.nents, 8);
+        p += 8;
+
+        for (size_t j = 0; j < w.nents; j++, p += 16) {
+            _put_le(p, w.ents[j].id, 8);
+            _put_le(p + 8, w.ents[j].off, 8);
+        }
+
+        ilens[i] = p - index[i];
+        nobjs += w.nents;
+    }
+
+    uint64_t index_off = w.off;
+    uint32_t crc = 0;
+    char crcbuf[4];
+
+    for (size_t i = 0; !w.err && i < n; i++) {
+        _put(&w, index[i], ilens[i]);
+        crc = _crc32c(crc, index[i], ilens[i]);
+    }
+
+    _put_le(crcbuf, crc, 4);
+    _put(&w, crcbuf, 4);
+
+    if (!w.err && w.blen
+        && write(w.fd, w.buf, w.blen) != (ssize_t) w.blen)
+        w.err = errno ? errno : EIO;
+
+    /* the header, now that the index is in place */
+    memcpy(hdr, CKPT_MAGIC, 8);
+    _put_le(hdr + 8, nobjs, 8);
+    _put_le(hdr + 16, index_off, 8);
+    _put_le(hdr + 24, n, 4);
+    _put_le(hdr + 28, _crc32c(0, hdr, 28), 4);
+
+    if (!w.err && (pwrite(w.fd, hdr, sizeof(hdr), 0) != sizeof(hdr)
+        || fsync(w.fd)))
+        w.err = errno ? errno : EIO;
+
+    if (w.fd >= 0 && close(w.fd) && !w.err)
+        w.err = errno;
+
+    if (!w.err && (rename(tmp, path) || !_sync_dir(path)))
+        w.err = errno;
+
+    if (w.err)
+        (void) unlink(tmp);
+
+    for (size_t i = 0; i < n; i++)
+        free(index[i]);
+
+    free(index);
+    free(ilens);
+    free(w.ents);
+    free(w.buf);
+    free(tmp);
+    errno = w.err;
+
+    return !w.err;
+}
+
+/* see ostore_impl.h */
+bool _ckpt_write(const char* path, const ostore_ckpt_source* srcs, size_t n,
+    bool background) {
+    if (_ckpt_child) {
+        errno = EBUSY;
+        return false;
+    }
+
+    if (!background)
+        return _write(path, srcs, n);
+
+    /* the CRC tables must not be built by the child */
+    (void) _crc32c(0, NULL, 0);
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return false;
+
+    if (pid == 0) {
+        bool ok = _write(path, srcs, n);
+        _exit(ok ? 0 : (errno ? errno : EIO) & 0xff);
+    }
+
+    _ckpt_child = pid;
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _ckpt_wait() {
+    int status;
+
+    if (!_ckpt_child)
+        return true;
+
+    while (waitpid(_ckpt_child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            _ckpt_child = 0;
+            return false;
+        }
+    }
+
+    _ckpt_child = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return true;
+
+    errno = WIFEXITED(status) ? WEXITSTATUS(status) : EINTR;
+
+    return false;
+}
+
+/* the loader of type in loaders[0..n), or NULL */
+static const ostore_loader* _loader(const ostore_loader* loaders, size_t n,
+    const char* type, size_t tlen) {
+    for (size_t i = 0; i < n; i++)
+        if (strlen(loaders[i].type) == tlen
+            && !memcmp(loaders[i].type, type, tlen))
+            return &loaders[i];
+
+    return NULL;
+}
+
+/* see ostore_impl.h */
+bool _ckpt_read(const char* path, const ostore_loader* loaders, size_t n,
+    idmap** objs) {
+    struct stat sbuf;
+    int fd = open(path, O_RDONLY);
+    int err = 0;
+
+    if (fd < 0)
+        return false;
+
+    char* buf = fstat(fd, &sbuf) ? NULL : (char*) malloc(sbuf.st_size + 1);
+    ssize_t size = buf ? read(fd, buf, sbuf.st_size) : -1;
+
+    close(fd);
+
+    if (size != (ssize_t) sbuf.st_size) {
+        if (size >= 0)
+            errno = EIO;
+        free(buf);
+        return false;
+    }
+
+    uint64_t index_off = size >= CKPT_HDR_SIZE
+        ? _get_le(buf + 16, 8) : 0;
+
+    if (size < CKPT_HDR_SIZE + 4 || memcmp(buf, CKPT_MAGIC, 8)
+        || _get_le(buf + 28, 4) != _crc32c(0, buf, 28)
+        || index_off < CKPT_HDR_SIZE || index_off > (uint64_t) size - 4
+        || _get_le(buf + size - 4, 4)
+            != _crc32c(0, buf + index_off, size - 4 - index_off)) {
+        free(buf);
+        errno = EBADMSG;
+        return false;
+    }
+
+    if (!(*objs = create_idmap())) {
+        free(buf);
+        return false;
+    }
+
+    const char* p = buf + index_off;
+    const char* end = buf + size - 4;
+    uint32_t ntypes = (uint32_t) _get_le(buf + 24, 4);
+
+    for (uint32_t t = 0; !err && t < ntypes; t++) {
+        size_t tlen = p < end ? (unsigned char) *p : 0;
+
+        if (!tlen || (size_t) (end - p) < 1 + tlen + 8) {
+            err = EBADMSG;
+            break;
+        }
+
+        const char* type = p + 1;
+        uint64_t count = _get_le(type + tlen, 8);
+
+        p = type + tlen + 8;
+
+        if (count > (uint64_t) (end - p) / 16) {
+            err = EBADMSG;
+            break;
+        }
+
+        const ostore_loader* l = _loader(loaders, n, type, tlen);
+
+        for (uint64_t i = 0; l && !err && i < count; i++) {
+            uint64_t id = _get_le(p + 16 * i, 8);
+            uint64_t off = _get_le(p + 16 * i + 8, 8);
+            size_t rlen = off >= CKPT_HDR_SIZE && off < index_off 
+                ? _rec_length(buf + off, index_off - off) : 0;
+            ostore_rec rec;
+            size_t textlen;
+
+            if (!rlen || !_rec_decode(buf + off, rlen, &rec) 
+                || rec.id != id) {
+                err = EBADMSG;
+                break;
+            }
+
+            char* text = _rec_text(&rec, &textlen);
+
+            if (!text) {
+                err = errno;
+                break;
+            }
+
+            errno = 0;
+            void* obj = l->parse(text, l->arg);
+
+            if (!obj || !set_identry(*objs, (uintptr_t) id, obj))
+                err = errno ? errno : EINVAL;
+
+            free(text);
+        }
+
+        p += 16 * count;
+    }
+
+    free(buf);
+    errno = err;
+
+    return !err;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ostore_impl.h"
+
+/*
+ * Content-addressed deduplication of object files (see ostore_opts.dedup).
+ *
+ * A value is written once, as a blob file named by a hash of its bytes in
+ * the .blobs directory of the type directory. The object file of each
+ * object with that value is a hard link to the blob, so storing a
+ * duplicate value is a single linkat and the object files read exactly as
+ * without deduplication. The reference count of a blob is the link count
+ * of its inode less one (the blob's own name): unlinking an object whose
+ * file has the last other link also removes the blob.
+ *
+ * A blob is named by a 64-bit FNV-1a hash, the CRC32C and the length of
+ * the value, and is not compared byte by byte before it is linked.
+ *
+ * Object files are never written in place, as that would change every
+ * object linked to the same blob: an object stored with a new value has
+ * its file replaced by renaming a new link over it. If two threads write
+ * the same new blob at once, one of them keeps its own copy, which costs
+ * space but not correctness. A blob that is removed while it is being
+ * linked is written again by the next store of its value.
+ */
+
+#define BLOB_DIR ".blobs"
+#define BLOB_NAME_MAX 80
+
+/* set name to the path of the blob of data[0..len) relative to the type dir */
+static void _blob_name(char* name, const char* data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) data[i]) * 0x100000001b3u;
+
+    snprintf(name, BLOB_NAME_MAX, "%s/%016llx%08x-%zx.blob", BLOB_DIR,
+        (unsigned long long) h, (unsigned) _crc32c(0, data, len), len);
+}
+
+/* write the blob of data[0..len) of the object id */
+static bool _write_blob(int dfd, const char* blob, uintptr_t id,
+    const char* data, size_t len) {
+    char tmp[BLOB_NAME_MAX];
+
+    if (mkdirat(dfd, BLOB_DIR, 0755) && errno != EEXIST)
+        return false;
+
+    /* the id makes the temporary name unique among concurrent stores */
+    snprintf(tmp, sizeof(tmp), "%s/%#zx.tmp", BLOB_DIR, id);
+
+    int fd = openat(dfd, tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+
+    _stats_sys(fd < 0 ? 2 : 6);     /* with the write, link and unlink */
+
+    if (fd < 0)
+        return false;
+
+    ssize_t w = write(fd, data, len);
+
+    if (w >= 0 && w != (ssize_t) len)
+        errno = EIO;
+
+    bool ok = w == (ssize_t) len;
+
+    if (close(fd))
+        ok = false;
+
+    /* another store may have written the same blob meanwhile */
+    ok = ok && (linkat(dfd, tmp, dfd, blob, 0) == 0 || errno == EEXIST);
+
+    int err = errno;
+
+    (void) unlinkat(dfd, tmp, 0);
+    errno = err;
+
+    return ok;
+}
+
+/*
+ * the blob of the object file name and its inode, if the file is linked to
+ * a blob that no other object file shares (blob set to "" otherwise)
+ */
+static void _sole_blob(int dfd, const char* name, char* blob, ino_t* ino) {
+    struct stat sbuf;
+    char stack[1024];
+
+    blob[0] = '\0';
+
+    int fd = openat(dfd, name, O_RDONLY);
+
+    _stats_sys(fd < 0 ? 1 : 4);     /* with the stat, read and close */
+
+    if (fd < 0)
+        return;
+
+    if (!fstat(fd, &sbuf) && sbuf.st_nlink == 2) {
+        char* buf = sbuf.st_size <= (off_t) sizeof(stack) ? stack
+            : (char*) malloc(sbuf.st_size);
+        ssize_t len = buf ? read(fd, buf, sbuf.st_size) : -1;
+
+        if (len == (ssize_t) sbuf.st_size) {
+            _blob_name(blob, buf, len);
+            *ino = sbuf.st_ino;
+        }
+
+        if (buf != stack)
+            free(buf);
+    }
+
+    close(fd);
+}
+
+/* remove the blob if it is still the inode ino and has no object files */
+static void _release_blob(int dfd, const char* blob, ino_t ino) {
+    struct stat sbuf;
+
+    if (blob[0] && !fstatat(dfd, blob, &sbuf, 0) && sbuf.st_ino == ino
+        && sbuf.st_nlink == 1)
+        (void) unlinkat(dfd, blob, 0);
+}
+
+/* see ostore_impl.h */
+bool _dedup_store(int dfd, const char* name, uintptr_t id, const char* data,
+    size_t len) {
+    char blob[BLOB_NAME_MAX];
+    char old[BLOB_NAME_MAX];
+    char tmp[OSTORE_NAME_MAX + 4];
+    ino_t ino = 0;
+
+    _blob_name(blob, data, len);
+
+    for (int tries = 0; tries < 2; tries++) {
+        _stats_sys(1);
+
+        if (linkat(dfd, blob, dfd, name, 0) == 0)
+            return true;
+
+        if (errno == EEXIST) {
+            struct stat nbuf, bbuf;
+
+            /* already linked to the blob (rename would do nothing) */
+            if (!fstatat(dfd, name, &nbuf, 0) && !fstatat(dfd, blob, &bbuf, 0)
+                && nbuf.st_ino == bbuf.st_ino && nbuf.st_dev == bbuf.st_dev)
+                return true;
+
+            /* a stored object: replace its file with a new link */
+            _sole_blob(dfd, name, old, &ino);
+            snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+            (void) unlinkat(dfd, tmp, 0);
+
+            if (linkat(dfd, blob, dfd, tmp, 0) == 0) {
+                if (renameat(dfd, tmp, dfd, name)) {
+                    int err = errno;
+                    (void) unlinkat(dfd, tmp, 0);
+                    errno = err;
+                    return false;
+                }
+
+                if (strcmp(old, blob))
+                    _release_blob(dfd, old, ino);
+
+                return true;
+            }
+        }
+
+        if (errno != ENOENT || !_write_blob(dfd, blob, id, data, len))
+            return false;
+    }
+
+    errno = EIO;    /* the blob was removed again */
+
+    return false;
+}
+
+/* see ostore_impl.h */
+bool _dedup_unlink(int dfd, const char* name) {
+    char blob[BLOB_NAME_MAX];
+    ino_t ino = 0;
+
+    _sole_blob(dfd, name, blob, &ino);
+
+    _stats_sys(1);
+
+    if (unlinkat(dfd, name, 0) && errno != ENOENT)
+        return false;
+
+    _release_blob(dfd, blob, ino);
+
+    return true;
+}
@@ -0,0 +1,482 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "id_map.h"
+#include "ostore_impl.h"
+
+/*
+ * Deferred persistence of the object store: a nursery of new objects.
+ *
+ * A store is held in memory as a pending entry for the deferral window
+ * (ostore_opts.defer_ms), or until defer_count newer objects have been
+ * stored after it, whichever comes first, before it is passed on to the
+ * backend (or, in async mode, to the writer queue). An unlink of an object
+ * with a pending store drops the entry: the pair is cancelled and no I/O
+ * happens, unless an earlier store of the object was already persisted, in
+ * which case that one is unlinked. Another store of a pending object
+ * replaces the value of its entry and keeps its deadline, so no store is
+ * held for longer than the window.
+ *
+ * Pending entries are kept in an id map (by object id) and in a list in the
+ * order they were stored, which is also the order of their deadlines and
+ * sequence numbers. A ticker thread persists the entries whose deadline has
+ * passed, as one batch (see _sync_commit); there is no ticker without a
+ * window. The storing thread persists the entries that defer_count newer
+ * ones have followed and, if there are more than DEFER_MAX_PENDING
+ * entries, the oldest without waiting for their deadline.
+ *
+ * Each persisted entry is counted by why it was promoted out of the
+ * nursery (its age, the count or a flush) and each cancelled one by its
+ * age, for tuning the window (see ostore_defer_stats).
+ *
+ * The ids of persisted objects are kept in a second id map, so that a
+ * cancelled unlink knows whether there is an earlier store to remove.
+ * Objects stored before the store was enabled are not known to it.
+ *
+ * Batches are persisted one at a time (_defer_io_lock). While a batch is
+ * being persisted (_defer_busy), an unlink that is not cancelled waits for
+ * it, so it is never applied before a store of the same object that was
+ * made before it. A load of an object with a pending store is served from
+ * its entry (see _defer_lookup), and waits for a batch in the same way.
+ */
+
+#define DEFER_MAX_PENDING 65536
+#define DEFER_BATCH 64      /* entries persisted with one _ostore_apply */
+
+/* a pending store */
+typedef struct defer_entry {
+    struct defer_entry* prev;
+    struct defer_entry* next;
+    uintptr_t id;
+    char type[OSTORE_TYPE_MAX + 1];
+    char* data;
+    size_t len;
+    uint64_t born;          /* CLOCK_MONOTONIC ns */
+    uint64_t deadline;      /* UINT64_MAX if there is no window */
+    uint64_t seq;           /* number of entries created before */
+} defer_entry;
+
+static pthread_mutex_t _defer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _defer_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _defer_tick = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _defer_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t _defer_ticker;
+static bool _defer_on = false;
+static bool _defer_stopping = false;
+static bool _defer_busy = false;        /* a batch is being persisted */
+static bool _defer_async = false;
+static bool _defer_ticking = false;     /* the ticker runs */
+
+static uint64_t _defer_window;          /* ns, 0 for none */
+static uint64_t _defer_count;           /* 0 for no limit */
+static uint64_t _defer_seq = 0;         /* entries created */
+static idmap* _defer_index = NULL;      /* id -> defer_entry* */
+static idmap* _defer_persisted = NULL;  /* ids of persisted objects */
+static defer_entry* _defer_head = NULL; /* oldest */
+static defer_entry* _defer_tail = NULL;
+static size_t _defer_npending = 0;
+
+static uint64_t _defer_cancelled = 0;
+static uint64_t _defer_stored = 0;
+static uint64_t _defer_aged = 0;
+static uint64_t _defer_counted = 0;
+static uint64_t _defer_death_ns = 0;    /* total age of cancelled entries */
+static int _defer_err = 0;              /* errno of first failed batch of
+                                         * the ticker */
+
+/* CLOCK_MONOTONIC in ns */
+static uint64_t _now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* unlink e from the list and the index. Called with _defer_lock held. */
+static void _remove(defer_entry* e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        _defer_head = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        _defer_tail = e->prev;
+
+    (void) delete_identry(_defer_index, e->id);
+    _defer_npending--;
+}
+
+static void _free_entry(defer_entry* e) {
+    free(e->data);
+    free(e);
+}
+
+/* true if defer_count entries followed e. Called with _defer_lock held. */
+static bool _counted_out(const defer_entry* e) {
+    return _defer_count && _defer_seq - e->seq > _defer_count;
+}
+
+/*
+ * apply the stores of the n entries es to the backend (or queue them) and
+ * free them, returns false with errno set if any failed
+ */
+static bool _persist(defer_entry** es, size_t n) {
+    ostore_op ops[DEFER_BATCH];
+    bool ok = true;
+    int err = 0;
+
+    for (size_t i = 0; i < n; i += DEFER_BATCH) {
+        size_t m = n - i < DEFER_BATCH ? n - i : DEFER_BATCH;
+
+        for (size_t j = 0; j < m; j++) {
+            defer_entry* e = es[i + j];
+
+            if (_defer_async) {
+                if (!_async_store(e->type, e->id, e->data, e->len)) {
+                    ok = false;
+                    err = err ? err : errno;
+                }
+            } else {
+                ops[j].op = OSTORE_OP_STORE;
+                ops[j].id = e->id;
+                ops[j].type = e->type;
+                ops[j].data = e->data;
+                ops[j].len = e->len;
+                ops[j].iov = NULL;
+            }
+        }
+
+        size_t failed = _defer_async ? 0 : _ostore_apply(ops, m);
+
+        if (failed) {
+            _stats_fail(errno, failed);
+            ok = false;
+            err = err ? err : errno;
+        }
+    }
+
+    if (n && !_defer_async && !_sync_commit(n)) {
+        ok = false;
+        err = err ? err : errno;
+    }
+
+    pthread_mutex_lock(&_defer_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        if (!set_identry(_defer_persisted, es[i]->id, (void*) 1)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+
+        _free_entry(es[i]);
+    }
+
+    _defer_stored += n;
+    pthread_mutex_unlock(&_defer_lock);
+
+    errno = err;
+
+    return ok;
+}
+
+/*
+ * persist the pending entries whose deadline is before until, and then the
+ * oldest while there are more than keep entries
+ */
+static bool _persist_upto(uint64_t until, size_t keep) {
+    bool ok = true;
+
+    pthread_mutex_lock(&_defer_io_lock);
+
+    for (;;) {
+        defer_entry* es[DEFER_BATCH];
+        size_t n = 0;
+        uint64_t now = _now();
+
+        pthread_mutex_lock(&_defer_lock);
+
+        while (n < DEFER_BATCH && _defer_head
+            && (_defer_head->deadline <= until || _defer_npending > keep
+            || _counted_out(_defer_head))) {
+            if (_defer_head->deadline <= now)
+                _defer_aged++;
+            else if (_counted_out(_defer_head))
+                _defer_counted++;
+
+            es[n] = _defer_head;
+            _remove(es[n++]);
+        }
+
+        _defer_busy = n > 0;
+        pthread_mutex_unlock(&_defer_lock);
+
+        if (!n)
+            break;
+
+        if (!_persist(es, n))
+            ok = false;
+
+        pthread_mutex_lock(&_defer_lock);
+        _defer_busy = false;
+        pthread_cond_broadcast(&_defer_idle);
+        pthread_mutex_unlock(&_defer_lock);
+    }
+
+    pthread_mutex_unlock(&_defer_io_lock);
+
+    return ok;
+}
+
+/* the ticker thread, persists entries as their deadlines pass */
+static void* _ticker(void* arg) {
+    struct timespec ts;
+
+    pthread_mutex_lock(&_defer_lock);
+
+    while (!_defer_stopping) {
+        uint64_t wake = _defer_head ? _defer_head->deadline
+            : _now() + _defer_window;
+        uint64_t now = _now();
+
+        if (wake > now) {
+            uint64_t wait = wake - now;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += wait / 1000000000u;
+            ts.tv_nsec += wait % 1000000000u;
+
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait(&_defer_tick, &_defer_lock, &ts);
+            continue;
+        }
+
+        pthread_mutex_unlock(&_defer_lock);
+        bool ok = _persist_upto(_now(), DEFER_MAX_PENDING);
+        int err = errno;
+        pthread_mutex_lock(&_defer_lock);
+
+        if (!ok && !_defer_err)
+            _defer_err = err ? err : EIO;
+    }
+
+    pthread_mutex_unlock(&_defer_lock);
+
+    return NULL;
+}
+
+/* see ostore_impl.h */
+bool _defer_open(const ostore_opts* opts) {
+    _defer_window = (uint64_t) opts->defer_ms * 1000000u;
+    _defer_count = opts->defer_count;
+    _defer_async = opts->async;
+    _defer_seq = 0;
+    _defer_cancelled = _defer_stored = 0;
+    _defer_aged = _defer_counted = _defer_death_ns = 0;
+    _defer_err = 0;
+    _defer_stopping = false;
+
+    if (!(_defer_index = create_idmap())
+        || !(_defer_persisted = create_idmap())) {
+        delete_idmap(&_defer_index);
+        return false;
+    }
+
+    int err = _defer_window 
+        ? pthread_create(&_defer_ticker, NULL, _ticker, NULL) : 0;
+
+    if (err) {
+        delete_idmap(&_defer_index);
+        delete_idmap(&_defer_persisted);
+        errno = err;
+        return false;
+    }
+
+    _defer_ticking = _defer_window > 0;
+    _defer_on = true;
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _defer_close() {
+    if (!_defer_on)
+        return true;
+
+    if (_defer_ticking) {
+        pthread_mutex_lock(&_defer_lock);
+        _defer_stopping = true;
+        pthread_cond_signal(&_defer_tick);
+        pthread_mutex_unlock(&_defer_lock);
+
+        pthread_join(_defer_ticker, NULL);
+        _defer_ticking = false;
+    }
+
+    bool ok = _persist_upto(UINT64_MAX, 0);
+
+    delete_idmap(&_defer_index);
+    delete_idmap(&_defer_persisted);
+    _defer_on = false;
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _defer_on_store(const char* type, uintptr_t id, const char* data,
+    size_t len) {
+    char* copy = (char*) malloc(len + 1);
+
+    if (!copy)
+        return false;
+
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+
+    pthread_mutex_lock(&_defer_lock);
+
+    defer_entry* e = (defer_entry*) get_identry(_defer_index, id);
+
+    if (e && !strcmp(e->type, type)) {
+        /* replace the pending value, keep the deadline */
+        free(e->data);
+        e->data = copy;
+        e->len = len;
+        pthread_mutex_unlock(&_defer_lock);
+
+        return true;
+    }
+
+    if (e) {
+        /* the id of an object of another type: persist that one first */
+        uint64_t deadline = e->deadline;
+
+        pthread_mutex_unlock(&_defer_lock);
+        free(copy);
+
+        return _persist_upto(deadline, DEFER_MAX_PENDING)
+            && _defer_on_store(type, id, data, len);
+    }
+
+    if (!(e = (defer_entry*) calloc(1, sizeof(defer_entry)))
+        || !set_identry(_defer_index, id, e)) {
+        pthread_mutex_unlock(&_defer_lock);
+        free(e);
+        free(copy);
+        return false;
+    }
+
+    e->id = id;
+    strncpy(e->type, type, OSTORE_TYPE_MAX);
+    e->data = copy;
+    e->len = len;
+    e->born = _now();
+    e->deadline = _defer_window ? e->born + _defer_window : UINT64_MAX;
+    e->seq = _defer_seq++;
+    e->prev = _defer_tail;
+
+    if (_defer_tail)
+        _defer_tail->next = e;
+    else
+        _defer_head = e;
+
+    _defer_tail = e;
+
+    bool full = ++_defer_npending > DEFER_MAX_PENDING
+        || _counted_out(_defer_head);
+
+    pthread_mutex_unlock(&_defer_lock);
+
+    return !full || _persist_upto(0, DEFER_MAX_PENDING);
+}
+
+/* see ostore_impl.h */
+bool _defer_on_unlink(const char* type, uintptr_t id) {
+    pthread_mutex_lock(&_defer_lock);
+
+    /* a store of the object may be on its way to the backend */
+    while (_defer_busy)
+        pthread_cond_wait(&_defer_idle, &_defer_lock);
+
+    defer_entry* e = (defer_entry*) get_identry(_defer_index, id);
+    bool persisted = delete_identry(_defer_persisted, id) != NULL;
+    bool cancelled = e && !strcmp(e->type, type);
+
+    if (cancelled) {
+        _defer_death_ns += _now() - e->born;
+        _remove(e);
+        _free_entry(e);
+        _defer_cancelled++;
+    }
+
+    pthread_mutex_unlock(&_defer_lock);
+
+    return cancelled && !persisted;
+}
+
+/* see ostore_impl.h */
+bool _defer_lookup(const char* type, uintptr_t id, char** data, size_t* len) {
+    if (!_defer_on)
+        return false;
+
+    pthread_mutex_lock(&_defer_lock);
+
+    /* the entries of a batch are in neither the nursery nor the backend */
+    while (_defer_busy)
+        pthread_cond_wait(&_defer_idle, &_defer_lock);
+
+    defer_entry* e = (defer_entry*) get_identry(_defer_index, id);
+    bool found = e && !strcmp(e->type, type);
+
+    if (found && (*data = (char*) malloc(e->len + 1))) {
+        memcpy(*data, e->data, e->len + 1);
+        *len = e->len;
+    }
+
+    pthread_mutex_unlock(&_defer_lock);
+
+    return found;
+}
+
+/* see ostore_impl.h */
+bool _defer_flush() {
+    if (!_defer_on)
+        return true;
+
+    bool ok = _persist_upto(UINT64_MAX, 0);
+
+    pthread_mutex_lock(&_defer_lock);
+    int err = ok ? _defer_err : errno;
+    _defer_err = 0;
+    pthread_mutex_unlock(&_defer_lock);
+
+    errno = err;
+
+    return !err;
+}
+
+/* see ostore_impl.h */
+void _defer_stats(ostore_defer_stats* stats) {
+    pthread_mutex_lock(&_defer_lock);
+    stats->cancelled = _defer_cancelled;
+    stats->persisted = _defer_stored;
+    stats->aged = _defer_aged;
+    stats->counted = _defer_counted;
+    stats->pending = _defer_npending;
+    stats->death_age_ns = _defer_death_ns;
+    pthread_mutex_unlock(&_defer_lock);
+
+    /* of the objects that left the nursery, the share that was written */
+    stats->survival = stats->persisted 
+        ? (double) stats->persisted / (stats->persisted + stats->cancelled)
+        : 0;
+}
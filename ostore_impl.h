@@ -0,0 +1,560 @@
+#ifndef _OSTORE_IMPL_H
+#define _OSTORE_IMPL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "obj_store.h"
+
+/*
+ * Internal declarations shared by the modules that implement the object 
+ * store (obj_store.c and the ostore_*.c files). This header is NOT part of
+ * the public interface of the object store; see obj_store.h for that.
+ */
+
+/* name of the object store directory, relative to the current directory */
+#define OSTORE_DIRNAME "ostore"
+
+/* maximum length of an object type name (e.g. "int" or "str") */
+#define OSTORE_TYPE_MAX 31
+
+/* 
+ * maximum number of types for which the store keeps per-type state (open
+ * directories of the files backend, segments of the log backend)
+ */
+#define OSTORE_MAX_TYPES 16
+
+/* maximum length of a path of a file in the object store */
+#define OSTORE_PATH_MAX 256
+
+/* 
+ * _create_ostore_dir helper function (see obj_store.c): creates the ostore 
+ * directory (typedir NULL) or the ostore/<typedir> directory if it does not
+ * already exist.
+ */
+bool _create_ostore_dir(const char* typedir);
+
+/* 
+ * _valid_type helper function (see obj_store.c): true if type can be used as
+ * the name of a type directory in the store (non-empty, no more than 
+ * OSTORE_TYPE_MAX characters, no '/' and not "." or "..").
+ */
+bool _valid_type(const char* type);
+
+/* maximum number of entries in the async queue (see ostore_opts) */
+#define OSTORE_QUEUE_MAX (1 << 20)
+
+/* operations on an object, see ostore_op */
+#define OSTORE_OP_STORE 1
+#define OSTORE_OP_UNLINK 2
+
+/* 
+ * an already validated store (data of len bytes) or unlink of the object 
+ * type/id. A store of store_obj_iov has the iovcnt buffers of iov instead, 
+ * len bytes in all, and data NULL; it is only made synchronously.
+ */
+typedef struct ostore_op {
+    int op;
+    uintptr_t id;
+    const char* type;
+    const char* data;
+    size_t len;
+    const struct iovec* iov;
+    int iovcnt;
+} ostore_op;
+
+/*
+ * _ostore_apply (see obj_store.c) applies the operations ops[0..n) in order
+ * with the backend in use. It is called by store_obj and unlink_obj in 
+ * synchronous mode (n is 1) and with each batch drained by the writer in 
+ * async mode. Returns the number of operations that failed and sets errno 
+ * to the error of the first. Removing an object that is not in the store 
+ * succeeds.
+ */
+size_t _ostore_apply(const ostore_op* ops, size_t n);
+
+/* number of backends of ostore_backend */
+#define OSTORE_NBACKENDS 3
+
+/*
+ * The interface of a backend. obj_store.c holds a table of them indexed by
+ * ostore_backend and calls the backend selected by enable_ostore_opts 
+ * through it, after it has validated the object and encoded its record 
+ * (so a backend stores opaque bytes). Calls may come from several threads
+ * at once (store_obj callers, the async writer and the defer ticker). To 
+ * add a backend, implement these functions in an ostore_<name>.c module, 
+ * add a value to ostore_backend and its entry to the table.
+ *
+ * open - prepares the backend with opts (NULL for the defaults)
+ * close - releases everything open called for
+ * store - stores data[0..len) as the value of type/id, replacing any
+ * storev - as store, with the value in the n buffers of iov (len bytes)
+ * unlink - removes type/id; succeeds if it is not stored
+ * load - the value of type/id (malloced, NUL-terminated, len set to its 
+ *      length), or NULL with errno set to ENOENT if it is not stored
+ * flush - writes out anything the backend has buffered
+ * sync - makes everything stored so far durable
+ *
+ * All but close return false (or NULL) and set errno on failure.
+ */
+typedef struct ostore_backend_ops {
+    bool (*open)(const ostore_opts* opts);
+    void (*close)();
+    bool (*store)(const char* type, uintptr_t id, const char* data, 
+        size_t len);
+    bool (*storev)(const char* type, uintptr_t id, const struct iovec* iov,
+        int n, size_t len);     /* NULL if the buffers must be gathered */
+    bool (*unlink)(const char* type, uintptr_t id);
+    char* (*load)(const char* type, uintptr_t id, size_t* len);
+    bool (*flush)();
+    bool (*sync)();
+} ostore_backend_ops;
+
+/* 
+ * _ostore_dirfd (see obj_store.c): an open descriptor of the ostore/<type>
+ * directory of the files backend, creating the directory if it does not 
+ * exist and create is true, or -1 with errno set on failure. Descriptors 
+ * are cached and must not be closed unless *tmp is set to true, which 
+ * happens only if there are more than OSTORE_MAX_TYPES types.
+ */
+int _ostore_dirfd(const char* type, bool create, bool* tmp);
+
+/* maximum number of levels of shard directories (see ostore_opts) */
+#define OSTORE_SHARD_MAX 2
+
+/* maximum length of an object file name relative to its type directory */
+#define OSTORE_NAME_MAX 32
+
+/*
+ * _ostore_objfile (see obj_store.c): formats at name (OSTORE_NAME_MAX 
+ * bytes) the path of the object file of id relative to the directory of 
+ * type, and returns the directory as _ostore_dirfd does. If create is true
+ * the shard directories of the path are created, unless they are already
+ * known to exist.
+ */
+int _ostore_objfile(const char* type, uintptr_t id, bool create, char* name,
+    bool* tmp);
+
+/*
+ * _ostore_dirty (see obj_store.c): notes the object file of op (and its
+ * directories), which the files backend has written, for the next sync of
+ * the backend, which fsyncs them. Called once the operation succeeded.
+ */
+void _ostore_dirty(const ostore_op* op);
+
+/* 
+ * _ostore_shard_name (see obj_store.c): true if name is the name of a shard
+ * directory (two lower case hex digits)
+ */
+bool _ostore_shard_name(const char* name);
+
+/*
+ * _ostore_flush writes out records the backend in use has buffered and 
+ * _ostore_sync makes every record written so far durable (see obj_store.c).
+ * Both return false and set errno on failure.
+ */
+bool _ostore_flush();
+bool _ostore_sync();
+
+/*
+ * Durability policy (see ostore_sync.c).
+ *
+ * _sync_open - sets the policy from opts and, for OSTORE_SYNC_INTERVAL,
+ *      starts the ticker thread
+ * _sync_close - stops the ticker and makes all committed records durable
+ *      (unless the policy is OSTORE_SYNC_NONE)
+ * _sync_commit - commits a batch of n records applied to the backend: 
+ *      flushes the backend and syncs as the policy requires
+ * _sync_all - makes all committed records durable
+ */
+bool _sync_open(const ostore_opts* opts);
+bool _sync_close();
+bool _sync_commit(size_t n);
+bool _sync_all();
+
+/*
+ * Asynchronous writer (see ostore_async.c). Stores and unlinks are copied
+ * into a bounded queue and applied by a writer thread in queue order.
+ *
+ * _async_open - creates the queue and starts the writer thread
+ * _async_close - applies all queued operations and stops the writer
+ * _async_store - queues a store of the object (data is copied)
+ * _async_unlink - queues an unlink of the object
+ * _async_lookup - true if an operation on the object is queued; *data is
+ *      then a malloced copy of the value of the latest one and *len its
+ *      length, or NULL with errno set to ENOENT if it is an unlink (or
+ *      another errno if there was no memory). If the latest one is on an
+ *      object of another type with the same id, the queue is flushed first
+ *      and false returned.
+ * _async_flush - waits until all operations queued before the call have
+ *      been applied; returns false with errno set to the error of the first
+ *      queued operation that failed since the last flush, if any
+ * _async_depth - the number of operations queued and not yet applied (0 
+ *      if the writer is not running)
+ */
+bool _async_open(const ostore_opts* opts);
+void _async_close();
+bool _async_store(const char* type, uintptr_t id, const char* data, 
+    size_t len);
+bool _async_unlink(const char* type, uintptr_t id);
+bool _async_lookup(const char* type, uintptr_t id, char** data, size_t* len);
+bool _async_flush();
+size_t _async_depth();
+
+/*
+ * Deferred persistence (see ostore_defer.c). Stores are held for 
+ * ostore_opts.defer_ms, or until defer_count newer objects are stored, 
+ * before they are applied (or queued in async mode), and an unlink in the
+ * meantime cancels the store.
+ *
+ * _defer_open - starts the ticker thread that persists expired stores, if
+ *      there is a window
+ * _defer_close - stops the ticker and persists all pending stores
+ * _defer_on_store - holds a store of the object (data is copied)
+ * _defer_on_unlink - cancels a pending store of the object; true if that
+ *      leaves nothing to unlink, false if the unlink must still be applied
+ * _defer_lookup - true if a store of the object is pending; *data is then
+ *      a malloced copy of its value and *len its length (*data NULL with
+ *      errno set if there was no memory)
+ * _defer_flush - persists all pending stores; returns false with errno set
+ *      to the error of the first store that failed since the last flush
+ * _defer_stats - sets the counters of stats (see defer_stats_ostore)
+ */
+bool _defer_open(const ostore_opts* opts);
+bool _defer_close();
+bool _defer_on_store(const char* type, uintptr_t id, const char* data, 
+    size_t len);
+bool _defer_on_unlink(const char* type, uintptr_t id);
+bool _defer_lookup(const char* type, uintptr_t id, char** data, size_t* len);
+bool _defer_flush();
+void _defer_stats(ostore_defer_stats* stats);
+
+/*
+ * Background unlinker (see ostore_reap.c). Unlinks are added to a pending
+ * set and applied in batches by a reaper thread; a store of a pending 
+ * object cancels its unlink.
+ *
+ * _reap_open - starts the reaper thread
+ * _reap_close - stops the reaper and applies all pending unlinks
+ * _reap_unlink - adds an unlink of the object to the pending set
+ * _reap_on_store - cancels a pending unlink of the object, or waits for it
+ *      if it is being applied
+ * _reap_pending - true if an unlink of the object is pending or being 
+ *      applied
+ * _reap_flush - applies all pending unlinks; returns false with errno set
+ *      to the error of the first unlink that failed since the last flush
+ * _reap_stats - sets the counters of stats (see unlink_stats_ostore)
+ */
+bool _reap_open(const ostore_opts* opts);
+bool _reap_close();
+bool _reap_unlink(const char* type, uintptr_t id);
+void _reap_on_store(const char* type, uintptr_t id);
+bool _reap_pending(const char* type, uintptr_t id);
+bool _reap_flush();
+void _reap_stats(ostore_unlink_stats* stats);
+
+/*
+ * io_uring engine of the files backend (see ostore_uring.c).
+ *
+ * _uring_open - sets up the ring; false if the kernel lacks support
+ * _uring_close - releases the ring
+ * _uring_apply - as _ostore_apply, for the files backend
+ * _uring_ready - false once completions were lost with a failed
+ *   io_uring_enter; the ring is then left alone until _uring_close
+ */
+bool _uring_open();
+void _uring_close();
+size_t _uring_apply(const ostore_op* ops, size_t n);
+bool _uring_ready();
+
+/* 
+ * callback of a scan of stored records (see _slots_scan and _log_scan): 
+ * data[0..len) is the stored value of the object id 
+ */
+typedef void (*ostore_scan_fn)(uintptr_t id, const char* data, size_t len,
+    void* arg);
+
+/* maximum length of a value in the fixed-slot store */
+#define OSTORE_SLOT_DATA 20
+
+/*
+ * Fixed-slot store (see ostore_slots.c) of the type named by 
+ * ostore_opts.slot_type, used with either backend.
+ *
+ * _slots_open - opens (creating if necessary) and maps ostore/<type>.slots
+ *      and rebuilds the index and free list
+ * _slots_close - unmaps and closes the slot file
+ * _slots_type - true if objects of type are kept in the slot store
+ * _slots_store - copies the value into the slot of the object, EINVAL if it
+ *      is empty or longer than OSTORE_SLOT_DATA
+ * _slots_unlink - frees the slot of the object, if it has one
+ * _slots_load - copies the value of the object to buf, which must have 
+ *      room for OSTORE_SLOT_DATA bytes, and returns its length, or 0 if it
+ *      has no slot
+ * _slots_sync - msyncs the mapping
+ * _slots_scan - calls fn for each stored object
+ */
+bool _slots_open(const char* type);
+void _slots_close();
+bool _slots_type(const char* type);
+bool _slots_store(uintptr_t id, const char* data, size_t len);
+bool _slots_unlink(uintptr_t id);
+size_t _slots_load(uintptr_t id, char* buf);
+bool _slots_sync();
+bool _slots_scan(ostore_scan_fn fn, void* arg);
+
+/* high nibble of the first byte of a binary record */
+#define OSTORE_REC_MAGIC 0xb0
+
+/* 
+ * maximum size of a binary record beyond its payload: tag, two varints 
+ * and the checksum 
+ */
+#define OSTORE_REC_OVERHEAD 25
+
+/* a decoded binary record, payload points into the decoded buffer */
+typedef struct ostore_rec {
+    int kind;
+    uintptr_t id;
+    const char* payload;
+    size_t len;
+} ostore_rec;
+
+/*
+ * Binary record format (see ostore_rec.c).
+ *
+ * _rec_open - sets the size from which payloads are compressed from opts
+ * _crc32c - the CRC32C of buf[0..len) continuing from crc (0 to start)
+ * _rec_encode - encodes the value string text[0..len) of an object of type
+ *      as a binary record at buf, which must have room for len + 
+ *      OSTORE_REC_OVERHEAD bytes; returns the size of the record
+ * _rec_encode_int - encodes an int value as the record of an "int" object
+ *      at buf, which must have room for OSTORE_REC_OVERHEAD + 10 bytes
+ * _rec_is_binary - true if buf[0..len) starts as a binary record
+ * _rec_length - the size of the binary record at the start of buf[0..len), 
+ *      or 0 if it is not one or does not fit
+ * _rec_decode - decodes the record buf[0..len), false with errno set to 
+ *      EBADMSG if it is malformed or its checksum does not match
+ * _rec_text - the value string of a decoded record (malloced, len set to
+ *      its length), or NULL with errno set
+ */
+void _rec_open(const ostore_opts* opts);
+uint32_t _crc32c(uint32_t crc, const void* buf, size_t len);
+size_t _rec_encode(char* buf, const char* type, uintptr_t id, 
+    const char* text, size_t len);
+size_t _rec_encode_int(char* buf, uintptr_t id, int val);
+bool _rec_is_binary(const char* buf, size_t len);
+size_t _rec_length(const char* buf, size_t len);
+bool _rec_decode(const char* buf, size_t len, ostore_rec* rec);
+char* _rec_text(const ostore_rec* rec, size_t* len);
+
+/*
+ * LZ codec of compressed binary records (see ostore_lz.c).
+ *
+ * _lz_compress - compresses src[0..len) to dst, returns the compressed size
+ *      or 0 if it does not fit in cap bytes
+ * _lz_decompress - decompresses the block src[0..len) to dst, returns the
+ *      decompressed size or SIZE_MAX if the block is malformed or does not
+ *      fit in cap bytes
+ */
+size_t _lz_compress(const char* src, size_t len, char* dst, size_t cap);
+size_t _lz_decompress(const char* src, size_t len, char* dst, size_t cap);
+
+/*
+ * LRU cache of value strings (see ostore_cache.c and load_obj in 
+ * obj_store.h). All functions do nothing, and _cache_get always misses, if
+ * ostore_opts.cache_size is 0.
+ *
+ * _cache_open - sets the size of the cache from opts and resets the counters
+ * _cache_close - drops every entry and turns the cache off
+ * _cache_clear - drops every entry
+ * _cache_get - if the value of the object is cached, copies it to buf (if 
+ *      it fits in size bytes with its NUL) and returns its length; -1 
+ *      otherwise. Counts a hit or a miss
+ * _cache_put - sets the cached value of a stored object if the generation
+ *      is still gen (taken before the store), otherwise drops it, as
+ *      another store may have been applied after this one
+ * _cache_putv - as _cache_put, with the value in n buffers of len bytes
+ * _cache_on - true if the cache has a size, so that puts are kept
+ * _cache_drop - drops the cached value of an unlinked object
+ * _cache_gen - the generation of the cache, advanced by each put and drop
+ * _cache_fill - caches the value read for the object if the generation is
+ *      still gen (taken before the read)
+ * _cache_stats - the numbers of hits and misses of _cache_get
+ */
+void _cache_open(const ostore_opts* opts);
+void _cache_close();
+void _cache_clear();
+ssize_t _cache_get(const char* type, uintptr_t id, char* buf, size_t size);
+void _cache_put(const char* type, uintptr_t id, const char* val, 
+    size_t len, uint64_t gen);
+void _cache_putv(const char* type, uintptr_t id, const struct iovec* iov,
+    int n, size_t len, uint64_t gen);
+bool _cache_on();
+void _cache_drop(const char* type, uintptr_t id);
+uint64_t _cache_gen();
+void _cache_fill(const char* type, uintptr_t id, const char* val, 
+    size_t len, uint64_t gen);
+void _cache_stats(uint64_t* hits, uint64_t* misses);
+
+/*
+ * Rate limiter of writes (see ostore_rate.c and rate_bytes in ostore_opts).
+ * All functions do nothing if neither rate is set.
+ *
+ * _rate_open - sets the rates from opts and resets the counters
+ * _rate_close - turns the limiter off
+ * _rate_admit - takes the tokens of the writes ops[0..n), waiting until 
+ *      the rates allow them; errno is preserved
+ * _rate_stats - the number of batches that waited and the total wait in ns
+ */
+void _rate_open(const ostore_opts* opts);
+void _rate_close();
+void _rate_admit(const ostore_op* ops, size_t n);
+void _rate_stats(uint64_t* throttled, uint64_t* throttled_ns);
+
+/*
+ * Deduplication of the files backend (see ostore_dedup.c). name is the
+ * path of the object file relative to the type directory dfd.
+ *
+ * _dedup_store - links the object file to the blob of the value, writing 
+ *      the blob if there is none
+ * _dedup_unlink - removes the object file, and its blob if no other object
+ *      file is linked to it
+ */
+bool _dedup_store(int dfd, const char* name, uintptr_t id, const char* data,
+    size_t len);
+bool _dedup_unlink(int dfd, const char* name);
+
+/*
+ * Instrumentation (see ostore_stats.c and stats_ostore in obj_store.h). If
+ * OSTORE_NO_STATS is defined the hooks are empty inline functions that
+ * compile to nothing.
+ *
+ * _stats_open - zeroes the counters and turns counting on if opts->stats
+ * _stats_close - turns counting off
+ * _stats_start - the start time of an operation (0 if counting is off)
+ * _stats_op - counts an operation of type started at start, and its 
+ *      failure with errno unless ok; errno is preserved
+ * _stats_apply - counts the records and bytes of the stores of ops[0..n)
+ *      applied to the backend
+ * _stats_fail - counts n operations applied in the background that failed
+ *      with err
+ * _stats_queue - records an async queue depth
+ * _stats_sys - counts n system calls made by a backend
+ * _stats_get, _stats_dump, _stats_percentile - see stats_ostore, 
+ *      dump_stats_ostore and percentile_ostore
+ */
+#ifndef OSTORE_NO_STATS
+extern bool _stats_on;
+extern uint64_t _stats_nsys;
+
+void _stats_open(const ostore_opts* opts);
+void _stats_close();
+uint64_t _stats_start();
+void _stats_op(ostore_stat_op op, const char* type, uint64_t start, 
+    bool ok);
+void _stats_apply(const ostore_op* ops, size_t n);
+void _stats_fail(int err, size_t n);
+void _stats_queue(size_t depth);
+
+static inline void _stats_sys(unsigned n) {
+    if (_stats_on)
+        __atomic_fetch_add(&_stats_nsys, n, __ATOMIC_RELAXED);
+}
+#else
+static inline void _stats_open(const ostore_opts* opts) {}
+static inline void _stats_close() {}
+static inline uint64_t _stats_start() { return 0; }
+static inline void _stats_op(ostore_stat_op op, const char* type, 
+    uint64_t start, bool ok) {}
+static inline void _stats_apply(const ostore_op* ops, size_t n) {}
+static inline void _stats_fail(int err, size_t n) {}
+static inline void _stats_queue(size_t depth) {}
+static inline void _stats_sys(unsigned n) {}
+#endif
+
+bool _stats_get(ostore_stats* stats);
+bool _stats_dump(FILE* stream);
+uint64_t _stats_percentile(const ostore_hist* h, double pct);
+
+/*
+ * Checkpoints (see ostore_ckpt.c and checkpoint_ostore in obj_store.h).
+ *
+ * _ckpt_write - writes the snapshot of the objects of srcs[0..n) to path,
+ *      in a forked child process if background is true; EBUSY while a 
+ *      background checkpoint is running
+ * _ckpt_wait - waits for the background checkpoint, if any, and returns 
+ *      false with errno set if it failed
+ * _ckpt_read - loads the objects of the snapshot at path with loaders, 
+ *      setting *objs to a new map from id to object
+ */
+bool _ckpt_write(const char* path, const ostore_ckpt_source* srcs, size_t n,
+    bool background);
+bool _ckpt_wait();
+bool _ckpt_read(const char* path, const ostore_loader* loaders, size_t n,
+    idmap** objs);
+
+/*
+ * Recovery (see ostore_load.c). _load_run loads the objects of the types of
+ * loaders[0..n) with nthreads workers and rewrites their records under the
+ * ids of the new objects (as binary records if binary is true) with the 
+ * given backend. See load_ostore in obj_store.h.
+ */
+bool _load_run(const ostore_loader* loaders, size_t n, unsigned nthreads,
+    ostore_backend backend, bool binary, idmap** objs);
+
+/*
+ * In-memory backend (see ostore_mem.c and ostore_backend_ops; _mem_flush 
+ * also serves as its sync).
+ */
+bool _mem_open(const ostore_opts* opts);
+void _mem_close();
+bool _mem_store(const char* type, uintptr_t id, const char* data, 
+    size_t len);
+bool _mem_storev(const char* type, uintptr_t id, const struct iovec* iov,
+    int n, size_t len);
+bool _mem_unlink(const char* type, uintptr_t id);
+char* _mem_load(const char* type, uintptr_t id, size_t* len);
+bool _mem_flush();
+
+/*
+ * Log-structured backend (see ostore_log.c and ostore_backend_ops). All 
+ * functions return false and set errno on failure.
+ *
+ * _log_open - opens the backend with the given options, replaying any 
+ *      existing segments to rebuild the in-memory index, and starts the
+ *      background compaction thread
+ * _log_close - stops the compaction thread and closes all segments
+ * _log_store - appends a put record for the object
+ * _log_unlink - appends a tombstone record for the object if it is live
+ * _log_load - the payload of the latest put record of the object 
+ *      (malloced, NUL-terminated, len set to its length), or NULL with 
+ *      errno set to ENOENT if it is not live, or to EBADMSG if the record
+ *      found is not a put of the object
+ * _log_compact - synchronously compacts all sealed segments that contain
+ *      dead records
+ * _log_flush - writes the buffered records of every type; records whose
+ *      write fails stay buffered and are written by the next flush
+ * _log_sync - writes the buffered records and fdatasyncs every segment 
+ *      written since the last sync
+ * _log_pause - holds off (pause true) or resumes compaction, so that 
+ *      segments are not moved or removed during a scan
+ * _log_segments - sets *nos to a malloced array of the segment numbers of
+ *      type (after writing its buffered records) and returns their number,
+ *      or -1
+ * _log_scan - calls fn for each live put record in segment no of type
+ */
+bool _log_open(const ostore_opts* opts);
+void _log_close();
+bool _log_store(const char* type, uintptr_t id, const char* data, size_t len);
+bool _log_unlink(const char* type, uintptr_t id);
+char* _log_load(const char* type, uintptr_t id, size_t* len);
+bool _log_compact();
+bool _log_flush();
+bool _log_sync();
+void _log_pause(bool pause);
+int _log_segments(const char* type, uint32_t** nos);
+bool _log_scan(const char* type, uint32_t no, ostore_scan_fn fn, void* arg);
+
+#endif
@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "ostore_impl.h"
+
+/*
+ * Recovery of the object store (load_ostore).
+ *
+ * Loading runs in three phases, each spread over a pool of worker threads
+ * that take units of work from a shared counter:
+ *
+ * 1. read - the records of each loaded type are read and decoded (a unit is
+ *      a chunk of object files of a type directory and its shard
+ *      directories, a log segment or the slot file) and passed to the parse
+ *      callback of the type, which creates the object. Callbacks of a
+ *      loader are called one at a time (under the loader's mutex), so they
+ *      need not be thread-safe, while reading, decoding and checksumming
+ *      run in parallel. Orphans of a crash are swept from type
+ *      directories: temporary files of convert_ostore and empty object
+ *      files.
+ * 2. store - the value of each loaded object is stored under its new id.
+ * 3. unlink - once the stores are committed, the records of the old ids
+ *      of the stored objects are removed, except where an old id is also
+ *      the new id of an object of the same type.
+ *
+ * Storing before unlinking means a crash part way leaves duplicates rather
+ * than losing objects. Records that are corrupt (EBADMSG) or whose
+ * callback or store fails are left as they are.
+ */
+
+#define LOAD_MAX_THREADS 64
+#define LOAD_CHUNK 512      /* object files or operations per unit */
+
+/* kinds of read units */
+#define UNIT_FILES 0
+#define UNIT_SEG 1
+#define UNIT_SLOTS 2
+
+/* a unit of the read phase */
+typedef struct load_unit {
+    int kind;
+    size_t loader;          /* index of the loader */
+    int dfd;                /* UNIT_FILES: type directory */
+    bool close_dfd;         /* close dfd with the unit (it is not cached) */
+    char** names;           /* UNIT_FILES: object file paths relative to 
+                             * dfd */
+    size_t nnames;
+    uint32_t seg;           /* UNIT_SEG: segment number */
+} load_unit;
+
+/* an object loaded from the record of old */
+typedef struct load_rec {
+    uintptr_t old;
+    void* obj;
+    size_t loader;
+    char* text;             /* its value string */
+    size_t len;
+    bool stored;            /* phase 2 stored it under its new id */
+} load_rec;
+
+/* the results of a worker */
+typedef struct load_out {
+    load_rec* recs;
+    size_t n;
+    size_t cap;
+    int err;                /* errno of the first failure */
+} load_out;
+
+/* state shared by the workers */
+typedef struct load_job {
+    const ostore_loader* loaders;
+    pthread_mutex_t* locks;     /* one per loader */
+    load_unit* units;
+    size_t nunits;
+    load_rec** recs;            /* phases 2 and 3: all loaded objects */
+    size_t nrecs;
+    idmap* fresh;               /* new id -> loader index + 1 */
+    bool binary;
+    int phase;
+    size_t next;                /* next unit or chunk */
+} load_job;
+
+/* a worker scanning a unit: its job, results and the unit's loader */
+typedef struct load_ctx {
+    load_job* job;
+    load_out* out;
+    size_t loader;
+} load_ctx;
+
+/* record err as the error of out unless there is one */
+static void _fail(load_out* out, int err) {
+    if (!out->err)
+        out->err = err ? err : EIO;
+}
+
+/* decode and load the stored value data[0..len) of id (ostore_scan_fn) */
+static void _load_rec(uintptr_t id, const char* data, size_t len, void* arg) {
+    load_ctx* ctx = (load_ctx*) arg;
+    load_job* job = ctx->job;
+    char* text;
+    size_t tlen = 0;
+
+    if (_rec_is_binary(data, len)) {
+        ostore_rec rec;
+
+        if (!_rec_decode(data, len, &rec)) {
+            _fail(ctx->out, errno);     /* corrupt: left as it is */
+            return;
+        }
+
+        text = _rec_text(&rec, &tlen);
+    } else if ((text = (char*) malloc(len + 1))) {
+        memcpy(text, data, len);
+        text[len] = '\0';
+        tlen = len;
+    }
+
+    if (!text) {
+        _fail(ctx->out, errno);
+        return;
+    }
+
+    const ostore_loader* l = &job->loaders[ctx->loader];
+
+    pthread_mutex_lock(&job->locks[ctx->loader]);
+    errno = 0;
+    void* obj = l->parse(text, l->arg);
+    int err = errno;
+    pthread_mutex_unlock(&job->locks[ctx->loader]);
+
+    load_out* out = ctx->out;
+
+    if (obj && out->n == out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 256;
+        load_rec* recs = (load_rec*) realloc(out->recs,
+            cap * sizeof(load_rec));
+
+        if (recs) {
+            out->recs = recs;
+            out->cap = cap;
+        } else {
+            err = errno;
+            obj = NULL;     /* leaks the object, but keeps its record */
+        }
+    }
+
+    if (!obj) {
+        free(text);
+        _fail(out, err ? err : EINVAL);
+        return;
+    }
+
+    load_rec* r = &out->recs[out->n++];
+
+    r->old = id;
+    r->obj = obj;
+    r->loader = ctx->loader;
+    r->text = text;
+    r->len = tlen;
+    r->stored = false;
+}
+
+/* load the object files of a UNIT_FILES unit */
+static void _load_files(load_ctx* ctx, load_unit* u) {
+    char stack[1024];
+
+    for (size_t i = 0; i < u->nnames; i++) {
+        const char* name = u->names[i];
+        const char* base = strrchr(name, '/');   /* in a shard directory */
+        size_t n = strlen(name);
+        char* end;
+
+        if (n > 4 && !strcmp(name + n - 4, ".tmp")) {
+            (void) unlinkat(u->dfd, name, 0);   /* left by a crash */
+            continue;
+        }
+
+        base = base ? base + 1 : name;
+
+        uintptr_t id = (uintptr_t) strtoull(base, &end, 16);
+
+        if (end == base || strcmp(end, ".txt"))
+            continue;
+
+        struct stat sbuf;
+        int fd = openat(u->dfd, name, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &sbuf)) {
+            _fail(ctx->out, errno);
+            if (fd >= 0)
+                close(fd);
+            continue;
+        }
+
+        char* buf = sbuf.st_size <= (off_t) sizeof(stack) ? stack
+            : (char*) malloc(sbuf.st_size);
+        ssize_t len = buf ? read(fd, buf, sbuf.st_size) : -1;
+
+        close(fd);
+
+        if (len != (ssize_t) sbuf.st_size) {
+            _fail(ctx->out, len < 0 ? errno : EIO);
+        } else if (len == 0) {
+            (void) unlinkat(u->dfd, name, 0);   /* created, never written */
+        } else {
+            _load_rec(id, buf, len, ctx);
+        }
+
+        if (buf != stack)
+            free(buf);
+    }
+}
+
+/* the record of the new object of r, encoded at *buf if binary */
+static const char* _new_rec(load_job* job, load_rec* r, char** buf,
+    size_t* len) {
+    const char* type = job->loaders[r->loader].type;
+
+    *len = r->len;
+
+    if (!job->binary || _slots_type(type))
+        return r->text;
+
+    if (!(*buf = (char*) malloc(r->len + OSTORE_REC_OVERHEAD)))
+        return NULL;
+
+    *len = _rec_encode(*buf, type, (uintptr_t) r->obj, r->text, r->len);
+
+    return *buf;
+}
+
+/* apply phase 2 or 3 to the chunk of the loaded objects starting at at */
+static void _rewrite(load_job* job, load_out* out, size_t at) {
+    ostore_op ops[LOAD_CHUNK];
+    load_rec* recs[LOAD_CHUNK];
+    char* bufs[LOAD_CHUNK];
+    size_t n = 0;
+
+    for (size_t i = at; i < job->nrecs && i < at + LOAD_CHUNK; i++) {
+        load_rec* r = job->recs[i];
+        ostore_op* op = &ops[n];
+
+        op->type = job->loaders[r->loader].type;
+        op->data = NULL;
+        op->len = 0;
+        op->iov = NULL;
+        bufs[n] = NULL;
+
+        if (job->phase == 2) {
+            op->op = OSTORE_OP_STORE;
+            op->id = (uintptr_t) r->obj;
+
+            if (!(op->data = _new_rec(job, r, &bufs[n], &op->len))) {
+                _fail(out, errno);
+                continue;
+            }
+        } else {
+            uintptr_t fresh = (uintptr_t) get_identry(job->fresh, r->old);
+
+            if (!r->stored || fresh == r->loader + 1)
+                continue;   /* not stored, or now that of a loaded object */
+
+            op->op = OSTORE_OP_UNLINK;
+            op->id = r->old;
+        }
+
+        recs[n++] = r;
+    }
+
+    /* the failed stores of a chunk are not known, so none counts as stored */
+    bool ok = !n || !_ostore_apply(ops, n);
+
+    if (!ok)
+        _fail(out, errno);
+
+    for (size_t i = 0; ok && job->phase == 2 && i < n; i++)
+        recs[i]->stored = true;
+
+    for (size_t i = 0; i < n; i++)
+        free(bufs[i]);
+}
+
+/* a worker thread */
+static void* _worker(void* arg) {
+    load_ctx* ctx = (load_ctx*) arg;
+    load_job* job = ctx->job;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+
+        if (job->phase == 1) {
+            if (i >= job->nunits)
+                break;
+
+            load_unit* u = &job->units[i];
+            const char* type = job->loaders[u->loader].type;
+
+            ctx->loader = u->loader;
+
+            if (u->kind == UNIT_FILES)
+                _load_files(ctx, u);
+            else if (u->kind == UNIT_SEG
+                && !_log_scan(type, u->seg, _load_rec, ctx))
+                _fail(ctx->out, errno);
+            else if (u->kind == UNIT_SLOTS)
+                (void) _slots_scan(_load_rec, ctx);
+        } else {
+            if (i * LOAD_CHUNK >= job->nrecs)
+                break;
+
+            _rewrite(job, ctx->out, i * LOAD_CHUNK);
+        }
+    }
+
+    return NULL;
+}
+
+/* run the current phase of job on nthreads workers */
+static void _run_phase(load_job* job, load_ctx* ctxs, unsigned nthreads) {
+    pthread_t threads[LOAD_MAX_THREADS];
+    unsigned started = 0;
+
+    job->next = 0;
+
+    for (unsigned i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, _worker, &ctxs[i]))
+            break;
+        started++;
+    }
+
+    (void) _worker(&ctxs[0]);   /* the calling thread is worker 0 */
+
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/* append a unit to *units */
+static bool _add_unit(load_unit** units, size_t* n, size_t* cap,
+    load_unit* u) {
+    if (*n == *cap) {
+        size_t c = *cap ? *cap * 2 : 64;
+        load_unit* p = (load_unit*) realloc(*units, c * sizeof(load_unit));
+
+        if (!p)
+            return false;
+
+        *units = p;
+        *cap = c;
+    }
+
+    (*units)[(*n)++] = *u;
+
+    return true;
+}
+
+/* 
+ * add the paths of the files in the directory dir (a path relative to the 
+ * type directory dfd, "" for itself, and its shard directories) to u, 
+ * adding u to *units each time it holds LOAD_CHUNK paths
+ */
+static bool _add_names(load_unit** units, size_t* n, size_t* cap,
+    load_unit* u, const char* dir) {
+    int fd = *dir ? openat(u->dfd, dir, O_RDONLY | O_DIRECTORY) 
+        : dup(u->dfd);
+    DIR* d = fd >= 0 ? fdopendir(fd) : NULL;
+    size_t dlen = strlen(dir);
+    struct dirent* de;
+    bool ok = true;
+
+    if (!d) {
+        if (fd >= 0)
+            close(fd);
+        return *dir && errno == ENOTDIR;    /* a file with a shard's name */
+    }
+
+    rewinddir(d);
+
+    while (ok && (de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        char* path = NULL;
+
+        if (asprintf(&path, "%s%s", dir, de->d_name) < 0) {
+            ok = false;
+            break;
+        }
+
+        if (_ostore_shard_name(de->d_name) 
+            && dlen < 3 * OSTORE_SHARD_MAX) {
+            char sub[3 * OSTORE_SHARD_MAX + 1];
+
+            snprintf(sub, sizeof(sub), "%s/", path);
+            free(path);
+            ok = _add_names(units, n, cap, u, sub);
+            continue;
+        }
+
+        if (!u->names && !(u->names = (char**) malloc(LOAD_CHUNK
+            * sizeof(char*)))) {
+            free(path);
+            ok = false;
+            break;
+        }
+
+        u->names[u->nnames] = path;
+
+        if (++u->nnames == LOAD_CHUNK) {
+            ok = _add_unit(units, n, cap, u);
+            u->names = NULL;
+            u->nnames = 0;
+        }
+    }
+
+    closedir(d);
+
+    return ok;
+}
+
+/* add UNIT_FILES units for the object files of loader l */
+static bool _add_file_units(load_unit** units, size_t* n, size_t* cap,
+    size_t l, const char* type) {
+    bool tmp;
+    int dfd = _ostore_dirfd(type, false, &tmp);
+
+    if (dfd < 0)
+        return errno == ENOENT;     /* no objects of the type */
+
+    load_unit u = { UNIT_FILES, l, dfd, false, NULL, 0, 0 };
+    size_t first = *n;
+    bool ok = _add_names(units, n, cap, &u, "");
+
+    if (u.names && !_add_unit(units, n, cap, &u)) {
+        for (size_t i = 0; i < u.nnames; i++)
+            free(u.names[i]);
+        free(u.names);
+        ok = false;
+    }
+
+    /* an uncached directory stays open for the workers */
+    if (tmp && *n > first)
+        (*units)[*n - 1].close_dfd = true;
+    else if (tmp)
+        close(dfd);
+
+    return ok;
+}
+
+/* free units[0..n) and close the directories opened for them */
+static void _free_units(load_unit* units, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < units[i].nnames; j++)
+            free(units[i].names[j]);
+
+        free(units[i].names);
+
+        if (units[i].close_dfd)
+            close(units[i].dfd);
+    }
+
+    free(units);
+}
+
+/* see ostore_impl.h */
+bool _load_run(const ostore_loader* loaders, size_t nloaders,
+    unsigned nthreads, ostore_backend backend, bool binary, idmap** objs) {
+    load_ctx ctxs[LOAD_MAX_THREADS];
+    load_out outs[LOAD_MAX_THREADS];
+    load_job job;
+    load_unit* units = NULL;
+    size_t nunits = 0, cap = 0;
+    bool ok = true;
+    int err = 0;
+
+    if (!nthreads) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (unsigned) ncpu : 1;
+    }
+
+    if (nthreads > LOAD_MAX_THREADS)
+        nthreads = LOAD_MAX_THREADS;
+
+    memset(&job, 0, sizeof(job));
+    memset(outs, 0, sizeof(outs));
+    job.loaders = loaders;
+    job.binary = binary;
+
+    if (!(*objs = create_idmap()) || !(job.fresh = create_idmap())
+        || !(job.locks = (pthread_mutex_t*) malloc(nloaders
+            * sizeof(pthread_mutex_t)))) {
+        delete_idmap(objs);
+        delete_idmap(&job.fresh);
+        return false;
+    }
+
+    for (size_t i = 0; i < nloaders; i++)
+        pthread_mutex_init(&job.locks[i], NULL);
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        ctxs[i].job = &job;
+        ctxs[i].out = &outs[i];
+    }
+
+    if (backend == OSTORE_LOG)
+        _log_pause(true);
+
+    /* phase 1: units of work for every loaded type */
+    for (size_t l = 0; ok && l < nloaders; l++) {
+        const char* type = loaders[l].type;
+
+        if (_slots_type(type)) {
+            load_unit u = { UNIT_SLOTS, l, -1, false, NULL, 0, 0 };
+            ok = _add_unit(&units, &nunits, &cap, &u);
+        }
+
+        if (ok && backend == OSTORE_LOG) {
+            uint32_t* nos = NULL;
+            int nsegs = _log_segments(type, &nos);
+
+            ok = nsegs >= 0;
+
+            for (int s = 0; ok && s < nsegs; s++) {
+                load_unit u = { UNIT_SEG, l, -1, false, NULL, 0, 
+                    nos[s] };
+                ok = _add_unit(&units, &nunits, &cap, &u);
+            }
+
+            free(nos);
+        } else if (ok) {
+            ok = _add_file_units(&units, &nunits, &cap, l, type);
+        }
+    }
+
+    if (!ok)
+        err = errno;
+
+    job.units = units;
+    job.nunits = ok ? nunits : 0;
+    job.phase = 1;
+    _run_phase(&job, ctxs, nthreads);
+
+    if (backend == OSTORE_LOG)
+        _log_pause(false);
+
+    /* gather the loaded objects */
+    for (unsigned i = 0; i < nthreads; i++)
+        job.nrecs += outs[i].n;
+
+    if (job.nrecs && !(job.recs = (load_rec**) malloc(job.nrecs
+        * sizeof(load_rec*)))) {
+        ok = false;
+        err = err ? err : errno;
+        job.nrecs = 0;
+    }
+
+    for (unsigned i = 0, k = 0; job.recs && i < nthreads; i++) {
+        for (size_t j = 0; j < outs[i].n; j++) {
+            load_rec* r = &outs[i].recs[j];
+
+            if (!set_identry(*objs, r->old, r->obj)
+                || !set_identry(job.fresh, (uintptr_t) r->obj,
+                    (void*) (r->loader + 1))) {
+                ok = false;
+                err = err ? err : errno;
+            }
+
+            job.recs[k++] = r;
+        }
+    }
+
+    /* phase 2: store the records under the new ids and commit them */
+    bool stored = false;
+
+    if (ok) {
+        job.phase = 2;
+        _run_phase(&job, ctxs, nthreads);
+        stored = !job.nrecs || _sync_commit(job.nrecs);
+
+        if (!stored) {
+            ok = false;
+            err = err ? err : errno;
+        }
+
+        for (unsigned i = 0; i < nthreads; i++) {
+            if (outs[i].err) {
+                ok = false;
+                err = err ? err : outs[i].err;
+            }
+        }
+    }
+
+    /* phase 3: only then unlink the old ids of the records stored */
+    if (stored) {
+        job.phase = 3;
+        _run_phase(&job, ctxs, nthreads);
+
+        if (job.nrecs && !_sync_commit(job.nrecs)) {
+            ok = false;
+            err = err ? err : errno;
+        }
+    }
+
+    for (unsigned i = 0; i < nthreads; i++) {
+        if (outs[i].err) {
+            ok = false;
+            err = err ? err : outs[i].err;
+        }
+
+        for (size_t j = 0; j < outs[i].n; j++)
+            free(outs[i].recs[j].text);
+
+        free(outs[i].recs);
+    }
+
+    _free_units(units, nunits);
+    free(job.recs);
+    delete_idmap(&job.fresh);
+
+    for (size_t i = 0; i < nloaders; i++)
+        pthread_mutex_destroy(&job.locks[i]);
+
+    free(job.locks);
+    errno = err;
+
+    return ok;
+}
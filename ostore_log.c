@@ -0,0 +1,909 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "id_map.h"
+#include "ostore_impl.h"
+
+/*
+ * Log-structured backend of the object store.
+ *
+ * The objects of each type are stored in a sequence of segment files in the
+ * type directory, ostore/<type>/<segment number>.log, where the segment
+ * number is 8 hex digits. Only the last (active) segment of a type is
+ * appended to. A segment is sealed once it reaches the configured segment
+ * size and a new active segment is started.
+ *
+ * A segment is a sequence of records, each a log_hdr followed by len bytes
+ * of payload. A put record holds the value string of an object. A tombstone
+ * record (no payload) records the deletion of an object.
+ *
+ * An in-memory index per type maps each live object id to the location of
+ * its latest put record. Records that are no longer referenced by the index
+ * are dead and their bytes are accounted per segment. A background thread
+ * compacts sealed segments that are at least half dead: live puts are copied
+ * to the active segment, tombstones are carried forward while an older
+ * segment that may hold an earlier put of the same id still exists, and the
+ * segment file is then removed.
+ *
+ * Appended records are collected in a write buffer per type and written
+ * with one pwrite when the buffer is full, the segment is sealed or the
+ * object store commits a batch (_log_flush), so that a batch of objects 
+ * shares one write and, depending on the durability policy, one fdatasync
+ * (_log_sync).
+ *
+ * All state is protected by _log_lock. Compaction reads records from a
+ * sealed segment without the lock (sealed segments are never written) and
+ * takes the lock to copy each record. Compactions by the background thread
+ * and by _log_compact are serialised by _log_compact_lock.
+ */
+
+#define LOG_PUT 0x54555001u         /* record magic of a put, "\1PUT" */
+#define LOG_TOMB 0x424d5401u        /* record magic of a tombstone, "\1TMB" */
+
+#define LOG_DEFAULT_SEGMENT_SIZE (4 * 1024 * 1024)
+#define LOG_REC_MAX 4096            /* maximum payload length of a record */
+#define SEG_NAME_FMT "%08x.log"     /* format of a segment file name */
+#define LOG_WBUF_SIZE (64 * 1024)   /* size of the write buffer of a type */
+
+/* header of a record in a segment */
+typedef struct log_hdr {
+    uint32_t magic;     /* LOG_PUT or LOG_TOMB */
+    uint32_t len;       /* length of the payload that follows */
+    uint64_t id;        /* id of the object */
+} log_hdr;
+
+/* location of the latest put record of a live object */
+typedef struct log_loc {
+    uint32_t seg;       /* segment number */
+    uint32_t len;       /* payload length */
+    off_t off;          /* offset of the record header in the segment */
+} log_loc;
+
+/* a segment file */
+typedef struct log_seg {
+    uint32_t no;        /* segment number */
+    int fd;             /* open file descriptor */
+    off_t size;         /* bytes appended, including buffered bytes */
+    off_t dead;         /* bytes of dead records */
+    bool dirty;         /* written since the last fdatasync */
+} log_seg;
+
+/* the segments and index of one type */
+typedef struct log_type {
+    char name[OSTORE_TYPE_MAX + 1];
+    idmap* index;       /* id -> log_loc* of live objects */
+    log_seg* segs;      /* segments, oldest first, the last is active */
+    int nsegs;
+    int cap;
+    char* wbuf;         /* records appended to the active segment but not 
+                         * yet written */
+    size_t wlen;
+} log_type;
+
+static pthread_mutex_t _log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _log_compact_lock = PTHREAD_MUTEX_INITIALIZER;
+                                        /* one compaction at a time */
+static pthread_cond_t _log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t _log_compactor;
+static bool _log_running = false;       /* compactor thread started */
+static bool _log_stopping = false;      /* compactor asked to exit */
+static bool _log_compact_wanted = false;
+
+static log_type _log_types[OSTORE_MAX_TYPES];
+static int _log_ntypes = 0;
+static off_t _log_segment_size = LOG_DEFAULT_SEGMENT_SIZE;
+
+/* size of a record with a payload of len bytes */
+static off_t _rec_size(uint32_t len) {
+    return (off_t) sizeof(log_hdr) + len;
+}
+
+/* path of segment no of type t, formatted into buf */
+static void _seg_path(char* buf, const char* type, uint32_t no) {
+    char name[16];
+
+    snprintf(name, sizeof(name), SEG_NAME_FMT, no);
+    snprintf(buf, OSTORE_PATH_MAX, "%s/%s/%s", OSTORE_DIRNAME, type, name);
+}
+
+/* the segment of t with the given number, or NULL */
+static log_seg* _find_seg(log_type* t, uint32_t no) {
+    for (int i = 0; i < t->nsegs; i++)
+        if (t->segs[i].no == no)
+            return &t->segs[i];
+
+    return NULL;
+}
+
+/* append a segment to t, opening (creating if create) its file */
+static log_seg* _add_seg(log_type* t, uint32_t no, bool create) {
+    char path[OSTORE_PATH_MAX];
+
+    if (t->nsegs == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 8;
+        log_seg* segs = (log_seg*) realloc(t->segs, cap * sizeof(log_seg));
+
+        if (!segs)
+            return NULL;
+
+        t->segs = segs;
+        t->cap = cap;
+    }
+
+    _seg_path(path, t->name, no);
+
+    int fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+
+    if (fd < 0)
+        return NULL;
+
+    log_seg* s = &t->segs[t->nsegs++];
+    s->no = no;
+    s->fd = fd;
+    s->size = 0;
+    s->dead = 0;
+    s->dirty = false;
+
+    return s;
+}
+
+/* start a new active segment for t */
+static log_seg* _roll_seg(log_type* t) {
+    uint32_t no = t->nsegs ? t->segs[t->nsegs - 1].no + 1 : 0;
+
+    return _add_seg(t, no, true);
+}
+
+/* mark the record at loc dead */
+static void _kill_loc(log_type* t, log_loc* loc) {
+    log_seg* s = _find_seg(t, loc->seg);
+
+    if (s)
+        s->dead += _rec_size(loc->len);
+}
+
+/*
+ * write the buffered records of t to its active segment with one pwrite.
+ * If the write fails the records stay buffered, where the index refers to
+ * them, and are written again by the next flush.
+ */
+static bool _flush_type(log_type* t) {
+    if (!t->wlen)
+        return true;
+
+    log_seg* s = &t->segs[t->nsegs - 1];
+    off_t at = s->size - t->wlen;
+    ssize_t w = pwrite(s->fd, t->wbuf, t->wlen, at);
+    _stats_sys(1);
+
+    s->dirty = true;
+
+    if (w != (ssize_t) t->wlen) {
+        /* drop a torn write so that the segment stays parseable */
+        if (w > 0)
+            (void) ftruncate(s->fd, at);
+
+        if (w >= 0)
+            errno = EIO;
+
+        return false;
+    }
+
+    t->wlen = 0;
+
+    return true;
+}
+
+/*
+ * append a record to the write buffer of the active segment of t, rolling
+ * to a new segment when the active one is full. On success *seg and *off 
+ * give the location of the record.
+ */
+static bool _append(log_type* t, uint32_t magic, uintptr_t id,
+    const char* data, uint32_t len, uint32_t* seg, off_t* off) {
+    log_seg* s = &t->segs[t->nsegs - 1];
+    size_t n = sizeof(log_hdr) + len;
+
+    if (s->size >= _log_segment_size) {
+        if (!_flush_type(t) || !(s = _roll_seg(t)))
+            return false;
+
+        _log_compact_wanted = true;
+        pthread_cond_signal(&_log_cond);
+    }
+
+    if (t->wlen + n > LOG_WBUF_SIZE && !_flush_type(t))
+        return false;
+
+    /* the buffer is not aligned for a log_hdr at every record */
+    log_hdr hdr = { magic, len, id };
+
+    memcpy(t->wbuf + t->wlen, &hdr, sizeof(hdr));
+
+    if (len)
+        memcpy(t->wbuf + t->wlen + sizeof(log_hdr), data, len);
+
+    *seg = s->no;
+    *off = s->size;
+    s->size += n;
+    t->wlen += n;
+
+    return true;
+}
+
+/*
+ * flush the write buffer of t and fdatasync its dirty segments. Called with 
+ * _log_lock held.
+ */
+static bool _sync_type(log_type* t) {
+    bool ok = _flush_type(t);
+
+    for (int i = 0; ok && i < t->nsegs; i++) {
+        if (t->segs[i].dirty) {
+            ok = fdatasync(t->segs[i].fd) == 0;
+            t->segs[i].dirty = !ok;
+            _stats_sys(1);
+        }
+    }
+
+    return ok;
+}
+
+/* free an index entry (foreach_identry callback) */
+static void _free_loc(uintptr_t id, void* val, void* arg) {
+    free(val);
+}
+
+/* close the segments of t and free its index */
+static void _close_type(log_type* t) {
+    for (int i = 0; i < t->nsegs; i++)
+        close(t->segs[i].fd);
+
+    free(t->segs);
+    free(t->wbuf);
+    foreach_identry(t->index, _free_loc, NULL);
+    delete_idmap(&t->index);
+    memset(t, 0, sizeof(log_type));
+}
+
+/*
+ * replay segment s of t: apply its records to the index and account dead
+ * bytes. A torn record at the end of the segment (e.g. after a crash) is
+ * truncated away.
+ */
+static bool _replay_seg(log_type* t, log_seg* s) {
+    struct stat sbuf;
+    log_hdr hdr;
+    off_t off = 0;
+
+    if (fstat(s->fd, &sbuf))
+        return false;
+
+    while (off + (off_t) sizeof(hdr) <= sbuf.st_size) {
+        if (pread(s->fd, &hdr, sizeof(hdr), off) != sizeof(hdr)
+            || (hdr.magic != LOG_PUT && hdr.magic != LOG_TOMB)
+            || hdr.len > LOG_REC_MAX
+            || off + _rec_size(hdr.len) > sbuf.st_size)
+            break;
+
+        log_loc* old = (log_loc*) get_identry(t->index, hdr.id);
+
+        if (old)
+            _kill_loc(t, old);
+
+        if (hdr.magic == LOG_PUT) {
+            log_loc* loc = old ? old : (log_loc*) malloc(sizeof(log_loc));
+
+            if (!loc || !set_identry(t->index, hdr.id, loc)) {
+                free(loc);
+                return false;
+            }
+
+            loc->seg = s->no;
+            loc->len = hdr.len;
+            loc->off = off;
+        } else {
+            if (old)
+                free(delete_identry(t->index, hdr.id));
+
+            s->dead += _rec_size(hdr.len);
+        }
+
+        off += _rec_size(hdr.len);
+    }
+
+    if (off < sbuf.st_size && ftruncate(s->fd, off))
+        return false;
+
+    s->size = off;
+
+    return true;
+}
+
+/* compare segment numbers for qsort */
+static int _cmp_no(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * open the existing segments of the type directory of t in order and replay
+ * them. The last segment becomes the active one (_append rolls it if it is
+ * full). If there are none, a first segment is started.
+ */
+static bool _load_type(log_type* t) {
+    char path[OSTORE_PATH_MAX];
+    uint32_t* nos = NULL;
+    int n = 0, cap = 0;
+    bool ok = true;
+
+    snprintf(path, sizeof(path), "%s/%s", OSTORE_DIRNAME, t->name);
+
+    DIR* dir = opendir(path);
+
+    if (dir) {
+        struct dirent* de;
+
+        while ((de = readdir(dir))) {
+            unsigned no;
+            char ext[8];
+
+            if (sscanf(de->d_name, "%8x.%7s", &no, ext) != 2
+                || strcmp(ext, "log") || strlen(de->d_name) != 12)
+                continue;
+
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                uint32_t* p = (uint32_t*) realloc(nos, cap * sizeof(uint32_t));
+
+                if (!p) {
+                    ok = false;
+                    break;
+                }
+
+                nos = p;
+            }
+
+            nos[n++] = no;
+        }
+
+        closedir(dir);
+    }
+
+    if (n)
+        qsort(nos, n, sizeof(uint32_t), _cmp_no);
+
+    for (int i = 0; ok && i < n; i++) {
+        log_seg* s = _add_seg(t, nos[i], false);
+
+        ok = s && _replay_seg(t, s);
+    }
+
+    free(nos);
+
+    return ok && (t->nsegs || _roll_seg(t));
+}
+
+/* the log_type for the named type, created (and loaded) on first use */
+static log_type* _get_type(const char* type) {
+    for (int i = 0; i < _log_ntypes; i++)
+        if (!strcmp(_log_types[i].name, type))
+            return &_log_types[i];
+
+    if (_log_ntypes == OSTORE_MAX_TYPES) {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    if (!_create_ostore_dir(type))
+        return NULL;
+
+    log_type* t = &_log_types[_log_ntypes];
+
+    memset(t, 0, sizeof(log_type));
+    strncpy(t->name, type, OSTORE_TYPE_MAX);
+
+    if (!(t->wbuf = (char*) malloc(LOG_WBUF_SIZE)) 
+        || !(t->index = create_idmap()) || !_load_type(t)) {
+        int err = errno;
+        _close_type(t);
+        errno = err;
+        return NULL;
+    }
+
+    _log_ntypes++;
+
+    return t;
+}
+
+/*
+ * compact sealed segment number no of t. Called without _log_lock held.
+ */
+static bool _compact_seg(log_type* t, uint32_t no) {
+    char data[LOG_REC_MAX];
+    log_hdr hdr;
+    off_t off = 0, size;
+    int fd;
+    bool ok = true;
+
+    pthread_mutex_lock(&_log_lock);
+    log_seg* s = _find_seg(t, no);
+    fd = s ? s->fd : -1;
+    size = s ? s->size : 0;
+    pthread_mutex_unlock(&_log_lock);
+
+    if (fd < 0)
+        return true;
+
+    while (ok && off < size) {
+        errno = EIO;    /* for a short read or a bad record */
+
+        if (pread(fd, &hdr, sizeof(log_hdr), off) != sizeof(log_hdr)
+            || hdr.len > LOG_REC_MAX
+            || pread(fd, data, hdr.len, off + sizeof(log_hdr)) 
+                != (ssize_t) hdr.len)
+            return false;
+
+        pthread_mutex_lock(&_log_lock);
+
+        log_loc* loc = (log_loc*) get_identry(t->index, hdr.id);
+        uint32_t seg;
+        off_t noff;
+
+        if (hdr.magic == LOG_PUT) {
+            if (loc && loc->seg == no && loc->off == off) {
+                ok = _append(t, LOG_PUT, hdr.id, data, hdr.len, &seg, 
+                    &noff);
+
+                if (ok) {
+                    loc->seg = seg;
+                    loc->off = noff;
+                }
+            }
+        } else if (!loc && t->nsegs && t->segs[0].no < no) {
+            /* an older segment may still hold a put of this id */
+            ok = _append(t, LOG_TOMB, hdr.id, NULL, 0, &seg, &noff);
+
+            log_seg* a = _find_seg(t, seg);
+
+            if (ok && a)
+                a->dead += _rec_size(0);
+        }
+
+        pthread_mutex_unlock(&_log_lock);
+
+        off += _rec_size(hdr.len);
+    }
+
+    if (!ok)
+        return false;
+
+    pthread_mutex_lock(&_log_lock);
+
+    /* copies must be durable before the original is removed */
+    ok = _sync_type(t);
+
+    if (ok) {
+        char path[OSTORE_PATH_MAX];
+
+        for (int i = 0; i < t->nsegs; i++) {
+            if (t->segs[i].no == no) {
+                close(t->segs[i].fd);
+                memmove(&t->segs[i], &t->segs[i + 1],
+                    (t->nsegs - i - 1) * sizeof(log_seg));
+                t->nsegs--;
+                break;
+            }
+        }
+
+        _seg_path(path, t->name, no);
+        ok = unlink(path) == 0;
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return ok;
+}
+
+/*
+ * compact the sealed segments of all types whose dead bytes are non-zero and
+ * at least the given fraction (num / den) of their size. The victims of a
+ * type are chosen before any is compacted, so segments sealed by the copies
+ * are left for a later pass.
+ */
+static bool _compact(off_t num, off_t den) {
+    bool ok = true;
+
+    pthread_mutex_lock(&_log_compact_lock);
+    pthread_mutex_lock(&_log_lock);
+    int ntypes = _log_ntypes;
+    pthread_mutex_unlock(&_log_lock);
+
+    for (int i = 0; ok && i < ntypes; i++) {
+        log_type* t = &_log_types[i];
+        uint32_t* victims;
+        int n = 0;
+
+        pthread_mutex_lock(&_log_lock);
+
+        victims = (uint32_t*) malloc(t->nsegs * sizeof(uint32_t) + 1);
+
+        for (int j = 0; victims && j < t->nsegs - 1; j++) {
+            log_seg* s = &t->segs[j];
+
+            if (s->dead && s->dead * den >= s->size * num)
+                victims[n++] = s->no;
+        }
+
+        pthread_mutex_unlock(&_log_lock);
+
+        ok = victims != NULL;
+
+        for (int j = 0; ok && j < n; j++)
+            ok = _compact_seg(t, victims[j]);
+
+        free(victims);
+    }
+
+    pthread_mutex_unlock(&_log_compact_lock);
+
+    return ok;
+}
+
+/* background compaction thread */
+static void* _compactor(void* arg) {
+    pthread_mutex_lock(&_log_lock);
+
+    while (!_log_stopping) {
+        while (!_log_compact_wanted && !_log_stopping)
+            pthread_cond_wait(&_log_cond, &_log_lock);
+
+        if (_log_stopping)
+            break;
+
+        _log_compact_wanted = false;
+        pthread_mutex_unlock(&_log_lock);
+
+        (void) _compact(1, 2);
+
+        pthread_mutex_lock(&_log_lock);
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return NULL;
+}
+
+/* see ostore_impl.h */
+bool _log_open(const ostore_opts* opts) {
+    if (opts && opts->log_segment_size)
+        _log_segment_size = (off_t) opts->log_segment_size;
+    else
+        _log_segment_size = LOG_DEFAULT_SEGMENT_SIZE;
+
+    _log_ntypes = 0;
+    _log_stopping = false;
+    _log_compact_wanted = false;
+
+    int err = pthread_create(&_log_compactor, NULL, _compactor, NULL);
+
+    if (err) {
+        errno = err;
+        return false;
+    }
+
+    _log_running = true;
+
+    return true;
+}
+
+/* see ostore_impl.h */
+void _log_close() {
+    if (_log_running) {
+        pthread_mutex_lock(&_log_lock);
+        _log_stopping = true;
+        pthread_cond_signal(&_log_cond);
+        pthread_mutex_unlock(&_log_lock);
+
+        pthread_join(_log_compactor, NULL);
+        _log_running = false;
+    }
+
+    for (int i = 0; i < _log_ntypes; i++) {
+        (void) _flush_type(&_log_types[i]);
+        _close_type(&_log_types[i]);
+    }
+
+    _log_ntypes = 0;
+}
+
+/* see ostore_impl.h */
+bool _log_store(const char* type, uintptr_t id, const char* data,
+    size_t len) {
+    if (len > LOG_REC_MAX) {
+        errno = EINVAL;
+        return false;
+    }
+
+    pthread_mutex_lock(&_log_lock);
+
+    log_type* t = _get_type(type);
+    uint32_t seg;
+    off_t off;
+    bool ok = t && _append(t, LOG_PUT, id, data, len, &seg, &off);
+
+    if (ok) {
+        log_loc* loc = (log_loc*) get_identry(t->index, id);
+
+        if (loc) {
+            _kill_loc(t, loc);
+        } else if (!(loc = (log_loc*) malloc(sizeof(log_loc)))
+            || !set_identry(t->index, id, loc)) {
+            free(loc);
+            ok = false;
+        }
+
+        if (ok) {
+            loc->seg = seg;
+            loc->len = len;
+            loc->off = off;
+        }
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _log_unlink(const char* type, uintptr_t id) {
+    pthread_mutex_lock(&_log_lock);
+
+    log_type* t = _get_type(type);
+    log_loc* loc = t ? (log_loc*) get_identry(t->index, id) : NULL;
+    bool ok = t != NULL;
+
+    if (loc) {
+        uint32_t seg;
+        off_t off;
+
+        ok = _append(t, LOG_TOMB, id, NULL, 0, &seg, &off);
+
+        if (ok) {
+            log_seg* s = _find_seg(t, seg);
+
+            _kill_loc(t, loc);
+            if (s)
+                s->dead += _rec_size(0);
+
+            free(delete_identry(t->index, id));
+        }
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _log_compact() {
+    return _compact(0, 1);
+}
+
+/* see ostore_impl.h */
+bool _log_flush() {
+    bool ok = true;
+
+    pthread_mutex_lock(&_log_lock);
+
+    for (int i = 0; i < _log_ntypes; i++)
+        ok = _flush_type(&_log_types[i]) && ok;
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _log_sync() {
+    int nfds = 0, cap = 0, *fds = NULL;
+    bool ok = true;
+
+    /* 
+     * flush under the lock, but fdatasync duplicates of the dirty segment
+     * descriptors without it so that stores are not held up by the disk
+     */
+    pthread_mutex_lock(&_log_lock);
+
+    for (int i = 0; i < _log_ntypes; i++) {
+        log_type* t = &_log_types[i];
+
+        ok = _flush_type(t) && ok;
+
+        for (int j = 0; j < t->nsegs; j++) {
+            if (!t->segs[j].dirty)
+                continue;
+
+            if (nfds == cap) {
+                cap = cap ? cap * 2 : 8;
+                int* p = (int*) realloc(fds, cap * sizeof(int));
+
+                if (!p) {
+                    ok = false;
+                    break;
+                }
+
+                fds = p;
+            }
+
+            if ((fds[nfds] = dup(t->segs[j].fd)) < 0) {
+                ok = false;
+                break;
+            }
+
+            nfds++;
+            t->segs[j].dirty = false;
+        }
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    for (int i = 0; i < nfds; i++) {
+        ok = fdatasync(fds[i]) == 0 && ok;
+        close(fds[i]);
+    }
+
+    _stats_sys(2 * nfds);
+
+    free(fds);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+void _log_pause(bool pause) {
+    if (pause)
+        pthread_mutex_lock(&_log_compact_lock);
+    else
+        pthread_mutex_unlock(&_log_compact_lock);
+}
+
+/* see ostore_impl.h */
+char* _log_load(const char* type, uintptr_t id, size_t* len) {
+    char* data = NULL;
+
+    pthread_mutex_lock(&_log_lock);
+
+    log_type* t = _get_type(type);
+    log_loc* loc = t ? (log_loc*) get_identry(t->index, id) : NULL;
+    log_seg* s = loc ? _find_seg(t, loc->seg) : NULL;
+
+    if (t && !s)
+        errno = ENOENT;
+    else if (s && (data = (char*) malloc(loc->len + 1))) {
+        off_t wstart = t->segs[t->nsegs - 1].size - (off_t) t->wlen;
+        log_hdr hdr;
+
+        /* the record may still be in the write buffer */
+        if (s == &t->segs[t->nsegs - 1] && loc->off >= wstart) {
+            const char* rec = t->wbuf + (loc->off - wstart);
+
+            memcpy(&hdr, rec, sizeof(hdr));
+            memcpy(data, rec + sizeof(log_hdr), loc->len);
+        } else {
+            struct iovec iov[2] = { { &hdr, sizeof(hdr) },
+                { data, loc->len } };
+            ssize_t r = preadv(s->fd, iov, 2, loc->off);
+
+            _stats_sys(1);
+
+            if (r != (ssize_t) (sizeof(hdr) + loc->len)) {
+                if (r >= 0)
+                    errno = EIO;
+                free(data);
+                data = NULL;
+            }
+        }
+
+        /* the index must point at a put of this object */
+        if (data && (hdr.magic != LOG_PUT || hdr.id != (uint64_t) id
+            || hdr.len != loc->len)) {
+            errno = EBADMSG;
+            free(data);
+            data = NULL;
+        }
+
+        if (data) {
+            data[loc->len] = '\0';
+            *len = loc->len;
+        }
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return data;
+}
+
+/* see ostore_impl.h */
+int _log_segments(const char* type, uint32_t** nos) {
+    int n = -1;
+
+    pthread_mutex_lock(&_log_lock);
+
+    log_type* t = _get_type(type);
+
+    if (t && _flush_type(t) 
+        && (*nos = (uint32_t*) malloc(t->nsegs * sizeof(uint32_t) + 1))) {
+        for (n = 0; n < t->nsegs; n++)
+            (*nos)[n] = t->segs[n].no;
+    }
+
+    pthread_mutex_unlock(&_log_lock);
+
+    return n;
+}
+
+/* see ostore_impl.h */
+bool _log_scan(const char* type, uint32_t no, ostore_scan_fn fn, void* arg) {
+    char* buf;
+    off_t size;
+    int fd;
+
+    pthread_mutex_lock(&_log_lock);
+
+    log_type* t = _get_type(type);
+    log_seg* s = t ? _find_seg(t, no) : NULL;
+
+    fd = s ? dup(s->fd) : -1;
+    size = s ? s->size : 0;
+
+    pthread_mutex_unlock(&_log_lock);
+
+    if (fd < 0)
+        return !t ? false : !s;
+
+    /* records are read from a copy of the whole segment */
+    ssize_t r = (buf = (char*) malloc(size + 1)) ? pread(fd, buf, size, 0) : -1;
+    bool ok = r == (ssize_t) size;
+
+    close(fd);
+
+    if (!ok && r >= 0)
+        errno = EIO;
+
+    for (off_t off = 0; ok && off + (off_t) sizeof(log_hdr) <= size; ) {
+        log_hdr hdr;
+
+        memcpy(&hdr, buf + off, sizeof(hdr));
+
+        if (hdr.len > LOG_REC_MAX || off + _rec_size(hdr.len) > size)
+            break;
+
+        if (hdr.magic == LOG_PUT) {
+            pthread_mutex_lock(&_log_lock);
+            log_loc* loc = (log_loc*) get_identry(t->index, hdr.id);
+            bool live = loc && loc->seg == no && loc->off == off;
+            pthread_mutex_unlock(&_log_lock);
+
+            if (live)
+                fn((uintptr_t) hdr.id, buf + off + sizeof(hdr), hdr.len, arg);
+        }
+
+        off += _rec_size(hdr.len);
+    }
+
+    free(buf);
+
+    return ok;
+}
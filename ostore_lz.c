@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <string.h>
+#include "ostore_impl.h"
+
+/*
+ * LZ77 block codec of compressed binary records (see ostore_rec.c), in the
+ * style of the LZ4 block format. A block is a sequence of:
+ *
+ *      token       1 byte, literal count in the high nibble and match
+ *                  length - LZ_MIN_MATCH in the low nibble, 15 meaning that
+ *                  extension bytes follow (each adds 0 to 255, a byte of
+ *                  255 means another follows)
+ *      literals    the literal count of bytes, copied as they are
+ *      offset      2 bytes, little-endian: the match is a copy of the bytes
+ *                  this far back in the output (it may overlap the output)
+ *      match       extension bytes of the match length
+ *
+ * The last sequence has literals only and ends the block. The compressor
+ * is greedy, finding matches with a hash table of the positions of 4-byte
+ * prefixes; the decompressor checks every length and offset against the
+ * bounds of its input and output.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+/* hash of the 4 bytes at p */
+static unsigned _hash(const unsigned char* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * write the extension bytes of n (a length beyond 15) at *out, false if
+ * they do not fit before end
+ */
+static bool _put_len(unsigned char** out, const unsigned char* end,
+    size_t n) {
+    for (; n >= 255; n -= 255) {
+        if (*out >= end)
+            return false;
+        *(*out)++ = 255;
+    }
+
+    if (*out >= end)
+        return false;
+
+    *(*out)++ = (unsigned char) n;
+
+    return true;
+}
+
+/*
+ * write a sequence of the literals lit[0..nlit) and, if mlen is not 0, a
+ * match of mlen bytes at offset, false if it does not fit before end
+ */
+static bool _put_seq(unsigned char** out, const unsigned char* end,
+    const unsigned char* lit, size_t nlit, size_t offset, size_t mlen) {
+    size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+    if (*out >= end)
+        return false;
+
+    *(*out)++ = (unsigned char) ((nlit < 15 ? nlit : 15) << 4
+        | (m < 15 ? m : 15));
+
+    if ((nlit >= 15 && !_put_len(out, end, nlit - 15))
+        || (size_t) (end - *out) < nlit)
+        return false;
+
+    memcpy(*out, lit, nlit);
+    *out += nlit;
+
+    if (!mlen)
+        return true;
+
+    if (end - *out < 2)
+        return false;
+
+    *(*out)++ = (unsigned char) offset;
+    *(*out)++ = (unsigned char) (offset >> 8);
+
+    return m < 15 || _put_len(out, end, m - 15);
+}
+
+/* see ostore_impl.h */
+size_t _lz_compress(const char* src, size_t len, char* dst, size_t cap) {
+    const unsigned char* in = (const unsigned char*) src;
+    const unsigned char* lit = in;      /* start of pending literals */
+    unsigned char* out = (unsigned char*) dst;
+    const unsigned char* end = out + cap;
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t i = 0;
+
+    memset(table, 0xff, sizeof(table));
+
+    while (len >= LZ_MIN_MATCH && i <= len - LZ_MIN_MATCH) {
+        unsigned h = _hash(in + i);
+        uint32_t cand = table[h];
+
+        table[h] = (uint32_t) i;
+
+        if (cand == UINT32_MAX || i - cand > LZ_MAX_OFFSET
+            || memcmp(in + cand, in + i, LZ_MIN_MATCH)) {
+            i++;
+            continue;
+        }
+
+        size_t mlen = LZ_MIN_MATCH;
+
+        while (i + mlen < len && in[cand + mlen] == in[i + mlen])
+            mlen++;
+
+        if (!_put_seq(&out, end, lit, in + i - lit, i - cand, mlen))
+            return 0;
+
+        i += mlen;
+        lit = in + i;
+    }
+
+    if (!_put_seq(&out, end, lit, in + len - lit, 0, 0))
+        return 0;
+
+    return out - (unsigned char*) dst;
+}
+
+/*
+ * read the extension bytes of a length at *in (before end) adding them to
+ * *n, false if the input ends first
+ */
+static bool _get_len(const unsigned char** in, const unsigned char* end,
+    size_t* n) {
+    unsigned char b;
+
+    do {
+        if (*in >= end)
+            return false;
+        b = *(*in)++;
+        *n += b;
+    } while (b == 255);
+
+    return true;
+}
+
+/* see ostore_impl.h */
+size_t _lz_decompress(const char* src, size_t len, char* dst, size_t cap) {
+    const unsigned char* in = (const unsigned char*) src;
+    const unsigned char* iend = in + len;
+    unsigned char* out = (unsigned char*) dst;
+    unsigned char* oend = out + cap;
+
+    while (in < iend) {
+        unsigned token = *in++;
+        size_t nlit = token >> 4;
+
+        if ((nlit == 15 && !_get_len(&in, iend, &nlit))
+            || (size_t) (iend - in) < nlit || (size_t) (oend - out) < nlit)
+            return SIZE_MAX;
+
+        memcpy(out, in, nlit);
+        in += nlit;
+        out += nlit;
+
+        if (in == iend)
+            break;      /* the last sequence */
+
+        if (iend - in < 2)
+            return SIZE_MAX;
+
+        size_t offset = in[0] | (size_t) in[1] << 8;
+        size_t mlen = token & 15;
+
+        in += 2;
+
+        if ((mlen == 15 && !_get_len(&in, iend, &mlen)) || !offset
+            || offset > (size_t) (out - (unsigned char*) dst))
+            return SIZE_MAX;
+
+        mlen += LZ_MIN_MATCH;
+
+        if ((size_t) (oend - out) < mlen)
+            return SIZE_MAX;
+
+        /* byte by byte, as the match may overlap what it writes */
+        for (const unsigned char* m = out - offset; mlen--; )
+            *out++ = *m++;
+    }
+
+    return out - (unsigned char*) dst;
+}
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "ostore_impl.h"
+
+/*
+ * In-memory backend of the object store (OSTORE_MEMORY).
+ *
+ * The value of each stored object is kept in a chained hash table by type
+ * and id, so stores, unlinks and loads behave as with the other backends
+ * but do no I/O: what is measured with it is the overhead of the libraries
+ * and of the store itself. Flushing and syncing do nothing. The contents
+ * are dropped when the store is disabled.
+ *
+ * The table doubles when it holds more entries than buckets. All state is
+ * protected by _mem_lock.
+ */
+
+#define MEM_MIN_BUCKETS 1024
+
+/* a stored object */
+typedef struct mem_ent {
+    struct mem_ent* next;   /* in the hash bucket */
+    uintptr_t id;
+    char type[OSTORE_TYPE_MAX + 1];
+    size_t len;
+    char data[];            /* len bytes and a NUL */
+} mem_ent;
+
+static pthread_mutex_t _mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_ent** _mem_buckets = NULL;
+static size_t _mem_nbuckets = 0;    /* a power of 2 */
+static size_t _mem_n = 0;
+
+/* the hash of the object type/id */
+static uint64_t _hash(const char* type, uintptr_t id) {
+    uint64_t h = (uint64_t) id * 0x9e3779b97f4a7c15u;
+
+    for (const char* c = type; *c; c++)
+        h = (h ^ (unsigned char) *c) * 0x100000001b3u;
+
+    return h >> 32;
+}
+
+/* the link to the entry of type/id, or to the NULL ending its bucket */
+static mem_ent** _find(const char* type, uintptr_t id) {
+    mem_ent** p = &_mem_buckets[_hash(type, id) & (_mem_nbuckets - 1)];
+
+    while (*p && ((*p)->id != id || strcmp((*p)->type, type)))
+        p = &(*p)->next;
+
+    return p;
+}
+
+/* double the table, if memory allows. Called with _mem_lock held. */
+static void _grow() {
+    size_t nb = _mem_nbuckets * 2;
+    mem_ent** buckets = (mem_ent**) calloc(nb, sizeof(mem_ent*));
+
+    if (!buckets)
+        return;     /* longer chains */
+
+    for (size_t i = 0; i < _mem_nbuckets; i++) {
+        mem_ent* e = _mem_buckets[i];
+
+        while (e) {
+            mem_ent* next = e->next;
+            mem_ent** b = &buckets[_hash(e->type, e->id) & (nb - 1)];
+
+            e->next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+
+    free(_mem_buckets);
+    _mem_buckets = buckets;
+    _mem_nbuckets = nb;
+}
+
+/* see ostore_impl.h */
+bool _mem_open(const ostore_opts* opts) {
+    pthread_mutex_lock(&_mem_lock);
+    _mem_buckets = (mem_ent**) calloc(MEM_MIN_BUCKETS, sizeof(mem_ent*));
+    _mem_nbuckets = _mem_buckets ? MEM_MIN_BUCKETS : 0;
+    _mem_n = 0;
+    pthread_mutex_unlock(&_mem_lock);
+
+    return _mem_buckets != NULL;
+}
+
+/* see ostore_impl.h */
+void _mem_close() {
+    pthread_mutex_lock(&_mem_lock);
+
+    for (size_t i = 0; i < _mem_nbuckets; i++) {
+        mem_ent* e = _mem_buckets[i];
+
+        while (e) {
+            mem_ent* next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+
+    free(_mem_buckets);
+    _mem_buckets = NULL;
+    _mem_nbuckets = _mem_n = 0;
+    pthread_mutex_unlock(&_mem_lock);
+}
+
+/* see ostore_impl.h */
+bool _mem_store(const char* type, uintptr_t id, const char* data,
+    size_t len) {
+    struct iovec iov = { (void*) data, len };
+
+    return _mem_storev(type, id, &iov, 1, len);
+}
+
+/* see ostore_impl.h */
+bool _mem_storev(const char* type, uintptr_t id, const struct iovec* iov,
+    int n, size_t len) {
+    mem_ent* e = (mem_ent*) malloc(sizeof(mem_ent) + len + 1);
+    size_t at = 0;
+
+    if (!e)
+        return false;
+
+    e->id = id;
+    strncpy(e->type, type, OSTORE_TYPE_MAX);
+    e->type[OSTORE_TYPE_MAX] = '\0';
+    e->len = len;
+
+    for (int i = 0; i < n; i++) {
+        if (iov[i].iov_len)
+            memcpy(e->data + at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+
+    e->data[len] = '\0';
+
+    pthread_mutex_lock(&_mem_lock);
+
+    mem_ent** p = _find(type, id);
+    mem_ent* old = *p;
+
+    /* the new entry takes the place of the old one */
+    e->next = old ? old->next : NULL;
+    *p = e;
+
+    if (!old && ++_mem_n > _mem_nbuckets)
+        _grow();
+
+    pthread_mutex_unlock(&_mem_lock);
+    free(old);
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _mem_unlink(const char* type, uintptr_t id) {
+    pthread_mutex_lock(&_mem_lock);
+
+    mem_ent** p = _find(type, id);
+    mem_ent* e = *p;
+
+    if (e) {
+        *p = e->next;
+        _mem_n--;
+    }
+
+    pthread_mutex_unlock(&_mem_lock);
+    free(e);
+
+    return true;
+}
+
+/* see ostore_impl.h */
+char* _mem_load(const char* type, uintptr_t id, size_t* len) {
+    char* data = NULL;
+
+    pthread_mutex_lock(&_mem_lock);
+
+    mem_ent* e = *_find(type, id);
+
+    if (!e)
+        errno = ENOENT;
+    else if ((data = (char*) malloc(e->len + 1))) {
+        memcpy(data, e->data, e->len + 1);
+        *len = e->len;
+    }
+
+    pthread_mutex_unlock(&_mem_lock);
+
+    return data;
+}
+
+/* see ostore_impl.h */
+bool _mem_flush() {
+    return true;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "ostore_impl.h"
+
+/*
+ * Token-bucket rate limiter of the writes of the object store (see
+ * rate_bytes, rate_ops and rate_burst_ms in ostore_opts).
+ *
+ * There is a bucket of bytes and a bucket of operations, each refilled at
+ * its rate up to the burst it may hold. A batch of operations is admitted
+ * by taking its tokens from both buckets at once. A bucket may go into
+ * debt by a batch larger than it holds, and the batch then waits until the
+ * debt would be repaid, so a burst is spread out at the configured rates
+ * and every writer waits its turn in the order it was admitted.
+ *
+ * Writes go through _ostore_apply, so in sync mode the thread that stores
+ * waits, while in async mode the writer thread does: stores keep being
+ * queued without waiting (until the queue is full, see async_backpressure)
+ * and the writer applies the operations that queued meanwhile as one
+ * larger batch, sharing writes and syncs, when it is admitted again.
+ *
+ * All state is protected by _rate_lock. _rate_on is only written while no
+ * other thread uses the store.
+ */
+
+#define RATE_DEFAULT_BURST_MS 100
+
+/* a token bucket */
+typedef struct bucket {
+    double rate;        /* tokens per ns, 0 if unlimited */
+    double cap;         /* tokens held at most */
+    double tokens;      /* negative if in debt */
+} bucket;
+
+static pthread_mutex_t _rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool _rate_on = false;
+static bucket _rate_bytes;
+static bucket _rate_ops;
+static uint64_t _rate_last = 0;     /* time of the last refill */
+static uint64_t _rate_throttled = 0;
+static uint64_t _rate_throttled_ns = 0;
+
+/* the monotonic time in ns */
+static uint64_t _now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* set b to rate tokens per second with a burst of burst_ms, full */
+static void _set(bucket* b, size_t rate, unsigned burst_ms) {
+    b->rate = rate / 1e9;
+    b->cap = b->tokens = rate * (burst_ms / 1000.0);
+}
+
+/*
+ * take need tokens from b after adding those of ns, returns the ns until b
+ * is out of debt
+ */
+static uint64_t _take(bucket* b, uint64_t ns, double need) {
+    if (!b->rate)
+        return 0;
+
+    b->tokens += ns * b->rate;
+
+    if (b->tokens > b->cap)
+        b->tokens = b->cap;
+
+    b->tokens -= need;
+
+    return b->tokens < 0 ? (uint64_t) (-b->tokens / b->rate) : 0;
+}
+
+/* see ostore_impl.h */
+void _rate_open(const ostore_opts* opts) {
+    unsigned burst = opts && opts->rate_burst_ms ? opts->rate_burst_ms
+        : RATE_DEFAULT_BURST_MS;
+
+    pthread_mutex_lock(&_rate_lock);
+    _set(&_rate_bytes, opts ? opts->rate_bytes : 0, burst);
+    _set(&_rate_ops, opts ? opts->rate_ops : 0, burst);
+    _rate_on = _rate_bytes.rate || _rate_ops.rate;
+    _rate_last = _now();
+    _rate_throttled = _rate_throttled_ns = 0;
+    pthread_mutex_unlock(&_rate_lock);
+}
+
+/* see ostore_impl.h */
+void _rate_close() {
+    pthread_mutex_lock(&_rate_lock);
+    _rate_on = false;
+    pthread_mutex_unlock(&_rate_lock);
+}
+
+/* see ostore_impl.h */
+void _rate_admit(const ostore_op* ops, size_t n) {
+    size_t bytes = 0;
+
+    if (!_rate_on || !n)
+        return;
+
+    for (size_t i = 0; i < n; i++)
+        if (ops[i].op == OSTORE_OP_STORE)
+            bytes += ops[i].len;
+
+    pthread_mutex_lock(&_rate_lock);
+
+    uint64_t now = _now();
+    uint64_t ns = now - _rate_last;
+    uint64_t wait = _take(&_rate_bytes, ns, bytes);
+    uint64_t wait_ops = _take(&_rate_ops, ns, n);
+
+    _rate_last = now;
+
+    if (wait_ops > wait)
+        wait = wait_ops;
+
+    if (wait) {
+        _rate_throttled++;
+        _rate_throttled_ns += wait;
+    }
+
+    pthread_mutex_unlock(&_rate_lock);
+
+    if (wait) {
+        int err = errno;
+        struct timespec ts = { wait / 1000000000u, wait % 1000000000u };
+
+        while (nanosleep(&ts, &ts) && errno == EINTR)
+            ;
+
+        errno = err;
+    }
+}
+
+/* see ostore_impl.h */
+void _rate_stats(uint64_t* throttled, uint64_t* throttled_ns) {
+    pthread_mutex_lock(&_rate_lock);
+    *throttled = _rate_throttled;
+    *throttled_ns = _rate_throttled_ns;
+    pthread_mutex_unlock(&_rate_lock);
+}
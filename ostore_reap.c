@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "id_map.h"
+#include "ostore_impl.h"
+
+/*
+ * Background unlinker of the object store (see ostore_opts.unlink_async):
+ * the reaper.
+ *
+ * unlink_obj adds the object to a set of pending unlinks and returns, so a
+ * delete costs its caller a hash insert instead of a directory update. A
+ * reaper thread takes the pending unlinks in the order they were made and
+ * applies them to the backend in batches of up to REAP_BATCH with
+ * _ostore_apply, each committed as one batch (see _sync_commit). The files
+ * backend removes each file with unlinkat against the cached descriptor of
+ * its type directory (or submits the batch through io_uring) and the log
+ * backend appends the tombstones of a batch together.
+ *
+ * Pending unlinks are kept in an id map (by object id) and in a list in
+ * the order they were made. An entry stays in the map while its batch is
+ * being applied (inflight), so the object is reported as not stored until
+ * its unlink is done:
+ *  - a store of an object with a pending unlink cancels the unlink, as the
+ *    store replaces the value anyway (ids are addresses and are reused by
+ *    new objects); if the unlink is in flight the store waits for it.
+ *  - load_obj of an object with a pending or inflight unlink fails with
+ *    ENOENT without reading the backend.
+ *
+ * If there are more than REAP_MAX_PENDING pending unlinks, the caller of
+ * unlink_obj applies a batch itself. _reap_flush applies all pending
+ * unlinks on the calling thread.
+ *
+ * Batches are applied one at a time (_reap_io_lock); the set and counters
+ * are protected by _reap_lock. _reap_count is also read without the lock
+ * so that stores and loads skip it while nothing is pending.
+ */
+
+#define REAP_MAX_PENDING 65536
+#define REAP_BATCH 64       /* unlinks applied with one _ostore_apply */
+
+/* a pending unlink */
+typedef struct reap_entry {
+    struct reap_entry* prev;    /* in the order the unlinks were made */
+    struct reap_entry* next;
+    uintptr_t id;
+    char type[OSTORE_TYPE_MAX + 1];
+    bool inflight;              /* its batch is being applied */
+} reap_entry;
+
+static pthread_mutex_t _reap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _reap_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _reap_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _reap_idle = PTHREAD_COND_INITIALIZER;
+static pthread_t _reaper;
+static bool _reap_on = false;
+static bool _reap_stopping = false;
+
+static idmap* _reap_index = NULL;       /* id -> reap_entry* */
+static reap_entry* _reap_head = NULL;   /* oldest not in flight */
+static reap_entry* _reap_tail = NULL;
+static size_t _reap_npending = 0;       /* in the list */
+static size_t _reap_count = 0;          /* in the index */
+
+static uint64_t _reap_unlinked = 0;
+static uint64_t _reap_cancelled = 0;
+static uint64_t _reap_batches = 0;
+static int _reap_err = 0;               /* errno of first failed unlink */
+
+/* take e out of the list. Called with _reap_lock held. */
+static void _unlist(reap_entry* e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        _reap_head = e->next;
+
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        _reap_tail = e->prev;
+
+    _reap_npending--;
+}
+
+/* remove e from the index and free it. Called with _reap_lock held. */
+static void _drop(reap_entry* e) {
+    (void) delete_identry(_reap_index, e->id);
+    __atomic_store_n(&_reap_count, _reap_count - 1, __ATOMIC_RELEASE);
+    free(e);
+}
+
+/*
+ * take up to REAP_BATCH pending unlinks and apply them, returns the number
+ * taken. Called with _reap_io_lock held.
+ */
+static size_t _reap_batch() {
+    reap_entry* es[REAP_BATCH];
+    ostore_op ops[REAP_BATCH];
+    size_t n = 0;
+
+    pthread_mutex_lock(&_reap_lock);
+
+    while (n < REAP_BATCH && _reap_head) {
+        reap_entry* e = _reap_head;
+
+        _unlist(e);
+        e->inflight = true;
+        es[n] = e;
+        ops[n].op = OSTORE_OP_UNLINK;
+        ops[n].id = e->id;
+        ops[n].type = e->type;
+        ops[n].data = NULL;
+        ops[n].len = 0;
+        ops[n].iov = NULL;
+        n++;
+    }
+
+    pthread_mutex_unlock(&_reap_lock);
+
+    if (!n)
+        return 0;
+
+    size_t failed = _ostore_apply(ops, n);
+    int err = failed ? (errno ? errno : EIO) : 0;
+
+    if (failed)
+        _stats_fail(err, failed);
+
+    if (!_sync_commit(n) && !err)
+        err = errno ? errno : EIO;
+
+    pthread_mutex_lock(&_reap_lock);
+
+    for (size_t i = 0; i < n; i++)
+        _drop(es[i]);
+
+    _reap_unlinked += n - failed;
+    _reap_batches++;
+
+    if (err && !_reap_err)
+        _reap_err = err;
+
+    pthread_cond_broadcast(&_reap_idle);
+    pthread_mutex_unlock(&_reap_lock);
+
+    return n;
+}
+
+/* apply all pending unlinks */
+static void _reap_all() {
+    /* no batch is in flight once the list is found empty with the lock */
+    pthread_mutex_lock(&_reap_io_lock);
+
+    while (_reap_batch())
+        ;
+
+    pthread_mutex_unlock(&_reap_io_lock);
+}
+
+/* the reaper thread, applies the pending unlinks as they are made */
+static void* _reap_thread(void* arg) {
+    pthread_mutex_lock(&_reap_lock);
+
+    for (;;) {
+        while (!_reap_head && !_reap_stopping)
+            pthread_cond_wait(&_reap_work, &_reap_lock);
+
+        if (!_reap_head)
+            break;      /* stopping, _reap_close applies the rest */
+
+        pthread_mutex_unlock(&_reap_lock);
+        pthread_mutex_lock(&_reap_io_lock);
+        (void) _reap_batch();
+        pthread_mutex_unlock(&_reap_io_lock);
+        pthread_mutex_lock(&_reap_lock);
+    }
+
+    pthread_mutex_unlock(&_reap_lock);
+
+    return NULL;
+}
+
+/* see ostore_impl.h */
+bool _reap_open(const ostore_opts* opts) {
+    _reap_head = _reap_tail = NULL;
+    _reap_npending = _reap_count = 0;
+    _reap_unlinked = _reap_cancelled = _reap_batches = 0;
+    _reap_err = 0;
+    _reap_stopping = false;
+
+    if (!(_reap_index = create_idmap()))
+        return false;
+
+    int err = pthread_create(&_reaper, NULL, _reap_thread, NULL);
+
+    if (err) {
+        delete_idmap(&_reap_index);
+        errno = err;
+        return false;
+    }
+
+    _reap_on = true;
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _reap_close() {
+    if (!_reap_on)
+        return true;
+
+    pthread_mutex_lock(&_reap_lock);
+    _reap_stopping = true;
+    pthread_cond_signal(&_reap_work);
+    pthread_mutex_unlock(&_reap_lock);
+
+    pthread_join(_reaper, NULL);
+
+    bool ok = _reap_flush();
+
+    delete_idmap(&_reap_index);
+    _reap_on = false;
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _reap_unlink(const char* type, uintptr_t id) {
+    reap_entry* e = (reap_entry*) calloc(1, sizeof(reap_entry));
+
+    if (!e)
+        return false;
+
+    e->id = id;
+    strncpy(e->type, type, OSTORE_TYPE_MAX);
+
+    pthread_mutex_lock(&_reap_lock);
+
+    reap_entry* old;
+
+    while ((old = (reap_entry*) get_identry(_reap_index, id))) {
+        if (!old->inflight && !strcmp(old->type, type)) {
+            /* already pending */
+            pthread_mutex_unlock(&_reap_lock);
+            free(e);
+            return true;
+        }
+
+        if (old->inflight) {
+            pthread_cond_wait(&_reap_idle, &_reap_lock);
+            continue;
+        }
+
+        /* the id of an object of another type: unlink that one first */
+        pthread_mutex_unlock(&_reap_lock);
+        _reap_all();
+        pthread_mutex_lock(&_reap_lock);
+    }
+
+    if (!set_identry(_reap_index, id, e)) {
+        pthread_mutex_unlock(&_reap_lock);
+        free(e);
+        return false;
+    }
+
+    e->prev = _reap_tail;
+
+    if (_reap_tail)
+        _reap_tail->next = e;
+    else
+        _reap_head = e;
+
+    _reap_tail = e;
+    __atomic_store_n(&_reap_count, _reap_count + 1, __ATOMIC_RELEASE);
+
+    bool full = ++_reap_npending > REAP_MAX_PENDING;
+
+    pthread_cond_signal(&_reap_work);
+    pthread_mutex_unlock(&_reap_lock);
+
+    if (full) {
+        pthread_mutex_lock(&_reap_io_lock);
+        (void) _reap_batch();
+        pthread_mutex_unlock(&_reap_io_lock);
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+void _reap_on_store(const char* type, uintptr_t id) {
+    if (!__atomic_load_n(&_reap_count, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&_reap_lock);
+
+    reap_entry* e;
+
+    while ((e = (reap_entry*) get_identry(_reap_index, id))
+        && !strcmp(e->type, type)) {
+        if (e->inflight) {
+            pthread_cond_wait(&_reap_idle, &_reap_lock);
+            continue;
+        }
+
+        /* the store replaces the value */
+        _unlist(e);
+        _reap_cancelled++;
+        _drop(e);
+        break;
+    }
+
+    pthread_mutex_unlock(&_reap_lock);
+}
+
+/* see ostore_impl.h */
+bool _reap_pending(const char* type, uintptr_t id) {
+    if (!__atomic_load_n(&_reap_count, __ATOMIC_ACQUIRE))
+        return false;
+
+    pthread_mutex_lock(&_reap_lock);
+
+    reap_entry* e = (reap_entry*) get_identry(_reap_index, id);
+    bool pending = e && !strcmp(e->type, type);
+
+    pthread_mutex_unlock(&_reap_lock);
+
+    return pending;
+}
+
+/* see ostore_impl.h */
+bool _reap_flush() {
+    _reap_all();
+
+    pthread_mutex_lock(&_reap_lock);
+    int err = _reap_err;
+    _reap_err = 0;
+    pthread_mutex_unlock(&_reap_lock);
+
+    errno = err;
+
+    return !err;
+}
+
+/* see ostore_impl.h */
+void _reap_stats(ostore_unlink_stats* stats) {
+    pthread_mutex_lock(&_reap_lock);
+    stats->pending = _reap_count;
+    stats->unlinked = _reap_unlinked;
+    stats->cancelled = _reap_cancelled;
+    stats->batches = _reap_batches;
+    pthread_mutex_unlock(&_reap_lock);
+}
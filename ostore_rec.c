@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include "ostore_impl.h"
+
+/*
+ * Binary record format of the object store (see OSTORE_FMT_BINARY in
+ * obj_store.h).
+ *
+ * A record is:
+ *
+ *      tag         1 byte, OSTORE_REC_MAGIC | kind (REC_RAW, REC_INT or
+ *                  REC_STR), with REC_LZ set if the payload is compressed
+ *      id          varint (LEB128) of the object id
+ *      len         varint of the payload length
+ *      payload     len bytes: for REC_INT the zig-zag varint of the value,
+ *                  for REC_STR the bytes of the string, for REC_RAW the
+ *                  value string as given to store_obj
+ *      crc         CRC32C of all the preceding bytes, little-endian
+ *
+ * Every field is either of fixed size or prefixed by its length, so a
+ * reader never scans for a delimiter. The magic nibble of the tag cannot
+ * be the first byte of a value string of the text format (a digit for
+ * "int" and "str"), which lets a reader or the converter tell the two
+ * layouts apart.
+ *
+ * The kind is chosen from the type name: the value strings of "int"
+ * ("%d\n", see integer.c) and "str" ("%d:%s\n", see string_o.c) are
+ * parsed to REC_INT and REC_STR payloads and converted back exactly by
+ * _rec_text. Value strings that do not parse, and those of other types,
+ * are stored as REC_RAW.
+ *
+ * With ostore_opts.compress_min, a payload of at least that many bytes is
+ * compressed with the LZ codec of ostore_lz.c and REC_LZ is set in the 
+ * tag. The payload is then the varint of the uncompressed length followed
+ * by the compressed block. A payload that does not get smaller is stored
+ * uncompressed. The checksum covers the record as stored, so a corrupt 
+ * record is detected before it is decompressed.
+ */
+
+#define REC_MAGIC_MASK 0xf0
+#define REC_RAW 0
+#define REC_INT 1
+#define REC_STR 2
+#define REC_LZ 0x08         /* flag of a compressed payload */
+
+#define LZ_STACK 4096       /* payloads up to this size are compressed on 
+                             * the stack */
+#define LZ_RAW_MAX (1 << 26)    /* limit of an uncompressed length */
+
+static size_t _compress_min = 0;    /* 0: payloads are not compressed */
+
+static const char* INT_TYPE = "int";
+static const char* STR_TYPE = "str";
+
+/*
+ * CRC32C (Castagnoli, reflected polynomial 0x82f63b78), slicing by 8. The
+ * tables are built on first use.
+ */
+static uint32_t _crc_table[8][256];
+static pthread_once_t _crc_once = PTHREAD_ONCE_INIT;
+
+static void _crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+
+        _crc_table[0][i] = c;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            _crc_table[t][i] = (_crc_table[t - 1][i] >> 8)
+                ^ _crc_table[0][_crc_table[t - 1][i] & 0xff];
+}
+
+/* see ostore_impl.h */
+uint32_t _crc32c(uint32_t crc, const void* buf, size_t len) {
+    const unsigned char* p = (const unsigned char*) buf;
+
+    pthread_once(&_crc_once, _crc_init);
+    crc = ~crc;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8
+            | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+
+        crc = _crc_table[7][lo & 0xff] ^ _crc_table[6][(lo >> 8) & 0xff]
+            ^ _crc_table[5][(lo >> 16) & 0xff] ^ _crc_table[4][lo >> 24]
+            ^ _crc_table[3][p[4]] ^ _crc_table[2][p[5]]
+            ^ _crc_table[1][p[6]] ^ _crc_table[0][p[7]];
+    }
+
+    while (len--)
+        crc = (crc >> 8) ^ _crc_table[0][(crc ^ *p++) & 0xff];
+
+    return ~crc;
+}
+
+/* write v as a varint at p, returns the number of bytes written */
+static size_t _put_varint(char* p, uint64_t v) {
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (char) (v | 0x80);
+        v >>= 7;
+    }
+
+    p[n++] = (char) v;
+
+    return n;
+}
+
+/* read a varint from p[0..len) into *v, returns its length or 0 */
+static size_t _get_varint(const char* p, size_t len, uint64_t* v) {
+    uint64_t r = 0;
+
+    for (size_t n = 0; n < len && n < 10; n++) {
+        unsigned char b = (unsigned char) p[n];
+
+        r |= (uint64_t) (b & 0x7f) << (7 * n);
+
+        if (!(b & 0x80)) {
+            *v = r;
+            return n + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* see ostore_impl.h */
+void _rec_open(const ostore_opts* opts) {
+    _compress_min = opts ? opts->compress_min : 0;
+}
+
+/* frame the payload of a record of kind at buf, returns the record size */
+static size_t _frame(char* buf, int kind, uintptr_t id, const char* payload,
+    size_t plen) {
+    size_t n = 0;
+
+    /* compressed only if it makes the payload smaller */
+    if (_compress_min && !(kind & REC_LZ) && plen >= _compress_min 
+        && plen > 10) {
+        char stack[LZ_STACK];
+        char* lz = plen <= sizeof(stack) ? stack : (char*) malloc(plen);
+        size_t hlen = lz ? _put_varint(lz, plen) : 0;
+        size_t blen = lz ? _lz_compress(payload, plen, lz + hlen, 
+            plen - hlen - 1) : 0;
+
+        if (blen)
+            n = _frame(buf, kind | REC_LZ, id, lz, hlen + blen);
+
+        if (lz != stack)
+            free(lz);
+
+        if (n)
+            return n;
+    }
+
+    buf[n++] = (char) (OSTORE_REC_MAGIC | kind);
+    n += _put_varint(buf + n, id);
+    n += _put_varint(buf + n, plen);
+    memmove(buf + n, payload, plen);
+    n += plen;
+
+    uint32_t crc = _crc32c(0, buf, n);
+
+    for (int i = 0; i < 4; i++)
+        buf[n++] = (char) (crc >> (8 * i));
+
+    return n;
+}
+
+/* 
+ * parse the text of an int ("%d\n") into *val, false unless the text is 
+ * exactly what "%d\n" formats for *val (so that _rec_text restores it)
+ */
+static bool _parse_int(const char* text, size_t len, int* val) {
+    const char* digits = text[0] == '-' ? text + 1 : text;
+    char* end;
+
+    if (len < 2 || text[len - 1] != '\n' || *digits < '0' || *digits > '9'
+        || (*digits == '0' && (digits != text || len != 2)))
+        return false;
+
+    errno = 0;
+    long v = strtol(text, &end, 10);
+
+    if (errno || end != text + len - 1 || v < INT_MIN || v > INT_MAX)
+        return false;
+
+    *val = (int) v;
+
+    return true;
+}
+
+/* see ostore_impl.h */
+size_t _rec_encode_int(char* buf, uintptr_t id, int val) {
+    char payload[10];
+    int64_t v = val;
+    size_t plen = _put_varint(payload, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+
+    return _frame(buf, REC_INT, id, payload, plen);
+}
+
+/* see ostore_impl.h */
+size_t _rec_encode(char* buf, const char* type, uintptr_t id,
+    const char* text, size_t len) {
+    int val;
+
+    if (!strcmp(type, INT_TYPE) && _parse_int(text, len, &val))
+        return _rec_encode_int(buf, id, val);
+
+    if (!strcmp(type, STR_TYPE) && len >= 3 && text[len - 1] == '\n') {
+        const char* colon = (const char*) memchr(text, ':', len);
+        char* end;
+
+        /* the length prefix must match, as _rec_text writes it back */
+        if (colon && colon > text && text[0] >= '0' && text[0] <= '9') {
+            unsigned long slen = strtoul(text, &end, 10);
+
+            if (end == colon && slen == len - (colon - text) - 2)
+                return _frame(buf, REC_STR, id, colon + 1, slen);
+        }
+    }
+
+    return _frame(buf, REC_RAW, id, text, len);
+}
+
+/* see ostore_impl.h */
+bool _rec_is_binary(const char* buf, size_t len) {
+    return len > 0
+        && ((unsigned char) buf[0] & REC_MAGIC_MASK) == OSTORE_REC_MAGIC;
+}
+
+/* see ostore_impl.h */
+size_t _rec_length(const char* buf, size_t len) {
+    uint64_t id, plen;
+    size_t n = 1, k;
+
+    if (!_rec_is_binary(buf, len) 
+        || !(k = _get_varint(buf + n, len - n, &id))
+        || !(n += k, k = _get_varint(buf + n, len - n, &plen))
+        || (n += k, plen > len || len - n < plen + 4))
+        return 0;
+
+    return n + plen + 4;
+}
+
+/* see ostore_impl.h */
+bool _rec_decode(const char* buf, size_t len, ostore_rec* rec) {
+    uint64_t id, plen;
+    size_t n = 1, k;
+
+    if (!_rec_is_binary(buf, len)
+        || ((rec->kind = (unsigned char) buf[0] & ~REC_MAGIC_MASK) 
+            & ~REC_LZ) > REC_STR
+        || !(k = _get_varint(buf + n, len - n, &id))
+        || !(n += k, k = _get_varint(buf + n, len - n, &plen))
+        || (n += k, len < n + 4 || plen != len - n - 4)) {
+        errno = EBADMSG;
+        return false;
+    }
+
+    uint32_t crc = 0;
+
+    for (int i = 0; i < 4; i++)
+        crc |= (uint32_t) (unsigned char) buf[n + plen + i] << (8 * i);
+
+    if (crc != _crc32c(0, buf, n + plen)) {
+        errno = EBADMSG;
+        return false;
+    }
+
+    rec->id = (uintptr_t) id;
+    rec->payload = buf + n;
+    rec->len = plen;
+
+    return true;
+}
+
+/* the value string of the compressed record rec, see _rec_text */
+static char* _lz_text(const ostore_rec* rec, size_t* len) {
+    ostore_rec raw = *rec;
+    uint64_t rlen;
+    size_t hlen = _get_varint(rec->payload, rec->len, &rlen);
+
+    if (!hlen || rlen > LZ_RAW_MAX) {
+        errno = EBADMSG;
+        return NULL;
+    }
+
+    char* payload = (char*) malloc(rlen ? rlen : 1);
+
+    if (!payload)
+        return NULL;
+
+    char* text = NULL;
+
+    if (_lz_decompress(rec->payload + hlen, rec->len - hlen, payload, rlen)
+        == rlen) {
+        raw.kind &= ~REC_LZ;
+        raw.payload = payload;
+        raw.len = rlen;
+        text = _rec_text(&raw, len);
+    } else {
+        errno = EBADMSG;
+    }
+
+    free(payload);
+
+    return text;
+}
+
+/* see ostore_impl.h */
+char* _rec_text(const ostore_rec* rec, size_t* len) {
+    char* text = NULL;
+    uint64_t v = 0;
+    int r = -1;
+
+    if (rec->kind & REC_LZ)
+        return _lz_text(rec, len);
+
+    errno = EBADMSG;
+
+    if (rec->kind == REC_INT) {
+        if (_get_varint(rec->payload, rec->len, &v) == rec->len) {
+            int64_t val = (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+            r = asprintf(&text, "%d\n", (int) val);
+        }
+    } else if (rec->kind == REC_STR) {
+        r = asprintf(&text, "%zu:%.*s\n", rec->len, (int) rec->len,
+            rec->payload);
+    } else if ((text = (char*) malloc(rec->len + 1))) {
+        memcpy(text, rec->payload, rec->len);
+        text[rec->len] = '\0';
+        r = (int) rec->len;
+    }
+
+    if (r < 0) {
+        if (text)
+            errno = ENOMEM;
+        free(text);
+        return NULL;
+    }
+
+    *len = (size_t) r;
+
+    return text;
+}
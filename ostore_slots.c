@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "id_map.h"
+#include "ostore_impl.h"
+
+/*
+ * Fixed-slot store of the object store.
+ *
+ * Objects of one small fixed-size type (e.g. int, whose value strings are
+ * at most 12 bytes) are kept in a single slot file, ostore/<type>.slots,
+ * that is memory-mapped shared. The file is a slot_hdr followed by an
+ * array of slots. A slot is free if its len is 0.
+ *
+ * An id map from object id to slot number + 1 and a free list of slot
+ * numbers are kept in memory and rebuilt from the file when it is opened.
+ * Storing an object is a copy into its slot (a new object takes a slot
+ * from the free list) and unlinking it clears the slot, so neither makes a
+ * system call unless the file has to grow. The data and id of a slot are
+ * written before its len, so a slot with a non-zero len is complete.
+ *
+ * The mapping is written back to the file by the kernel or by msync when
+ * the durability policy syncs (_slots_sync).
+ */
+
+#define SLOTS_MAGIC "OSLOTS1"
+#define SLOTS_INIT 1024             /* slots in a new file */
+
+/* header of a slot file */
+typedef struct slot_hdr {
+    char magic[8];
+    uint32_t slot_size;             /* sizeof(slot) */
+    char pad[20];
+} slot_hdr;
+
+/* a slot */
+typedef struct slot {
+    uint64_t id;
+    uint32_t len;                   /* length of data, 0 if free */
+    char data[OSTORE_SLOT_DATA];
+} slot;
+
+static pthread_mutex_t _slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static char _slots_type_name[OSTORE_TYPE_MAX + 1];
+static bool _slots_on = false;
+static int _slots_fd = -1;
+static char* _slots_map = NULL;
+static size_t _slots_map_sz;
+static uint32_t _slots_n;           /* number of slots in the file */
+static idmap* _slots_index = NULL;  /* id -> slot number + 1 */
+static uint32_t* _slots_free = NULL;/* free list (a stack) */
+static uint32_t _slots_nfree;
+
+/* slot number i of the mapping */
+static slot* _slot(uint32_t i) {
+    return (slot*) (_slots_map + sizeof(slot_hdr)) + i;
+}
+
+/* size of a slot file of n slots */
+static size_t _file_size(uint32_t n) {
+    return sizeof(slot_hdr) + (size_t) n * sizeof(slot);
+}
+
+/*
+ * resize the file and mapping to n slots and push the new slots on the
+ * free list (highest first, so that low slots are used first)
+ */
+static bool _grow(uint32_t n) {
+    uint32_t* fl = (uint32_t*) realloc(_slots_free, n * sizeof(uint32_t));
+
+    if (!fl)
+        return false;
+
+    _slots_free = fl;
+
+    if (ftruncate(_slots_fd, _file_size(n)))
+        return false;
+
+    void* map = _slots_map
+        ? mremap(_slots_map, _slots_map_sz, _file_size(n), MREMAP_MAYMOVE)
+        : mmap(NULL, _file_size(n), PROT_READ | PROT_WRITE, MAP_SHARED,
+            _slots_fd, 0);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    _slots_map = (char*) map;
+    _slots_map_sz = _file_size(n);
+
+    for (uint32_t i = n; i > _slots_n; i--)
+        _slots_free[_slots_nfree++] = i - 1;
+
+    _slots_n = n;
+
+    return true;
+}
+
+/*
+ * rebuild the index and free list from an existing file of n slots, grown
+ * to at least SLOTS_INIT
+ */
+static bool _load(uint32_t n) {
+    if (!_grow(n < SLOTS_INIT ? SLOTS_INIT : n))
+        return false;
+
+    _slots_nfree = 0;
+
+    for (uint32_t i = _slots_n; i > 0; i--) {
+        slot* s = _slot(i - 1);
+
+        if (s->len == 0 || s->len > OSTORE_SLOT_DATA) {
+            s->len = 0;
+            _slots_free[_slots_nfree++] = i - 1;
+            continue;
+        }
+
+        uintptr_t old = (uintptr_t) get_identry(_slots_index, s->id);
+
+        if (old) {
+            /* a duplicate left by a crash, keep the higher slot */
+            s->len = 0;
+            _slots_free[_slots_nfree++] = i - 1;
+        } else if (!set_identry(_slots_index, s->id, (void*) (uintptr_t) i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _slots_open(const char* type) {
+    char path[OSTORE_PATH_MAX];
+    struct stat sbuf;
+    slot_hdr hdr;
+
+    snprintf(path, sizeof(path), "%s/%s.slots", OSTORE_DIRNAME, type);
+
+    _slots_n = _slots_nfree = 0;
+
+    if ((_slots_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0
+        || fstat(_slots_fd, &sbuf)
+        || !(_slots_index = create_idmap()))
+        goto fail;
+
+    if (sbuf.st_size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SLOTS_MAGIC, sizeof(hdr.magic));
+        hdr.slot_size = sizeof(slot);
+
+        if (pwrite(_slots_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+            || !_grow(SLOTS_INIT))
+            goto fail;
+    } else {
+        if (pread(_slots_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+            || memcmp(hdr.magic, SLOTS_MAGIC, sizeof(hdr.magic))
+            || hdr.slot_size != sizeof(slot)) {
+            errno = EINVAL;     /* not a slot file of this layout */
+            goto fail;
+        }
+
+        if (!_load((sbuf.st_size - sizeof(hdr)) / sizeof(slot)))
+            goto fail;
+    }
+
+    strncpy(_slots_type_name, type, OSTORE_TYPE_MAX);
+    _slots_on = true;
+
+    return true;
+
+fail: ;
+    int err = errno;
+    _slots_close();
+    errno = err;
+
+    return false;
+}
+
+/* see ostore_impl.h */
+void _slots_close() {
+    if (_slots_map)
+        munmap(_slots_map, _slots_map_sz);
+
+    if (_slots_fd >= 0)
+        close(_slots_fd);
+
+    delete_idmap(&_slots_index);
+    free(_slots_free);
+
+    _slots_map = NULL;
+    _slots_fd = -1;
+    _slots_free = NULL;
+    _slots_n = _slots_nfree = 0;
+    _slots_on = false;
+}
+
+/* see ostore_impl.h */
+bool _slots_type(const char* type) {
+    return _slots_on && !strcmp(type, _slots_type_name);
+}
+
+/* see ostore_impl.h */
+bool _slots_store(uintptr_t id, const char* data, size_t len) {
+    if (len == 0 || len > OSTORE_SLOT_DATA) {
+        errno = EINVAL;
+        return false;
+    }
+
+    pthread_mutex_lock(&_slots_lock);
+
+    uintptr_t i = (uintptr_t) get_identry(_slots_index, id);
+    bool ok = true;
+
+    if (!i) {
+        ok = (_slots_nfree
+            || _grow(_slots_n < SLOTS_INIT ? SLOTS_INIT : _slots_n * 2))
+            && set_identry(_slots_index, id,
+                (void*) (uintptr_t) (_slots_free[_slots_nfree - 1] + 1));
+
+        if (ok)
+            i = _slots_free[--_slots_nfree] + 1;
+    }
+
+    if (ok) {
+        slot* s = _slot(i - 1);
+
+        /* clear the slot while it is rewritten */
+        __atomic_store_n(&s->len, 0, __ATOMIC_RELEASE);
+        s->id = id;
+        memcpy(s->data, data, len);
+        memset(s->data + len, 0, OSTORE_SLOT_DATA - len);
+        __atomic_store_n(&s->len, (uint32_t) len, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&_slots_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _slots_unlink(uintptr_t id) {
+    pthread_mutex_lock(&_slots_lock);
+
+    uintptr_t i = (uintptr_t) delete_identry(_slots_index, id);
+
+    if (i) {
+        slot* s = _slot(i - 1);
+
+        __atomic_store_n(&s->len, 0, __ATOMIC_RELEASE);
+        memset(s->data, 0, OSTORE_SLOT_DATA);
+        _slots_free[_slots_nfree++] = i - 1;
+    }
+
+    pthread_mutex_unlock(&_slots_lock);
+
+    return true;
+}
+
+/* see ostore_impl.h */
+size_t _slots_load(uintptr_t id, char* buf) {
+    size_t len = 0;
+
+    pthread_mutex_lock(&_slots_lock);
+
+    uintptr_t i = _slots_on ? (uintptr_t) get_identry(_slots_index, id) : 0;
+
+    if (i) {
+        slot* s = _slot(i - 1);
+
+        len = s->len;
+        memcpy(buf, s->data, len);
+    }
+
+    pthread_mutex_unlock(&_slots_lock);
+
+    return len;
+}
+
+/* see ostore_impl.h */
+bool _slots_sync() {
+    pthread_mutex_lock(&_slots_lock);
+    bool ok = !_slots_on || msync(_slots_map, _slots_map_sz, MS_SYNC) == 0;
+
+    if (_slots_on)
+        _stats_sys(1);
+    pthread_mutex_unlock(&_slots_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _slots_scan(ostore_scan_fn fn, void* arg) {
+    pthread_mutex_lock(&_slots_lock);
+
+    for (uint32_t i = 0; _slots_on && i < _slots_n; i++) {
+        slot* s = _slot(i);
+
+        if (s->len)
+            fn((uintptr_t) s->id, s->data, s->len, arg);
+    }
+
+    pthread_mutex_unlock(&_slots_lock);
+
+    return true;
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "ostore_impl.h"
+
+/*
+ * Instrumentation of the object store (see ostore_opts.stats and
+ * stats_ostore in obj_store.h).
+ *
+ * Each store_obj, store_int_obj, unlink_obj and load_obj call is timed with
+ * CLOCK_MONOTONIC and its latency in ns counted in the histogram of its
+ * operation and type. A histogram has HDR-style log-linear buckets: values
+ * below 8 ns have a bucket each and every power of two above is split into
+ * 8 buckets, so a bucket is at most 12.5% wide relative to its values, up
+ * to 2^42 ns (about 73 minutes); longer latencies are counted in the last
+ * bucket. The other counters are the bytes and number of records applied
+ * to the backend, the system calls made by the backends (_stats_sys) and
+ * failures by errno.
+ *
+ * Counters are updated with relaxed atomic additions and read without a
+ * lock, so a snapshot taken while operations run may be slightly torn
+ * between counters. The type table is searched without the lock as the
+ * typedir cache of obj_store.c is, and entries are added under it.
+ *
+ * If OSTORE_NO_STATS is defined, the hooks in ostore_impl.h are empty and
+ * stats_ostore and dump_stats_ostore fail with ENOTSUP.
+ */
+
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+
+/* the highest latency counted in bucket b */
+static uint64_t _bucket_top(unsigned b) {
+    if (b < SUB_COUNT)
+        return b;
+
+    unsigned e = b / SUB_COUNT + SUB_BITS - 1;
+    uint64_t sub = b % SUB_COUNT;
+
+    return ((SUB_COUNT + sub + 1) << (e - SUB_BITS)) - 1;
+}
+
+/* see ostore_impl.h */
+uint64_t _stats_percentile(const ostore_hist* h, double pct) {
+    uint64_t count = 0;
+
+    for (unsigned b = 0; b < OSTORE_HIST_BUCKETS; b++)
+        count += h->buckets[b];
+
+    if (!count)
+        return 0;
+
+    /* the rank of the percentile, at least the first value */
+    uint64_t rank = (uint64_t) (pct / 100.0 * count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+
+    for (unsigned b = 0; b < OSTORE_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+
+        if (seen >= rank) {
+            uint64_t top = _bucket_top(b);
+            return top < h->max_ns ? top : h->max_ns;
+        }
+    }
+
+    return h->max_ns;
+}
+
+#ifndef OSTORE_NO_STATS
+
+bool _stats_on = false;
+uint64_t _stats_nsys = 0;
+
+static pthread_mutex_t _stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static ostore_stats _stats;     /* the counters, zeroed by _stats_open */
+static size_t _stats_ntypes = 0;
+
+static const char* OP_NAMES[OSTORE_STAT_OPS] = { "store", "unlink", "load" };
+
+/* the bucket of a latency of v ns */
+static unsigned _bucket(uint64_t v) {
+    if (v < SUB_COUNT)
+        return (unsigned) v;
+
+    unsigned e = 63 - __builtin_clzll(v);    /* v is in [2^e, 2^(e+1)) */
+    unsigned b = (e - SUB_BITS + 1) * SUB_COUNT
+        + (unsigned) ((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+
+    return b < OSTORE_HIST_BUCKETS ? b : OSTORE_HIST_BUCKETS - 1;
+}
+
+/* the per-type counters of type, or of the other types if the table is full */
+static ostore_type_stats* _type_stats(const char* type) {
+    size_t n = __atomic_load_n(&_stats_ntypes, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i < n; i++)
+        if (!strcmp(_stats.types[i].type, type))
+            return &_stats.types[i];
+
+    pthread_mutex_lock(&_stats_lock);
+
+    size_t i;
+
+    for (i = n; i < _stats_ntypes; i++)
+        if (!strcmp(_stats.types[i].type, type))
+            break;
+
+    if (i == _stats_ntypes && i < OSTORE_STATS_TYPES - 1) {
+        strncpy(_stats.types[i].type, type, OSTORE_TYPE_MAX);
+        __atomic_store_n(&_stats_ntypes, i + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&_stats_lock);
+
+    return &_stats.types[i < OSTORE_STATS_TYPES ? i
+        : OSTORE_STATS_TYPES - 1];
+}
+
+/* count a failure with err */
+static void _fail(int err, size_t n) {
+    if (err <= 0 || err >= OSTORE_STATS_ERRNO_MAX)
+        err = 0;    /* unknown */
+
+    __atomic_fetch_add(&_stats.failures[err], n, __ATOMIC_RELAXED);
+}
+
+/* see ostore_impl.h */
+void _stats_open(const ostore_opts* opts) {
+    memset(&_stats, 0, sizeof(_stats));
+    _stats_ntypes = 0;
+    _stats_nsys = 0;
+    strcpy(_stats.types[OSTORE_STATS_TYPES - 1].type, "*");
+    _stats_on = opts && opts->stats;
+}
+
+/* see ostore_impl.h */
+void _stats_close() {
+    _stats_on = false;
+}
+
+/* see ostore_impl.h */
+uint64_t _stats_start() {
+    struct timespec ts;
+
+    if (!_stats_on)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* see ostore_impl.h */
+void _stats_op(ostore_stat_op op, const char* type, uint64_t start,
+    bool ok) {
+    if (!_stats_on || !type)
+        return;
+
+    int err = errno;
+    uint64_t ns = _stats_start() - start;
+    ostore_hist* h = &_type_stats(type)->ops[op];
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    if (!ok)
+        _fail(err, 1);
+
+    errno = err;
+}
+
+/* see ostore_impl.h */
+void _stats_apply(const ostore_op* ops, size_t n) {
+    uint64_t bytes = 0, records = 0;
+
+    if (!_stats_on)
+        return;
+
+    for (size_t i = 0; i < n; i++) {
+        if (ops[i].op == OSTORE_OP_STORE) {
+            bytes += ops[i].len;
+            records++;
+        }
+    }
+
+    __atomic_fetch_add(&_stats.bytes_written, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&_stats.records_written, records, __ATOMIC_RELAXED);
+}
+
+/* see ostore_impl.h */
+void _stats_fail(int err, size_t n) {
+    if (_stats_on && n)
+        _fail(err, n);
+}
+
+/* see ostore_impl.h */
+void _stats_queue(size_t depth) {
+    if (!_stats_on)
+        return;
+
+    size_t max = __atomic_load_n(&_stats.queue_max, __ATOMIC_RELAXED);
+
+    while (depth > max && !__atomic_compare_exchange_n(&_stats.queue_max,
+        &max, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* copy the counters to stats */
+static void _snapshot(ostore_stats* stats) {
+    size_t n = __atomic_load_n(&_stats_ntypes, __ATOMIC_ACQUIRE);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes_written = __atomic_load_n(&_stats.bytes_written,
+        __ATOMIC_RELAXED);
+    stats->records_written = __atomic_load_n(&_stats.records_written,
+        __ATOMIC_RELAXED);
+    stats->syscalls = __atomic_load_n(&_stats_nsys, __ATOMIC_RELAXED);
+    stats->queue_max = __atomic_load_n(&_stats.queue_max, __ATOMIC_RELAXED);
+    stats->queue_depth = _async_depth();
+
+    for (int e = 0; e < OSTORE_STATS_ERRNO_MAX; e++)
+        stats->failures[e] = __atomic_load_n(&_stats.failures[e],
+            __ATOMIC_RELAXED);
+
+    /* the listed types, then the other types if any were counted */
+    for (size_t i = 0; i <= n && i < OSTORE_STATS_TYPES; i++) {
+        size_t t = i < n ? i : OSTORE_STATS_TYPES - 1;
+        ostore_type_stats* src = &_stats.types[t];
+        ostore_type_stats* dst = &stats->types[stats->ntypes];
+        uint64_t count = 0;
+
+        memcpy(dst->type, src->type, sizeof(dst->type));
+
+        for (int op = 0; op < OSTORE_STAT_OPS; op++) {
+            ostore_hist* h = &src->ops[op];
+
+            dst->ops[op].count = __atomic_load_n(&h->count,
+                __ATOMIC_RELAXED);
+            dst->ops[op].total_ns = __atomic_load_n(&h->total_ns,
+                __ATOMIC_RELAXED);
+            dst->ops[op].max_ns = __atomic_load_n(&h->max_ns,
+                __ATOMIC_RELAXED);
+
+            for (int b = 0; b < OSTORE_HIST_BUCKETS; b++)
+                dst->ops[op].buckets[b] = __atomic_load_n(&h->buckets[b],
+                    __ATOMIC_RELAXED);
+
+            count += dst->ops[op].count;
+        }
+
+        if (i < n || count)
+            stats->ntypes++;
+    }
+}
+
+/* see ostore_impl.h */
+bool _stats_get(ostore_stats* stats) {
+    _snapshot(stats);
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _stats_dump(FILE* stream) {
+    ostore_stats* stats = (ostore_stats*) malloc(sizeof(ostore_stats));
+    int r = 0;
+
+    if (!stats)
+        return false;
+
+    _snapshot(stats);
+
+    r |= fprintf(stream, "records written %llu, bytes written %llu, "
+        "system calls %llu\n", (unsigned long long) stats->records_written,
+        (unsigned long long) stats->bytes_written,
+        (unsigned long long) stats->syscalls) < 0;
+    r |= fprintf(stream, "async queue depth %zu, max %zu\n",
+        stats->queue_depth, stats->queue_max) < 0;
+
+    for (int e = 0; e < OSTORE_STATS_ERRNO_MAX; e++)
+        if (stats->failures[e])
+            r |= fprintf(stream, "failures %s: %llu\n",
+                e ? strerror(e) : "unknown",
+                (unsigned long long) stats->failures[e]) < 0;
+
+    r |= fprintf(stream, "%-12s %-6s %10s %10s %10s %10s %10s %10s\n",
+        "type", "op", "count", "mean(ns)", "p50", "p99", "p99.9",
+        "max") < 0;
+
+    for (size_t i = 0; i < stats->ntypes; i++) {
+        for (int op = 0; op < OSTORE_STAT_OPS; op++) {
+            ostore_hist* h = &stats->types[i].ops[op];
+
+            if (!h->count)
+                continue;
+
+            r |= fprintf(stream,
+                "%-12s %-6s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                stats->types[i].type, OP_NAMES[op],
+                (unsigned long long) h->count,
+                (unsigned long long) (h->total_ns / h->count),
+                (unsigned long long) _stats_percentile(h, 50),
+                (unsigned long long) _stats_percentile(h, 99),
+                (unsigned long long) _stats_percentile(h, 99.9),
+                (unsigned long long) h->max_ns) < 0;
+        }
+    }
+
+    free(stats);
+
+    if (r && !errno)
+        errno = EIO;
+
+    return !r;
+}
+
+#else
+
+/* see ostore_impl.h */
+bool _stats_get(ostore_stats* stats) {
+    errno = ENOTSUP;
+    return false;
+}
+
+/* see ostore_impl.h */
+bool _stats_dump(FILE* stream) {
+    errno = ENOTSUP;
+    return false;
+}
+
+#endif
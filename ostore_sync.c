@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "ostore_impl.h"
+
+/*
+ * Durability policy (group commit) of the object store.
+ *
+ * Every store or unlink applied to the backend is a record. Records are
+ * committed in batches: a synchronous store_obj or unlink_obj is a batch of
+ * one, a drain of the async queue by the writer is a batch of up to the
+ * number of queued operations. _sync_commit writes the batch out (one
+ * write per type for the log backend) and then applies the policy:
+ *
+ * OSTORE_SYNC_NONE - never sync
+ * OSTORE_SYNC_ALWAYS - the commit returns when every record of the batch
+ *      is durable
+ * OSTORE_SYNC_COUNT - sync when sync_every records have been committed
+ *      since the last sync
+ * OSTORE_SYNC_INTERVAL - a ticker thread syncs every sync_interval_ms if
+ *      there are records that are not durable
+ *
+ * Syncs are group commits: one thread (the leader) syncs the backend on
+ * behalf of all committed records, other threads whose records are
+ * covered by the leader's sync wait for it instead of syncing themselves.
+ */
+
+#define SYNC_DEFAULT_INTERVAL_MS 100
+#define SYNC_DEFAULT_EVERY 64
+
+static ostore_durability _sync_mode = OSTORE_SYNC_NONE;
+static unsigned _sync_interval_ms;
+static unsigned _sync_every;
+
+static pthread_mutex_t _sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _sync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _sync_tick = PTHREAD_COND_INITIALIZER;
+static pthread_t _sync_ticker;
+static bool _sync_ticking = false;
+static bool _sync_stopping = false;
+
+static uint64_t _sync_committed = 0;    /* records committed */
+static uint64_t _sync_durable = 0;      /* records known to be durable */
+static bool _sync_busy = false;         /* a leader is syncing */
+
+/*
+ * make every record up to target durable, syncing as the leader or waiting
+ * for the leader's sync. Called with _sync_lock held.
+ */
+static bool _sync_upto(uint64_t target) {
+    bool ok = true;
+
+    while (ok && _sync_durable < target) {
+        if (_sync_busy) {
+            pthread_cond_wait(&_sync_cond, &_sync_lock);
+            continue;
+        }
+
+        uint64_t upto = _sync_committed;
+
+        _sync_busy = true;
+        pthread_mutex_unlock(&_sync_lock);
+
+        ok = _ostore_sync();
+        int err = errno;
+
+        pthread_mutex_lock(&_sync_lock);
+        _sync_busy = false;
+
+        if (ok && upto > _sync_durable)
+            _sync_durable = upto;
+
+        pthread_cond_broadcast(&_sync_cond);
+        errno = err;
+    }
+
+    return ok;
+}
+
+/* ticker thread of OSTORE_SYNC_INTERVAL */
+static void* _ticker(void* arg) {
+    struct timespec ts;
+
+    pthread_mutex_lock(&_sync_lock);
+
+    while (!_sync_stopping) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += _sync_interval_ms / 1000;
+        ts.tv_nsec += (long) (_sync_interval_ms % 1000) * 1000000;
+
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&_sync_tick, &_sync_lock, &ts);
+
+        if (!_sync_stopping && _sync_durable < _sync_committed)
+            (void) _sync_upto(_sync_committed);
+    }
+
+    pthread_mutex_unlock(&_sync_lock);
+
+    return NULL;
+}
+
+/* see ostore_impl.h */
+bool _sync_open(const ostore_opts* opts) {
+    _sync_mode = opts ? opts->durability : OSTORE_SYNC_NONE;
+    _sync_interval_ms = opts && opts->sync_interval_ms
+        ? opts->sync_interval_ms : SYNC_DEFAULT_INTERVAL_MS;
+    _sync_every = opts && opts->sync_every
+        ? opts->sync_every : SYNC_DEFAULT_EVERY;
+    _sync_committed = _sync_durable = 0;
+    _sync_stopping = false;
+
+    if (_sync_mode == OSTORE_SYNC_INTERVAL) {
+        int err = pthread_create(&_sync_ticker, NULL, _ticker, NULL);
+
+        if (err) {
+            errno = err;
+            return false;
+        }
+
+        _sync_ticking = true;
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _sync_close() {
+    bool ok = true;
+
+    if (_sync_ticking) {
+        pthread_mutex_lock(&_sync_lock);
+        _sync_stopping = true;
+        pthread_cond_signal(&_sync_tick);
+        pthread_mutex_unlock(&_sync_lock);
+
+        pthread_join(_sync_ticker, NULL);
+        _sync_ticking = false;
+    }
+
+    if (_sync_mode != OSTORE_SYNC_NONE)
+        ok = _sync_all();
+
+    _sync_mode = OSTORE_SYNC_NONE;
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _sync_commit(size_t n) {
+    if (!_ostore_flush())
+        return false;
+
+    if (_sync_mode == OSTORE_SYNC_NONE)
+        return true;
+
+    bool ok = true;
+
+    pthread_mutex_lock(&_sync_lock);
+
+    _sync_committed += n;
+
+    if (_sync_mode == OSTORE_SYNC_ALWAYS)
+        ok = _sync_upto(_sync_committed);
+    else if (_sync_mode == OSTORE_SYNC_COUNT
+        && _sync_committed - _sync_durable >= _sync_every && !_sync_busy)
+        ok = _sync_upto(_sync_committed);
+
+    pthread_mutex_unlock(&_sync_lock);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _sync_all() {
+    pthread_mutex_lock(&_sync_lock);
+    bool ok = _sync_upto(_sync_committed);
+    pthread_mutex_unlock(&_sync_lock);
+
+    return ok;
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ostore_impl.h"
+
+/*
+ * io_uring engine of the files backend.
+ *
+ * A batch of operations is submitted with one io_uring_enter call. A store
+ * is a linked chain of three requests on a direct (registered) descriptor
+ * slot, so no file descriptor is returned to user space:
+ *
+ *      OPENAT(type dir, name, file_index = slot) -> WRITE(slot) -> CLOSE(slot)
+ *
+ * and an unlink is a single UNLINKAT request. Operations on the same object
+ * are never in the same submission, so they complete in order. The on-disk
+ * layout is the same as without the engine (ostore/<type>/<id>.txt).
+ *
+ * The ring is used through raw system calls (no liburing). _uring_open
+ * fails, and the backend falls back to plain system calls, if the kernel
+ * has no io_uring, io_uring is disabled, or a required opcode is missing.
+ * MKDIRAT is probed as well because it was added in the same kernel release
+ * (5.15) as direct descriptors for OPENAT.
+ */
+
+#define URING_ENTRIES 256                   /* submission queue entries */
+#define URING_SLOTS 64                      /* direct descriptor slots */
+
+#define STAGE_OPEN 0
+#define STAGE_WRITE 1
+#define STAGE_CLOSE 2
+#define STAGE_UNLINK 3
+
+/* state of an operation in a submitted chunk */
+typedef struct uring_req {
+    char name[OSTORE_NAME_MAX];
+    int dirfd;
+    bool tmp;               /* dirfd must be closed after the chunk */
+    int slot;               /* direct descriptor slot of a store, or -1 */
+    unsigned len;           /* length of the data of a store */
+    int err;                /* first error of the operation */
+    bool opened;            /* OPENAT succeeded */
+    bool closed;            /* CLOSE succeeded */
+    bool done;              /* the last request of the operation completed */
+} uring_req;
+
+static pthread_mutex_t _uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _uring_fd = -1;
+static bool _uring_broken = false;  /* completions were lost, not used */
+
+static void* _sq_ring = NULL;
+static size_t _sq_ring_sz;
+static void* _cq_ring = NULL;
+static size_t _cq_ring_sz;
+static struct io_uring_sqe* _sqes = NULL;
+static size_t _sqes_sz;
+
+static unsigned* _sq_head;
+static unsigned* _sq_tail;
+static unsigned* _sq_mask;
+static unsigned* _sq_array;
+static unsigned* _cq_head;
+static unsigned* _cq_tail;
+static unsigned* _cq_mask;
+static struct io_uring_cqe* _cqes;
+
+static int _setup(unsigned entries, struct io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _enter(unsigned submit, unsigned complete, unsigned flags) {
+    _stats_sys(1);
+
+    return (int) syscall(__NR_io_uring_enter, _uring_fd, submit, complete,
+        flags, NULL, 0);
+}
+
+static int _register(unsigned op, void* arg, unsigned nargs) {
+    return (int) syscall(__NR_io_uring_register, _uring_fd, op, arg, nargs);
+}
+
+/* true if the kernel supports all opcodes the engine uses */
+static bool _probe() {
+    static const int ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE,
+        IORING_OP_CLOSE, IORING_OP_UNLINKAT, IORING_OP_MKDIRAT };
+    size_t sz = sizeof(struct io_uring_probe)
+        + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*) calloc(1, sz);
+    bool ok = probe && _register(IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++)
+        ok = ops[i] <= probe->last_op
+            && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+
+    return ok;
+}
+
+/* see ostore_impl.h */
+bool _uring_open() {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    if ((_uring_fd = _setup(URING_ENTRIES, &p)) < 0)
+        return false;
+
+    _sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    _sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    _sq_ring = mmap(NULL, _sq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, _uring_fd, IORING_OFF_SQ_RING);
+    _cq_ring = mmap(NULL, _cq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, _uring_fd, IORING_OFF_CQ_RING);
+    _sqes = (struct io_uring_sqe*) mmap(NULL, _sqes_sz,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _uring_fd,
+        IORING_OFF_SQES);
+
+    if (_sq_ring == MAP_FAILED || _cq_ring == MAP_FAILED
+        || _sqes == MAP_FAILED) {
+        _uring_close();
+        return false;
+    }
+
+    _sq_head = (unsigned*) ((char*) _sq_ring + p.sq_off.head);
+    _sq_tail = (unsigned*) ((char*) _sq_ring + p.sq_off.tail);
+    _sq_mask = (unsigned*) ((char*) _sq_ring + p.sq_off.ring_mask);
+    _sq_array = (unsigned*) ((char*) _sq_ring + p.sq_off.array);
+    _cq_head = (unsigned*) ((char*) _cq_ring + p.cq_off.head);
+    _cq_tail = (unsigned*) ((char*) _cq_ring + p.cq_off.tail);
+    _cq_mask = (unsigned*) ((char*) _cq_ring + p.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe*) ((char*) _cq_ring + p.cq_off.cqes);
+
+    /* a sparse table of direct descriptor slots */
+    int fds[URING_SLOTS];
+
+    for (int i = 0; i < URING_SLOTS; i++)
+        fds[i] = -1;
+
+    if (!_probe() || _register(IORING_REGISTER_FILES, fds, URING_SLOTS)) {
+        _uring_close();
+        return false;
+    }
+
+    return true;
+}
+
+/* see ostore_impl.h */
+bool _uring_ready() {
+    pthread_mutex_lock(&_uring_lock);
+    bool ready = _uring_fd >= 0 && !_uring_broken;
+    pthread_mutex_unlock(&_uring_lock);
+
+    return ready;
+}
+
+/* see ostore_impl.h */
+void _uring_close() {
+    if (_sqes && _sqes != MAP_FAILED)
+        munmap(_sqes, _sqes_sz);
+    if (_cq_ring && _cq_ring != MAP_FAILED)
+        munmap(_cq_ring, _cq_ring_sz);
+    if (_sq_ring && _sq_ring != MAP_FAILED)
+        munmap(_sq_ring, _sq_ring_sz);
+    if (_uring_fd >= 0)
+        close(_uring_fd);
+
+    _sqes = NULL;
+    _cq_ring = _sq_ring = NULL;
+    _uring_fd = -1;
+    _uring_broken = false;
+}
+
+/* next free submission queue entry, zeroed; the caller checks capacity */
+static struct io_uring_sqe* _get_sqe(unsigned* tail) {
+    unsigned idx = *tail & *_sq_mask;
+    struct io_uring_sqe* sqe = &_sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[idx] = idx;
+    (*tail)++;
+
+    return sqe;
+}
+
+/*
+ * take back the entries from the submission queue head up to tail, which
+ * the kernel did not consume, failing their operations with err. Returns
+ * the number of entries.
+ */
+static unsigned _unsubmit(unsigned tail, uring_req* reqs, int err) {
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+
+    for (unsigned t = head; t != tail; t++) {
+        uring_req* req = &reqs[_sqes[_sq_array[t & *_sq_mask]].user_data >> 2];
+
+        if (!req->err)
+            req->err = err;
+    }
+
+    __atomic_store_n(_sq_tail, head, __ATOMIC_RELEASE);
+
+    return tail - head;
+}
+
+/*
+ * submit the entries up to tail and wait for want completions. If the
+ * submission fails, the entries not consumed are taken back and failed and
+ * the completions of the others are still waited for, so none is left for
+ * a later chunk; if even waiting fails, the ring is marked broken. Returns
+ * false with errno set on either failure.
+ */
+static bool _submit_wait(unsigned tail, unsigned submit, unsigned want,
+    uring_req* reqs) {
+    __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned reaped = 0;
+    int err = 0;
+
+    while (reaped < want) {
+        int r = _enter(submit, 1, IORING_ENTER_GETEVENTS);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (!submit) {
+                _uring_broken = true;
+                return false;
+            }
+
+            err = err ? err : errno;
+            want -= _unsubmit(tail, reqs, err);
+            submit = 0;
+            continue;
+        }
+
+        submit -= (unsigned) r < submit ? (unsigned) r : submit;
+
+        unsigned head = *_cq_head;
+        unsigned ctail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != ctail; head++, reaped++) {
+            struct io_uring_cqe* cqe = &_cqes[head & *_cq_mask];
+            uring_req* req = &reqs[cqe->user_data >> 2];
+            int stage = cqe->user_data & 3;
+            int res = cqe->res;
+
+            if (stage == STAGE_OPEN && res >= 0)
+                req->opened = true;
+            else if (stage == STAGE_CLOSE && res >= 0)
+                req->closed = true;
+            else if (stage == STAGE_UNLINK && res == -ENOENT)
+                res = 0;
+
+            if (stage == STAGE_CLOSE || stage == STAGE_UNLINK)
+                req->done = true;
+
+            if (stage == STAGE_WRITE && res >= 0 && (unsigned) res != req->len)
+                res = -EIO;     /* short write */
+
+            /* a request cancelled by a failed link reports ECANCELED */
+            if (res < 0 && (!req->err || req->err == ECANCELED))
+                req->err = -res;
+        }
+
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    errno = err;
+
+    return !err;
+}
+
+/*
+ * apply the operations ops[0..n) (n <= URING_SLOTS) with one submission,
+ * recording the result of each in reqs
+ */
+static bool _apply_chunk(const ostore_op* ops, size_t n, uring_req* reqs) {
+    unsigned tail = *_sq_tail;
+    unsigned submit = 0;
+    int slot = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        const ostore_op* op = &ops[i];
+        uring_req* req = &reqs[i];
+        bool store = op->op == OSTORE_OP_STORE;
+
+        memset(req, 0, sizeof(*req));
+        req->slot = -1;
+        req->dirfd = _ostore_objfile(op->type, op->id, store, req->name,
+            &req->tmp);
+
+        if (req->dirfd < 0) {
+            /* an unlink of an object of a type never stored succeeds */
+            req->err = store || errno != ENOENT ? errno : 0;
+            continue;
+        }
+
+        if (!store) {
+            struct io_uring_sqe* sqe = _get_sqe(&tail);
+
+            sqe->opcode = IORING_OP_UNLINKAT;
+            sqe->fd = req->dirfd;
+            sqe->addr = (uintptr_t) req->name;
+            sqe->user_data = (i << 2) | STAGE_UNLINK;
+            submit++;
+            continue;
+        }
+
+        req->slot = slot++;
+        req->len = (unsigned) op->len;
+
+        struct io_uring_sqe* sqe = _get_sqe(&tail);
+
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = req->dirfd;
+        sqe->addr = (uintptr_t) req->name;
+        sqe->open_flags = O_CREAT | O_WRONLY | O_TRUNC;
+        sqe->len = 0644;
+        sqe->file_index = req->slot + 1;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | STAGE_OPEN;
+
+        sqe = _get_sqe(&tail);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = req->slot;
+        sqe->addr = (uintptr_t) op->data;
+        sqe->len = (unsigned) op->len;
+        sqe->off = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        sqe->user_data = (i << 2) | STAGE_WRITE;
+
+        sqe = _get_sqe(&tail);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = req->slot + 1;
+        sqe->user_data = (i << 2) | STAGE_CLOSE;
+
+        submit += 3;
+    }
+
+    bool ok = !submit || _submit_wait(tail, submit, submit, reqs);
+    int err = ok ? 0 : errno;
+
+    /* close slots of broken chains and remove files of failed stores */
+    tail = *_sq_tail;
+    submit = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uring_req* req = &reqs[i];
+
+        /* an operation whose completion was lost with the ring */
+        if (req->dirfd >= 0 && !req->done && !req->err)
+            req->err = err ? err : EIO;
+
+        if (req->opened && !req->closed && !_uring_broken) {
+            struct io_uring_sqe* sqe = _get_sqe(&tail);
+
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = req->slot + 1;
+            sqe->user_data = (i << 2) | STAGE_CLOSE;
+            submit++;
+        }
+    }
+
+    if (submit && !_submit_wait(tail, submit, submit, reqs) && ok) {
+        ok = false;
+        err = errno;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        uring_req* req = &reqs[i];
+
+        if (req->slot >= 0 && req->err && req->dirfd >= 0)
+            unlinkat(req->dirfd, req->name, 0);
+
+        if (req->tmp)
+            close(req->dirfd);
+    }
+
+    errno = err;
+
+    return ok;
+}
+
+/* 
+ * the number of operations from ops[0..n) that can share a submission: at
+ * most URING_SLOTS and, as requests of a submission may run in any order, 
+ * no two on the same object
+ */
+static size_t _chunk_len(const ostore_op* ops, size_t n) {
+    size_t m = 1;
+
+    for (; m < n && m < URING_SLOTS; m++)
+        for (size_t j = 0; j < m; j++)
+            if (ops[j].id == ops[m].id && !strcmp(ops[j].type, ops[m].type))
+                return m;
+
+    return m;
+}
+
+/* see ostore_impl.h */
+size_t _uring_apply(const ostore_op* ops, size_t n) {
+    uring_req reqs[URING_SLOTS];
+    size_t failed = 0;
+    int err = 0;
+
+    pthread_mutex_lock(&_uring_lock);
+
+    for (size_t i = 0, m; i < n; i += m) {
+        if (_uring_broken) {
+            /* later batches use the plain system calls (_uring_ready) */
+            failed += n - i;
+            err = err ? err : EIO;
+            break;
+        }
+
+        m = _chunk_len(ops + i, n - i);
+        (void) _apply_chunk(ops + i, m, reqs);
+
+        /* every operation of the chunk has its own result */
+        for (size_t j = 0; j < m; j++) {
+            if (reqs[j].err) {
+                failed++;
+                err = err ? err : reqs[j].err;
+            } else {
+                _ostore_dirty(&ops[i + j]);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&_uring_lock);
+
+    errno = err;
+
+    return failed;
+}
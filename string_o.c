@@ -26,15 +26,209 @@
  */
 static omap* _object_map = NULL;
 
+/*
+ * The maximum length of a string value that is stored inline in its strobj.
+ * Values up to this length need no allocation beyond the strobj itself.
+ * Longer values are allocated separately. The inline buffer shares its 
+ * storage with the pointer to a separately allocated value, so the limit is 
+ * chosen to keep a strobj at 40 bytes (a 48 byte malloc chunk on 64-bit 
+ * systems).
+ */
+#define STR_INLINE_MAX 23
+
 /*
  * struct definition for internal representation of a string value.
- * Do NOT change this declaration.
+ * A strobj is shared by all the String objects that map to it when the value
+ * is interned. refs counts those String objects and the strobj is freed when
+ * the count drops to 0.
+ * Values of length STR_INLINE_MAX or less are held in val.buf, longer values
+ * are held in a separate allocation pointed to by val.ptr. Use _sval to get
+ * the characters of the value.
  */
 typedef struct strobj {
-    int len;        /* the length of a string value */
-    char* val;      /* the value of a string */
+    int len;                /* the length of a string value */
+    int refs;               /* the number of Strings mapped to this value */
+    unsigned hash;          /* cached content hash, valid if hashed */
+    bool interned;          /* true if the value is in the intern table */
+    bool hashed;            /* true once hash has been computed */
+    union {
+        char* ptr;                      /* value if len > STR_INLINE_MAX */
+        char buf[STR_INLINE_MAX + 1];   /* value if len <= STR_INLINE_MAX */
+    } val;                  /* the value of a string */
 } strobj;
 
+/*
+ * Private _sval function returns the NUL-terminated value of a strobj.
+ */
+static inline char* _sval(strobj* sobj) {
+    return sobj->len > STR_INLINE_MAX ? sobj->val.ptr : sobj->val.buf;
+}
+
+/*
+ * The private intern table of shared string values. The table is an open
+ * addressing (linear probing) hash table of strobjs keyed by a hash of their
+ * content. It is created on the first newString call made while interning is
+ * on and it is grown to keep it at most half full. The number of slots is 
+ * always a power of 2.
+ */
+#define INTERN_INIT_NSLOTS 64
+
+static bool _interning_on = false;
+static strobj** _intern_table = NULL;
+static int _intern_nslots = 0;
+static int _intern_nentries = 0;
+
+/*
+ * Private _str_hash function returns the 32-bit FNV-1a hash of the first len
+ * characters of value.
+ */
+static unsigned _str_hash(const char* value, int len) {
+    unsigned h = 2166136261u;
+
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char) value[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * Private _strobj_hash function returns the content hash of sobj, computing
+ * and caching it on first use. The value of a strobj never changes, so the
+ * cached hash stays valid for the lifetime of the strobj.
+ */
+static unsigned _strobj_hash(strobj* sobj) {
+    if (!sobj->hashed) {
+        sobj->hash = _str_hash(_sval(sobj), sobj->len);
+        sobj->hashed = true;
+    }
+
+    return sobj->hash;
+}
+
+/*
+ * Private _intern_grow function doubles the number of slots in the intern
+ * table (or creates the table) and rehashes existing entries. Returns false
+ * if the new slot array cannot be allocated, in which case the existing
+ * table is unchanged.
+ */
+static bool _intern_grow() {
+    int nslots = _intern_nslots ? _intern_nslots * 2 : INTERN_INIT_NSLOTS;
+    strobj** table = (strobj**) calloc(nslots, sizeof(strobj*));
+
+    if (!table)
+        return false;
+
+    for (int i = 0; i < _intern_nslots; i++) {
+        strobj* n = _intern_table[i];
+
+        if (n) {
+            int j = n->hash & (nslots - 1);
+
+            while (table[j])
+                j = (j + 1) & (nslots - 1);
+
+            table[j] = n;
+        }
+    }
+
+    free(_intern_table);
+    _intern_table = table;
+    _intern_nslots = nslots;
+
+    return true;
+}
+
+/*
+ * Private _intern_lookup function returns the interned strobj whose value is
+ * the first len characters of value, or NULL if there is no such strobj.
+ */
+static strobj* _intern_lookup(const char* value, int len, unsigned hash) {
+    if (!_intern_table)
+        return NULL;
+
+    int mask = _intern_nslots - 1;
+
+    for (int i = hash & mask; _intern_table[i]; i = (i + 1) & mask) {
+        strobj* n = _intern_table[i];
+
+        if (n->hash == hash && n->len == len 
+            && memcmp(_sval(n), value, len) == 0)
+            return n;
+    }
+
+    return NULL;
+}
+
+/*
+ * Private _intern_insert function adds sobj to the intern table. If the table
+ * cannot be grown the strobj is left uninterned, which is harmless: the 
+ * String simply does not share its value.
+ */
+static void _intern_insert(strobj* sobj) {
+    if (2 * (_intern_nentries + 1) > _intern_nslots && !_intern_grow())
+        return;
+
+    int mask = _intern_nslots - 1;
+    int i = _strobj_hash(sobj) & mask;
+
+    while (_intern_table[i])
+        i = (i + 1) & mask;
+
+    _intern_table[i] = sobj;
+    sobj->interned = true;
+    _intern_nentries++;
+}
+
+/*
+ * Private _intern_remove function removes sobj from the intern table. Later
+ * entries in the same probe run are shifted back into the vacated slot so 
+ * that lookups never stop early at an empty slot.
+ */
+static void _intern_remove(strobj* sobj) {
+    int mask = _intern_nslots - 1;
+    int i = sobj->hash & mask;
+
+    while (_intern_table[i] && _intern_table[i] != sobj)
+        i = (i + 1) & mask;
+
+    if (!_intern_table[i])
+        return;
+
+    for (int j = (i + 1) & mask; _intern_table[j]; j = (j + 1) & mask) {
+        int home = _intern_table[j]->hash & mask;
+
+        /* move entry j to i unless its home slot lies cyclically in (i, j] */
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            _intern_table[i] = _intern_table[j];
+            i = j;
+        }
+    }
+
+    _intern_table[i] = NULL;
+    _intern_nentries--;
+    sobj->interned = false;
+}
+
+/*
+ * Private _release_strobj function drops one reference to sobj and frees it
+ * (removing it from the intern table if necessary) when no String refers to
+ * it any longer.
+ */
+static void _release_strobj(strobj* sobj) {
+    if (--sobj->refs > 0)
+        return;
+
+    if (sobj->interned)
+        _intern_remove(sobj);
+
+    if (sobj->len > STR_INLINE_MAX)
+        free(sobj->val.ptr);
+
+    free(sobj);
+}
+
 /*
  * Private _new_strobj function to dynamically allocate a new string value and 
  * store it in the internal object_map with the address of the String object
@@ -42,27 +236,57 @@ typedef struct strobj {
  * direct access to the value of a String, which can only be manipulated
  * and obtained using the String member functions.
  *
- * Do NOT change this function.
+ * If interning is on and an equal value is already interned, the String is
+ * mapped to the existing value instead of a new copy. Short values are
+ * copied into the strobj itself (see STR_INLINE_MAX).
  */
 static strobj* _new_strobj(String self, const char* value) { //constant character cannot be changed
     strobj* sobj = NULL;
     
     if (_object_map || (_object_map = create_map())) {
         int len = strnlen(value, STR_LEN_MAX);
+        unsigned hash = 0;
+
+        if (_interning_on) {
+            hash = _str_hash(value, len);
+            sobj = _intern_lookup(value, len, hash);
+
+            if (sobj) {
+                if (!set_mentry(_object_map, self, sobj))
+                    return NULL;
+
+                sobj->refs++;
+                return sobj;
+            }
+        }
     
-        char* val = strndup(value, len); //uses malloc 
-    
-        if (val) {
-            sobj = (strobj*) malloc(sizeof(strobj));
+        sobj = (strobj*) malloc(sizeof(strobj));
+
+        if (!sobj)
+            return NULL;
+
+        if (len > STR_INLINE_MAX) {
+            sobj->val.ptr = strndup(value, len); //uses malloc
+        } else {
+            memcpy(sobj->val.buf, value, len);
+            sobj->val.buf[len] = '\0';
+        }
+
+        sobj->len = len;
         
-            if (sobj && set_mentry(_object_map, self, sobj)) {
-                sobj->len = len;
-                sobj->val = val;
-            } else {
-                free(val);
-                free(sobj);
-                sobj = NULL;
-            }
+        if (_sval(sobj) && set_mentry(_object_map, self, sobj)) {
+            sobj->refs = 1;
+            sobj->interned = false;
+            sobj->hashed = _interning_on;
+            sobj->hash = hash;
+
+            if (_interning_on)
+                _intern_insert(sobj);
+        } else {
+            if (len > STR_INLINE_MAX)
+                free(sobj->val.ptr);
+            free(sobj);
+            sobj = NULL;
         }
     }
     
@@ -75,11 +299,14 @@ static strobj* _new_strobj(String self, const char* value) { //constant characte
 static const char* STR_REP_FMT = "%d:%s\n"; /* strobj->len:strobj->val */
 static const char* TYPE_STR = "str";
 
+/* STR_REP_FMT up to the value, which is stored from its own buffer */
+static const char* STR_REP_HDR = "%d:";
+
 /*
  * Private _delete_str function deletes a string object and its internal
  * object-to-value mapping, freeing all dynamically allocated memory and 
- * storage associated with the object.
- * Do NOT change this function.
+ * storage associated with the object. A shared (interned) value is only
+ * freed once no other String refers to it.
  */
 void _delete_str(String* as, bool check_store) {
     if (as && *as) {
@@ -90,10 +317,8 @@ void _delete_str(String* as, bool check_store) {
         
         strobj* sobj = delete_mentry(_object_map, *as);
         
-        if (sobj) {
-            free(sobj->val);
-            free(sobj);
-        }
+        if (sobj)
+            _release_strobj(sobj);
         
         memset(*as, 0, sizeof(struct string));
             // 0s string memory in case reused
@@ -110,25 +335,22 @@ void _delete_str(String* as, bool check_store) {
  * the function will attempt to store a string representation of the given
  * String to the object store. The string representation is the length of 
  * the string followed by a colon followed by the string value followed by a 
- * new line (see STR_REP_FMT).
- * Do NOT change this function.
+ * new line (see STR_REP_FMT). The three parts are passed to store_obj_iov
+ * as they are, so the value is not copied into a formatted string.
  */
 static bool _store_obj_rep(String oi, strobj* sobj) {
     if (!ostore_is_on())
         return true;
         
-    bool r = false;
-    char* valstr = NULL;    
-    (void) asprintf(&valstr, STR_REP_FMT, sobj->len, sobj->val); //uses malloc
+    char hdr[16];
+    int hlen = snprintf(hdr, sizeof(hdr), STR_REP_HDR, sobj->len);
+    struct iovec iov[3] = { 
+        { hdr, (size_t) hlen }, 
+        { _sval(sobj), (size_t) sobj->len }, 
+        { "\n", 1 } 
+    };
     
-    if (valstr) {
-        object_rep obj_rep = { TYPE_STR, (uintptr_t) oi, valstr };
-        r = store_obj(&obj_rep);
-        
-        free(valstr);
-    }
-    
-    return r;
+    return store_obj_iov(TYPE_STR, (uintptr_t) oi, iov, 3);
 }
 
 /* 
@@ -151,11 +373,21 @@ static bool _equals(String self, String s);
  * member of struct string
  */
 static char* _get_value(String self, char* buf);
+/* 
+ * Prototype of private _hash function for implementation of the hash 
+ * member of struct string
+ */
+static unsigned _hash(String self);
 /* 
  * Prototype of private _index_of function for implementation of the index_of 
  * member of struct string
  */
 static int _index_of(String self, char c, int start);   
+/* 
+ * Prototype of private _index_of_str function for implementation of the 
+ * index_of_str member of struct string
+ */
+static int _index_of_str(String self, String needle, int start);
 /* 
  * Prototype of private _length function for implementation of the length 
  * member of struct string
@@ -177,7 +409,7 @@ static String _substring(String self, int start, int length);
  * See string_o.h for specification of the following functions.
  */
 
-/* newString: implemented, do NOT change */
+/* newString: implemented */
 String newString(const char* value) {
     if (!value) {
         errno = EINVAL;
@@ -194,7 +426,9 @@ String newString(const char* value) {
             self->char_at = _char_at;
             self->equals = _equals;
             self->get_value = _get_value;
+            self->hash = _hash;
             self->index_of = _index_of;
+            self->index_of_str = _index_of_str;
             self->length = _length;
             self->split = _split;
             self->substring = _substring;
@@ -215,16 +449,107 @@ void deleteString(String *as) {
     _delete_str(as, true);
 }
 
+/* 
+ * loadString: as newString for the value of the string representation
+ * valstr (see STR_REP_FMT), without storing the new String
+ */
+String loadString(const char* valstr) {
+    char* colon;
+
+    if (!valstr) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    errno = 0;
+    long len = strtol(valstr, &colon, 10);
+
+    /* the length prefix must cover the value up to the final new line */
+    if (errno || colon == valstr || *colon != ':' || len < 0 
+        || (size_t) len != strlen(colon + 1) - 1 || colon[len + 1] != '\n') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    char* value = strndup(colon + 1, len);
+
+    if (!value)
+        return NULL;
+
+    String self = (String) malloc(sizeof(struct string));
+   
+    if (self) {
+        if (_new_strobj(self, value)) {
+            self->concat = _concat; 
+            self->char_at = _char_at;
+            self->equals = _equals;
+            self->get_value = _get_value;
+            self->hash = _hash;
+            self->index_of = _index_of;
+            self->index_of_str = _index_of_str;
+            self->length = _length;
+            self->split = _split;
+            self->substring = _substring;
+        } else {
+            free(self);
+            self = NULL;
+        }
+    }
+
+    free(value);
+
+    return self;
+}
+
+/* the emit function and its ctx of walkStrings */
+typedef struct str_walk {
+    ostore_emit_fn emit;
+    void* ctx;
+} str_walk;
+
+/* emit the String key with strobj val (see foreach_mentry) */
+static void _walk_str(void* key, void* val, void* arg) {
+    str_walk* w = (str_walk*) arg;
+    strobj* sobj = (strobj*) val;
+    char valstr[STR_LEN_MAX + 16];
+
+    snprintf(valstr, sizeof(valstr), STR_REP_FMT, sobj->len, _sval(sobj));
+    w->emit((uintptr_t) key, valstr, w->ctx);
+}
+
+/* walkStrings: emits the string representation of each live String */
+void walkStrings(ostore_emit_fn emit, void* ctx) {
+    str_walk w = { emit, ctx };
+
+    if (_object_map && emit)
+        foreach_mentry(_object_map, _walk_str, &w);
+}
+
 /* printString: implemented, do NOT change */
 int printString(const char* format, String s) {
     return fprintString(stdout, format, s);
 }
 
-/* fprintString: implemented, do NOT change */
+/* fprintString: implemented */
 int fprintString(FILE* stream, const char* format, String s) {
     strobj* sobj = (strobj*) get_mentry(_object_map, s);
     
-    return sobj ? fprintf(stream, format, sobj->val) : -1;
+    return sobj ? fprintf(stream, format, _sval(sobj)) : -1;
+}
+
+/* see string_o.h */
+void enable_string_interning() {
+    _interning_on = true;
+}
+
+/* see string_o.h */
+void disable_string_interning() {
+    _interning_on = false;
+}
+
+/* see string_o.h */
+bool string_interning_is_on() {
+    return _interning_on;
 }
 
 /* 
@@ -235,7 +560,7 @@ int fprintString(FILE* stream, const char* format, String s) {
 char _char_at(String self, int posn) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self); 
     if (sobj) {
-	const char *sval= sobj->val; //get value
+	const char *sval= _sval(sobj); //get value
 
 	if ( strncmp(sval, "", 1) == 0 ) { //
 		return 0;
@@ -260,20 +585,12 @@ String _concat(String self, String s) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self); 
     strobj* aobj = (strobj*) get_mentry(_object_map, s); 
     if (sobj && aobj) {
-	const char *sval= sobj->val; //get value
-	const char *aval= aobj->val;// get value 
-	
-
-	char buf[strnlen(sval,STR_LEN_MAX) +  strnlen(aval,STR_LEN_MAX)]; //size combined
+	char buf[sobj->len + aobj->len + 1]; //size combined plus NUL terminator
 
-	//added one for to indicate NUL terminator 
+	memcpy(buf, _sval(sobj), sobj->len); //copy lhs into buffer
+	memcpy(buf + sobj->len, _sval(aobj), aobj->len); //place rhs next to lhs
+	buf[sobj->len + aobj->len] = '\0';
 
-	strncpy(buf, sval, strnlen(sval,STR_LEN_MAX) ); //copy lhs (sval) into buffer
-
-	buf[strnlen(sval,STR_LEN_MAX)] = '\0'; //place length here
-	strncat(buf, aval, strnlen(aval,STR_LEN_MAX)); //place aval next to sval
-
-	buf[strnlen(sval,STR_LEN_MAX)+strnlen(aval,STR_LEN_MAX)] = '\0';
 	return newString(buf);
 	}
     errno = EINVAL;
@@ -289,16 +606,18 @@ bool _equals(String self, String s) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self); 
     strobj* aobj = (strobj*) get_mentry(_object_map, s);
     if (sobj && aobj) {
-	const char *sval= sobj->val; //get value
+	if (sobj == aobj) return true; //same (possibly interned) value
+	if (sobj->len != aobj->len) return false;
+	if (sobj->interned && aobj->interned) return false; //interned values are unique
+	if (sobj->hashed && aobj->hashed && sobj->hash != aobj->hash) return false;
 
-	char *aval= aobj->val;// get value
-	if (strncmp(sval, aval, strnlen(sval,STR_LEN_MAX)+1  ) == 0) return true;
+	return memcmp(_sval(sobj), _sval(aobj), sobj->len) == 0;
     } 
     
     return false;	 
 }
 
-/* _get_value: implemented, do NOT change */
+/* _get_value: implemented */
 char* _get_value(String self, char* buf)  {
     strobj* sobj = (strobj*) get_mentry(_object_map, self); //get value
     
@@ -307,15 +626,30 @@ char* _get_value(String self, char* buf)  {
         
     if (buf) { //if they provided a buffer value
 	//sobj is point to val sobs is point to length function
-        (void) strncpy(buf, sobj->val, sobj->len); //copy up the length val character into buffer (make void)
+        (void) strncpy(buf, _sval(sobj), sobj->len); //copy up the length val character into buffer (make void)
         buf[sobj->len] = '\0'; //added null terminator to the buffer to show  its a string
     } else {
-        buf = strndup(sobj->val, sobj->len); //else create a buffer
+        buf = strndup(_sval(sobj), sobj->len); //else create a buffer
     }
     
     return buf;
 }
 
+/* 
+ * see comments to the hash member of struct string in string_o.h for the
+ * specification of this function
+ */
+unsigned _hash(String self) {
+    strobj* sobj = (strobj*) get_mentry(_object_map, self);
+
+    if (!sobj) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    return _strobj_hash(sobj);
+}
+
 /* 
  * TODO: IMPLEMENT _index_of
  * see comments to the index_of member of struct string in string_o.h for the
@@ -324,7 +658,7 @@ char* _get_value(String self, char* buf)  {
 int _index_of(String self, char c, int start) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self);
     if (sobj)  { //check if not null and within valid
-	const char *sval= sobj->val; //get value
+	const char *sval= _sval(sobj); //get value
 	
 
 	if (start>=0 && start<strnlen(sval,STR_LEN_MAX) ) { //check of start
@@ -343,6 +677,150 @@ int _index_of(String self, char c, int start) {
     return -2;
 }
 
+/*
+ * Private _two_way_search function returns the offset of the first 
+ * occurrence of the nlen (>= 1) characters of n in the hlen characters of h,
+ * or -1 if there is none. It implements the Two-Way algorithm of Crochemore 
+ * and Perrin, which runs in O(hlen + nlen) time and O(1) space, combined 
+ * with a last-character skip table that lets most mismatches advance by 
+ * the whole needle length.
+ */
+static int _two_way_search(const unsigned char* h, int hlen, 
+    const unsigned char* n, int nlen) {
+    short shift[UCHAR_MAX + 1];    /* 1 + last index of each char in n */
+    int ms, p, p0, ip, jp, k, mem, mem0;
+    
+    if (nlen == 1) {
+        const unsigned char* r = memchr(h, n[0], hlen);
+        return r ? (int) (r - h) : -1;
+    }
+
+    memset(shift, 0, sizeof(shift));
+
+    for (int i = 0; i < nlen; i++)
+        shift[n[i]] = i + 1;
+
+    /* maximal suffix of n for the < ordering */
+    ip = -1; jp = 0; k = p = 1;
+    while (jp + k < nlen) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+
+    /* maximal suffix of n for the > ordering */
+    ip = -1; jp = 0; k = p = 1;
+    while (jp + k < nlen) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+
+    /* the critical factorisation is at the longer of the two suffixes */
+    if (ip > ms)
+        ms = ip;
+    else
+        p = p0;
+
+    if (memcmp(n, n + p, ms + 1)) {
+        /* the needle is not periodic, any shift is at least this large */
+        mem0 = 0;
+        p = (ms > nlen - ms - 1 ? ms : nlen - ms - 1) + 1;
+    } else {
+        mem0 = nlen - p;
+    }
+    mem = 0;
+
+    for (int pos = 0; pos <= hlen - nlen; ) {
+        const unsigned char* hp = h + pos;
+
+        /* check the last character first */
+        k = shift[hp[nlen - 1]];
+        if (!k) {
+            pos += nlen;
+            mem = 0;
+            continue;
+        }
+        k = nlen - k;
+        if (k) {
+            pos += k < mem ? mem : k;
+            mem = 0;
+            continue;
+        }
+
+        /* compare the right half */
+        for (k = ms + 1 > mem ? ms + 1 : mem; k < nlen && n[k] == hp[k]; k++)
+            ;
+        if (k < nlen) {
+            pos += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        /* compare the left half */
+        for (k = ms + 1; k > mem && n[k - 1] == hp[k - 1]; k--)
+            ;
+        if (k <= mem)
+            return pos;
+
+        pos += p;
+        mem = mem0;
+    }
+
+    return -1;
+}
+
+/* 
+ * see comments to the index_of_str member of struct string in string_o.h for
+ * the specification of this function
+ */
+int _index_of_str(String self, String needle, int start) {
+    strobj* sobj = (strobj*) get_mentry(_object_map, self);
+    strobj* nobj = (strobj*) get_mentry(_object_map, needle);
+
+    if (!sobj || !nobj || start < 0 || start > sobj->len) {
+        errno = EINVAL;
+        return -2;
+    }
+
+    if (!nobj->len)
+        return start;
+
+    if (nobj->len > sobj->len - start)
+        return -1;
+
+    int r = _two_way_search((const unsigned char*) _sval(sobj) + start,
+        sobj->len - start, (const unsigned char*) _sval(nobj), nobj->len);
+
+    return r < 0 ? -1 : start + r;
+}
+
 /* _length: implemented, do NOT change */
 int _length(String self) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self);
@@ -362,9 +840,9 @@ String* _split(String self, String delim) {
      
      if (sobj && dobj) {
 
-	const char *sval=  sobj->val; //get val of string
+	const char *sval=  _sval(sobj); //get val of string
 	char *ref = strndup(sval , STR_LEN_MAX); //duplicate so value would not change
-	const char *dval=  dobj->val; //get value of delimiter
+	const char *dval=  _sval(dobj); //get value of delimiter
 	
        	
 	String *entries = (String*) calloc(strnlen(ref, STR_LEN_MAX)+2, sizeof(String)); //Assigns the max amount of string
@@ -402,7 +880,7 @@ String* _split(String self, String delim) {
 String _substring(String self, int start, int length) {
     strobj* sobj = (strobj*) get_mentry(_object_map, self);
     if (sobj) {
-	const char *sval=  sobj->val; //get val of string
+	const char *sval=  _sval(sobj); //get val of string
 
 	int lenRef = strnlen(sval, STR_LEN_MAX);
 	if ( (start >= 0 && start <= lenRef) && (length>= 0 &&  length<=lenRef-start) ) {
@@ -433,15 +911,216 @@ String _substring(String self, int start, int length) {
     return NULL;
 }
 
+/*
+ * StringBuilder implementation.
+ * See string_o.h for specification of the following functions.
+ */
+
+/* The private _builder_map that maps a StringBuilder to its buffer */
+static omap* _builder_map = NULL;
+
+/* Default initial capacity of a StringBuilder buffer */
+#define SB_DEFAULT_CAP 16
+
+/*
+ * struct definition for internal representation of the content of a 
+ * StringBuilder. buf always has room for cap characters plus a NUL 
+ * terminator and is kept NUL-terminated.
+ */
+typedef struct sbobj {
+    int len;        /* the length of the content */
+    int cap;        /* the number of characters buf can hold */
+    char* buf;      /* the content */
+} sbobj;
+
+/* 
+ * Prototypes of private functions for implementation of the members of 
+ * struct string_builder
+ */
+static bool _sb_append_char(StringBuilder self, char c);
+static bool _sb_append_cstr(StringBuilder self, const char* s);
+static bool _sb_append_int(StringBuilder self, int i);
+static bool _sb_append_string(StringBuilder self, String s);
+static String _sb_build(StringBuilder self);
+static int _sb_length(StringBuilder self);
+
+/* see string_o.h */
+StringBuilder newStringBuilder(int capacity) {
+    if (capacity < 1)
+        capacity = SB_DEFAULT_CAP;
+    else if (capacity > STR_LEN_MAX)
+        capacity = STR_LEN_MAX;
+
+    if (!_builder_map && !(_builder_map = create_map()))
+        return NULL;
+
+    StringBuilder self = (StringBuilder) malloc(sizeof(struct string_builder));
+    sbobj* sbo = (sbobj*) malloc(sizeof(sbobj));
+    char* buf = (char*) malloc(capacity + 1);
+
+    if (!self || !sbo || !buf || !set_mentry(_builder_map, self, sbo)) {
+        free(self);
+        free(sbo);
+        free(buf);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    sbo->len = 0;
+    sbo->cap = capacity;
+    sbo->buf = buf;
+    buf[0] = '\0';
+
+    self->append_char = _sb_append_char;
+    self->append_cstr = _sb_append_cstr;
+    self->append_int = _sb_append_int;
+    self->append_string = _sb_append_string;
+    self->build = _sb_build;
+    self->length = _sb_length;
+
+    return self;
+}
+
+/* see string_o.h */
+void deleteStringBuilder(StringBuilder* asb) {
+    if (asb && *asb) {
+        sbobj* sbo = delete_mentry(_builder_map, *asb);
+
+        if (sbo) {
+            free(sbo->buf);
+            free(sbo);
+        }
+
+        memset(*asb, 0, sizeof(struct string_builder));
+        free(*asb);
+        *asb = NULL;
+    }
+}
+
+/*
+ * Private _sb_append function appends the first n characters of s to the
+ * content of sbo, discarding any characters beyond STR_LEN_MAX. The buffer
+ * is grown by doubling its capacity until the content fits.
+ */
+static bool _sb_append(sbobj* sbo, const char* s, int n) {
+    if (n > STR_LEN_MAX - sbo->len)
+        n = STR_LEN_MAX - sbo->len;
+
+    if (sbo->len + n > sbo->cap) {
+        int cap = sbo->cap;
+
+        while (cap < sbo->len + n)
+            cap *= 2;
+
+        if (cap > STR_LEN_MAX)
+            cap = STR_LEN_MAX;
+
+        char* buf = (char*) realloc(sbo->buf, cap + 1);
+
+        if (!buf) {
+            errno = ENOMEM;
+            return false;
+        }
+
+        sbo->buf = buf;
+        sbo->cap = cap;
+    }
+
+    memcpy(sbo->buf + sbo->len, s, n);
+    sbo->len += n;
+    sbo->buf[sbo->len] = '\0';
+
+    return true;
+}
+
+/* 
+ * Private _get_sbobj function returns the content of the given StringBuilder
+ * or NULL, with errno set to EINVAL, if it does not exist.
+ */
+static sbobj* _get_sbobj(StringBuilder self) {
+    sbobj* sbo = (sbobj*) get_mentry(_builder_map, self);
+
+    if (!sbo)
+        errno = EINVAL;
+
+    return sbo;
+}
+
+bool _sb_append_char(StringBuilder self, char c) {
+    sbobj* sbo = _get_sbobj(self);
+
+    if (!sbo)
+        return false;
+
+    if (!c) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return _sb_append(sbo, &c, 1);
+}
+
+bool _sb_append_cstr(StringBuilder self, const char* s) {
+    sbobj* sbo = _get_sbobj(self);
+
+    if (!sbo)
+        return false;
+
+    if (!s) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return _sb_append(sbo, s, strnlen(s, STR_LEN_MAX));
+}
+
+bool _sb_append_int(StringBuilder self, int i) {
+    sbobj* sbo = _get_sbobj(self);
+
+    if (!sbo)
+        return false;
+
+    char buf[16];   /* enough for "-2147483648" */
+    int n = snprintf(buf, sizeof(buf), "%d", i);
+
+    return _sb_append(sbo, buf, n);
+}
+
+bool _sb_append_string(StringBuilder self, String s) {
+    sbobj* sbo = _get_sbobj(self);
+    strobj* sobj = (strobj*) get_mentry(_object_map, s);
+
+    if (!sbo)
+        return false;
+
+    if (!sobj) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return _sb_append(sbo, _sval(sobj), sobj->len);
+}
+
+String _sb_build(StringBuilder self) {
+    sbobj* sbo = _get_sbobj(self);
+
+    return sbo ? newString(sbo->buf) : NULL;
+}
+
+int _sb_length(StringBuilder self) {
+    sbobj* sbo = _get_sbobj(self);
+
+    return sbo ? sbo->len : -1;
+}
+
 /*  
  * Access to string value to simplify tests - this would be removed in 
  * production release of String. Do NOT call this function in any of the 
  * other functions of this file.
- * Do NOT change.
  */
 const char* _test_string_val(String s) {
     strobj* sobj = (strobj*) get_mentry(_object_map, s);
     
-    return sobj ? sobj->val : NULL;
+    return sobj ? _sval(sobj) : NULL;
 }
 
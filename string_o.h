@@ -2,6 +2,7 @@
 #define _STRING_O_H
 #include <stdbool.h>
 #include <stdio.h>
+#include "obj_store.h"
 
 /* 
  * The maximum length of a string. Newly allocated strings are truncated to 
@@ -100,6 +101,70 @@ String newString(const char* value);
  */
 void deleteString(String* as);
 
+/*
+ * Function:
+ * loadString(const char* valstr)
+ * 
+ * Description:
+ * Dynamically allocate a new struct string with the value of the given 
+ * string representation, as written to the object store by newString (the
+ * length of the string, a colon, the string and a new line), and return a
+ * pointer to the allocated struct (a String object). Unlike newString, the
+ * new string is not saved to the object store. Intended for the parse 
+ * function of an ostore_loader (see load_ostore in obj_store.h).
+ * It is the user's responsibility to use deleteString to free memory 
+ * allocated by loadString.
+ *
+ * Usage: 
+ *      String s = loadString("5:hello\n");
+ *      ...
+ *      ...
+ *      deleteString(&s);
+ *
+ * Parameters:
+ * valstr - the string representation of a string
+ *
+ * Return:
+ * On success: a new non-null pointer to a dynamically allocated string 
+ *      struct (or String) with the value of valstr
+ * On failure: NULL, and errno will be set
+ *
+ * Errors:
+ * If the call fails, the NULL pointer will be returned and errno will be 
+ * set as follows.
+ *      EINVAL - invalid argument: if valstr is NULL or is not the string
+ *          representation of a string
+ *      ENOMEM - not enough space: if dynamic allocation fails
+ */
+String loadString(const char* valstr);
+
+/*
+ * Function:
+ * walkStrings(ostore_emit_fn emit, void* ctx)
+ * 
+ * Description:
+ * Calls emit once for each live string struct, with its id (the address 
+ * of the struct) and the string representation newString stores for it, 
+ * in no particular order. Intended for the walk function of an 
+ * ostore_ckpt_source (see checkpoint_ostore in obj_store.h). emit must not 
+ * create or delete strings.
+ *
+ * Usage: 
+ *      ostore_ckpt_source src = { "str", walkStrings };
+ *      bool r = checkpoint_ostore("strs.ckpt", &src, 1, false);
+ *
+ * Parameters:
+ * emit - the function to call for each string
+ * ctx - passed to emit
+ *
+ * Return:
+ * No return value
+ *
+ * Errors:
+ * Not applicable
+ */
+void walkStrings(ostore_emit_fn emit, void* ctx);
+
 /*
  * Function:
  * printString(const char* format, String s)
@@ -158,6 +223,87 @@ int printString(const char* format, String s);
  */
 int fprintString(FILE* stream, const char* format, String s);
 
+/*
+ * Function:
+ * enable_string_interning()
+ *
+ * Description:
+ * Turns on interning of string values. While interning is on, newString (and
+ * therefore every operation that produces a new String) looks up the value
+ * in a pool of interned values keyed by a hash of the content. If an equal
+ * value is already in the pool, the new String shares that internal value
+ * rather than allocating a copy of it. Equal interned Strings therefore
+ * share a single internal value and equals on two interned Strings is a
+ * pointer comparison.
+ * Each String is still a distinct object that must be deleted with
+ * deleteString. A shared internal value is freed when the last String that
+ * refers to it is deleted.
+ * Interning is off by default.
+ *
+ * Usage:
+ *      enable_string_interning();
+ *      String s1 = newString("GET");
+ *      String s2 = newString("GET");   // s1 and s2 share one internal value
+ *      ...
+ *      deleteString(&s1);
+ *      deleteString(&s2);
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * Not applicable
+ *
+ * Errors:
+ * Not applicable
+ */
+void enable_string_interning();
+
+/*
+ * Function:
+ * disable_string_interning()
+ *
+ * Description:
+ * Turns off interning of string values. Strings created after the call
+ * always have their own internal value. Strings that were created while
+ * interning was on continue to share their values until they are deleted.
+ *
+ * Usage:
+ *      disable_string_interning();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * Not applicable
+ *
+ * Errors:
+ * Not applicable
+ */
+void disable_string_interning();
+
+/*
+ * Function:
+ * string_interning_is_on()
+ *
+ * Description:
+ * Indicates whether new string values are interned.
+ *
+ * Usage:
+ *      bool r = string_interning_is_on();
+ *
+ * Parameters:
+ * none
+ *
+ * Return:
+ * true if enable_string_interning has been called and has not been followed
+ * by a call to disable_string_interning, false otherwise.
+ *
+ * Errors:
+ * Not applicable
+ */
+bool string_interning_is_on();
+
 /*
  * Type definition:
  * struct string - a string whose "member" functions ensure operations on its
@@ -169,7 +315,9 @@ int fprintString(FILE* stream, const char* format, String s);
  *      concat
  *      equals
  *      get_value
+ *      hash
  *      index_of
+ *      index_of_str
  *      length
  *      split
  *      substring
@@ -272,8 +420,10 @@ struct string {
      * If either or both parameters is NULL, the function will return false.
      * Note: two non-null pointers to the same string object are trivially equal 
      * because they are identical their internal representation will be 
-     * identical (i.e. the same objects in memory).
-     * 
+     * identical (i.e. the same objects in memory). Likewise, two strings that
+     * share an interned value (see enable_string_interning) are equal
+     * without comparing their characters.
+     *
      * Usage: 
      *      String s1 = newString("hello");     
      *      String s2 = newString("hello");
@@ -357,6 +507,42 @@ struct string {
      */
     char* (*get_value)(String self, char* buf);
 
+    /*
+     * Pointer to function member field:
+     * hash(String self)
+     * 
+     * Description:
+     * Return a hash of the content of the string. Logically equal strings 
+     * (see equals) always have the same hash, so the hash can be used to 
+     * place Strings in containers that are keyed by content. The hash is 
+     * computed the first time it is needed and cached with the string value,
+     * so subsequent calls do not read the characters of the string again.
+     * equals uses cached hashes to reject unequal strings without comparing
+     * their characters.
+     * 
+     * Usage: 
+     *      String s = newString("hello");      // assume s is not null
+     *      String t = newString("hello");      // assume t is not null
+     *      unsigned hs = s->hash(s);           // hs == t->hash(t)
+     *      ...
+     *      ...
+     *      deleteString(&s);
+     *      deleteString(&t);
+     *
+     * Parameters:
+     * self - the non-null String on which hash is called (e.g. s in above
+     *      example). 
+     *
+     * Return:
+     * On success: the hash of the content of the string
+     * On failure: 0 and errno will be set to EINVAL
+     *
+     * Errors:
+     * If the call fails, 0 will be returned and errno will be set to:
+     *      EINVAL - invalid argument: if self is NULL
+     */
+    unsigned (*hash)(String self);
+
     /*
      * Pointer to function member field:
      * index_of(String self, char c, int start)
@@ -394,6 +580,49 @@ struct string {
      */
     int (*index_of)(String self, char c, int start);
 
+    /*
+     * Pointer to function member field:
+     * index_of_str(String self, String needle, int start)
+     * 
+     * Description:
+     * Return the index position of the first occurrence of the value of the
+     * String needle in the given string, starting from position start. If 
+     * needle does not occur in the string at or after the starting position,
+     * -1 is returned. An empty needle occurs at every position, so start is
+     * returned for an empty needle.
+     * The search uses the Two-Way string matching algorithm. It takes time 
+     * linear in the length of the string, uses constant space and does not 
+     * allocate memory.
+     * 
+     * Usage: 
+     *      String s = newString("hello hello");    // assume s is not null
+     *      String ll = newString("ll");            // assume ll is not null
+     *      int l1 = s->index_of_str(s, ll, 0);     // l1 will be 2
+     *      int l2 = s->index_of_str(s, ll, 3):     // l2 will be 8
+     *      ...
+     *      ...
+     *      deleteString(&s);    
+     *      deleteString(&ll);    
+     *
+     * Parameters:
+     * self - the non-null String on which index_of_str is called (e.g. s in 
+     *      above example). 
+     * needle - the non-null String to find in self
+     * start - the position in the string to start the search from, in the 
+     *      range 0 to self->length(self)
+     *
+     * Return:
+     * On success: the index of the first occurrence of needle at or after 
+     *      start, or -1 if there is no such occurrence
+     * On failure: -2 and errno will be set to EINVAL
+     *
+     * Errors:
+     * If the call fails, -2 will be returned and errno will be set to:
+     *      EINVAL - invalid argument: if self or needle is NULL or start is 
+     *          outside the valid range for the string.
+     */
+    int (*index_of_str)(String self, String needle, int start);
+
     /*
      * Pointer to function member field:
      * length(String self)
@@ -545,6 +774,175 @@ struct string {
     String (*substring)(String self, int start, int length);
 };
 
+/*
+ * Type definition:
+ * StringBuilder
+ * 
+ * Description:
+ * Declares StringBuilder to be an alias for the type: "pointer to a struct
+ * string_builder". (See below for definition of struct string_builder).
+ */
+typedef struct string_builder* StringBuilder;
+
+/*
+ * Function:
+ * newStringBuilder(int capacity)
+ * 
+ * Description:
+ * Dynamically allocate a new, empty struct string_builder and return a 
+ * pointer to it. A StringBuilder is a mutable buffer of characters that is 
+ * used to construct a String piece by piece. Its buffer grows geometrically
+ * (doubling) as characters are appended, so appending n pieces costs 
+ * O(log n) reallocations, and the final String is created once by build.
+ * Like a String, the content of a StringBuilder is maintained in an object
+ * map and is not directly accessible via the struct. The content of a
+ * StringBuilder is never written to the object store.
+ * It is the user's responsibility to use deleteStringBuilder to free memory
+ * allocated by newStringBuilder.
+ *
+ * Usage: 
+ *      StringBuilder sb = newStringBuilder(0);
+ *      sb->append_cstr(sb, "status=");
+ *      sb->append_int(sb, 200);
+ *      String s = sb->build(sb);       // s will be "status=200"
+ *      ...
+ *      deleteString(&s);
+ *      deleteStringBuilder(&sb);
+ *
+ * Parameters:
+ * capacity - the initial capacity of the buffer in characters. A capacity 
+ *      less than 1 selects a small default capacity. The capacity is capped
+ *      at STR_LEN_MAX.
+ *
+ * Return:
+ * On success: a new non-null pointer to a dynamically allocated 
+ *      string_builder struct (or StringBuilder) with empty content
+ * On failure: NULL, and errno will be set to ENOMEM
+ *
+ * Errors:
+ * If the call fails, the NULL pointer will be returned and errno will be 
+ * set as follows.
+ *      ENOMEM - not enough space: if dynamic allocation fails
+ */
+StringBuilder newStringBuilder(int capacity);
+
+/*
+ * Function:
+ * deleteStringBuilder(StringBuilder* asb)
+ * 
+ * Description:
+ * Delete a struct string_builder previously allocated by newStringBuilder,
+ * freeing its buffer. Strings previously returned by build are not 
+ * affected.
+ *
+ * Usage: 
+ *      StringBuilder sb = newStringBuilder(0);
+ *      ...
+ *      deleteStringBuilder(&sb);
+ *      // sb is now NULL
+ *
+ * Parameters:
+ * asb - the address of a StringBuilder pointer
+ *
+ * Return:
+ * No return value but a side effect of this function is that the pointer to 
+ * the struct string_builder is set to NULL.
+ *
+ * Errors:
+ * Not applicable
+ */
+void deleteStringBuilder(StringBuilder* asb);
+
+/*
+ * Type definition:
+ * struct string_builder - a mutable buffer used to construct Strings.
+ * 
+ * Description:
+ * The definition of a string builder type with "member functions":
+ *      append_char
+ *      append_cstr
+ *      append_int
+ *      append_string
+ *      build
+ *      length
+ * 
+ * The content of a StringBuilder is limited to STR_LEN_MAX characters, the 
+ * same limit as a String. Characters appended beyond that limit are 
+ * discarded, in the same way that newString truncates its value.
+ *
+ * The append member functions return true on success and false on failure,
+ * in which case errno will be set to:
+ *      EINVAL - invalid argument: if self (or the value to append) is NULL
+ *          or does not exist
+ *      ENOMEM - not enough space: if the buffer cannot be grown
+ * The content of the StringBuilder is unchanged by a failed append.
+ */
+struct string_builder {
+    /*
+     * Pointer to function member field:
+     * append_char(StringBuilder self, char c)
+     * 
+     * Description:
+     * Append the character c to the content of self. c must not be NUL.
+     */
+    bool (*append_char)(StringBuilder self, char c);
+
+    /*
+     * Pointer to function member field:
+     * append_cstr(StringBuilder self, const char* s)
+     * 
+     * Description:
+     * Append the NUL-terminated character string s to the content of self.
+     */
+    bool (*append_cstr)(StringBuilder self, const char* s);
+
+    /*
+     * Pointer to function member field:
+     * append_int(StringBuilder self, int i)
+     * 
+     * Description:
+     * Append the decimal representation of i to the content of self.
+     */
+    bool (*append_int)(StringBuilder self, int i);
+
+    /*
+     * Pointer to function member field:
+     * append_string(StringBuilder self, String s)
+     * 
+     * Description:
+     * Append the value of the String s to the content of self. The value is
+     * copied directly from s without an intermediate copy.
+     */
+    bool (*append_string)(StringBuilder self, String s);
+
+    /*
+     * Pointer to function member field:
+     * build(StringBuilder self)
+     * 
+     * Description:
+     * Return a newly allocated String whose value is the current content of 
+     * self. self is not changed and can be appended to and built again. As
+     * with newString, it is the responsibility of the user to subsequently
+     * free memory allocated for the returned String by using deleteString.
+     * 
+     * Return:
+     * On success: a new non-null String
+     * On failure: NULL, and errno will be set to EINVAL if self is NULL or
+     *      does not exist or to a value set by newString.
+     */
+    String (*build)(StringBuilder self);
+
+    /*
+     * Pointer to function member field:
+     * length(StringBuilder self)
+     * 
+     * Description:
+     * Return the length of the current content of self, or -1 with errno set
+     * to EINVAL if self is NULL or does not exist.
+     */
+    int (*length)(StringBuilder self);
+};
+
 /*  
  * Function:
  * _test_string_val(String s)
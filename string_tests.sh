@@ -13,7 +13,7 @@ cd ./bin
 
 if [ $? != 0 ]; then exit $?; fi
 
-for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15
+for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
 do
     ./test_string $i $1
 done
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../obj_store.h"
+
+/*
+ * Benchmark of object store throughput (objects stored per second) for each
+ * backend (uring is the files backend with the io_uring engine, slots is the
+ * fixed-slot store for the benchmark's type, memory the in-memory backend
+ * that does no I/O), durability mode and synchronous/async mode. The store
+ * is created in the ostore sub-directory of the current directory, so run
+ * it from a directory on the filesystem to measure (e.g. bin).
+ *
+ * A second table gives the create and unlink rates of the files backend
+ * with populations of 1e4 objects up to max_population (by powers of 10)
+ * for each number of shard directory levels.
+ *
+ * A third table gives the rate of load_obj of the objects for the files, 
+ * log and memory backends, without a cache and with a cache of every 
+ * object.
+ *
+ * Usage:
+ *      bin/ostore_bench [objects [max_population]]
+ */
+
+#define DEFAULT_OBJS 2000
+#define DEFAULT_POPULATION 100000
+#define MIN_POPULATION 10000
+
+static const char* BACKENDS[] = { "files", "uring", "log", "slots",
+    "memory" };
+static const ostore_backend LOAD_BACKENDS[] = { OSTORE_FILES, OSTORE_LOG,
+    OSTORE_MEMORY };
+static const char* LOAD_NAMES[] = { "files", "log", "memory" };
+static const char* MODES[] = { "none", "interval", "count", "always" };
+
+static double now_s() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* objects per second storing n objects (and unlinking them, untimed) */
+static double bench(ostore_opts* opts, int n) {
+    char valstr[32];
+    object_rep obj_rep = { "bench", 0, valstr };
+
+    if (!enable_ostore_opts(opts)) {
+        perror("enable_ostore_opts");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_s();
+
+    for (int i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i;
+        snprintf(valstr, sizeof(valstr), "%d", i * 7919);
+
+        if (!store_obj(&obj_rep)) {
+            perror("store_obj");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!flush_ostore()) {
+        perror("flush_ostore");
+        exit(EXIT_FAILURE);
+    }
+
+    double secs = now_s() - start;
+
+    for (int i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i;
+        unlink_obj(&obj_rep);
+    }
+
+    (void) compact_ostore();
+    disable_ostore();
+
+    return n / secs;
+}
+
+/* 
+ * objects per second creating n objects with shard_levels levels, and 
+ * unlinking them (*unlinks)
+ */
+static double bench_shard(unsigned levels, long n, double* unlinks) {
+    char valstr[32];
+    object_rep obj_rep = { "shard", 0, valstr };
+    ostore_opts opts = { .shard_levels = levels };
+
+    if (!enable_ostore_opts(&opts)) {
+        perror("enable_ostore_opts");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_s();
+
+    /* ids spaced as the addresses of objects */
+    for (long i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i * 32;
+        snprintf(valstr, sizeof(valstr), "%ld\n", i);
+
+        if (!store_obj(&obj_rep)) {
+            perror("store_obj");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double creates = n / (now_s() - start);
+
+    start = now_s();
+
+    for (long i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i * 32;
+        unlink_obj(&obj_rep);
+    }
+
+    *unlinks = n / (now_s() - start);
+    disable_ostore();
+
+    return creates;
+}
+
+/* objects per second loading n stored objects with load_obj */
+static double bench_load(ostore_opts* opts, int n) {
+    char valstr[32];
+    char buf[32];
+    object_rep obj_rep = { "bench", 0, valstr };
+
+    if (!enable_ostore_opts(opts)) {
+        perror("enable_ostore_opts");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i;
+        snprintf(valstr, sizeof(valstr), "%d\n", i * 7919);
+
+        if (!store_obj(&obj_rep)) {
+            perror("store_obj");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double start = now_s();
+
+    for (int i = 0; i < n; i++) {
+        if (load_obj("bench", (uintptr_t) i, buf, sizeof(buf)) < 0) {
+            perror("load_obj");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double secs = now_s() - start;
+
+    for (int i = 0; i < n; i++) {
+        obj_rep.id = (uintptr_t) i;
+        unlink_obj(&obj_rep);
+    }
+
+    (void) compact_ostore();
+    disable_ostore();
+
+    return n / secs;
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : DEFAULT_OBJS;
+    long max = argc > 2 ? atol(argv[2]) : DEFAULT_POPULATION;
+
+    if (n < 1)
+        n = DEFAULT_OBJS;
+
+    printf("%8s %10s %14s %14s\n", "backend", "durability", "sync", "async");
+    printf("%8s %10s %14s %14s\n", "", "", "(objs/s)", "(objs/s)");
+
+    for (int b = 0; b < 5; b++) {
+        for (int m = OSTORE_SYNC_NONE; m <= OSTORE_SYNC_ALWAYS; m++) {
+            ostore_opts opts = { .backend = b == 2 ? OSTORE_LOG 
+                : b == 4 ? OSTORE_MEMORY : OSTORE_FILES,
+                .io_uring = b == 1, .slot_type = b == 3 ? "bench" : NULL,
+                .durability = m,
+                .sync_interval_ms = 10, .sync_every = 64 };
+            double sync = bench(&opts, n);
+
+            opts.async = true;
+            double async = bench(&opts, n);
+
+            printf("%8s %10s %14.0f %14.0f\n", BACKENDS[b], MODES[m], sync,
+                async);
+        }
+    }
+
+    printf("\n%10s %6s %14s %14s\n", "population", "shards", "create", 
+        "unlink");
+    printf("%10s %6s %14s %14s\n", "", "", "(objs/s)", "(objs/s)");
+
+    for (long p = MIN_POPULATION; p <= max; p *= 10) {
+        for (unsigned levels = 0; levels <= 2; levels++) {
+            double unlinks;
+            double creates = bench_shard(levels, p, &unlinks);
+
+            printf("%10ld %6u %14.0f %14.0f\n", p, levels, creates, unlinks);
+        }
+    }
+
+    printf("\n%8s %14s %14s\n", "backend", "uncached", "cached");
+    printf("%8s %14s %14s\n", "", "(loads/s)", "(loads/s)");
+
+    for (int b = 0; b < 3; b++) {
+        ostore_opts opts = { .backend = LOAD_BACKENDS[b] };
+        double cold = bench_load(&opts, n);
+
+        opts.cache_size = n;
+        double hot = bench_load(&opts, n);
+
+        printf("%8s %14.0f %14.0f\n", LOAD_NAMES[b], cold, hot);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../string_o.h"
+
+/* 
+ * Benchmark of String substring search: index_of_str against the
+ * substring-and-equals loop that it replaces.
+ *
+ * Usage:
+ *      bin/string_bench [iterations]
+ */
+
+#define DEFAULT_ITERS 2000
+
+/* the substring-and-equals search that index_of_str replaces */
+static int naive_index_of_str(String s, String needle, int start) {
+    int slen = s->length(s);
+    int nlen = needle->length(needle);
+
+    for (int i = start; i + nlen <= slen; i++) {
+        String sub = s->substring(s, i, nlen);
+        bool found = sub && sub->equals(sub, needle);
+
+        deleteString(&sub);
+
+        if (found)
+            return i;
+    }
+
+    return -1;
+}
+
+static double now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(int hlen, int nlen, int iters) {
+    char hbuf[hlen + 1];
+    char nbuf[nlen + 1];
+
+    /* a haystack of a repeated pattern with the needle only at the end */
+    for (int i = 0; i < hlen; i++)
+        hbuf[i] = "abcab"[i % 5];
+    hbuf[hlen] = '\0';
+
+    memcpy(nbuf, hbuf + hlen - nlen, nlen);
+    nbuf[nlen - 1] = 'z';
+    nbuf[nlen] = '\0';
+    hbuf[hlen - 1] = 'z';
+
+    String s = newString(hbuf);
+    String needle = newString(nbuf);
+
+    int exp = hlen - nlen;
+    int r1 = 0, r2 = 0;
+
+    double t0 = now_ns();
+    for (int i = 0; i < iters; i++)
+        r1 = s->index_of_str(s, needle, 0);
+    double t1 = now_ns();
+    for (int i = 0; i < iters; i++)
+        r2 = naive_index_of_str(s, needle, 0);
+    double t2 = now_ns();
+
+    if (r1 != exp || r2 != exp)
+        printf("unexpected result: %d %d (expected %d)\n", r1, r2, exp);
+
+    double fast = (t1 - t0) / iters;
+    double slow = (t2 - t1) / iters;
+
+    printf("%8d %8d %14.1f %14.1f %9.1fx\n", hlen, nlen, fast, slow, 
+        slow / fast);
+
+    deleteString(&s);
+    deleteString(&needle);
+}
+
+int main(int argc, char** argv) {
+    int iters = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERS;
+    int hlens[] = { 64, 256, STR_LEN_MAX };
+    int nlens[] = { 2, 8, 32 };
+
+    if (iters < 1)
+        iters = DEFAULT_ITERS;
+
+    printf("%8s %8s %14s %14s %10s\n", "haystack", "needle", 
+        "index_of_str", "substr+equals", "speedup");
+    printf("%8s %8s %14s %14s\n", "(chars)", "(chars)", "(ns/search)", 
+        "(ns/search)");
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            bench(hlens[i], nlens[j], iters);
+
+    return 0;
+}
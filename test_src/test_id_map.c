@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include "test_lib.h"
+#include "../id_map.h"
+
+#define NR_TESTS 3
+
+/* test functions */
+int test_set_get_delete_identry();
+int test_foreach_identry();
+int test_identry_err();
+
+struct test_defn test_schedule[NR_TESTS] = {
+    /* test 0 */
+    { "test_set_get_delete_identry", test_set_get_delete_identry, 12, 0 },
+    /* test 1 */
+    { "test_foreach_identry", test_foreach_identry, 3, 0 },
+    /* test 2 */
+    { "test_identry_err", test_identry_err, 10, 0 },
+};
+
+/* number of entries used in tests, enough to grow the map several times */
+#define NIDS 10000
+
+int main(int argc, char** argv) {
+    run_tests(argc, argv, NR_TESTS, test_schedule, true);
+    
+    return 0;
+}
+
+int test_set_get_delete_identry() {
+    int test_case = 0;
+    static int vals[NIDS];
+    errno = 0;
+    idmap* m = create_idmap();
+
+    assert_notnull(++test_case, __LINE__, m);
+    assert_eq(++test_case, __LINE__, get_numidentries(m), 0);
+
+    bool ok = true;
+
+    /* ids as aligned addresses and 0, which is a valid id */
+    for (int i = 0; i < NIDS; i++) {
+        vals[i] = i;
+        ok = set_identry(m, (uintptr_t) i * 16, &vals[i]) && ok;
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_eq(++test_case, __LINE__, get_numidentries(m), NIDS);
+
+    int wrong = 0;
+
+    for (int i = 0; i < NIDS; i++)
+        if (get_identry(m, (uintptr_t) i * 16) != &vals[i])
+            wrong++;
+
+    assert_eq(++test_case, __LINE__, wrong, 0);
+
+    /* replace does not add an entry */
+    assert_true(++test_case, __LINE__, set_identry(m, 16, &vals[7]));
+    assert_identical(++test_case, __LINE__, get_identry(m, 16), &vals[7]);
+    assert_eq(++test_case, __LINE__, get_numidentries(m), NIDS);
+
+    /* delete every other entry, the rest must still be found */
+    for (int i = 0; i < NIDS; i += 2)
+        if (delete_identry(m, (uintptr_t) i * 16) != &vals[i])
+            wrong++;
+
+    assert_eq(++test_case, __LINE__, wrong, 0);
+    assert_eq(++test_case, __LINE__, get_numidentries(m), NIDS / 2);
+
+    for (int i = 3; i < NIDS; i += 2)
+        if (get_identry(m, (uintptr_t) i * 16) != &vals[i] 
+            || get_identry(m, (uintptr_t) (i - 1) * 16))
+            wrong++;
+
+    assert_eq(++test_case, __LINE__, wrong, 0);
+
+    delete_idmap(&m);
+    assert_null(++test_case, __LINE__, m);
+
+    return test_case;
+}
+
+static void sum_entry(uintptr_t id, void* val, void* arg) {
+    long* sums = (long*) arg;
+
+    sums[0] += (long) id;
+    sums[1] += *(int*) val;
+    sums[2]++;
+}
+
+int test_foreach_identry() {
+    int test_case = 0;
+    static int vals[NIDS];
+    long exp_ids = 0, exp_vals = 0;
+    long sums[3] = { 0, 0, 0 };
+    idmap* m = create_idmap();
+    assert(m);
+
+    for (int i = 0; i < NIDS; i++) {
+        vals[i] = i * 3;
+        assert(set_identry(m, (uintptr_t) i + 1000, &vals[i]));
+        exp_ids += i + 1000;
+        exp_vals += i * 3;
+    }
+
+    foreach_identry(m, sum_entry, sums);
+
+    assert_true(++test_case, __LINE__, sums[0] == exp_ids);
+    assert_true(++test_case, __LINE__, sums[1] == exp_vals);
+    assert_eq(++test_case, __LINE__, (int) sums[2], NIDS);
+
+    delete_idmap(&m);
+
+    return test_case;
+}
+
+int test_identry_err() {
+    int test_case = 0;
+    int val = 1;
+    idmap* m = create_idmap();
+    assert(m);
+
+    errno = 0;
+    assert_null(++test_case, __LINE__, get_identry(m, 42));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    errno = 0;
+    assert_null(++test_case, __LINE__, delete_identry(m, 42));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, set_identry(m, 42, NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, set_identry(NULL, 42, &val));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    errno = 0;
+    assert_eq(++test_case, __LINE__, get_numidentries(NULL), -1);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    delete_idmap(&m);
+
+    return test_case;
+}
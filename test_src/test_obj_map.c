@@ -11,7 +11,7 @@
 #include "strtest_lib.h"
 #include "../obj_map.h"
 
-#define NR_TESTS 7
+#define NR_TESTS 8
 
 /* test functions */
 int test_create_map();
@@ -21,6 +21,7 @@ int test_get_mentry();
 int test_get_numbuckets();
 int test_get_numentries();
 int test_set_mentry();
+int test_foreach_mentry();
 
 struct test_defn test_schedule[NR_TESTS] = {
     /* test 0 */
@@ -37,10 +38,13 @@ struct test_defn test_schedule[NR_TESTS] = {
     { "test_get_numentries", test_get_numentries, 53, 0 },
     /* test 6 */
     { "test_set_mentry", test_set_mentry, 33, 0 },
+    /* test 7 */
+    { "test_foreach_mentry", test_foreach_mentry, 56, 0 },
 
 };
 
 /* helper functions */
+void _sum_entry(void* key, void* val, void* arg);
 
 int main(int argc, char** argv) {
     run_tests(argc, argv, NR_TESTS, test_schedule, true);
@@ -388,3 +392,47 @@ int test_set_mentry() {
     return test_case;
 }
 
+int test_foreach_mentry() {
+    int test_case = 0;
+    int vals[50];
+    int sum = 0;
+    omap* m = create_map_wbuckets(7);
+
+    assert(m);
+
+    errno = 0;
+    foreach_mentry(m, _sum_entry, &sum);
+    assert_eq(++test_case, __LINE__, sum, 0);
+    assert_eq(++test_case, __LINE__, errno, 0);
+
+    /* more entries than buckets, so some buckets have chains */
+    for (int i = 0; i < 50; i++) {
+        vals[i] = i;
+        assert_true(++test_case, __LINE__, set_mentry(m, &vals[i], &vals[i]));
+    }
+
+    foreach_mentry(m, _sum_entry, &sum);
+    assert_eq(++test_case, __LINE__, sum, 49 * 50 / 2);
+
+    (void) delete_mentry(m, &vals[10]);
+    sum = 0;
+    foreach_mentry(m, _sum_entry, &sum);
+    assert_eq(++test_case, __LINE__, sum, 49 * 50 / 2 - 10);
+
+    errno = 0;
+    foreach_mentry(NULL, _sum_entry, &sum);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    errno = 0;
+    foreach_mentry(m, NULL, &sum);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    delete_map(&m);
+
+    return test_case;
+}
+
+/* adds the value of an entry to *arg, checking the key maps to it */
+void _sum_entry(void* key, void* val, void* arg) {
+    assert(key == val);
+    *(int*) arg += *(int*) val;
+}
@@ -8,6 +8,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
+#include <dirent.h>
 #include "test_lib.h"
 #include "strtest_lib.h"
 #include "../string_o.h"
@@ -17,12 +19,32 @@
 static char* OFILE_FMT = "./%s/%s/%#zx.txt";
 static char* OSTORE_DIR = "ostore";
 
-#define NR_TESTS 3
+#define NR_TESTS 23
 
 /* test functions */
 int test_enable_is_on();
 int test_store_unlink_norm();
 int test_store_unlink_err();
+int test_log_compact();
+int test_async();
+int test_durability();
+int test_many_types();
+int test_io_uring();
+int test_slots();
+int test_binary_format();
+int test_defer();
+int test_load();
+int test_shard();
+int test_compress();
+int test_dedup();
+int test_checkpoint();
+int test_load_obj();
+int test_stats();
+int test_rate();
+int test_nursery();
+int test_memory();
+int test_store_iov();
+int test_unlink_async();
 
 struct test_defn test_schedule[NR_TESTS] = {
     /* test 0 */
@@ -30,7 +52,47 @@ struct test_defn test_schedule[NR_TESTS] = {
     /* test 1 */
     { "test_ostore_unlink_norm", test_store_unlink_norm, 169, 0 },
     /* test 2 */
-    { "test_ostore_unlink_err", test_store_unlink_err, 6, 0 }
+    { "test_ostore_unlink_err", test_store_unlink_err, 6, 0 },
+    /* test 3 */
+    { "test_ostore_log_compact", test_log_compact, 13, 0 },
+    /* test 4 */
+    { "test_ostore_async", test_async, 34, 0 },
+    /* test 5 */
+    { "test_ostore_durability", test_durability, 41, 0 },
+    /* test 6 */
+    { "test_ostore_many_types", test_many_types, 181, 0 },
+    /* test 7 */
+    { "test_ostore_io_uring", test_io_uring, 25, 0 },
+    /* test 8 */
+    { "test_ostore_slots", test_slots, 18, 0 },
+    /* test 9 */
+    { "test_ostore_binary_format", test_binary_format, 72, 0 },
+    /* test 10 */
+    { "test_ostore_defer", test_defer, 57, 0 },
+    /* test 11 */
+    { "test_ostore_load", test_load, 102, 0 },
+    /* test 12 */
+    { "test_ostore_shard", test_shard, 48, 0 },
+    /* test 13 */
+    { "test_ostore_compress", test_compress, 48, 0 },
+    /* test 14 */
+    { "test_ostore_dedup", test_dedup, 60, 0 },
+    /* test 15 */
+    { "test_ostore_checkpoint", test_checkpoint, 53, 0 },
+    /* test 16 */
+    { "test_ostore_load_obj", test_load_obj, 99, 0 },
+    /* test 17 */
+    { "test_ostore_stats", test_stats, 156, 0 },
+    /* test 18 */
+    { "test_ostore_rate", test_rate, 149, 0 },
+    /* test 19 */
+    { "test_ostore_nursery", test_nursery, 53, 0 },
+    /* test 20 */
+    { "test_ostore_memory", test_memory, 60, 0 },
+    /* test 21 */
+    { "test_ostore_store_iov", test_store_iov, 73, 0 },
+    /* test 22 */
+    { "test_ostore_unlink_async", test_unlink_async, 60, 0 }
 };
 
 /* helper functions */
@@ -38,6 +100,19 @@ int assert_written(int test_case, int called_at, const char* type,
     uintptr_t oid, char* data);
 int assert_unlinked(int test_case, int called_at, char* ofile);
 object_rep* _new_dummy_obj_rep(void* obj);
+off_t _segs_size(const char* type, bool remove);
+bool _file_contains(const char* path, const char* data);
+ssize_t _read_file(const char* type, uintptr_t oid, char* buf, size_t size);
+bool _segs_contain(const char* type, const char* data);
+void* _parse_int(const char* valstr, void* arg);
+int _find_ofile(const char* dir, uintptr_t oid, char* path, size_t size);
+int _count_blobs(const char* type);
+void* _parse_str(const char* valstr, void* arg);
+void* _parse_dup(const char* valstr, void* arg);
+void _delete_obj(uintptr_t id, void* val, void* arg);
+void _delete_loaded(idmap** objs, bool strings);
+bool _flip_byte(const char* path, off_t off);
+uint64_t _now_ms();
 
 int main(int argc, char** argv) {
     run_tests(argc, argv, NR_TESTS, test_schedule, true);
@@ -169,6 +244,1951 @@ int test_store_unlink_err() {
     return test_case;
 }
 
+int test_log_compact() {
+    int test_case = 0;
+    char valstr[16];
+    ostore_opts opts = { .backend = OSTORE_LOG, .log_segment_size = 256 };
+    object_rep obj_rep = { "logobj", 0, valstr };
+    off_t written = 0;
+    bool ok = true;
+
+    disable_ostore();
+    
+    errno = 0;
+    assert_false(++test_case, __LINE__, compact_ostore());
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    
+    errno = 0;
+    obj_rep.id = 1;
+    strcpy(valstr, "v001");
+    assert_false(++test_case, __LINE__, store_obj(&obj_rep));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    
+    (void) _segs_size(obj_rep.type, true);  /* start from an empty log */
+
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, ostore_is_on());
+
+    /* 20 puts of 16 byte header + 4 bytes, then 15 tombstones of 16 bytes */
+    for (int i = 1; i <= 20; i++) {
+        obj_rep.id = i;
+        snprintf(valstr, sizeof(valstr), "v%03d", i);
+        ok = store_obj(&obj_rep) && ok;
+        written += 20;
+    }
+    
+    for (int i = 1; i <= 15; i++) {
+        obj_rep.id = i;
+        unlink_obj(&obj_rep);
+        written += 16;
+    }
+    
+    assert_true(++test_case, __LINE__, ok);
+    assert_true(++test_case, __LINE__, compact_ostore());
+    assert_true(++test_case, __LINE__, _segs_size(obj_rep.type, false) 
+        < written);
+
+    for (int i = 16; ok && i <= 20; i++) {
+        snprintf(valstr, sizeof(valstr), "v%03d", i);
+        ok = _segs_contain(obj_rep.type, valstr);
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    
+    /* reopening replays the compacted segments */
+    disable_ostore();
+    assert_false(++test_case, __LINE__, ostore_is_on());
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, compact_ostore());
+    
+    disable_ostore();
+     
+    return test_case;
+}
+
+int test_async() {
+    int test_case = 0;
+    char valstr[16];
+    ostore_opts opts = { .async = true, .async_queue_size = 4 };
+    object_rep obj_rep = { "asyncobj", 0, valstr };
+    char *ofile = NULL;
+    bool ok = true;
+
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    /* a queue of 4 blocks the producer while the writer catches up */
+    for (int i = 1; i <= 100; i++) {
+        obj_rep.id = i;
+        snprintf(valstr, sizeof(valstr), "a%d", i);
+        ok = store_obj(&obj_rep) && ok;
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    test_case = assert_written(test_case, __LINE__, obj_rep.type, 1, "a1");
+    test_case = assert_written(test_case, __LINE__, obj_rep.type, 100, 
+        "a100");
+
+    for (int i = 1; i <= 100; i++) {
+        obj_rep.id = i;
+        unlink_obj(&obj_rep);
+    }
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, obj_rep.type, 
+        (uintptr_t) 100);
+    test_case = assert_unlinked(test_case, __LINE__, ofile);
+
+    /* with sync backpressure operations on an object keep their order */
+    opts.async_queue_size = 2;
+    opts.async_backpressure = OSTORE_BP_SYNC;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    obj_rep.id = 1;
+    for (int i = 1; i <= 50; i++) {
+        snprintf(valstr, sizeof(valstr), "b%d", i);
+        ok = store_obj(&obj_rep) && ok;
+        if (i < 50)
+            unlink_obj(&obj_rep);
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    test_case = assert_written(test_case, __LINE__, obj_rep.type, 1, "b50");
+    unlink_obj(&obj_rep);
+
+    /* errors of queued operations are reported by flush_ostore */
+    int fd = open("ostore/asyncfile", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    close(fd);
+    
+    obj_rep.type = "asyncfile";
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    errno = 0;
+    assert_false(++test_case, __LINE__, flush_ostore());
+    assert_eq(++test_case, __LINE__, errno, ENOTDIR);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    unlink("ostore/asyncfile");
+
+    disable_ostore();
+    assert_false(++test_case, __LINE__, ostore_is_on());
+    errno = 0;
+    assert_false(++test_case, __LINE__, flush_ostore());
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    
+    return test_case;
+}
+
+int test_durability() {
+    int test_case = 0;
+    char valstr[16];
+    ostore_opts opts = { .sync_interval_ms = 5, .sync_every = 3 };
+    object_rep obj_rep = { "syncobj", 0, valstr };
+    ostore_durability modes[] = { OSTORE_SYNC_NONE, OSTORE_SYNC_INTERVAL, 
+        OSTORE_SYNC_COUNT, OSTORE_SYNC_ALWAYS };
+
+    opts.durability = OSTORE_SYNC_ALWAYS + 1;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    /* every mode, synchronous and async, with the files backend */
+    for (int m = 0; m < 4; m++) {
+        bool ok = true;
+
+        opts.durability = modes[m];
+        opts.async = m % 2;
+        assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+        
+        for (int i = 1; i <= 10; i++) {
+            obj_rep.id = i;
+            snprintf(valstr, sizeof(valstr), "d%d-%d", m, i);
+            ok = store_obj(&obj_rep) && ok;
+        }
+        
+        assert_true(++test_case, __LINE__, ok);
+        assert_true(++test_case, __LINE__, flush_ostore());
+        snprintf(valstr, sizeof(valstr), "d%d-10", m);
+        test_case = assert_written(test_case, __LINE__, obj_rep.type, 10, 
+            valstr);
+    }
+
+    /* the log backend commits a batch with one write */
+    opts.backend = OSTORE_LOG;
+    opts.async = false;
+    (void) _segs_size(obj_rep.type, true);
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    obj_rep.id = 1;
+    strcpy(valstr, "dlog");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    assert_true(++test_case, __LINE__, _segs_contain(obj_rep.type, "dlog"));
+
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_many_types() {
+    int test_case = 0;
+    char type[16];
+    object_rep obj_rep = { type, 0, "many" };
+
+    assert_true(++test_case, __LINE__, enable_ostore());
+
+    /* more types than the store keeps directories open for */
+    for (int i = 0; i < 20; i++) {
+        char *ofile = NULL;
+
+        snprintf(type, sizeof(type), "type%02d", i);
+        obj_rep.id = (uintptr_t) &test_case + i;
+        assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+        test_case = assert_written(test_case, __LINE__, type, obj_rep.id, 
+            "many");
+        unlink_obj(&obj_rep);
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, type, obj_rep.id);
+        test_case = assert_unlinked(test_case, __LINE__, ofile);
+    }
+
+    return test_case;
+}
+
+int test_io_uring() {
+    int test_case = 0;
+    char valstr[16];
+    ostore_opts opts = { .io_uring = true };
+    object_rep obj_rep = { "uringobj", 1, valstr };
+    char *ofile = NULL;
+    bool ok = true;
+
+    /* passes with or without kernel support (fallback) */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    strcpy(valstr, "first");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    strcpy(valstr, "2nd");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    test_case = assert_written(test_case, __LINE__, obj_rep.type, 1, "2nd");
+    unlink_obj(&obj_rep);
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, obj_rep.type, 
+        (uintptr_t) 1);
+    test_case = assert_unlinked(test_case, __LINE__, ofile);
+    
+    /* async batches with several operations on the same objects */
+    opts.async = true;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 300; i++) {
+        obj_rep.id = i % 10;
+        snprintf(valstr, sizeof(valstr), "u%d", i);
+        ok = store_obj(&obj_rep) && ok;
+        if (i % 3 == 0)
+            unlink_obj(&obj_rep);
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    
+    /* the last operation on id 9 was the store of u299 */
+    test_case = assert_written(test_case, __LINE__, obj_rep.type, 9, "u299");
+    /* and on id 7 the unlink after the store of u297 */
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, obj_rep.type, 
+        (uintptr_t) 7);
+    test_case = assert_unlinked(test_case, __LINE__, ofile);
+    
+    int fd = open("ostore/uringfile", O_CREAT | O_WRONLY, 0644);
+    assert(fd >= 0);
+    close(fd);
+    
+    opts.async = false;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    obj_rep.type = "uringfile";
+    errno = 0;
+    assert_false(++test_case, __LINE__, store_obj(&obj_rep));
+    assert_eq(++test_case, __LINE__, errno, ENOTDIR);
+    unlink("ostore/uringfile");
+
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_slots() {
+    int test_case = 0;
+    char valstr[32];
+    char* slots = "ostore/slotint.slots";
+    ostore_opts opts = { .slot_type = "slotint", 
+        .durability = OSTORE_SYNC_COUNT };
+    object_rep obj_rep = { "slotint", 0, valstr };
+    struct stat sbuf;
+    bool ok = true;
+
+    unlink(slots);
+
+    opts.slot_type = "bad/type";
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    opts.slot_type = "slotint";
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    /* more objects than the initial slots, so the file grows */
+    for (int i = 0; i < 3000; i++) {
+        obj_rep.id = i;
+        snprintf(valstr, sizeof(valstr), "<%d>\n", i);
+        ok = store_obj(&obj_rep) && ok;
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+
+    for (int i = 0; i < 3000; i += 2) {
+        obj_rep.id = i;
+        unlink_obj(&obj_rep);
+    }
+
+    /* no object files are written for the slot type */
+    assert_eq(++test_case, __LINE__, stat("ostore/slotint", &sbuf), -1);
+    
+    strcpy(valstr, "a value longer than a slot");
+    errno = 0;
+    assert_false(++test_case, __LINE__, store_obj(&obj_rep));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    assert_true(++test_case, __LINE__, flush_ostore());
+    disable_ostore();
+
+    assert_true(++test_case, __LINE__, _file_contains(slots, "<2999>\n"));
+    assert_false(++test_case, __LINE__, _file_contains(slots, "<2998>\n"));
+    assert_eq(++test_case, __LINE__, stat(slots, &sbuf), 0);
+    off_t size = sbuf.st_size;
+
+    /* reopened, the freed slots are reused and the file does not grow */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 3000; i += 2) {
+        obj_rep.id = 10000 + i;
+        snprintf(valstr, sizeof(valstr), "<%d>\n", 10000 + i);
+        ok = store_obj(&obj_rep) && ok;
+    }
+
+    obj_rep.id = 2999;
+    unlink_obj(&obj_rep);
+    disable_ostore();
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_eq(++test_case, __LINE__, stat(slots, &sbuf), 0);
+    assert_eq(++test_case, __LINE__, sbuf.st_size, size);
+    assert_true(++test_case, __LINE__, _file_contains(slots, "<12998>\n"));
+    assert_false(++test_case, __LINE__, _file_contains(slots, "<2999>\n"));
+    assert_true(++test_case, __LINE__, _file_contains(slots, "<2997>\n"));
+    
+    unlink(slots);
+
+    return test_case;
+}
+
+int test_binary_format() {
+    int test_case = 0;
+    char buf[64];
+    ostore_opts opts = { .format = OSTORE_FMT_BINARY };
+    object_rep ints = { "int", 1001, "-42\n" };
+    object_rep strs = { "str", 1002, "5:hello\n" };
+    object_rep raws = { "bfmt", 1003, "raw value\n" };
+    object_rep ints2 = { "int", 1004, NULL };
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, store_obj(&ints));
+    assert_true(++test_case, __LINE__, store_obj(&strs));
+    assert_true(++test_case, __LINE__, store_obj(&raws));
+    assert_true(++test_case, __LINE__, store_int_obj("int", 1004, 7));
+    
+    /* tag, 2 byte id, length, payload and 4 byte checksum */
+    assert_eq(++test_case, __LINE__, _read_file("int", 1001, buf, 64), 9);
+    assert_eq(++test_case, __LINE__, buf[0] & 0xf0, 0xb0);
+    assert_eq(++test_case, __LINE__, _read_file("str", 1002, buf, 64), 13);
+    assert_eq(++test_case, __LINE__, _read_file("bfmt", 1003, buf, 64), 18);
+    assert_eq(++test_case, __LINE__, _read_file("int", 1004, buf, 64), 9);
+
+    /* back to exactly the value strings */
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    test_case = assert_written(test_case, __LINE__, "int", 1001, "-42\n");
+    test_case = assert_written(test_case, __LINE__, "str", 1002, 
+        "5:hello\n");
+    test_case = assert_written(test_case, __LINE__, "bfmt", 1003, 
+        "raw value\n");
+    test_case = assert_written(test_case, __LINE__, "int", 1004, "7\n");
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    test_case = assert_written(test_case, __LINE__, "int", 1001, "-42\n");
+    
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_BINARY));
+    assert_eq(++test_case, __LINE__, _read_file("int", 1001, buf, 64), 9);
+    assert_eq(++test_case, __LINE__, _read_file("str", 1002, buf, 64), 13);
+
+    /* a corrupt record is left as it is, the others are converted */
+    char* ofile = NULL;
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "str", (uintptr_t) 1002);
+    int fd = open(ofile, O_WRONLY);
+    assert_eq(++test_case, __LINE__, pwrite(fd, "j", 1, 4), 1);
+    close(fd);
+    free(ofile);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    assert_eq(++test_case, __LINE__, errno, EBADMSG);
+    assert_eq(++test_case, __LINE__, _read_file("str", 1002, buf, 64), 13);
+    test_case = assert_written(test_case, __LINE__, "int", 1001, "-42\n");
+    
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(7));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    unlink_obj(&ints);
+    unlink_obj(&strs);
+    unlink_obj(&raws);
+    unlink_obj(&ints2);
+    disable_ostore();
+
+    /* text is the default and store_int_obj formats the value string */
+    assert_true(++test_case, __LINE__, enable_ostore());
+    assert_true(++test_case, __LINE__, store_int_obj("int", 1004, -7));
+    test_case = assert_written(test_case, __LINE__, "int", 1004, "-7\n");
+    unlink_obj(&ints2);
+
+    opts.backend = OSTORE_LOG;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    assert_eq(++test_case, __LINE__, errno, ENOTSUP);
+    disable_ostore();
+    (void) _segs_size("int", true);
+
+    opts.format = 2;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    return test_case;
+}
+
+int test_defer() {
+    int test_case = 0;
+    char valstr[32];
+    char buf[32];
+    char* ofile = NULL;
+    struct stat sbuf;
+    object_rep obj_rep = { "dfr", 0, valstr };
+    ostore_opts opts = { .defer_ms = 300 };
+    ostore_defer_stats stats;
+    bool ok = true;
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    errno = 0;
+    assert_false(++test_case, __LINE__, defer_stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    /* temporaries: every odd object is deleted straight away */
+    for (int i = 1; i <= 100; i++) {
+        obj_rep.id = i;
+        snprintf(valstr, sizeof(valstr), "%d\n", i);
+        ok = store_obj(&obj_rep) && ok;
+
+        if (i % 2)
+            unlink_obj(&obj_rep);
+    }
+
+    assert_true(++test_case, __LINE__, ok);
+    
+    /* nothing is written within the window */
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "dfr", (uintptr_t) 2);
+    assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), -1);
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.cancelled, 50);
+    assert_eq(++test_case, __LINE__, stats.persisted, 0);
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 50);
+    test_case = assert_written(test_case, __LINE__, "dfr", 2, "2\n");
+    test_case = assert_written(test_case, __LINE__, "dfr", 100, "100\n");
+    free(ofile);
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "dfr", (uintptr_t) 1);
+    assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), -1);
+    free(ofile);
+
+    /* cancelling a store of a persisted object still removes its file */
+    obj_rep.id = 2;
+    strcpy(valstr, "two\n");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    unlink_obj(&obj_rep);
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "dfr", (uintptr_t) 2);
+    assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), -1);
+    free(ofile);
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.cancelled, 51);
+
+    /* the last store of an object within the window is written */
+    obj_rep.id = 4;
+    strcpy(valstr, "four\n");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+    strcpy(valstr, "FOUR\n");
+    assert_true(++test_case, __LINE__, store_obj(&obj_rep));
+
+    /* a load is served from the pending store, which stays pending */
+    assert_eq(++test_case, __LINE__, load_obj("dfr", 4, buf, sizeof(buf)), 5);
+    assert_eq(++test_case, __LINE__, strcmp(buf, "FOUR\n"), 0);
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 50);
+
+    /* and is written without a flush once the window has passed */
+    usleep(700 * 1000);
+    test_case = assert_written(test_case, __LINE__, "dfr", 4, "FOUR\n");
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 51);
+    
+    for (int i = 2; i <= 100; i += 2) {
+        obj_rep.id = i;
+        unlink_obj(&obj_rep);
+    }
+
+    /* with the async writer */
+    opts.async = true;
+    opts.defer_ms = 50;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 0);
+
+    for (int i = 1; i <= 100; i++) {
+        obj_rep.id = i;
+        snprintf(valstr, sizeof(valstr), "%d\n", i);
+        ok = store_obj(&obj_rep) && ok;
+
+        if (i > 10)
+            unlink_obj(&obj_rep);
+    }
+
+    disable_ostore();
+    test_case = assert_written(test_case, __LINE__, "dfr", 10, "10\n");
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "dfr", (uintptr_t) 11);
+    assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), -1);
+    free(ofile);
+
+    assert_true(++test_case, __LINE__, enable_ostore());
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.cancelled, 0);
+
+    for (int i = 1; i <= 10; i++) {
+        obj_rep.id = i;
+        unlink_obj(&obj_rep);
+    }
+
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_load() {
+    int test_case = 0;
+    int vals[] = { 0, -7, 2147483647 };
+    char* strs[] = { "hello", "a:b" };
+    uintptr_t ioids[3], soids[2];
+    ostore_loader loaders[] = { 
+        { "int", _parse_int, NULL }, 
+        { "str", _parse_str, NULL } 
+    };
+    ostore_opts opts = { .backend = OSTORE_LOG, .format = OSTORE_FMT_BINARY };
+    ostore_opts bin_opts = { .format = OSTORE_FMT_BINARY };
+    object_rep bad = { "int", 0x10, "junk\n" };
+    object_rep corrupt = { "int", 0x30, NULL };
+    struct stat sbuf;
+    idmap* objs = NULL;
+    char* ofile = NULL;
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(loaders, 2, 4, &objs));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    assert_null(++test_case, __LINE__, objs);
+
+    /* objects stored before a restart */
+    assert_true(++test_case, __LINE__, enable_ostore());
+
+    for (int i = 0; i < 3; i++) {
+        Integer oi = newInteger(vals[i]);
+        ioids[i] = (uintptr_t) oi;      /* kept so the address is not reused */
+    }
+
+    for (int i = 0; i < 2; i++) {
+        String os = newString(strs[i]);
+        soids[i] = (uintptr_t) os;
+    }
+
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore());
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(NULL, 2, 4, &objs));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    loaders[1].parse = NULL;
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(loaders, 2, 4, &objs));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    loaders[1].parse = _parse_str;
+
+    /* orphans of a crash */
+    (void) asprintf(&ofile, "./%s/int/%#zx.tmp", OSTORE_DIR, ioids[0]);
+    close(open(ofile, O_WRONLY | O_CREAT, 0644));
+    free(ofile);
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "int", (uintptr_t) 0x20);
+    close(open(ofile, O_WRONLY | O_CREAT, 0644));
+    free(ofile);
+
+    assert_true(++test_case, __LINE__, load_ostore(loaders, 2, 4, &objs));
+    assert_notnull(++test_case, __LINE__, objs);
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 5);
+
+    for (int i = 0; i < 3; i++) {
+        Integer oi = (Integer) get_identry(objs, ioids[i]);
+        char valstr[16];
+
+        assert_notnull(++test_case, __LINE__, oi);
+        assert_eq(++test_case, __LINE__, oi->get_value(oi), vals[i]);
+        snprintf(valstr, sizeof(valstr), "%d\n", vals[i]);
+        test_case = assert_written(test_case, __LINE__, "int", 
+            (uintptr_t) oi, valstr);
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "int", ioids[i]);
+        test_case = assert_unlinked(test_case, __LINE__, ofile);
+        deleteInteger(&oi);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        String os = (String) get_identry(objs, soids[i]);
+        char valstr[32];
+
+        assert_notnull(++test_case, __LINE__, os);
+        assert_eq(++test_case, __LINE__, 
+            strcmp(os->get_value(os, valstr), strs[i]), 0);
+        snprintf(valstr, sizeof(valstr), "%zu:%s\n", strlen(strs[i]), 
+            strs[i]);
+        test_case = assert_written(test_case, __LINE__, "str", 
+            (uintptr_t) os, valstr);
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "str", soids[i]);
+        test_case = assert_unlinked(test_case, __LINE__, ofile);
+        deleteString(&os);
+    }
+
+    delete_idmap(&objs);
+
+    (void) asprintf(&ofile, "./%s/int/%#zx.tmp", OSTORE_DIR, ioids[0]);
+    test_case = assert_unlinked(test_case, __LINE__, ofile);
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "int", (uintptr_t) 0x20);
+    test_case = assert_unlinked(test_case, __LINE__, ofile);
+
+    /* a record that does not parse is left, the others are loaded */
+    assert_true(++test_case, __LINE__, store_obj(&bad));
+    Integer oi = newInteger(5);
+    uintptr_t oid = (uintptr_t) oi;
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(loaders, 1, 1, &objs));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 1);
+    test_case = assert_written(test_case, __LINE__, "int", 0x10, "junk\n");
+
+    Integer li = (Integer) get_identry(objs, oid);
+    
+    assert_notnull(++test_case, __LINE__, li);
+    deleteInteger(&li);
+    delete_idmap(&objs);
+    unlink_obj(&bad);
+    disable_ostore();
+    deleteInteger(&oi);
+
+    /* a corrupt binary record is reported and left in place */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&bin_opts));
+    assert_true(++test_case, __LINE__, store_int_obj("int", 0x30, 7));
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "int", (uintptr_t) 0x30);
+
+    int fd = open(ofile, O_RDWR);
+    char last;
+
+    (void) stat(ofile, &sbuf);
+    (void) pread(fd, &last, 1, sbuf.st_size - 1);
+    last ^= 0xff;
+    (void) pwrite(fd, &last, 1, sbuf.st_size - 1);
+    close(fd);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(loaders, 1, 1, &objs));
+    assert_eq(++test_case, __LINE__, errno, EBADMSG);
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 0);
+    assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), 0);
+    free(ofile);
+    delete_idmap(&objs);
+    unlink_obj(&corrupt);
+    disable_ostore();
+
+    /* the log backend with binary records */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 3; i++)
+        ioids[i] = (uintptr_t) newInteger(vals[i]);
+
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, load_ostore(loaders, 2, 0, &objs));
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 3);
+
+    for (int i = 0; i < 3; i++) {
+        Integer oi = (Integer) get_identry(objs, ioids[i]);
+
+        assert_notnull(++test_case, __LINE__, oi);
+        assert_eq(++test_case, __LINE__, oi->get_value(oi), vals[i]);
+        ioids[i] = (uintptr_t) oi;
+    }
+
+    delete_idmap(&objs);
+
+    /* loaded again, from the records written under the new ids */
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, load_ostore(loaders, 1, 2, &objs));
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 3);
+
+    for (int i = 0; i < 3; i++) {
+        Integer oi = (Integer) get_identry(objs, ioids[i]);
+        Integer prev = (Integer) ioids[i];
+
+        assert_notnull(++test_case, __LINE__, oi);
+        assert_eq(++test_case, __LINE__, oi->get_value(oi), vals[i]);
+        deleteInteger(&oi);
+        deleteInteger(&prev);
+    }
+
+    delete_idmap(&objs);
+    disable_ostore();
+    (void) _segs_size("int", true);
+
+    return test_case;
+}
+
+int test_shard() {
+    int test_case = 0;
+    char path[512];
+    char flat[512];
+    char* valstrs[] = { "first\n", "second\n", "third\n" };
+    object_rep reps[3];
+    ostore_opts opts = { .shard_levels = 2 };
+    ostore_loader loader = { "shd", _parse_dup, NULL };
+    idmap* objs = NULL;
+
+    for (int i = 0; i < 3; i++) {
+        reps[i].type = "shd";
+        reps[i].id = (uintptr_t) &reps[i];
+        reps[i].valstr = valstrs[i];
+    }
+
+    /* ostore/shd/<ab>/<cd>/<id>.txt */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 3; i++) {
+        assert_true(++test_case, __LINE__, store_obj(&reps[i]));
+        snprintf(flat, sizeof(flat), OFILE_FMT, OSTORE_DIR, "shd", 
+            reps[i].id);
+        assert_eq(++test_case, __LINE__, access(flat, F_OK), -1);
+        assert_eq(++test_case, __LINE__, 
+            _find_ofile("ostore/shd", reps[i].id, path, sizeof(path)), 2);
+        assert_true(++test_case, __LINE__, 
+            _file_contains(path, valstrs[i]));
+        assert_eq(++test_case, __LINE__, strlen(path),    /* no "./" */
+            strlen(flat) - 2 + strlen("ab/cd/"));
+    }
+
+    /* converted in place in the shard directories */
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_BINARY));
+    (void) _find_ofile("ostore/shd", reps[0].id, path, sizeof(path));
+
+    unsigned char tag = 0;
+    int fd = open(path, O_RDONLY);
+
+    assert_eq(++test_case, __LINE__, read(fd, &tag, 1), 1);
+    assert_eq(++test_case, __LINE__, tag & 0xf0, 0xb0);
+    close(fd);
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    assert_true(++test_case, __LINE__, _file_contains(path, valstrs[0]));
+
+    /* loaded from the shard directories */
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, load_ostore(&loader, 1, 2, &objs));
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 3);
+
+    for (int i = 0; i < 3; i++) {
+        char* obj = (char*) get_identry(objs, reps[i].id);
+
+        assert_notnull(++test_case, __LINE__, obj);
+        assert_eq(++test_case, __LINE__, strcmp(obj, valstrs[i]), 0);
+        assert_eq(++test_case, __LINE__, 
+            _find_ofile("ostore/shd", reps[i].id, path, sizeof(path)), -1);
+        assert_eq(++test_case, __LINE__, 
+            _find_ofile("ostore/shd", (uintptr_t) obj, path, sizeof(path)), 
+            2);
+
+        object_rep obj_rep = { "shd", (uintptr_t) obj, NULL };
+
+        unlink_obj(&obj_rep);
+        assert_eq(++test_case, __LINE__, access(path, F_OK), -1);
+        free(obj);
+    }
+
+    delete_idmap(&objs);
+
+    /* one level, through io_uring if the kernel supports it */
+    opts.shard_levels = 1;
+    opts.io_uring = true;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_eq(++test_case, __LINE__, 
+        _find_ofile("ostore/shd", reps[0].id, path, sizeof(path)), 1);
+    assert_true(++test_case, __LINE__, _file_contains(path, valstrs[0]));
+    unlink_obj(&reps[0]);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_eq(++test_case, __LINE__, access(path, F_OK), -1);
+    disable_ostore();
+
+    opts.shard_levels = 3;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    return test_case;
+}
+
+int test_compress() {
+    int test_case = 0;
+    char value[1001];
+    char raw[3001];
+    char* valstr = NULL;
+    char buf[4096];
+    ostore_opts opts = { .format = OSTORE_FMT_BINARY, .compress_min = 64 };
+    ostore_loader loader = { "str", _parse_str, NULL };
+    idmap* objs = NULL;
+
+    /* a log-like string, a run and pseudo-random bytes */
+    for (int i = 0; i < 1000; i++)
+        value[i] = "GET /index.html 200 "[i % 20];
+    value[1000] = '\0';
+    (void) asprintf(&valstr, "%d:%s\n", 1000, value);
+
+    unsigned seed = 1;
+
+    for (int i = 0; i < 3000; i++) {
+        seed = seed * 1103515245 + 12345;
+        raw[i] = i < 1000 ? 'a' : (char) ('!' + (seed >> 16) % 90);
+    }
+    raw[2999] = '\n';
+    raw[3000] = '\0';
+
+    object_rep strs = { "str", 1001, valstr };
+    object_rep hello = { "str", 1002, "5:hello\n" };
+    object_rep raws = { "lzr", 1003, raw };
+
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, store_obj(&strs));
+    assert_true(++test_case, __LINE__, store_obj(&hello));
+    assert_true(++test_case, __LINE__, store_obj(&raws));
+
+    ssize_t len = _read_file("str", 1001, buf, sizeof(buf));
+
+    assert_true(++test_case, __LINE__, len > 0 && len < 100);
+    /* below the threshold, as without compression */
+    assert_eq(++test_case, __LINE__, _read_file("str", 1002, buf, 
+        sizeof(buf)), 13);
+    len = _read_file("lzr", 1003, buf, sizeof(buf));
+    assert_true(++test_case, __LINE__, len > 2000 && len < 3000);
+
+    /* decompressed to exactly the value strings */
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    test_case = assert_written(test_case, __LINE__, "str", 1001, valstr);
+    test_case = assert_written(test_case, __LINE__, "str", 1002, 
+        "5:hello\n");
+    test_case = assert_written(test_case, __LINE__, "lzr", 1003, raw);
+    assert_eq(++test_case, __LINE__, _read_file("lzr", 1003, buf, 
+        sizeof(buf)), 3000);
+    assert_true(++test_case, __LINE__, convert_ostore(OSTORE_FMT_BINARY));
+    assert_true(++test_case, __LINE__, 
+        _read_file("str", 1001, buf, sizeof(buf)) < 100);
+
+    /* loaded from compressed records */
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, load_ostore(&loader, 1, 2, &objs));
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 2);
+
+    String os = (String) get_identry(objs, 1001);
+    char sbuf[1024];
+
+    assert_notnull(++test_case, __LINE__, os);
+    assert_eq(++test_case, __LINE__, strcmp(os->get_value(os, sbuf), value),
+        0);
+    deleteString(&os);
+    os = (String) get_identry(objs, 1002);
+    deleteString(&os);
+    delete_idmap(&objs);
+
+    /* a corrupt compressed record is detected */
+    char* ofile = NULL;
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "lzr", (uintptr_t) 1003);
+    int fd = open(ofile, O_WRONLY);
+    assert_eq(++test_case, __LINE__, pwrite(fd, "\x01", 1, 100), 1);
+    close(fd);
+    free(ofile);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_TEXT));
+    assert_eq(++test_case, __LINE__, errno, EBADMSG);
+    unlink_obj(&raws);
+    disable_ostore();
+
+    /* the log backend */
+    opts.backend = OSTORE_LOG;
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, store_obj(&strs));
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_true(++test_case, __LINE__, _segs_size("str", false) < 200);
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_true(++test_case, __LINE__, load_ostore(&loader, 1, 2, &objs));
+    assert_eq(++test_case, __LINE__, get_numidentries(objs), 1);
+    os = (String) get_identry(objs, 1001);
+    assert_notnull(++test_case, __LINE__, os);
+    assert_eq(++test_case, __LINE__, strcmp(os->get_value(os, sbuf), value),
+        0);
+    deleteString(&os);
+    delete_idmap(&objs);
+    disable_ostore();
+    (void) _segs_size("str", true);
+
+    /* compression needs binary records */
+    opts.backend = OSTORE_FILES;
+    opts.format = OSTORE_FMT_TEXT;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    free(valstr);
+
+    return test_case;
+}
+
+int test_dedup() {
+    int test_case = 0;
+    struct stat sbuf1, sbuf2;
+    char* ofile1 = NULL;
+    char* ofile2 = NULL;
+    object_rep reps[4];
+    ostore_opts opts = { .dedup = true };
+
+    for (int i = 0; i < 4; i++) {
+        reps[i].type = "ddp";
+        reps[i].id = 2001 + i;
+        reps[i].valstr = i < 3 ? "same value\n" : "other value\n";
+    }
+
+    (void) asprintf(&ofile1, OFILE_FMT, OSTORE_DIR, "ddp", (uintptr_t) 2001);
+    (void) asprintf(&ofile2, OFILE_FMT, OSTORE_DIR, "ddp", (uintptr_t) 2002);
+
+    /* one blob per distinct value, object files linked to it */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 4; i++)
+        assert_true(++test_case, __LINE__, store_obj(&reps[i]));
+
+    test_case = assert_written(test_case, __LINE__, "ddp", 2001, 
+        "same value\n");
+    test_case = assert_written(test_case, __LINE__, "ddp", 2004, 
+        "other value\n");
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 2);
+    assert_eq(++test_case, __LINE__, stat(ofile1, &sbuf1), 0);
+    assert_eq(++test_case, __LINE__, stat(ofile2, &sbuf2), 0);
+    assert_eq(++test_case, __LINE__, sbuf1.st_ino, sbuf2.st_ino);
+    assert_eq(++test_case, __LINE__, sbuf1.st_nlink, 4);
+
+    /* storing the same value again changes nothing */
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    assert_eq(++test_case, __LINE__, stat(ofile1, &sbuf1), 0);
+    assert_eq(++test_case, __LINE__, sbuf1.st_nlink, 4);
+
+    /* a new value replaces the link, the shared blob is unchanged */
+    reps[1].valstr = "other value\n";
+    assert_true(++test_case, __LINE__, store_obj(&reps[1]));
+    test_case = assert_written(test_case, __LINE__, "ddp", 2002, 
+        "other value\n");
+    test_case = assert_written(test_case, __LINE__, "ddp", 2001, 
+        "same value\n");
+    assert_eq(++test_case, __LINE__, stat(ofile1, &sbuf1), 0);
+    assert_eq(++test_case, __LINE__, sbuf1.st_nlink, 3);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 2);
+
+    /* a blob is removed with the last object linked to it */
+    unlink_obj(&reps[0]);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 2);
+    unlink_obj(&reps[2]);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 1);
+    unlink_obj(&reps[1]);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 1);
+    unlink_obj(&reps[3]);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 0);
+    test_case = assert_unlinked(test_case, __LINE__, ofile1);
+    test_case = assert_unlinked(test_case, __LINE__, ofile2);
+
+    /* a value last stored in a replaced file */
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    reps[0].valstr = "third value\n";
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 1);
+    unlink_obj(&reps[0]);
+    assert_eq(++test_case, __LINE__, _count_blobs("ddp"), 0);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_BINARY));
+    assert_eq(++test_case, __LINE__, errno, ENOTSUP);
+    disable_ostore();
+
+    /* deduplication needs text object files */
+    opts.format = OSTORE_FMT_BINARY;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    opts.format = OSTORE_FMT_TEXT;
+    opts.backend = OSTORE_LOG;
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&opts));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    return test_case;
+}
+
+int test_checkpoint() {
+    int test_case = 0;
+    int vals[] = { 42, -1, 7 };
+    char* strs[] = { "snapshot", "" };
+    Integer ints[3];
+    String strings[2];
+    ostore_ckpt_source srcs[] = { 
+        { "int", walkIntegers }, 
+        { "str", walkStrings } 
+    };
+    ostore_loader loaders[] = { 
+        { "int", _parse_int, NULL }, 
+        { "str", _parse_str, NULL } 
+    };
+    off_t offs[] = { 40, 20, -6 };     /* a record, the header, the index */
+    char* path = "ostore_test.ckpt";
+    idmap* iobjs = NULL;
+    idmap* sobjs = NULL;
+    struct stat sbuf;
+    char buf[32];
+
+    /* independent of the object store */
+    for (int i = 0; i < 3; i++)
+        ints[i] = newInteger(vals[i]);
+
+    for (int i = 0; i < 2; i++)
+        strings[i] = newString(strs[i]);
+
+    assert_true(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+        false));
+    assert_eq(++test_case, __LINE__, stat("ostore_test.ckpt.tmp", &sbuf), -1);
+    assert_true(++test_case, __LINE__, load_checkpoint_ostore(path, 
+        &loaders[0], 1, &iobjs));
+    assert_true(++test_case, __LINE__, load_checkpoint_ostore(path, 
+        &loaders[1], 1, &sobjs));
+    assert_true(++test_case, __LINE__, get_numidentries(iobjs) >= 3);
+    assert_true(++test_case, __LINE__, get_numidentries(sobjs) >= 2);
+
+    for (int i = 0; i < 3; i++) {
+        Integer oi = (Integer) get_identry(iobjs, (uintptr_t) ints[i]);
+
+        assert_notnull(++test_case, __LINE__, oi);
+        assert_true(++test_case, __LINE__, oi != ints[i]);
+        assert_eq(++test_case, __LINE__, oi->get_value(oi), vals[i]);
+        assert_null(++test_case, __LINE__, 
+            get_identry(sobjs, (uintptr_t) ints[i]));
+    }
+
+    for (int i = 0; i < 2; i++) {
+        String os = (String) get_identry(sobjs, (uintptr_t) strings[i]);
+
+        assert_notnull(++test_case, __LINE__, os);
+        assert_eq(++test_case, __LINE__, 
+            strcmp(os->get_value(os, buf), strs[i]), 0);
+    }
+
+    _delete_loaded(&iobjs, false);
+    _delete_loaded(&sobjs, true);
+
+    /* in the background, the objects as they were at the call */
+    uintptr_t gone = (uintptr_t) ints[2];
+
+    assert_true(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+        true));
+    errno = 0;
+    assert_false(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+        false));
+    assert_eq(++test_case, __LINE__, errno, EBUSY);
+    deleteInteger(&ints[2]);
+    assert_true(++test_case, __LINE__, wait_checkpoint_ostore());
+    assert_true(++test_case, __LINE__, wait_checkpoint_ostore());
+    assert_true(++test_case, __LINE__, load_checkpoint_ostore(path, 
+        &loaders[0], 1, &iobjs));
+
+    Integer oi = (Integer) get_identry(iobjs, gone);
+
+    assert_notnull(++test_case, __LINE__, oi);
+    assert_eq(++test_case, __LINE__, oi->get_value(oi), vals[2]);
+    _delete_loaded(&iobjs, false);
+
+    /* a corrupt snapshot */
+    for (int i = 0; i < 3; i++) {
+        assert_true(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+            false));
+        assert_true(++test_case, __LINE__, _flip_byte(path, offs[i]));
+        errno = 0;
+        assert_false(++test_case, __LINE__, load_checkpoint_ostore(path, 
+            &loaders[0], 1, &iobjs));
+        assert_eq(++test_case, __LINE__, errno, EBADMSG);
+        _delete_loaded(&iobjs, false);
+    }
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, checkpoint_ostore(NULL, srcs, 2, 
+        false));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    srcs[1].walk = NULL;
+    errno = 0;
+    assert_false(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+        false));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    srcs[1].walk = walkStrings;
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_checkpoint_ostore(path, NULL, 
+        1, &iobjs));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    assert_null(++test_case, __LINE__, iobjs);
+
+    /* a failed checkpoint leaves the previous snapshot */
+    assert_true(++test_case, __LINE__, checkpoint_ostore(path, srcs, 2, 
+        false));
+    assert_false(++test_case, __LINE__, checkpoint_ostore(
+        "no_such_dir/ostore_test.ckpt", srcs, 2, false));
+    assert_true(++test_case, __LINE__, load_checkpoint_ostore(path, 
+        &loaders[1], 1, &sobjs));
+    assert_notnull(++test_case, __LINE__, 
+        get_identry(sobjs, (uintptr_t) strings[0]));
+    _delete_loaded(&sobjs, true);
+    unlink(path);
+
+    for (int i = 0; i < 2; i++)
+        deleteInteger(&ints[i]);
+
+    for (int i = 0; i < 2; i++)
+        deleteString(&strings[i]);
+
+    return test_case;
+}
+
+int test_load_obj() {
+    int test_case = 0;
+    char* vals[] = { "first\n", "second\n", "third\n" };
+    object_rep reps[3];
+    ostore_opts opts = { .cache_size = 2 };
+    ostore_cache_stats stats;
+    char* ofile = NULL;
+    char buf[64];
+
+    for (int i = 0; i < 3; i++) {
+        reps[i].type = "lru";
+        reps[i].id = 3001 + i;
+        reps[i].valstr = vals[i];
+    }
+
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("lru", 3001, buf, sizeof(buf)),
+        -1);
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    /* the values most recently stored and loaded are cached */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 3; i++)
+        assert_true(++test_case, __LINE__, store_obj(&reps[i]));
+
+    for (int i = 2; i >= 0; i--) {
+        assert_eq(++test_case, __LINE__, 
+            load_obj("lru", reps[i].id, buf, sizeof(buf)), strlen(vals[i]));
+        assert_eq(++test_case, __LINE__, strcmp(buf, vals[i]), 0);
+    }
+
+    assert_true(++test_case, __LINE__, cache_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.hits, 2);
+    assert_eq(++test_case, __LINE__, stats.misses, 1);
+
+    /* a hit does no I/O, the least recently used was evicted */
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "lru", reps[1].id);
+    assert_eq(++test_case, __LINE__, unlink(ofile), 0);
+    free(ofile);
+    assert_eq(++test_case, __LINE__, 
+        load_obj("lru", reps[1].id, buf, sizeof(buf)), strlen(vals[1]));
+    errno = 0;
+    assert_eq(++test_case, __LINE__, 
+        load_obj("lru", reps[2].id, buf, sizeof(buf)), strlen(vals[2]));
+    assert_true(++test_case, __LINE__, cache_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.hits, 3);
+    assert_eq(++test_case, __LINE__, stats.misses, 2);
+
+    /* a new value replaces the cached one */
+    reps[0].valstr = "changed\n";
+    assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+    assert_eq(++test_case, __LINE__, 
+        load_obj("lru", reps[0].id, buf, sizeof(buf)), 8);
+    assert_eq(++test_case, __LINE__, strcmp(buf, "changed\n"), 0);
+    assert_true(++test_case, __LINE__, store_int_obj("lru", 3010, -42));
+    assert_eq(++test_case, __LINE__, load_obj("lru", 3010, buf, sizeof(buf)),
+        4);
+    assert_eq(++test_case, __LINE__, strcmp(buf, "-42\n"), 0);
+
+    /* errors */
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("lru", 3010, buf, 4), -1);
+    assert_eq(++test_case, __LINE__, errno, ERANGE);
+    unlink_obj(&reps[0]);
+    errno = 0;
+    assert_eq(++test_case, __LINE__, 
+        load_obj("lru", reps[0].id, buf, sizeof(buf)), -1);
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("none", 1, buf, sizeof(buf)), 
+        -1);
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("lru", 3010, NULL, 8), -1);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("a/b", 3010, buf, 8), -1);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    errno = 0;
+    assert_false(++test_case, __LINE__, cache_stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    for (int i = 1; i < 3; i++)
+        unlink_obj(&reps[i]);
+
+    object_rep ri = { "lru", 3010, NULL };
+
+    unlink_obj(&ri);
+    disable_ostore();
+
+    /* without a cache, from each backend and format */
+    ostore_opts others[] = {
+        { .backend = OSTORE_LOG, .format = OSTORE_FMT_BINARY },
+        { .format = OSTORE_FMT_BINARY, .compress_min = 16, .shard_levels = 1 },
+        { .slot_type = "lru" },
+        { .async = true },
+        { .defer_ms = 1000 }
+    };
+    char* value = "a value long enough to be compressed, compressed\n";
+
+    reps[0].valstr = value;
+
+    for (int i = 0; i < 5; i++) {
+        reps[1].valstr = i == 2 ? "12\n" : value;
+        assert_true(++test_case, __LINE__, enable_ostore_opts(&others[i]));
+        assert_true(++test_case, __LINE__, store_obj(&reps[1]));
+        assert_eq(++test_case, __LINE__, 
+            load_obj("lru", reps[1].id, buf, sizeof(buf)), 
+            strlen(reps[1].valstr));
+        assert_eq(++test_case, __LINE__, strcmp(buf, reps[1].valstr), 0);
+
+        /* again after a restart */
+        disable_ostore();
+        assert_true(++test_case, __LINE__, enable_ostore_opts(&others[i]));
+        assert_eq(++test_case, __LINE__, 
+            load_obj("lru", reps[1].id, buf, sizeof(buf)), 
+            strlen(reps[1].valstr));
+        assert_eq(++test_case, __LINE__, strcmp(buf, reps[1].valstr), 0);
+        assert_true(++test_case, __LINE__, cache_stats_ostore(&stats));
+        assert_eq(++test_case, __LINE__, stats.hits, 0);
+        assert_eq(++test_case, __LINE__, stats.misses, 1);
+        unlink_obj(&reps[1]);
+        errno = 0;
+        assert_eq(++test_case, __LINE__, 
+            load_obj("lru", reps[1].id, buf, sizeof(buf)), -1);
+        assert_eq(++test_case, __LINE__, errno, ENOENT);
+        disable_ostore();
+    }
+
+    (void) _segs_size("lru", true);
+
+    return test_case;
+}
+
+int test_stats() {
+    int test_case = 0;
+    char* vals[] = { "one\n", "two two\n", "three three three\n", "4\n" };
+    object_rep reps[4];
+    ostore_opts opts = { .stats = true };
+    ostore_opts async_opts = { .stats = true, .async = true };
+    ostore_stats* stats = (ostore_stats*) calloc(1, sizeof(ostore_stats));
+    size_t bytes = 0;
+    char buf[4096];
+
+    assert_notnull(++test_case, __LINE__, stats);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, stats_ostore(stats));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    errno = 0;
+    assert_false(++test_case, __LINE__, dump_stats_ostore(stderr));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    /* operations are counted per type */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    for (int i = 0; i < 4; i++) {
+        reps[i].type = i < 3 ? "stat" : "stat2";
+        reps[i].id = 4001 + i;
+        reps[i].valstr = vals[i];
+        assert_true(++test_case, __LINE__, store_obj(&reps[i]));
+        bytes += strlen(vals[i]);
+    }
+
+    assert_eq(++test_case, __LINE__, load_obj("stat", 4001, buf, sizeof(buf)),
+        4);
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("stat", 4999, buf, sizeof(buf)),
+        -1);
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    unlink_obj(&reps[0]);
+
+    assert_true(++test_case, __LINE__, stats_ostore(stats));
+    assert_eq(++test_case, __LINE__, stats->ntypes, 2);
+    assert_eq(++test_case, __LINE__, strcmp(stats->types[0].type, "stat"), 0);
+    assert_eq(++test_case, __LINE__, strcmp(stats->types[1].type, "stat2"),
+        0);
+    assert_eq(++test_case, __LINE__, 
+        stats->types[0].ops[OSTORE_STAT_STORE].count, 3);
+    assert_eq(++test_case, __LINE__, 
+        stats->types[0].ops[OSTORE_STAT_UNLINK].count, 1);
+    assert_eq(++test_case, __LINE__, 
+        stats->types[0].ops[OSTORE_STAT_LOAD].count, 2);
+    assert_eq(++test_case, __LINE__, 
+        stats->types[1].ops[OSTORE_STAT_STORE].count, 1);
+    assert_eq(++test_case, __LINE__, 
+        stats->types[1].ops[OSTORE_STAT_LOAD].count, 0);
+    assert_eq(++test_case, __LINE__, stats->records_written, 4);
+    assert_eq(++test_case, __LINE__, stats->bytes_written, bytes);
+    assert_true(++test_case, __LINE__, stats->syscalls >= 4 * 3);
+    assert_eq(++test_case, __LINE__, stats->failures[ENOENT], 1);
+    assert_eq(++test_case, __LINE__, stats->queue_max, 0);
+
+    /* percentiles are ordered and bounded by the maximum */
+    ostore_hist* h = &stats->types[0].ops[OSTORE_STAT_STORE];
+
+    assert_true(++test_case, __LINE__, h->max_ns > 0);
+    assert_true(++test_case, __LINE__, h->total_ns >= h->max_ns);
+    assert_true(++test_case, __LINE__, 
+        percentile_ostore(h, 0) <= percentile_ostore(h, 50));
+    assert_true(++test_case, __LINE__, 
+        percentile_ostore(h, 50) <= percentile_ostore(h, 99));
+    assert_true(++test_case, __LINE__, percentile_ostore(h, 100) == h->max_ns);
+    assert_true(++test_case, __LINE__, percentile_ostore(NULL, 50) == 0);
+
+    /* the text dump */
+    FILE* f = tmpfile();
+    size_t n;
+
+    assert_notnull(++test_case, __LINE__, f);
+    assert_true(++test_case, __LINE__, dump_stats_ostore(f));
+    rewind(f);
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    assert_notnull(++test_case, __LINE__, strstr(buf, "records written 4"));
+    assert_notnull(++test_case, __LINE__, strstr(buf, strerror(ENOENT)));
+    assert_notnull(++test_case, __LINE__, strstr(buf, "stat2"));
+    assert_notnull(++test_case, __LINE__, strstr(buf, "unlink"));
+
+    for (int i = 1; i < 4; i++)
+        unlink_obj(&reps[i]);
+
+    disable_ostore();
+
+    /* a restart zeroes the counters, nothing is counted with stats off */
+    assert_true(++test_case, __LINE__, enable_ostore());
+    assert_true(++test_case, __LINE__, store_obj(&reps[1]));
+    assert_true(++test_case, __LINE__, stats_ostore(stats));
+    assert_eq(++test_case, __LINE__, stats->ntypes, 0);
+    assert_eq(++test_case, __LINE__, stats->records_written, 0);
+    assert_eq(++test_case, __LINE__, stats->syscalls, 0);
+    unlink_obj(&reps[1]);
+    disable_ostore();
+
+    /* async: stores are written by the writer thread and queue up */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&async_opts));
+
+    for (int i = 0; i < 100; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("stat", 5000 + i, i));
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_true(++test_case, __LINE__, stats_ostore(stats));
+    assert_eq(++test_case, __LINE__, 
+        stats->types[0].ops[OSTORE_STAT_STORE].count, 100);
+    assert_eq(++test_case, __LINE__, stats->records_written, 100);
+    assert_true(++test_case, __LINE__, stats->queue_max >= 1);
+    assert_eq(++test_case, __LINE__, stats->queue_depth, 0);
+
+    for (int i = 0; i < 100; i++) {
+        object_rep r = { "stat", 5000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    /* errors */
+    errno = 0;
+    assert_false(++test_case, __LINE__, stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    errno = 0;
+    assert_false(++test_case, __LINE__, dump_stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    disable_ostore();
+
+    free(stats);
+
+    return test_case;
+}
+
+int test_rate() {
+    int test_case = 0;
+    ostore_opts by_ops = { .rate_ops = 100, .rate_burst_ms = 100 };
+    ostore_opts by_bytes = { .rate_bytes = 10000, .rate_burst_ms = 100 };
+    ostore_opts async_opts = { .async = true, .rate_ops = 200, 
+        .rate_burst_ms = 50 };
+    ostore_rate_stats stats;
+    char value[501];
+    uint64_t t;
+
+    memset(value, 'r', 499);
+    value[499] = '\n';
+    value[500] = '\0';
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    /* unlimited: nothing waits */
+    assert_true(++test_case, __LINE__, enable_ostore());
+
+    for (int i = 0; i < 30; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("rate", 6000 + i, i));
+
+    assert_true(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.throttled, 0);
+    assert_eq(++test_case, __LINE__, stats.throttled_ns, 0);
+    disable_ostore();
+
+    /* 30 stores at 100/s with a burst of 10 take at least 0.2 s */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&by_ops));
+    t = _now_ms();
+
+    for (int i = 0; i < 30; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("rate", 6000 + i, i));
+
+    assert_true(++test_case, __LINE__, _now_ms() - t >= 180);
+    assert_true(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_true(++test_case, __LINE__, stats.throttled >= 19);
+    assert_true(++test_case, __LINE__, stats.throttled_ns >= 180000000u);
+    disable_ostore();
+
+    /* 6 stores of 500 bytes at 10000 B/s with a burst of 1000 B: 0.2 s */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&by_bytes));
+    t = _now_ms();
+
+    for (int i = 0; i < 6; i++) {
+        object_rep r = { "rate", 6000 + i, value };
+        assert_true(++test_case, __LINE__, store_obj(&r));
+    }
+
+    assert_true(++test_case, __LINE__, _now_ms() - t >= 180);
+    assert_true(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_true(++test_case, __LINE__, stats.throttled >= 4);
+    test_case = assert_written(test_case, __LINE__, "rate", 6005, value);
+    disable_ostore();
+
+    /* async: stores queue without waiting, the writer is held back */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&async_opts));
+    t = _now_ms();
+
+    for (int i = 0; i < 50; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("rate", 6000 + i, i));
+
+    uint64_t queued = _now_ms() - t;
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+    assert_true(++test_case, __LINE__, _now_ms() - t >= 150);
+    assert_true(++test_case, __LINE__, queued < _now_ms() - t - 100);
+    assert_true(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_true(++test_case, __LINE__, stats.throttled >= 1);
+    disable_ostore();
+
+    /* unlinks count as operations: 50 at 100/s take at least 0.4 s */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&by_ops));
+    t = _now_ms();
+
+    for (int i = 0; i < 50; i++) {
+        object_rep r = { "rate", 6000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    assert_true(++test_case, __LINE__, _now_ms() - t >= 380);
+    assert_true(++test_case, __LINE__, rate_stats_ostore(&stats));
+    assert_true(++test_case, __LINE__, stats.throttled >= 39);
+
+    /* errors */
+    errno = 0;
+    assert_false(++test_case, __LINE__, rate_stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_nursery() {
+    int test_case = 0;
+    ostore_opts by_count = { .defer_count = 4 };
+    ostore_opts by_age = { .defer_ms = 20, .defer_count = 1000 };
+    ostore_opts young = { .defer_count = 16 };
+    ostore_defer_stats stats;
+    char* ofile = NULL;
+    struct stat sbuf;
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, promote_all_ostore());
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    /* a store is written once 4 newer objects have been stored */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&by_count));
+
+    for (int i = 0; i < 10; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("nurs", 7000 + i, i));
+
+    for (int i = 8; i < 10; i++) {
+        object_rep r = { "nurs", 7000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 6);
+    assert_eq(++test_case, __LINE__, stats.counted, 6);
+    assert_eq(++test_case, __LINE__, stats.aged, 0);
+    assert_eq(++test_case, __LINE__, stats.pending, 2);
+    assert_eq(++test_case, __LINE__, stats.cancelled, 2);
+    assert_true(++test_case, __LINE__, stats.death_age_ns > 0);
+    assert_true(++test_case, __LINE__, stats.survival == 0.75);
+
+    for (int i = 0; i < 10; i++) {
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "nurs", 7000 + i);
+        assert_eq(++test_case, __LINE__, stat(ofile, &sbuf) == 0, i < 6);
+        free(ofile);
+    }
+
+    /* promote_all_ostore writes the survivors, later stores are held */
+    assert_true(++test_case, __LINE__, promote_all_ostore());
+    assert_true(++test_case, __LINE__, store_int_obj("nurs", 7020, 20));
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.persisted, 8);
+    assert_eq(++test_case, __LINE__, stats.counted, 6);
+    assert_eq(++test_case, __LINE__, stats.pending, 1);
+
+    for (int i = 6; i < 8; i++) {
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "nurs", 7000 + i);
+        assert_eq(++test_case, __LINE__, stat(ofile, &sbuf), 0);
+        free(ofile);
+    }
+
+    for (int i = 0; i < 21; i++) {
+        object_rep r = { "nurs", 7000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    disable_ostore();
+
+    /* with a window, the first limit reached promotes */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&by_age));
+
+    for (int i = 0; i < 3; i++)
+        assert_true(++test_case, __LINE__, store_int_obj("nurs", 7000 + i, i));
+
+    usleep(200000);
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.aged, 3);
+    assert_eq(++test_case, __LINE__, stats.counted, 0);
+    assert_eq(++test_case, __LINE__, stats.pending, 0);
+
+    for (int i = 0; i < 3; i++) {
+        object_rep r = { "nurs", 7000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    disable_ostore();
+
+    /* Integers that die young are never written */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&young));
+
+    int written = 0;
+
+    for (int i = 0; i < 100; i++) {
+        Integer oi = newInteger(i);
+
+        (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, "int", (uintptr_t) oi);
+        deleteInteger(&oi);
+        written += stat(ofile, &sbuf) == 0;
+        free(ofile);
+    }
+
+    assert_true(++test_case, __LINE__, defer_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.cancelled, 100);
+    assert_eq(++test_case, __LINE__, stats.persisted, 0);
+    assert_true(++test_case, __LINE__, stats.survival == 0);
+    assert_eq(++test_case, __LINE__, written, 0);
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_memory() {
+    int test_case = 0;
+    ostore_opts opts = { .backend = OSTORE_MEMORY };
+    ostore_opts bin_opts = { .backend = OSTORE_MEMORY, 
+        .format = OSTORE_FMT_BINARY, .compress_min = 16 };
+    ostore_opts async_opts = { .backend = OSTORE_MEMORY, .async = true,
+        .durability = OSTORE_SYNC_ALWAYS };
+    ostore_opts bad = { .backend = OSTORE_MEMORY + 1 };
+    char* vals[] = { "first\n", "second\n", 
+        "a value long enough to be compressed, compressed\n" };
+    object_rep reps[3];
+    idmap* objs = NULL;
+    struct stat sbuf;
+    char buf[64];
+
+    for (int i = 0; i < 3; i++) {
+        reps[i].type = "mem";
+        reps[i].id = 8001 + i;
+        reps[i].valstr = vals[i];
+    }
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, enable_ostore_opts(&bad));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    /* objects are stored and loaded without files, in either format */
+    for (int f = 0; f < 2; f++) {
+        assert_true(++test_case, __LINE__, 
+            enable_ostore_opts(f ? &bin_opts : &opts));
+
+        for (int i = 0; i < 3; i++)
+            assert_true(++test_case, __LINE__, store_obj(&reps[i]));
+
+        for (int i = 0; i < 3; i++) {
+            assert_eq(++test_case, __LINE__, 
+                load_obj("mem", reps[i].id, buf, sizeof(buf)), 
+                strlen(vals[i]));
+            assert_eq(++test_case, __LINE__, strcmp(buf, vals[i]), 0);
+        }
+
+        assert_true(++test_case, __LINE__, store_int_obj("mem", 8010, -5));
+        assert_eq(++test_case, __LINE__, 
+            load_obj("mem", 8010, buf, sizeof(buf)), 3);
+        assert_eq(++test_case, __LINE__, strcmp(buf, "-5\n"), 0);
+        assert_eq(++test_case, __LINE__, stat("ostore/mem", &sbuf), -1);
+
+        /* a store replaces the value, an unlink removes it */
+        reps[0].valstr = vals[1];
+        assert_true(++test_case, __LINE__, store_obj(&reps[0]));
+        assert_eq(++test_case, __LINE__, 
+            load_obj("mem", reps[0].id, buf, sizeof(buf)), strlen(vals[1]));
+        reps[0].valstr = vals[0];
+        unlink_obj(&reps[0]);
+        errno = 0;
+        assert_eq(++test_case, __LINE__, 
+            load_obj("mem", reps[0].id, buf, sizeof(buf)), -1);
+        assert_eq(++test_case, __LINE__, errno, ENOENT);
+        unlink_obj(&reps[0]);   /* not stored */
+
+        /* the contents do not outlive the store */
+        assert_true(++test_case, __LINE__, flush_ostore());
+        disable_ostore();
+        assert_true(++test_case, __LINE__, 
+            enable_ostore_opts(f ? &bin_opts : &opts));
+        errno = 0;
+        assert_eq(++test_case, __LINE__, 
+            load_obj("mem", reps[1].id, buf, sizeof(buf)), -1);
+        assert_eq(++test_case, __LINE__, errno, ENOENT);
+        disable_ostore();
+    }
+
+    /* async, and a table that grows */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&async_opts));
+
+    for (int i = 0; i < 5000; i++)
+        if (!store_int_obj("mem", 9000 + i, i))
+            break;
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+
+    int found = 0;
+
+    for (int i = 0; i < 5000; i++)
+        found += load_obj("mem", 9000 + i, buf, sizeof(buf)) > 0
+            && atoi(buf) == i;
+
+    assert_eq(++test_case, __LINE__, found, 5000);
+
+    for (int i = 0; i < 5000; i++) {
+        object_rep r = { "mem", 9000 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    assert_true(++test_case, __LINE__, flush_ostore());
+    errno = 0;
+    assert_eq(++test_case, __LINE__, load_obj("mem", 9000, buf, sizeof(buf)),
+        -1);
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    disable_ostore();
+
+    /* Integers, and what the backend does not support */
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+
+    Integer oi = newInteger(77);
+
+    assert_eq(++test_case, __LINE__, 
+        load_obj("int", (uintptr_t) oi, buf, sizeof(buf)), 3);
+    assert_eq(++test_case, __LINE__, strcmp(buf, "77\n"), 0);
+    deleteInteger(&oi);
+
+    ostore_loader loader = { "int", _parse_int, NULL };
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, load_ostore(&loader, 1, 1, &objs));
+    assert_eq(++test_case, __LINE__, errno, ENOTSUP);
+    errno = 0;
+    assert_false(++test_case, __LINE__, convert_ostore(OSTORE_FMT_BINARY));
+    assert_eq(++test_case, __LINE__, errno, ENOTSUP);
+    assert_true(++test_case, __LINE__, compact_ostore());
+    disable_ostore();
+
+    return test_case;
+}
+
+int test_store_iov() {
+    int test_case = 0;
+    ostore_opts modes[] = {
+        { .cache_size = 4 },
+        { .format = OSTORE_FMT_BINARY },
+        { .async = true },
+        { .backend = OSTORE_LOG },
+        { .backend = OSTORE_MEMORY }
+    };
+    char big[1000];
+    struct iovec iov[4] = { { "5:", 2 }, { NULL, 0 }, { "hello", 5 }, 
+        { "\n", 1 } };
+    struct iovec bigv[2] = { { big, sizeof(big) - 1 }, { "\n", 1 } };
+    char buf[sizeof(big) + 1];
+
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    errno = 0;
+    assert_false(++test_case, __LINE__, store_obj_iov("iov", 9501, iov, 4));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    /* the buffers are written out as one value string */
+    assert_true(++test_case, __LINE__, enable_ostore());
+    assert_true(++test_case, __LINE__, store_obj_iov("iov", 9501, iov, 4));
+    test_case = assert_written(test_case, __LINE__, "iov", 9501, "5:hello\n");
+    assert_eq(++test_case, __LINE__, _read_file("iov", 9501, buf, 
+        sizeof(buf)), 8);
+
+    /* Strings are stored with their value as a buffer of its own */
+    String s = newString("iov string");
+
+    assert_notnull(++test_case, __LINE__, s);
+    test_case = assert_written(test_case, __LINE__, "str", (uintptr_t) s, 
+        "10:iov string\n");
+    deleteString(&s);
+
+    /* invalid arguments */
+    struct iovec bad[1] = { { NULL, 1 } };
+    struct iovec* nulls[] = { NULL, iov, iov, bad };
+    int ns[] = { 1, 0, OSTORE_IOV_MAX + 1, 1 };
+
+    for (int i = 0; i < 4; i++) {
+        errno = 0;
+        assert_false(++test_case, __LINE__, 
+            store_obj_iov("iov", 9502, nulls[i], ns[i]));
+        assert_eq(++test_case, __LINE__, errno, EINVAL);
+    }
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, store_obj_iov("a/b", 9502, iov, 4));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    disable_ostore();
+
+    /* in each other mode, small and gathered on the heap */
+    for (int m = 0; m < 5; m++) {
+        assert_true(++test_case, __LINE__, enable_ostore_opts(&modes[m]));
+        assert_true(++test_case, __LINE__, 
+            store_obj_iov("iov", 9503, iov, 4));
+        assert_true(++test_case, __LINE__, 
+            store_obj_iov("iov", 9504, bigv, 2));
+        assert_true(++test_case, __LINE__, flush_ostore());
+        assert_eq(++test_case, __LINE__, 
+            load_obj("iov", 9503, buf, sizeof(buf)), 8);
+        assert_eq(++test_case, __LINE__, strcmp(buf, "5:hello\n"), 0);
+        assert_eq(++test_case, __LINE__, 
+            load_obj("iov", 9504, buf, sizeof(buf)), sizeof(big));
+        assert_eq(++test_case, __LINE__, strncmp(buf, big, sizeof(big) - 1),
+            0);
+        assert_eq(++test_case, __LINE__, buf[sizeof(big) - 1], '\n');
+        disable_ostore();
+    }
+
+    return test_case;
+}
+
+int test_unlink_async() {
+    int test_case = 0;
+    ostore_opts opts = { .unlink_async = true, 
+        .durability = OSTORE_SYNC_ALWAYS };
+    ostore_opts log_opts = { .backend = OSTORE_LOG, .unlink_async = true };
+    ostore_opts mem_opts = { .backend = OSTORE_MEMORY, .unlink_async = true };
+    ostore_opts async_opts = { .async = true, .unlink_async = true };
+    ostore_opts* modes[] = { &log_opts, &mem_opts, &async_opts };
+    ostore_unlink_stats stats;
+    char buf[64];
+    int gone = 0;
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, drain_unlinks_ostore());
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+    errno = 0;
+    assert_false(++test_case, __LINE__, unlink_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, errno, ENOENT);
+
+    assert_true(++test_case, __LINE__, enable_ostore_opts(&opts));
+    errno = 0;
+    assert_false(++test_case, __LINE__, unlink_stats_ostore(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    /* unlinked objects are gone at once, and their files once drained */
+    for (int i = 0; i < 200; i++)
+        if (!store_int_obj("reap", 9601 + i, i))
+            break;
+
+    for (int i = 0; i < 200; i++) {
+        object_rep r = { "reap", 9601 + i, NULL };
+        unlink_obj(&r);
+    }
+
+    for (int i = 0; i < 200; i++) {
+        errno = 0;
+        gone += load_obj("reap", 9601 + i, buf, sizeof(buf)) == -1
+            && errno == ENOENT;
+    }
+
+    assert_eq(++test_case, __LINE__, gone, 200);
+    assert_true(++test_case, __LINE__, drain_unlinks_ostore());
+    assert_true(++test_case, __LINE__, unlink_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.pending, 0);
+    assert_eq(++test_case, __LINE__, stats.unlinked, 200);
+    assert_eq(++test_case, __LINE__, stats.cancelled, 0);
+    assert_true(++test_case, __LINE__, 
+        stats.batches >= 4 && stats.batches <= 200);
+    assert_eq(++test_case, __LINE__, _read_file("reap", 9601, buf, 
+        sizeof(buf)), -1);
+    assert_eq(++test_case, __LINE__, _read_file("reap", 9800, buf, 
+        sizeof(buf)), -1);
+
+    /* a store after the unlink wins, whether it cancelled it or not */
+    object_rep r = { "reap", 9601, NULL };
+
+    assert_true(++test_case, __LINE__, store_int_obj("reap", 9601, 1));
+    unlink_obj(&r);
+    assert_true(++test_case, __LINE__, store_int_obj("reap", 9601, 2));
+    assert_eq(++test_case, __LINE__, 
+        load_obj("reap", 9601, buf, sizeof(buf)), 2);
+    assert_eq(++test_case, __LINE__, strcmp(buf, "2\n"), 0);
+    assert_true(++test_case, __LINE__, flush_ostore());
+    test_case = assert_written(test_case, __LINE__, "reap", 9601, "2\n");
+    assert_true(++test_case, __LINE__, unlink_stats_ostore(&stats));
+    assert_eq(++test_case, __LINE__, stats.unlinked + stats.cancelled, 201);
+
+    /* deleting a String */
+    String s = newString("reaped");
+    uintptr_t sid = (uintptr_t) s;
+
+    test_case = assert_written(test_case, __LINE__, "str", sid, "6:reaped\n");
+    deleteString(&s);
+    assert_true(++test_case, __LINE__, drain_unlinks_ostore());
+    assert_eq(++test_case, __LINE__, _read_file("str", sid, buf, sizeof(buf)),
+        -1);
+
+    /* pending unlinks are applied when the store is disabled */
+    for (int i = 0; i < 50; i++) {
+        object_rep u = { "reap", 9601 + i, NULL };
+
+        if (!store_int_obj("reap", 9601 + i, i))
+            break;
+
+        unlink_obj(&u);
+    }
+
+    disable_ostore();
+    assert_true(++test_case, __LINE__, enable_ostore());
+    gone = 0;
+
+    for (int i = 0; i < 50; i++)
+        gone += load_obj("reap", 9601 + i, buf, sizeof(buf)) == -1;
+
+    assert_eq(++test_case, __LINE__, gone, 50);
+    disable_ostore();
+
+    /* the other backends, and async mode that queues unlinks itself */
+    for (int m = 0; m < 3; m++) {
+        assert_true(++test_case, __LINE__, enable_ostore_opts(modes[m]));
+        assert_true(++test_case, __LINE__, store_int_obj("reap", 9610, 10));
+        r.id = 9610;
+        unlink_obj(&r);
+        errno = 0;
+        assert_eq(++test_case, __LINE__, 
+            load_obj("reap", 9610, buf, sizeof(buf)), -1);
+        assert_eq(++test_case, __LINE__, errno, ENOENT);
+        assert_true(++test_case, __LINE__, flush_ostore());
+        assert_true(++test_case, __LINE__, unlink_stats_ostore(&stats));
+        assert_eq(++test_case, __LINE__, stats.unlinked, m < 2 ? 1 : 0);
+        disable_ostore();
+    }
+
+    return test_case;
+}
+
 /* helper functions */
 int assert_written(int test_case, int called_at, const char* type, 
     uintptr_t oid, char* data) {
@@ -246,7 +2266,224 @@ object_rep* _new_dummy_obj_rep(void* obj) {
     return obj_rep;
 }
 
+/* total size of the log segments of type, removing them if remove is true */
+off_t _segs_size(const char* type, bool remove) {
+    char path[512];
+    off_t total = 0;
+    struct stat sbuf;
+    struct dirent* de;
+    DIR* dir;
+
+    snprintf(path, sizeof(path), "%s/%s", OSTORE_DIR, type);
+    
+    if (!(dir = opendir(path)))
+        return 0;
+
+    while ((de = readdir(dir))) {
+        if (!strstr(de->d_name, ".log"))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s/%s", OSTORE_DIR, type, de->d_name);
+        
+        if (!stat(path, &sbuf))
+            total += sbuf.st_size;
+
+        if (remove)
+            unlink(path);
+    }
+
+    closedir(dir);
+
+    return total;
+}
+
+/* true if one of the log segments of type contains data */
+bool _segs_contain(const char* type, const char* data) {
+    char path[512];
+    char buf[4096];
+    bool found = false;
+    struct dirent* de;
+    DIR* dir;
+
+    snprintf(path, sizeof(path), "%s/%s", OSTORE_DIR, type);
+    
+    if (!(dir = opendir(path)))
+        return false;
+
+    while (!found && (de = readdir(dir))) {
+        if (!strstr(de->d_name, ".log"))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s/%s", OSTORE_DIR, type, de->d_name);
+
+        int fd = open(path, O_RDONLY);
+        ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf)) : -1;
+
+        if (fd >= 0)
+            close(fd);
+            
+        found = n > 0 && memmem(buf, n, data, strlen(data)) != NULL;
+    }
+
+    closedir(dir);
+
+    return found;
+}
+
+/* true if the file at path contains data */
+bool _file_contains(const char* path, const char* data) {
+    struct stat sbuf;
+    bool found = false;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &sbuf)) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    char* buf = (char*) malloc(sbuf.st_size);
+    ssize_t n = buf ? read(fd, buf, sbuf.st_size) : -1;
+
+    close(fd);
+    found = n > 0 && memmem(buf, n, data, strlen(data)) != NULL;
+    free(buf);
+
+    return found;
+}
+
+/* read up to size bytes of the object file of type/oid into buf */
+ssize_t _read_file(const char* type, uintptr_t oid, char* buf, size_t size) {
+    char* ofile = NULL;
+
+    (void) asprintf(&ofile, OFILE_FMT, OSTORE_DIR, type, oid);
+
+    int fd = ofile ? open(ofile, O_RDONLY) : -1;
+    ssize_t n = fd >= 0 ? read(fd, buf, size) : -1;
+
+    if (fd >= 0)
+        close(fd);
+    free(ofile);
+
+    return n;
+}
+
+/* parse functions of the loaders of test_load */
+void* _parse_int(const char* valstr, void* arg) {
+    return loadInteger(valstr);
+}
+
+void* _parse_str(const char* valstr, void* arg) {
+    return loadString(valstr);
+}
+
+void* _parse_dup(const char* valstr, void* arg) {
+    return strdup(valstr);
+}
+
+/* 
+ * find the object file of oid under dir, setting path to it, returns the 
+ * number of directories between dir and the file or -1 if there is none
+ */
+int _find_ofile(const char* dir, uintptr_t oid, char* path, size_t size) {
+    char name[32];
+    int depth = -1;
+    struct dirent* de;
+    DIR* d = opendir(dir);
+
+    if (!d)
+        return -1;
+
+    snprintf(name, sizeof(name), "%#zx.txt", oid);
+
+    while (depth < 0 && (de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        snprintf(path, size, "%s/%s", dir, de->d_name);
+
+        if (!strcmp(de->d_name, name)) {
+            depth = 0;
+        } else if (de->d_type == DT_DIR) {
+            char sub[512];
+
+            snprintf(sub, sizeof(sub), "%s", path);
+            depth = _find_ofile(sub, oid, path, size);
+            depth = depth < 0 ? -1 : depth + 1;
+        }
+    }
+
+    closedir(d);
+
+    return depth;
+}
+
+/* the number of value blobs of type (deduplication) */
+int _count_blobs(const char* type) {
+    char path[512];
+    int n = 0;
+    struct dirent* de;
+    DIR* d;
+
+    snprintf(path, sizeof(path), "%s/%s/.blobs", OSTORE_DIR, type);
+
+    if (!(d = opendir(path)))
+        return 0;
+
+    while ((de = readdir(d)))
+        if (strstr(de->d_name, ".blob"))
+            n++;
+
+    closedir(d);
+
+    return n;
+}
+
+/* delete the loaded objects of _delete_loaded */
+void _delete_obj(uintptr_t id, void* val, void* arg) {
+    if (*(bool*) arg) {
+        String os = (String) val;
+        deleteString(&os);
+    } else {
+        Integer oi = (Integer) val;
+        deleteInteger(&oi);
+    }
+}
+
+/* delete the map *objs of loaded Strings (or Integers) and their objects */
+void _delete_loaded(idmap** objs, bool strings) {
+    if (*objs)
+        foreach_identry(*objs, _delete_obj, &strings);
+
+    delete_idmap(objs);
+}
+
+/* invert the byte at off (from the end if negative) of the file at path */
+bool _flip_byte(const char* path, off_t off) {
+    int fd = open(path, O_RDWR);
+    struct stat sbuf;
+    char c;
+
+    if (fd < 0 || fstat(fd, &sbuf))
+        return false;
+
+    if (off < 0)
+        off += sbuf.st_size;
+
+    bool ok = pread(fd, &c, 1, off) == 1;
 
+    c = ~c;
+    ok = ok && pwrite(fd, &c, 1, off) == 1;
+    close(fd);
+
+    return ok;
+}
 
+/* the monotonic time in ms */
+uint64_t _now_ms() {
+    struct timespec ts;
 
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -8,7 +8,7 @@
 #include "strtest_lib.h"
 #include "../string_o.h"
 
-#define NR_TESTS 16
+#define NR_TESTS 21
 
 /* test functions */
 int test_newString();
@@ -27,6 +27,11 @@ int test_split_norm();
 int test_split_err();
 int test_substring_norm();
 int test_substring_err();
+int test_interning();
+int test_hash();
+int test_inline_values();
+int test_string_builder();
+int test_index_of_str();
 
 struct test_defn test_schedule[NR_TESTS] = {
     { "test_newString",         test_newString,         19, 0 },   /* test  0 */
@@ -45,6 +50,11 @@ struct test_defn test_schedule[NR_TESTS] = {
     { "test_split_err",         test_split_err,          6, 0 },   /* test 13 */
     { "test_substring_norm",    test_substring_norm,   112, 0 },   /* test 14 */
     { "test_substring_err",     test_substring_err,     24, 0 },   /* test 15 */
+    { "test_interning",         test_interning,         15, 0 },   /* test 16 */
+    { "test_hash",              test_hash,              24, 0 },   /* test 17 */
+    { "test_inline_values",     test_inline_values,     31, 0 },   /* test 18 */
+    { "test_string_builder",    test_string_builder,    23, 0 },   /* test 19 */
+    { "test_index_of_str",      test_index_of_str,      22, 0 },   /* test 20 */
 };
 
 int main(int argc, char** argv) {
@@ -863,6 +873,359 @@ int test_substring_err()  {
     return test_case;
 }
 
+int test_interning() {
+    int test_case = 0;
+
+    assert_false(++test_case, __LINE__, string_interning_is_on());
+    enable_string_interning();
+    assert_true(++test_case, __LINE__, string_interning_is_on());
+
+    String s = newString("GET");
+    String t = newString("GET");
+    String u = newString("PUT");
+
+    assert(s);
+    assert(t);
+    assert(u);
+
+    assert_notidentical(++test_case, __LINE__, s, t);
+    assert_identical(++test_case, __LINE__, _test_string_val(s), 
+        _test_string_val(t));
+    assert_notidentical(++test_case, __LINE__, _test_string_val(s), 
+        _test_string_val(u));
+    assert_true(++test_case, __LINE__, s->equals(s, t));
+    assert_false(++test_case, __LINE__, s->equals(s, u));
+
+    String v = s->concat(s, u);
+    String w = newString("GETPUT");
+
+    assert(v);
+    assert(w);
+    assert_identical(++test_case, __LINE__, _test_string_val(v), 
+        _test_string_val(w));
+
+    deleteString(&s);
+    assert_eq(++test_case, __LINE__, 
+        strncmp(_test_string_val(t), "GET", 4), 0);
+    assert_eq(++test_case, __LINE__, t->length(t), 3);
+
+    deleteString(&t);
+    deleteString(&u);
+    deleteString(&v);
+    deleteString(&w);
+
+    disable_string_interning();
+    assert_false(++test_case, __LINE__, string_interning_is_on());
+
+    s = newString("GET");
+    t = newString("GET");
+
+    assert(s);
+    assert(t);
+    assert_notidentical(++test_case, __LINE__, _test_string_val(s), 
+        _test_string_val(t));
+    assert_true(++test_case, __LINE__, s->equals(s, t));
+
+    deleteString(&s);
+    deleteString(&t);
+
+    errno = 0;
+    enable_string_interning();
+    s = newString(NULL);
+    assert_null(++test_case, __LINE__, s);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    disable_string_interning();
+
+    return test_case;
+}
+
+int test_hash() {
+    int test_case = 0;
+
+    for (int i = 0; i < 5; i++) {
+        String s = create_test_str(-1);
+        String t = newString(_test_string_val(s));
+
+        assert(s);
+        assert(t);
+
+        unsigned hs = s->hash(s);
+        assert_true(++test_case, __LINE__, hs == t->hash(t));
+        assert_true(++test_case, __LINE__, hs == s->hash(s));
+        assert_true(++test_case, __LINE__, s->equals(s, t));
+
+        deleteString(&s);
+        deleteString(&t);
+    }
+
+    String s = newString("hello");
+    String t = newString("hellp");
+    String u = newString("hell");
+
+    assert(s);
+    assert(t);
+    assert(u);
+
+    assert_true(++test_case, __LINE__, s->hash(s) != t->hash(t));
+    assert_false(++test_case, __LINE__, s->equals(s, t));
+    assert_false(++test_case, __LINE__, t->equals(t, s));
+    assert_false(++test_case, __LINE__, s->equals(s, u));
+    assert_false(++test_case, __LINE__, u->equals(u, s));
+
+    String o = newString("o");
+    assert(o);
+    String v = u->concat(u, o);
+    assert(v);
+    assert_true(++test_case, __LINE__, s->equals(s, v));
+    assert_true(++test_case, __LINE__, s->hash(s) == v->hash(v));
+
+    errno = 0;
+    assert_eq(++test_case, __LINE__, s->hash(NULL), 0);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    deleteString(&s);
+    deleteString(&t);
+    deleteString(&u);
+    deleteString(&o);
+    deleteString(&v);
+
+    return test_case;
+}
+
+int test_inline_values() {
+    int test_case = 0;
+    int lens[] = { 0, 1, 22, 23, 24, 25, STR_LEN_MAX };
+    int nlens = sizeof(lens) / sizeof(lens[0]);
+    
+    for (int i = 0; i < nlens; i++) {
+        char* buf;
+        int len = create_test_buf(lens[i], &buf);
+        
+        if (!lens[i]) {
+            buf[0] = '\0';
+            len = 0;
+        }
+
+        String s = newString(buf);
+        assert(s);
+
+        assert_eq(++test_case, __LINE__, s->length(s), len);
+        assert_eq(++test_case, __LINE__, 
+            strncmp(_test_string_val(s), buf, len + 1), 0);
+        
+        String t = s->concat(s, s);
+        assert(t);
+        
+        int tlen = 2 * len > STR_LEN_MAX ? STR_LEN_MAX : 2 * len;
+        assert_eq(++test_case, __LINE__, t->length(t), tlen);
+        assert_eq(++test_case, __LINE__, 
+            strncmp(_test_string_val(t) + len, buf, tlen - len), 0);
+        
+        deleteString(&s);
+        deleteString(&t);
+        free(buf);
+    }
+
+    /* interned values that are repeatedly added to and removed from the 
+     * intern table */
+    enable_string_interning();
+
+    char val[8];
+    String strs[200];
+    
+    for (int i = 0; i < 200; i++) {
+        snprintf(val, sizeof(val), "k%d", i % 50);
+        strs[i] = newString(val);
+        assert(strs[i]);
+    }
+
+    for (int i = 0; i < 200; i += 2)
+        deleteString(&strs[i]);
+
+    int mismatches = 0;
+
+    for (int i = 1; i < 200; i += 2) {
+        snprintf(val, sizeof(val), "k%d", i % 50);
+        String t = newString(val);
+        assert(t);
+
+        if (_test_string_val(t) != _test_string_val(strs[i]) 
+            || strcmp(_test_string_val(strs[i]), val))
+            mismatches++;
+
+        deleteString(&t);
+        deleteString(&strs[i]);
+    }
+
+    assert_eq(++test_case, __LINE__, mismatches, 0);
+
+    for (int i = 0; i < 200; i++) {
+        snprintf(val, sizeof(val), "k%d", i % 50);
+        strs[i] = newString(val);
+        assert(strs[i]);
+    }
+
+    assert_identical(++test_case, __LINE__, _test_string_val(strs[3]), 
+        _test_string_val(strs[53]));
+    assert_notidentical(++test_case, __LINE__, _test_string_val(strs[3]), 
+        _test_string_val(strs[4]));
+
+    for (int i = 0; i < 200; i++)
+        deleteString(&strs[i]);
+    
+    disable_string_interning();
+
+    return test_case;
+}
+
+int test_string_builder() {
+    int test_case = 0;
+
+    StringBuilder sb = newStringBuilder(0);
+    assert_notnull(++test_case, __LINE__, sb);
+    assert_eq(++test_case, __LINE__, sb->length(sb), 0);
+
+    String hello = newString("hello");
+    assert(hello);
+
+    assert_true(++test_case, __LINE__, sb->append_cstr(sb, "status="));
+    assert_true(++test_case, __LINE__, sb->append_int(sb, -200));
+    assert_true(++test_case, __LINE__, sb->append_char(sb, ' '));
+    assert_true(++test_case, __LINE__, sb->append_string(sb, hello));
+
+    String s = sb->build(sb);
+    assert_notnull(++test_case, __LINE__, s);
+    assert_eq(++test_case, __LINE__, s->length(s), 17);
+    assert_eq(++test_case, __LINE__, 
+        strcmp(_test_string_val(s), "status=-200 hello"), 0);
+
+    /* the builder can be appended to after build */
+    assert_true(++test_case, __LINE__, sb->append_char(sb, '!'));
+    String t = sb->build(sb);
+    assert(t);
+    assert_eq(++test_case, __LINE__, 
+        strcmp(_test_string_val(t), "status=-200 hello!"), 0);
+    assert_eq(++test_case, __LINE__, 
+        strcmp(_test_string_val(s), "status=-200 hello"), 0);
+
+    deleteString(&s);
+    deleteString(&t);
+    deleteStringBuilder(&sb);
+    assert_null(++test_case, __LINE__, sb);
+
+    /* many small appends, content is truncated to STR_LEN_MAX */
+    sb = newStringBuilder(1);
+    assert(sb);
+
+    bool ok = true;
+
+    for (int i = 0; i < STR_LEN_MAX + 10; i++)
+        ok = sb->append_char(sb, 'a' + i % 26) && ok;
+
+    assert_true(++test_case, __LINE__, ok);
+    assert_eq(++test_case, __LINE__, sb->length(sb), STR_LEN_MAX);
+
+    s = sb->build(sb);
+    assert(s);
+    assert_eq(++test_case, __LINE__, s->length(s), STR_LEN_MAX);
+    assert_eq(++test_case, __LINE__, s->char_at(s, 27), 'b');
+
+    deleteString(&s);
+    deleteStringBuilder(&sb);
+
+    /* errors */
+    sb = newStringBuilder(4);
+    assert(sb);
+
+    errno = 0;
+    assert_false(++test_case, __LINE__, sb->append_cstr(sb, NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    errno = 0;
+    assert_false(++test_case, __LINE__, sb->append_string(sb, NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    errno = 0;
+    assert_null(++test_case, __LINE__, sb->build(NULL));
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    deleteStringBuilder(&sb);
+    deleteString(&hello);
+
+    return test_case;
+}
+
+int test_index_of_str() {
+    int test_case = 0;
+
+    String s = newString("hello hello");
+    String ll = newString("ll");
+    String hello = newString("hello");
+    String x = newString("lox");
+    String empty = newString("");
+    String abab = newString("abaabaabab");
+    String aab = newString("aabab");
+
+    assert(s && ll && hello && x && empty && abab && aab);
+
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, ll, 0), 2);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, ll, 3), 8);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, ll, 9), -1);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, hello, 0), 0);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, hello, 1), 6);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, s, 0), 0);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, x, 0), -1);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, empty, 4), 4);
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, empty, 11), 11);
+    assert_eq(++test_case, __LINE__, empty->index_of_str(empty, empty, 0), 0);
+    assert_eq(++test_case, __LINE__, empty->index_of_str(empty, ll, 0), -1);
+    assert_eq(++test_case, __LINE__, hello->index_of_str(hello, s, 0), -1);
+
+    /* periodic needle */
+    assert_eq(++test_case, __LINE__, abab->index_of_str(abab, aab, 0), 5);
+
+    errno = 0;
+    assert_eq(++test_case, __LINE__, s->index_of_str(NULL, ll, 0), -2);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    errno = 0;
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, NULL, 0), -2);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    errno = 0;
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, ll, -1), -2);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+    
+    errno = 0;
+    assert_eq(++test_case, __LINE__, s->index_of_str(s, ll, 12), -2);
+    assert_eq(++test_case, __LINE__, errno, EINVAL);
+
+    /* long haystack with the needle at the end */
+    char* buf;
+    int len = create_test_buf(STR_LEN_MAX, &buf);
+    memset(buf, 'a', len - 3);
+    buf[len - 3] = 'a';
+    buf[len - 2] = 'b';
+    buf[len - 1] = 'a';
+    String t = newString(buf);
+    String aba = newString("aaaba");
+    assert(t && aba);
+    assert_eq(++test_case, __LINE__, t->index_of_str(t, aba, 0), len - 5);
+
+    free(buf);
+    deleteString(&t);
+    deleteString(&aba);
+    deleteString(&s);
+    deleteString(&ll);
+    deleteString(&hello);
+    deleteString(&x);
+    deleteString(&empty);
+    deleteString(&abab);
+    deleteString(&aab);
+
+    return test_case;
+}
+
 void assert_concat_success(int test_case, int called_at, String lhs, String rhs, 
     String result) {
     assert_notnull_ca(test_case, __LINE__, called_at, result);